@@ -0,0 +1,285 @@
+#include "Autotuner.h"
+#include "CTimer.h"
+
+#include <fstream>
+#include <sstream>
+
+// candidate work-group extents, every combination within the device and kernel limits is measured
+static const int s_shapes_x[] = { 8, 16, 32, 64, 128, 256 };
+static const int s_shapes_y[] = { 1, 2, 4, 8, 16, 32 };
+
+static int NextPowerOfTwo(int value)
+{
+	int p = 1;
+	while (p < value) {
+		p *= 2;
+	}
+	return p;
+}
+
+Autotuner::Autotuner(cl_context clContext, cl_device_id clDevice, const char* profile_path, bool tune)
+	: m_clContext(clContext), m_clDevice(clDevice), m_clProfilingQueue(NULL), m_profile_path(profile_path),
+	  m_max_work_group_size(0), m_local_mem_size(0), m_tune(tune)
+{
+	m_max_work_item_sizes[0] = m_max_work_item_sizes[1] = m_max_work_item_sizes[2] = 0;
+}
+
+Autotuner::~Autotuner()
+{
+	releaseResources();
+}
+
+bool Autotuner::initResources()
+{
+	cl_int cl_error;
+
+	// profiles are stored per device and driver, a driver update may change the best shapes
+	char deviceName[256];
+	char driverVersion[256];
+	V_RETURN_FALSE_CL(clGetDeviceInfo(m_clDevice, CL_DEVICE_NAME, sizeof(deviceName), deviceName, NULL), "Unable to query device name.");
+	V_RETURN_FALSE_CL(clGetDeviceInfo(m_clDevice, CL_DRIVER_VERSION, sizeof(driverVersion), driverVersion, NULL), "Unable to query driver version.");
+	m_device_key = std::string(deviceName) + " / " + driverVersion;
+	for (size_t i = 0; i < m_device_key.size(); i++) {
+		if (m_device_key[i] == '\t' || m_device_key[i] == '\n' || m_device_key[i] == '\r') {
+			m_device_key[i] = ' ';
+		}
+	}
+
+	V_RETURN_FALSE_CL(clGetDeviceInfo(m_clDevice, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &m_max_work_group_size, NULL), "Unable to query device limits.");
+	V_RETURN_FALSE_CL(clGetDeviceInfo(m_clDevice, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(m_max_work_item_sizes), m_max_work_item_sizes, NULL), "Unable to query device limits.");
+	V_RETURN_FALSE_CL(clGetDeviceInfo(m_clDevice, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &m_local_mem_size, NULL), "Unable to query device limits.");
+
+	// the targets run on a queue of their own, so the measured interval holds only their commands
+	m_clProfilingQueue = clCreateCommandQueue(m_clContext, m_clDevice, CL_QUEUE_PROFILING_ENABLE, &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create the profiling command queue.");
+
+	loadProfiles();
+
+	return true;
+}
+
+void Autotuner::releaseResources()
+{
+	if (m_clProfilingQueue) {
+		clReleaseCommandQueue(m_clProfilingQueue);
+		m_clProfilingQueue = NULL;
+	}
+}
+
+void Autotuner::selectLocalWorkSize(TuningTarget& target, int width, int height, int localWorkSize[2])
+{
+	if (!m_clProfilingQueue) {
+		return;
+	}
+
+	std::map<std::string, Profile>::const_iterator it = m_profiles.find(profileKey(target, width, height));
+	if (it != m_profiles.end()) {
+		localWorkSize[0] = it->second.localWorkSize[0];
+		localWorkSize[1] = it->second.localWorkSize[1];
+		std::cout << "Tuned local work size: (" << localWorkSize[0] << "x" << localWorkSize[1] << ")" << std::endl;
+		return;
+	}
+	if (m_tune) {
+		tune(target, width, height, localWorkSize);
+	}
+}
+
+bool Autotuner::tune(TuningTarget& target, int width, int height, int localWorkSize[2])
+{
+	std::vector<std::pair<int, int> > shapes;
+	candidateShapes(target, shapes);
+	if (shapes.empty()) {
+		std::cout << "Autotuning " << target.name() << ": no legal work-group shape" << std::endl;
+		return false;
+	}
+
+	std::cout << "Autotuning " << target.name() << " over " << shapes.size() << " work-group shapes" << std::endl;
+
+	Profile best;
+	best.time = -1.0;
+	for (size_t i = 0; i < shapes.size(); i++) {
+		int shape[2] = { shapes[i].first, shapes[i].second };
+		double time = measure(target, shape);
+		std::cout << "  (" << shape[0] << "x" << shape[1] << ")\t";
+		if (time < 0.0) {
+			std::cout << "failed" << std::endl;
+			continue;
+		}
+		std::cout << time << " ms" << std::endl;
+
+		if (best.time < 0.0 || time < best.time) {
+			best.localWorkSize[0] = shape[0];
+			best.localWorkSize[1] = shape[1];
+			best.time = time;
+		}
+	}
+	if (best.time < 0.0) {
+		return false;
+	}
+
+	localWorkSize[0] = best.localWorkSize[0];
+	localWorkSize[1] = best.localWorkSize[1];
+	std::cout << "Best local work size: (" << localWorkSize[0] << "x" << localWorkSize[1] << ")  " << best.time << " ms" << std::endl;
+
+	m_profiles[profileKey(target, width, height)] = best;
+	saveProfiles();
+
+	return true;
+}
+
+std::string Autotuner::profileKey(const TuningTarget& target, int width, int height) const
+{
+	// images are bucketed by their power of two extents; the hot kernel and its build options are part of the key,
+	// a scheme or option change of the same engine runs a different kernel
+	std::ostringstream key;
+	key << m_device_key << "\t" << target.name() << "\t" << target.kernelName() << "\t" << target.buildOptions() << "\t"
+		<< NextPowerOfTwo(width) << "x" << NextPowerOfTwo(height);
+	return key.str();
+}
+
+void Autotuner::candidateShapes(TuningTarget& target, std::vector<std::pair<int, int> >& shapes)
+{
+	char* program_code = NULL;
+	size_t program_size = 0;
+
+	LoadProgram(target.programPath().c_str(), &program_code, &program_size);
+	if (!program_code) {
+		return;
+	}
+
+	for (size_t y = 0; y < sizeof(s_shapes_y) / sizeof(s_shapes_y[0]); y++) {
+		for (size_t x = 0; x < sizeof(s_shapes_x) / sizeof(s_shapes_x[0]); x++) {
+			if (isLegalShape(program_code, program_size, target.kernelName(), target.buildOptions(), s_shapes_x[x], s_shapes_y[y])) {
+				shapes.push_back(std::make_pair(s_shapes_x[x], s_shapes_y[y]));
+			}
+		}
+	}
+
+	delete [] program_code;
+}
+
+bool Autotuner::isLegalShape(const char* source, size_t source_size, const char* kernel_name, const std::string& options, int lx, int ly)
+{
+	size_t size = (size_t)(lx * ly);
+
+	// device limits
+	if ((size_t)lx > m_max_work_item_sizes[0] || (size_t)ly > m_max_work_item_sizes[1] || size > m_max_work_group_size) {
+		return false;
+	}
+
+	// kernel limits: the tile sizes change the local memory and register usage of the hot kernel,
+	// the solver programs include SolverCommon.cl from the kernel directory
+	std::ostringstream buildOptions;
+	buildOptions << KernelIncludeOption() << " -D TILE_SIZE_X=" << lx << " -D TILE_SIZE_Y=" << ly << " " << options;
+
+	cl_int cl_error;
+	cl_program program = clCreateProgramWithSource(m_clContext, 1, &source, &source_size, &cl_error);
+	if (cl_error != CL_SUCCESS) {
+		return false;
+	}
+	if (clBuildProgram(program, 1, &m_clDevice, buildOptions.str().c_str(), NULL, NULL) != CL_SUCCESS) {
+		SAFE_RELEASE_PROGRAM(program);
+		return false;
+	}
+
+	bool legal = false;
+	cl_kernel kernel = clCreateKernel(program, kernel_name, &cl_error);
+	if (cl_error == CL_SUCCESS) {
+		size_t kernel_work_group_size = 0;
+		size_t preferred_multiple = 1;
+		cl_ulong kernel_local_mem = 0;
+		cl_error  = clGetKernelWorkGroupInfo(kernel, m_clDevice, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernel_work_group_size, NULL);
+		cl_error |= clGetKernelWorkGroupInfo(kernel, m_clDevice, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &preferred_multiple, NULL);
+		cl_error |= clGetKernelWorkGroupInfo(kernel, m_clDevice, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &kernel_local_mem, NULL);
+
+		legal = (cl_error == CL_SUCCESS) && size <= kernel_work_group_size && kernel_local_mem <= m_local_mem_size &&
+				(preferred_multiple <= 1 || size % preferred_multiple == 0);
+		SAFE_RELEASE_KERNEL(kernel);
+	}
+	SAFE_RELEASE_PROGRAM(program);
+
+	return legal;
+}
+
+double Autotuner::measure(TuningTarget& target, int localWorkSize[2])
+{
+	if (!target.prepare(m_clProfilingQueue, localWorkSize)) {
+		target.release();
+		return -1.0;
+	}
+
+	// warm-up run: first launches include driver side kernel setup
+	target.run();
+
+	// the run is bracketed by markers, their profiling timestamps give the device time of all commands in between
+	cl_event start = NULL;
+	cl_event end = NULL;
+	CTimer timer;
+	timer.Start();
+	clEnqueueMarker(m_clProfilingQueue, &start);
+	target.run();
+	clEnqueueMarker(m_clProfilingQueue, &end);
+	clFinish(m_clProfilingQueue);
+	timer.Stop();
+
+	double time = 1000.0 * timer.GetElapsedTime();
+	cl_ulong t_start = 0;
+	cl_ulong t_end = 0;
+	if (start && end &&
+		clGetEventProfilingInfo(start, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &t_start, NULL) == CL_SUCCESS &&
+		clGetEventProfilingInfo(end, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &t_end, NULL) == CL_SUCCESS &&
+		t_end > t_start) {
+		time = (t_end - t_start) * 1.0e-6;
+	}
+	if (start) {
+		clReleaseEvent(start);
+	}
+	if (end) {
+		clReleaseEvent(end);
+	}
+
+	target.release();
+
+	return time;
+}
+
+void Autotuner::loadProfiles()
+{
+	std::ifstream file(m_profile_path.c_str());
+	if (!file.is_open()) {
+		return;
+	}
+
+	// one profile per line: device, engine, kernel, build options, size bucket, local work size x, y, time (tab separated)
+	std::string line;
+	while (std::getline(file, line)) {
+		std::vector<std::string> fields;
+		std::istringstream stream(line);
+		std::string field;
+		while (std::getline(stream, field, '\t')) {
+			fields.push_back(field);
+		}
+		if (fields.size() != 8) {
+			continue;
+		}
+
+		Profile profile;
+		std::istringstream values(fields[5] + " " + fields[6] + " " + fields[7]);
+		if (values >> profile.localWorkSize[0] >> profile.localWorkSize[1] >> profile.time) {
+			m_profiles[fields[0] + "\t" + fields[1] + "\t" + fields[2] + "\t" + fields[3] + "\t" + fields[4]] = profile;
+		}
+	}
+}
+
+void Autotuner::saveProfiles() const
+{
+	std::ofstream file(m_profile_path.c_str());
+	if (!file.is_open()) {
+		std::cout << "Unable to write tuning profiles: " << m_profile_path << std::endl;
+		return;
+	}
+
+	for (std::map<std::string, Profile>::const_iterator it = m_profiles.begin(); it != m_profiles.end(); ++it) {
+		file << it->first << "\t" << it->second.localWorkSize[0] << "\t" << it->second.localWorkSize[1] << "\t" << it->second.time << std::endl;
+	}
+}
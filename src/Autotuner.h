@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Common.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/* Engine configuration measured by the autotuner. prepare() constructs the engine with
+   the given work-group shape on the (profiling) queue of the tuner, run() computes the
+   flow and release() frees the engine again. The hot kernel of the engine is built once
+   per shape to query its work-group limits. */
+class TuningTarget
+{
+public:
+	virtual ~TuningTarget() {}
+
+	virtual const char* name() const = 0;
+	virtual std::string programPath() const = 0;
+	virtual const char* kernelName() const = 0;
+	virtual std::string buildOptions() const = 0;	// options besides TILE_SIZE_X and TILE_SIZE_Y
+
+	virtual bool prepare(cl_command_queue queue, int localWorkSize[2]) = 0;
+	virtual void run() = 0;
+	virtual void release() = 0;
+};
+
+/* Sweeps the legal work-group (tile) shapes of a target and persists the fastest one per
+   device and image-size bucket in a text profile, so later runs pick it up without tuning. */
+class Autotuner
+{
+private:
+	struct Profile
+	{
+		int localWorkSize[2];
+		double time;	// ms
+	};
+
+	cl_context m_clContext;
+	cl_device_id m_clDevice;
+	cl_command_queue m_clProfilingQueue;
+
+	std::string m_profile_path;
+	std::string m_device_key;
+	std::map<std::string, Profile> m_profiles;	// device key, engine, kernel, build options and size bucket -> best shape
+
+	size_t m_max_work_group_size;
+	size_t m_max_work_item_sizes[3];
+	cl_ulong m_local_mem_size;
+
+	bool m_tune;	// tune targets without a stored profile
+
+public:
+	Autotuner(cl_context clContext, cl_device_id clDevice, const char* profile_path, bool tune);
+	~Autotuner();
+
+	bool initResources();
+	void releaseResources();
+
+	// stored shape for the target and image size, tuned first when tuning is enabled and none is stored;
+	// localWorkSize keeps its value if there is neither
+	void selectLocalWorkSize(TuningTarget& target, int width, int height, int localWorkSize[2]);
+
+	bool tune(TuningTarget& target, int width, int height, int localWorkSize[2]);
+
+private:
+	std::string profileKey(const TuningTarget& target, int width, int height) const;
+	void candidateShapes(TuningTarget& target, std::vector<std::pair<int, int> >& shapes);
+	bool isLegalShape(const char* source, size_t source_size, const char* kernel_name, const std::string& options, int lx, int ly);
+	double measure(TuningTarget& target, int localWorkSize[2]);
+
+	void loadProfiles();
+	void saveProfiles() const;
+};
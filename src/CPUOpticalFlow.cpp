@@ -1,11 +1,16 @@
 #include "CPUOpticalFlow.h"
+#include "Timing.h"
 
 #include <algorithm>
 #include <iostream>
 #include <cmath>
 
-CPUOpticalFlow::CPUOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega)
-	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega)
+// tile size of the wavefront parallelization of the lexicographic SOR sweep
+#define SOR_TILE_SIZE 32
+
+CPUOpticalFlow::CPUOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
+							   SolverScheme scheme)
+	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega), m_scheme(scheme)
 {
 }
 
@@ -27,13 +32,14 @@ void CPUOpticalFlow::computeFlow(Image& u, Image& v)
 	Image du(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// x-component of flow increment
 	Image dv(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// y-component of flow increment
 
-	int current_warp_level = std::min(m_warp_levels, computeMaxWarpLevels()) - 1;
+	int current_warp_level = startWarpLevel();
 	
-	// initialize output flow arrays
-	u.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 1, 1);
-	v.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 1, 1);
+	// initialize output flow arrays, with the initial flow for a warm start
+	initializeFlow(u, v);
 
 	while (current_warp_level >= 0) {
+		TIMING_LEVEL(current_warp_level);
+
 		// compute level sizes
 		level_width = static_cast<int>(ceil(m_source_img_1.width() * pow(m_warp_scale, current_warp_level)));
 		level_height = static_cast<int>(ceil(m_source_img_1.height() * pow(m_warp_scale, current_warp_level)));
@@ -43,6 +49,7 @@ void CPUOpticalFlow::computeFlow(Image& u, Image& v)
 		std::cout << "Solve level: " << current_warp_level << " (" << level_width << "x" << level_height << ")" << std::endl;
 
 		// perform resampling of images
+		TIMING_BEGIN("pyramid");
 		if (current_warp_level == 0) {
 			img_1_res = m_source_img_1;
 			img_2_res = m_source_img_2;
@@ -55,16 +62,21 @@ void CPUOpticalFlow::computeFlow(Image& u, Image& v)
 		Image::resampleAreaBasedWithoutReallocating(v, dv, level_width, level_height);
 		u = du;
 		v = dv;
+		TIMING_END();
 
 		// perform backward registration
+		TIMING_BEGIN("warp");
 		Image::backwardRegistration(img_1_res, img_2_res, img_2_br, u, v, hx, hy);
+		TIMING_END();
 
 		// solve difference problem at current resolution to obtain increment
 		solveDifference(img_1_res, img_2_br, du, dv, u, v, hx, hy, m_alpha, m_omega);
 
 		// add solved increment to the global flow
+		TIMING_BEGIN("add");
 		u += du;
 		v += dv;
+		TIMING_END();
 
 		// go to the next level
 		current_warp_level--;
@@ -101,6 +113,7 @@ void CPUOpticalFlow::solveDifference(	   Image& img_1,	// in     : 1st image
 	img_2.fillBoudaries();
 
 	// Compute motion tensor
+	TIMING_BEGIN("tensor");
 	float* J11 = new float[width * height];
 	float* J22 = new float[width * height];
 	float* J12 = new float[width * height];
@@ -109,6 +122,28 @@ void CPUOpticalFlow::solveDifference(	   Image& img_1,	// in     : 1st image
 
 #define JIND(X, Y) ((Y) * width + (X))
 
+// in-place SOR update of one pixel, dv uses the already updated du of the same pixel
+#define SOR_UPDATE(X, Y) \
+	{ \
+		xp = ((X) < width - 1)	* hx_2; \
+		xm = ((X) > 0)			* hx_2; \
+		yp = ((Y) < height - 1)	* hy_2; \
+		ym = ((Y) > 0)			* hy_2; \
+		sum = (xp + xm + yp + ym); \
+		du.pixel_w(X, Y) = (1.f - omega) * du.pixel_r(X, Y) + \
+						   omega * ( -J13[JIND(X, Y)] - J12[JIND(X, Y)] * dv.pixel_r(X, Y) + \
+						   yp * (u.pixel_r(X, Y + 1) - u.pixel_r(X, Y)) + ym * (u.pixel_r(X, Y - 1) - u.pixel_r(X, Y)) + \
+						   xp * (u.pixel_r(X + 1, Y) - u.pixel_r(X, Y)) + xm * (u.pixel_r(X - 1, Y) - u.pixel_r(X, Y)) + \
+						   yp * du.pixel_r(X, Y + 1) + ym * du.pixel_r(X, Y - 1) + \
+						   xp * du.pixel_r(X + 1, Y) + xm * du.pixel_r(X - 1, Y)) / (J11[JIND(X, Y)] + sum); \
+		dv.pixel_w(X, Y) = (1.f - omega) * dv.pixel_r(X, Y) + \
+						   omega * ( -J23[JIND(X, Y)] - J12[JIND(X, Y)] * du.pixel_r(X, Y) + \
+						   yp * (v.pixel_r(X, Y + 1) - v.pixel_r(X, Y)) + ym * (v.pixel_r(X, Y - 1) - v.pixel_r(X, Y)) + \
+						   xp * (v.pixel_r(X + 1, Y) - v.pixel_r(X, Y)) + xm * (v.pixel_r(X - 1, Y) - v.pixel_r(X, Y)) + \
+						   yp * dv.pixel_r(X, Y + 1) + ym * dv.pixel_r(X, Y - 1) + \
+						   xp * dv.pixel_r(X + 1, Y) + xm * dv.pixel_r(X - 1, Y)) / (J22[JIND(X, Y)] + sum); \
+	}
+
 	for (int y = 0; y < height; y++) {
 		for (int x = 0; x < width; x++) {
 			// Derivatives variables
@@ -123,49 +158,109 @@ void CPUOpticalFlow::solveDifference(	   Image& img_1,	// in     : 1st image
 
 		}
 	}
+	TIMING_END();
+
+	TIMING_BEGIN("solve");
+	TIMING_COUNT("pixel updates", (double)width * height * solverIterations());
+
+	if (m_residual_report) {
+		m_residuals.clear();
+		recordResidual(img_1, img_2, du, dv, u, v, hx, hy);
+	}
+
+	if (m_scheme == SOLVER_LEXICOGRAPHIC) {
+		// Gauss-Seidel sweep in lexicographic order. It is parallelized as a wavefront over tiles:
+		// tile (tx, ty) is processed after its left and upper neighbours, and tiles on the same
+		// anti-diagonal don't share any stencil points, so the result equals the sequential sweep.
+		const int tiles_x = (width + SOR_TILE_SIZE - 1) / SOR_TILE_SIZE;
+		const int tiles_y = (height + SOR_TILE_SIZE - 1) / SOR_TILE_SIZE;
+
+		for (int k = 0; k < solverIterations(); k++) {
+			for (int wave = 0; wave < tiles_x + tiles_y - 1; wave++) {
+				const int ty_first = std::max(0, wave - tiles_x + 1);
+				const int ty_last = std::min(wave, tiles_y - 1);
 
-	Image du_r;
-	Image dv_r;
+				#pragma omp parallel for private(xp, xm, yp, ym, sum) schedule(static)
+				for (int ty = ty_first; ty <= ty_last; ty++) {
+					const int tx = wave - ty;
+					const int y_end = std::min((ty + 1) * SOR_TILE_SIZE, height);
+					const int x_end = std::min((tx + 1) * SOR_TILE_SIZE, width);
 
-	// double buffering
-	du_r.reinit(du.width(), du.height(), du.actual_width(), du.actual_height(), 1, 1);
-	dv_r.reinit(du.width(), du.height(), du.actual_width(), du.actual_height(), 1, 1);
+					for (int y = ty * SOR_TILE_SIZE; y < y_end; y++) {
+						for (int x = tx * SOR_TILE_SIZE; x < x_end; x++) {
+							SOR_UPDATE(x, y);
+						}
+					}
+				}
+			}
+			if (m_residual_report) {
+				recordResidual(img_1, img_2, du, dv, u, v, hx, hy);
+			}
+		}
+	} else if (m_scheme == SOLVER_RED_BLACK) {
+		// For all iterations
+		for (int k = 0; k < solverIterations(); k++) {
+			// red pixels first, then black pixels using the updated red ones
+			for (int color = 0; color < 2; color++) {
+				#pragma omp parallel for private(xp, xm, yp, ym, sum) schedule(static)
+				for (int y = 0; y < height; y++) {
+					for (int x = (y + color) & 1; x < width; x += 2) {
+						SOR_UPDATE(x, y);
+					}
+				}
+			}
+			if (m_residual_report) {
+				recordResidual(img_1, img_2, du, dv, u, v, hx, hy);
+			}
+		}
+	} else {
+		Image du_r;
+		Image dv_r;
+
+		// double buffering
+		du_r.reinit(du.width(), du.height(), du.actual_width(), du.actual_height(), 1, 1);
+		dv_r.reinit(du.width(), du.height(), du.actual_width(), du.actual_height(), 1, 1);
 	  
-	// For all iterations		      
-	for (int k = 0; k < m_solver_iterations; k++) {
-		// For all image pixels
-		for (int y = 0; y < height; y++) {
-			for (int x = 0; x < width; x++) {
-				// Compute weights 
-				xp = (x < width - 1)	* hx_2;
-				xm = (x > 0)			* hx_2;
-				yp = (y < height - 1)	* hy_2;
-				ym = (y > 0)			* hy_2;
+		// For all iterations		      
+		for (int k = 0; k < solverIterations(); k++) {
+			// For all image pixels
+			for (int y = 0; y < height; y++) {
+				for (int x = 0; x < width; x++) {
+					// Compute weights 
+					xp = (x < width - 1)	* hx_2;
+					xm = (x > 0)			* hx_2;
+					yp = (y < height - 1)	* hy_2;
+					ym = (y > 0)			* hy_2;
 				
-				sum = (xp + xm + yp + ym);
+					sum = (xp + xm + yp + ym);
 				
-				du_r.pixel_w(x, y) = (1.f - omega) * du.pixel_r(x, y) +
-								   omega * ( -J13[JIND(x, y)] - J12[JIND(x, y)] * dv.pixel_r(x, y) +
+					du_r.pixel_w(x, y) = (1.f - omega) * du.pixel_r(x, y) +
+									   omega * ( -J13[JIND(x, y)] - J12[JIND(x, y)] * dv.pixel_r(x, y) +
 
-								   yp * (u.pixel_r(x, y + 1) - u.pixel_r(x, y)) + ym * (u.pixel_r(x, y -1) - u.pixel_r(x, y)) + 
-								   xp * (u.pixel_r(x + 1, y) - u.pixel_r(x, y)) + xm * (u.pixel_r(x - 1, y)- u.pixel_r(x, y)) +
+									   yp * (u.pixel_r(x, y + 1) - u.pixel_r(x, y)) + ym * (u.pixel_r(x, y -1) - u.pixel_r(x, y)) + 
+									   xp * (u.pixel_r(x + 1, y) - u.pixel_r(x, y)) + xm * (u.pixel_r(x - 1, y)- u.pixel_r(x, y)) +
 
-								   yp * du.pixel_r(x, y + 1) + ym * du.pixel_r(x, y - 1) + 
-								   xp * du.pixel_r(x + 1, y) + xm * du.pixel_r(x - 1, y)) / (J11[JIND(x, y)] + sum);
+									   yp * du.pixel_r(x, y + 1) + ym * du.pixel_r(x, y - 1) + 
+									   xp * du.pixel_r(x + 1, y) + xm * du.pixel_r(x - 1, y)) / (J11[JIND(x, y)] + sum);
 
-				dv_r.pixel_w(x, y) = (1.f - omega) * dv.pixel_r(x, y) +
-								   omega * ( -J23[JIND(x, y)] - J12[JIND(x, y)] * du.pixel_r(x, y) +
+					dv_r.pixel_w(x, y) = (1.f - omega) * dv.pixel_r(x, y) +
+									   omega * ( -J23[JIND(x, y)] - J12[JIND(x, y)] * du.pixel_r(x, y) +
 
-								   yp * (v.pixel_r(x, y + 1) - v.pixel_r(x, y)) + ym * (v.pixel_r(x, y - 1) - v.pixel_r(x, y)) + 
-								   xp * (v.pixel_r(x + 1, y) - v.pixel_r(x, y)) + xm * (v.pixel_r(x - 1, y) - v.pixel_r(x, y)) +
+									   yp * (v.pixel_r(x, y + 1) - v.pixel_r(x, y)) + ym * (v.pixel_r(x, y - 1) - v.pixel_r(x, y)) + 
+									   xp * (v.pixel_r(x + 1, y) - v.pixel_r(x, y)) + xm * (v.pixel_r(x - 1, y) - v.pixel_r(x, y)) +
 
-								   yp * dv.pixel_r(x, y + 1) + ym * dv.pixel_r(x, y - 1) + 
-								   xp * dv.pixel_r(x + 1, y) + xm * dv.pixel_r(x - 1, y) ) / (J22[JIND(x, y)] + sum);
+									   yp * dv.pixel_r(x, y + 1) + ym * dv.pixel_r(x, y - 1) + 
+									   xp * dv.pixel_r(x + 1, y) + xm * dv.pixel_r(x - 1, y) ) / (J22[JIND(x, y)] + sum);
+				}
+			}
+			du.swap_data(du_r);
+			dv.swap_data(dv_r);
+			if (m_residual_report) {
+				recordResidual(img_1, img_2, du, dv, u, v, hx, hy);
 			}
 		}
-		du.swap_data(du_r);
-		dv.swap_data(dv_r);
 	}
+	TIMING_END();
 
 	delete[] J11;
 	delete[] J22;
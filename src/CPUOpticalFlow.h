@@ -5,8 +5,11 @@
 class CPUOpticalFlow :
 	public OpticalFlowBase
 {
+private:
+	SolverScheme m_scheme;
 public:
-	CPUOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega);
+	CPUOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
+		SolverScheme scheme = SOLVER_JACOBI);
 	~CPUOpticalFlow();
 
 	void computeFlow(Image& u, Image& v);
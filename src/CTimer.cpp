@@ -12,8 +12,10 @@ void CTimer::Start()
 {
 #ifdef _WIN32
 	QueryPerformanceCounter(&m_StartTime);
-#else
+#elif defined (__APPLE__) || defined(MACOSX)
 	gettimeofday(&m_StartTime, NULL);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &m_StartTime);
 #endif
 }
 
@@ -21,8 +23,10 @@ void CTimer::Stop()
 {
 #ifdef _WIN32
 	QueryPerformanceCounter(&m_EndTime);
-#else
+#elif defined (__APPLE__) || defined(MACOSX)
 	gettimeofday(&m_EndTime, NULL);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &m_EndTime);
 #endif
 }
 
@@ -38,10 +42,33 @@ double CTimer::GetElapsedTime()
 	{
 		return -1;
 	}
-#else
+#elif defined (__APPLE__) || defined(MACOSX)
 
 	double delta = ((double)(m_EndTime.tv_sec - m_StartTime.tv_sec)) + 1.0e-6*((double)(m_EndTime.tv_usec-m_StartTime.tv_usec));
 
 	return delta;
+#else
+
+	double delta = ((double)(m_EndTime.tv_sec - m_StartTime.tv_sec)) + 1.0e-9*((double)(m_EndTime.tv_nsec-m_StartTime.tv_nsec));
+
+	return delta;
+#endif
+}
+
+double CTimer::Now()
+{
+#ifdef _WIN32
+	LARGE_INTEGER now, freq;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&freq);
+	return double(now.QuadPart) / double(freq.QuadPart);
+#elif defined (__APPLE__) || defined(MACOSX)
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (double)now.tv_sec + 1.0e-6 * (double)now.tv_usec;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + 1.0e-9 * (double)now.tv_nsec;
 #endif
 }
@@ -27,9 +27,12 @@ protected:
 #ifdef WIN32
 	LARGE_INTEGER		m_StartTime;
 	LARGE_INTEGER		m_EndTime;
-#else
+#elif defined (__APPLE__) || defined(MACOSX)
 	struct timeval		m_StartTime;
 	struct timeval		m_EndTime;
+#else
+	struct timespec		m_StartTime;	// CLOCK_MONOTONIC, not affected by wall clock adjustments
+	struct timespec		m_EndTime;
 #endif
 
 public:
@@ -43,6 +46,9 @@ public:
 
 	//returns the elapsed time in seconds
 	double GetElapsedTime();
+
+	//returns the current time of the monotonic clock in seconds (arbitrary origin)
+	static double Now();
 };
 
 #endif
@@ -1,6 +1,81 @@
 #include "Common.h"
 #include "CTimer.h"
 
+#include <algorithm>
+#include <cstring>
+
+bool InitContextResources(cl_device_type DeviceType, bool Profiling, cl_context& Context, cl_command_queue& CommandQueue, cl_device_id& Device)
+{
+	cl_int clError;
+	cl_platform_id platforms[8];
+	cl_uint platformCount = 0;
+
+	V_RETURN_FALSE_CL(clGetPlatformIDs(8, platforms, &platformCount), "Failed to get CL platform ID");
+
+	// first device of the requested type on any platform
+	Device = NULL;
+	for (cl_uint p = 0; p < platformCount && p < 8 && !Device; p++) {
+		if (clGetDeviceIDs(platforms[p], DeviceType, 1, &Device, NULL) != CL_SUCCESS) {
+			Device = NULL;
+		}
+	}
+	if (!Device) {
+		cout << "No OpenCL device of the requested type found." << endl;
+		return false;
+	}
+
+	char deviceName[256];
+	V_RETURN_FALSE_CL(clGetDeviceInfo(Device, CL_DEVICE_NAME, 256, &deviceName, NULL), "Unable to query device name.");
+	cout << "Device: " << deviceName << endl;
+
+	Context = clCreateContext(0, 1, &Device, NULL, NULL, &clError);
+	V_RETURN_FALSE_CL(clError, "Failed to create OpenCL context.");
+
+	CommandQueue = clCreateCommandQueue(Context, Device, Profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &clError);
+	V_RETURN_FALSE_CL(clError, "Failed to create the command queue in the context");
+
+	return true;
+}
+
+void CleanupContextResources(cl_context& Context, cl_command_queue& CommandQueue)
+{
+	if (CommandQueue) {
+		clReleaseCommandQueue(CommandQueue);
+		CommandQueue = NULL;
+	}
+	if (Context) {
+		clReleaseContext(Context);
+		Context = NULL;
+	}
+}
+
+static std::string DefaultKernelDirectory()
+{
+	const char* directory = getenv("GPUFLOW_KERNEL_DIR");
+	return (directory && *directory) ? directory : "./src/kernels";
+}
+
+static std::string& KernelDirectory()
+{
+	static std::string directory = DefaultKernelDirectory();
+	return directory;
+}
+
+void SetKernelDirectory(const char* Directory)
+{
+	KernelDirectory() = Directory ? Directory : DefaultKernelDirectory();
+}
+
+std::string KernelPath(const char* FileName)
+{
+	return KernelDirectory() + "/" + FileName;
+}
+
+std::string KernelIncludeOption()
+{
+	return "-I " + KernelDirectory();
+}
+
 void PrintBuildLog(cl_program Program, cl_device_id Device)
 {
 	cl_build_status buildStatus;
@@ -54,6 +129,58 @@ void LoadProgram(const char* Path, char** pSource, size_t* SourceSize)
 	(*pSource)[*SourceSize] = '\0';
 }
 
+cl_int WriteBufferMapped(cl_command_queue CommandQueue, cl_mem Buffer, size_t Size, const void* pSource, size_t Offset)
+{
+	cl_int clErr;
+	void* ptr = clEnqueueMapBuffer(CommandQueue, Buffer, CL_TRUE, CL_MAP_WRITE, Offset, Size, 0, NULL, NULL, &clErr);
+	if(clErr != CL_SUCCESS)
+	{
+		return clErr;
+	}
+	memcpy(ptr, pSource, Size);
+	return clEnqueueUnmapMemObject(CommandQueue, Buffer, ptr, 0, NULL, NULL);
+}
+
+cl_int ReadBufferMapped(cl_command_queue CommandQueue, cl_mem Buffer, size_t Size, void* pDestination, size_t Offset)
+{
+	cl_int clErr;
+	void* ptr = clEnqueueMapBuffer(CommandQueue, Buffer, CL_TRUE, CL_MAP_READ, Offset, Size, 0, NULL, NULL, &clErr);
+	if(clErr != CL_SUCCESS)
+	{
+		return clErr;
+	}
+	memcpy(pDestination, ptr, Size);
+	clErr = clEnqueueUnmapMemObject(CommandQueue, Buffer, ptr, 0, NULL, NULL);
+	clErr |= clFinish(CommandQueue);
+	return clErr;
+}
+
+void BuildResampleTable(int SrcSize, int DstSize, std::vector<cl_int>& Index, std::vector<float>& Weights, int& Taps)
+{
+	/* output cell d covers [d*src, (d+1)*src) and source cell k covers [k*dst, (k+1)*dst) in units of 1/(src*dst),
+	   the weight of k is the overlap normalized by the output cell size; integer arithmetic keeps the spans exact */
+	Index.assign(2 * DstSize, 0);
+	Taps = 1;
+	for (int d = 0; d < DstSize; d++) {
+		int lo = d * SrcSize;
+		int hi = (d + 1) * SrcSize;
+		Index[2 * d] = lo / DstSize;
+		Index[2 * d + 1] = (hi - 1) / DstSize - Index[2 * d] + 1;
+		Taps = max(Taps, (int)Index[2 * d + 1]);
+	}
+
+	Weights.assign(DstSize * Taps, 0.f);
+	for (int d = 0; d < DstSize; d++) {
+		int lo = d * SrcSize;
+		int hi = (d + 1) * SrcSize;
+		for (int t = 0; t < Index[2 * d + 1]; t++) {
+			int k = Index[2 * d] + t;
+			int overlap = min(hi, (k + 1) * DstSize) - max(lo, k * DstSize);
+			Weights[d * Taps + t] = (float)((double)overlap / SrcSize);
+		}
+	}
+}
+
 size_t GetGlobalWorkSize(size_t DataSize, size_t LocalWorkSize)
 {
 	size_t r = DataSize % LocalWorkSize;
@@ -14,11 +14,12 @@
 
 #include <stdlib.h>
 #include <string>
+#include <vector>
 #include <iostream>
 
 using namespace std;
 
-static const char* errorToString(cl_int error)
+static inline const char* errorToString(cl_int error)
 {
 		switch(error)
 		{
@@ -85,12 +86,33 @@ static const char* errorToString(cl_int error)
 #define SAFE_RELEASE_PROGRAM(ptr) {if(ptr){ clReleaseProgram(ptr); ptr = NULL; }}
 #define SAFE_RELEASE_MEMOBJECT(ptr) {if(ptr){ clReleaseMemObject(ptr); ptr = NULL; }}
 
+//creates a context and a command queue on the first device of the given type on any platform and prints the device name.
+//Profiling enables the event timestamps of the queue. What was created before a failure is left for CleanupContextResources
+bool InitContextResources(cl_device_type DeviceType, bool Profiling, cl_context& Context, cl_command_queue& CommandQueue, cl_device_id& Device);
+void CleanupContextResources(cl_context& Context, cl_command_queue& CommandQueue);
+
+//directory of the OpenCL kernel sources: ./src/kernels relative to the working directory, or GPUFLOW_KERNEL_DIR if that is set.
+//SetKernelDirectory names another one (NULL: back to the default), programs built afterwards are loaded from it
+void SetKernelDirectory(const char* Directory);
+std::string KernelPath(const char* FileName);
+//build option with the kernel directory as include path, for the programs including SolverCommon.cl
+std::string KernelIncludeOption();
+
 //this utility function gets building error messages for an OpenCL program object
 void PrintBuildLog(cl_program Program, cl_device_id Device);
 
 //loads an OpenCL program from a file to the memory (as a string)
 void LoadProgram(const char* Path, char** pSource, size_t* SourceSize);
 
+//blocking host <-> device transfers through map/unmap. For buffers created with CL_MEM_ALLOC_HOST_PTR on devices
+//which share memory with the host (integrated GPUs, CPU devices) the mapped pointer is the buffer itself (zero-copy)
+cl_int WriteBufferMapped(cl_command_queue CommandQueue, cl_mem Buffer, size_t Size, const void* pSource, size_t Offset = 0);
+cl_int ReadBufferMapped(cl_command_queue CommandQueue, cl_mem Buffer, size_t Size, void* pDestination, size_t Offset = 0);
+
+//area based resampling table of SrcSize -> DstSize cells for the resample kernels: Index holds the int2 (first source index,
+//taps used) and Weights the Taps area weights of every output index, Taps is the widest span of an output cell
+void BuildResampleTable(int SrcSize, int DstSize, std::vector<cl_int>& Index, std::vector<float>& Weights, int& Taps);
+
 //it is also a common task to determine how many OpenCL work groups are needed to run over a given dataset.
 //If the size of the work group is given, we can round up the data size to be multiple of this number.
 size_t GetGlobalWorkSize(size_t DataSize, size_t LocalWorkSize);
@@ -0,0 +1,311 @@
+#include "EngineFactory.h"
+
+#include "CPUOpticalFlow.h"
+#include "GPUNaiveOpticalFlow.h"
+#include "GPUOptimizedOpticalFlow.h"
+#include "GPUFullOpticalFlow.h"
+#include "GPUFlowDrivenRobust.h"
+
+#include <algorithm>
+#include <sstream>
+
+/* registry of the engines by name, in the order they are listed */
+struct EngineNameEntry
+{
+	EngineKind engine;
+	const char* name;
+	const char* description;
+	bool device;			// needs an OpenCL context
+};
+
+static const EngineNameEntry g_engine_names[] = {
+	{ ENGINE_CPU,			"cpu",			"CPU reference (OpenMP)",									false },
+	{ ENGINE_NAIVE,			"naive",		"GPU, host-driven pyramid, global memory solver",			true },
+	{ ENGINE_FLOW_DRIVEN,	"flow_driven",	"GPU, host-driven pyramid, flow-driven robust model",		true },
+	{ ENGINE_OPTIMIZED,		"optimized",	"GPU, host-driven pyramid, local memory solver",			true },
+	{ ENGINE_FULL,			"full",			"GPU, device-resident pyramid",								true },
+	{ ENGINE_FULL_HALF,		"full_half",	"GPU, device-resident pyramid, half storage",				true },
+	{ ENGINE_FULL_TILED,	"full_tiled",	"GPU, device-resident pyramid, tiled solver",				true },
+	{ ENGINE_FULL_ROBUST,	"full_robust",	"GPU, device-resident pyramid, flow-driven robust model",	true }
+};
+static const int g_engine_count = sizeof(g_engine_names) / sizeof(g_engine_names[0]);
+
+static const EngineNameEntry* FindEngine(EngineKind engine)
+{
+	for (int k = 0; k < g_engine_count; k++) {
+		if (g_engine_names[k].engine == engine) {
+			return &g_engine_names[k];
+		}
+	}
+	return NULL;
+}
+
+const char* EngineName(EngineKind engine)
+{
+	const EngineNameEntry* entry = FindEngine(engine);
+	return entry ? entry->name : "";
+}
+
+const char* EngineDescription(EngineKind engine)
+{
+	const EngineNameEntry* entry = FindEngine(engine);
+	return entry ? entry->description : "";
+}
+
+bool EngineFromName(const std::string& name, EngineKind& engine)
+{
+	for (int k = 0; k < g_engine_count; k++) {
+		if (name == g_engine_names[k].name) {
+			engine = g_engine_names[k].engine;
+			return true;
+		}
+	}
+	return false;
+}
+
+EngineKind EngineAt(int index)
+{
+	return g_engine_names[index].engine;
+}
+
+int EngineCount()
+{
+	return g_engine_count;
+}
+
+bool EngineUsesDevice(EngineKind engine)
+{
+	const EngineNameEntry* entry = FindEngine(engine);
+	return entry ? entry->device : false;
+}
+
+bool EngineUsesInnerIterations(EngineKind engine)
+{
+	return engine == ENGINE_FLOW_DRIVEN || engine == ENGINE_FULL_ROBUST;
+}
+
+bool EngineReportsResidual(EngineKind engine)
+{
+	// the other engines keep their increments on the device between the iterations
+	return engine == ENGINE_CPU || engine == ENGINE_NAIVE;
+}
+
+static const char* g_robust_kernel_names[] = { "global", "tiled", "fused" };	// in the order of RobustKernels
+
+bool RobustKernelsFromName(const std::string& name, RobustKernels& kernels)
+{
+	for (int k = 0; k < 3; k++) {
+		if (name == g_robust_kernel_names[k]) {
+			kernels = (RobustKernels)k;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* RobustKernelsName(RobustKernels kernels)
+{
+	return g_robust_kernel_names[kernels];
+}
+
+bool RobustKernelsFromList(const std::string& list, std::vector<RobustKernels>& kernels)
+{
+	kernels.clear();
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		RobustKernels k;
+		if (!RobustKernelsFromName(item, k)) {
+			return false;
+		}
+		kernels.push_back(k);
+	}
+	return !kernels.empty();
+}
+
+RobustKernels DefaultRobustKernels(SolverScheme scheme)
+{
+	return (scheme == SOLVER_JACOBI) ? ROBUST_TILED_FUSED : ROBUST_GLOBAL;
+}
+
+void DefaultLocalWorkSize(EngineKind engine, int localWorkSize[2])
+{
+	// shapes the engines were written for: 32x16 for the naive and optimized solvers, 32x4 for the others
+	bool wide = (engine == ENGINE_NAIVE || engine == ENGINE_OPTIMIZED);
+	localWorkSize[0] = 32;
+	localWorkSize[1] = wide ? 16 : 4;
+}
+
+OpticalFlowBase* CreateEngine(EngineKind engine, const Image& img1, const Image& img2, const EngineParameters& p,
+							  cl_context context, cl_command_queue queue, cl_device_id device, const int* localWorkSize)
+{
+	int lws[2];
+	DefaultLocalWorkSize(engine, lws);
+	if (localWorkSize) {
+		lws[0] = localWorkSize[0];
+		lws[1] = localWorkSize[1];
+	}
+
+	switch (engine) {
+	case ENGINE_CPU:
+		return new CPUOpticalFlow(img1, img2, p.warp_levels, p.warp_scale, p.solver_iterations, p.alpha, p.omega, p.scheme);
+	case ENGINE_NAIVE: {
+		GPUNaiveOpticalFlow* flow = new GPUNaiveOpticalFlow(img1, img2, p.warp_levels, p.warp_scale, p.solver_iterations, p.alpha, p.omega,
+															context, queue, lws, p.scheme);
+		if (flow->initResources(context, device)) {
+			return flow;
+		}
+		ReleaseEngine(engine, flow);
+		return NULL;
+	}
+	case ENGINE_FLOW_DRIVEN: {
+		GPUFlowDrivenRobust* flow = new GPUFlowDrivenRobust(img1, img2, p.warp_levels, p.warp_scale, p.solver_iterations, p.inner_iterations, p.alpha, p.omega, p.e_smooth, p.e_data,
+															context, queue, lws, p.scheme, p.robust_kernels);
+		if (flow->initResources(context, device)) {
+			return flow;
+		}
+		ReleaseEngine(engine, flow);
+		return NULL;
+	}
+	case ENGINE_OPTIMIZED: {
+		GPUOptimizedOpticalFlow* flow = new GPUOptimizedOpticalFlow(img1, img2, p.warp_levels, p.warp_scale, p.solver_iterations, p.alpha, p.omega,
+																	context, queue, lws, p.temporal_iterations, p.scheme);
+		if (flow->initResources(context, device)) {
+			return flow;
+		}
+		ReleaseEngine(engine, flow);
+		return NULL;
+	}
+	case ENGINE_FULL:
+	case ENGINE_FULL_HALF:
+	case ENGINE_FULL_TILED:
+	case ENGINE_FULL_ROBUST: {
+		bool half_storage = (engine == ENGINE_FULL_HALF);
+		SolverStage stage = (engine == ENGINE_FULL_TILED) ? STAGE_TILED : (engine == ENGINE_FULL_ROBUST) ? STAGE_ROBUST : STAGE_NAIVE;
+		GPUFullOpticalFlow* flow = new GPUFullOpticalFlow(img1, img2, p.warp_levels, p.warp_scale, p.solver_iterations, p.alpha, p.omega,
+														  context, queue, lws, p.scheme, p.warp_mode, half_storage, stage,
+														  p.inner_iterations, p.e_smooth, p.e_data);
+		if (flow->initResources(context, device)) {
+			return flow;
+		}
+		ReleaseEngine(engine, flow);
+		return NULL;
+	}
+	}
+	return NULL;
+}
+
+void ReleaseEngine(EngineKind engine, OpticalFlowBase* flow)
+{
+	switch (engine) {
+	case ENGINE_CPU:
+		break;
+	case ENGINE_NAIVE:
+		static_cast<GPUNaiveOpticalFlow*>(flow)->releaseResources();
+		break;
+	case ENGINE_FLOW_DRIVEN:
+		static_cast<GPUFlowDrivenRobust*>(flow)->releaseResources();
+		break;
+	case ENGINE_OPTIMIZED:
+		static_cast<GPUOptimizedOpticalFlow*>(flow)->releaseResources();
+		break;
+	case ENGINE_FULL:
+	case ENGINE_FULL_HALF:
+	case ENGINE_FULL_TILED:
+	case ENGINE_FULL_ROBUST:
+		static_cast<GPUFullOpticalFlow*>(flow)->releaseResources();
+		break;
+	}
+	SAFE_DELETE(flow);
+}
+
+EngineTuningTarget::EngineTuningTarget(EngineKind engine, const Image& img1, const Image& img2, const EngineParameters& p,
+									   cl_context clContext, cl_device_id clDevice)
+	: m_engine(engine), m_img1(img1), m_img2(img2), m_parameters(p), m_clContext(clContext), m_clDevice(clDevice), m_flow(NULL)
+{
+}
+
+EngineTuningTarget::~EngineTuningTarget()
+{
+	release();
+}
+
+const char* EngineTuningTarget::name() const
+{
+	return EngineName(m_engine);
+}
+
+std::string EngineTuningTarget::programPath() const
+{
+	switch (m_engine) {
+	case ENGINE_NAIVE:
+		return KernelPath("NaiveSolver.cl");
+	case ENGINE_FLOW_DRIVEN:
+		return KernelPath("FlowDrivenSolver.cl");
+	case ENGINE_OPTIMIZED:
+		return KernelPath("OptimizedSolver.cl");
+	case ENGINE_FULL:
+	case ENGINE_FULL_HALF:
+	case ENGINE_FULL_TILED:
+	case ENGINE_FULL_ROBUST:
+		return KernelPath("FullGPUSolver.cl");
+	default:
+		return "";
+	}
+}
+
+const char* EngineTuningTarget::kernelName() const
+{
+	// solver kernel the engine launches for its scheme (flow_driven: the inner iteration kernel of its variant)
+	bool red_black = (m_parameters.scheme == SOLVER_RED_BLACK);
+	const char* robust_solvers[3] = { "Solver", "SolverTiled", "SolverTiledPhiKsi" };	// in the order of RobustKernels
+	switch (m_engine) {
+	case ENGINE_NAIVE:
+		return red_black ? "NaiveSolverRedBlack" : "NaiveSolver";
+	case ENGINE_FLOW_DRIVEN:
+		return red_black ? "SolverRedBlack" : robust_solvers[m_parameters.robust_kernels];
+	case ENGINE_OPTIMIZED:
+		return red_black ? "OptimizedSolverRedBlack" : (m_parameters.temporal_iterations > 1 ? "OptimizedSolverTemporal" : "OptimizedSolver");
+	case ENGINE_FULL:
+	case ENGINE_FULL_HALF:
+		return red_black ? "SolverRedBlack" : "Solver";
+	case ENGINE_FULL_TILED:
+		return red_black ? "SolverTiledRedBlack" : "SolverTiled";
+	case ENGINE_FULL_ROBUST:
+		return red_black ? "SolverRobustRedBlack" : "SolverRobust";
+	default:
+		return "";
+	}
+}
+
+std::string EngineTuningTarget::buildOptions() const
+{
+	std::ostringstream options;
+	if (m_engine == ENGINE_OPTIMIZED) {
+		options << "-D TEMPORAL_ITERATIONS=" << m_parameters.temporal_iterations;
+	} else if (m_engine == ENGINE_FULL_HALF) {
+		options << "-D HALF_STORAGE";
+	}
+	return options.str();
+}
+
+bool EngineTuningTarget::prepare(cl_command_queue queue, int localWorkSize[2])
+{
+	m_flow = CreateEngine(m_engine, m_img1, m_img2, m_parameters, m_clContext, queue, m_clDevice, localWorkSize);
+	return m_flow != NULL;
+}
+
+void EngineTuningTarget::run()
+{
+	if (m_flow) {
+		m_flow->computeFlow(m_u, m_v);
+	}
+}
+
+void EngineTuningTarget::release()
+{
+	if (m_flow) {
+		ReleaseEngine(m_engine, m_flow);
+		m_flow = NULL;
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Common.h"
+#include "OpticalFlowBase.h"
+#include "Autotuner.h"
+#include "GPUFullOpticalFlow.h"
+#include "GPUFlowDrivenRobust.h"
+
+#include <string>
+#include <vector>
+
+/* engines the tools can create by name */
+enum EngineKind
+{
+	ENGINE_CPU,
+	ENGINE_NAIVE,
+	ENGINE_FLOW_DRIVEN,
+	ENGINE_OPTIMIZED,
+	ENGINE_FULL,
+	ENGINE_FULL_HALF,
+	ENGINE_FULL_TILED,
+	ENGINE_FULL_ROBUST
+};
+
+/* model parameters shared by all engines; engines ignore what they do not use */
+struct EngineParameters
+{
+	int warp_levels;
+	float warp_scale;
+	int solver_iterations;
+	int inner_iterations;		// robust engines (flow_driven, full_robust)
+	int temporal_iterations;	// optimized
+	float alpha;
+	float omega;
+	float e_smooth;
+	float e_data;
+	SolverScheme scheme;
+	WarpMode warp_mode;			// full engines
+	RobustKernels robust_kernels;	// flow_driven, tiled and fused kernels require SOLVER_JACOBI
+};
+
+const char* EngineName(EngineKind engine);
+const char* EngineDescription(EngineKind engine);
+bool EngineFromName(const std::string& name, EngineKind& engine);
+int EngineCount();
+/* engine of the registry, 0 <= index < EngineCount() */
+EngineKind EngineAt(int index);
+/* false for engines that run without an OpenCL context */
+bool EngineUsesDevice(EngineKind engine);
+/* true for the engines with an inner (lagged diffusivity) loop */
+bool EngineUsesInnerIterations(EngineKind engine);
+/* true for the engines that record the residual of their solver iterations (OpticalFlowBase::setResidualReport) */
+bool EngineReportsResidual(EngineKind engine);
+
+/* kernel variant of the flow_driven engine by name: global, tiled, fused */
+bool RobustKernelsFromName(const std::string& name, RobustKernels& kernels);
+const char* RobustKernelsName(RobustKernels kernels);
+/* comma separated variants, e.g. "global,tiled,fused"; false for an unknown name or an empty list */
+bool RobustKernelsFromList(const std::string& list, std::vector<RobustKernels>& kernels);
+/* fastest variant the scheme supports: fused for Jacobi, global for red-black */
+RobustKernels DefaultRobustKernels(SolverScheme scheme);
+
+/* work-group shape of the engine when no tuned one is given */
+void DefaultLocalWorkSize(EngineKind engine, int localWorkSize[2]);
+
+/* engine with initialized device resources, NULL on failure; without localWorkSize the default
+   work-group shape of the engine is used */
+OpticalFlowBase* CreateEngine(EngineKind engine, const Image& img1, const Image& img2, const EngineParameters& p,
+							  cl_context context, cl_command_queue queue, cl_device_id device, const int* localWorkSize = NULL);
+void ReleaseEngine(EngineKind engine, OpticalFlowBase* flow);
+
+/* autotuning target of a device engine: prepare() creates the engine on the profiling queue of the tuner,
+   the program, hot kernel and build options follow the engine and its parameters */
+class EngineTuningTarget : public TuningTarget
+{
+private:
+	EngineKind m_engine;
+	const Image& m_img1;
+	const Image& m_img2;
+	EngineParameters m_parameters;
+	cl_context m_clContext;
+	cl_device_id m_clDevice;
+
+	OpticalFlowBase* m_flow;
+	Image m_u;
+	Image m_v;
+
+public:
+	EngineTuningTarget(EngineKind engine, const Image& img1, const Image& img2, const EngineParameters& p,
+					   cl_context clContext, cl_device_id clDevice);
+	~EngineTuningTarget();
+
+	const char* name() const;
+	std::string programPath() const;
+	const char* kernelName() const;
+	std::string buildOptions() const;
+
+	bool prepare(cl_command_queue queue, int localWorkSize[2]);
+	void run();
+	void release();
+};
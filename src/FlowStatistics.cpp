@@ -0,0 +1,324 @@
+#include "FlowStatistics.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cfloat>
+
+// histogram bin of a value, -1 for NaN and infinity; clamped in float so the conversion to int stays defined
+static int HistogramBin(float value, float bin, int bins)
+{
+	if (!(std::fabs(value) <= FLT_MAX))
+		return -1;
+	return (int)std::min(std::max(value / bin, 0.f), (float)(bins - 1));
+}
+
+FlowStatistics::FlowStatistics(cl_context clContext, cl_command_queue clCommandQueue, int bins, float epe_bin, float magnitude_bin)
+	: m_clContext(clContext), m_clCommandQueue(clCommandQueue), m_localWorkSize(256),
+	m_clProgram(NULL), m_clStatisticsKernel(NULL),
+	m_d_u_gt(NULL), m_d_v_gt(NULL), m_d_partial(NULL), m_d_epe_histogram(NULL), m_d_magnitude_histogram(NULL), m_partial_groups(0),
+	m_gt_width(0), m_gt_height(0), m_bins(std::max(bins, 1)), m_epe_bin(epe_bin), m_magnitude_bin(magnitude_bin), m_half_storage(false)
+{
+}
+
+FlowStatistics::~FlowStatistics()
+{
+}
+
+bool FlowStatistics::initResources(cl_context context, cl_device_id device, bool half_storage)
+{
+	cl_int cl_error;
+	char * program_code;
+	size_t program_size;
+
+	m_clContext = context;
+	m_half_storage = half_storage;
+
+	// largest power of two work-group up to 256 (tree reduction in local memory)
+	size_t max_work_group_size = 1;
+	V_RETURN_FALSE_CL(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &max_work_group_size, NULL), "Unable to query the work-group size.");
+	m_localWorkSize = 1;
+	while (m_localWorkSize * 2 <= std::min(max_work_group_size, (size_t)256)) {
+		m_localWorkSize *= 2;
+	}
+
+	LoadProgram(KernelPath("FlowStatistics.cl").c_str(), &program_code, &program_size);
+
+	// create a program object
+	m_clProgram = clCreateProgramWithSource(context, 1, (const char**)&program_code, &program_size, &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create program from file.");
+
+	// build program
+	char compileOptions[128];
+	#ifdef _WIN32   // Windows version
+		sprintf_s(compileOptions, "-D GROUP_SIZE=%d -D BINS=%d%s", (int)m_localWorkSize, m_bins, half_storage ? " -D HALF_STORAGE" : "");
+	#else           // Linux version
+		sprintf(compileOptions, "-D GROUP_SIZE=%d -D BINS=%d%s", (int)m_localWorkSize, m_bins, half_storage ? " -D HALF_STORAGE" : "");
+	#endif
+	cl_error = clBuildProgram(m_clProgram, 1, &device, compileOptions, NULL, NULL);
+	if (cl_error != CL_SUCCESS) {
+		PrintBuildLog(m_clProgram, device);
+		return false;
+	}
+
+	m_clStatisticsKernel = clCreateKernel(m_clProgram, "FlowStatistics", &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel: FlowStatistics");
+
+	m_d_epe_histogram = clCreateBuffer(context, CL_MEM_READ_WRITE, m_bins * sizeof(cl_uint), NULL, &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	m_d_magnitude_histogram = clCreateBuffer(context, CL_MEM_READ_WRITE, m_bins * sizeof(cl_uint), NULL, &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+
+	return true;
+}
+
+void FlowStatistics::releaseResources()
+{
+	SAFE_RELEASE_MEMOBJECT(m_d_u_gt);
+	SAFE_RELEASE_MEMOBJECT(m_d_v_gt);
+	SAFE_RELEASE_MEMOBJECT(m_d_partial);
+	SAFE_RELEASE_MEMOBJECT(m_d_epe_histogram);
+	SAFE_RELEASE_MEMOBJECT(m_d_magnitude_histogram);
+	m_partial_groups = 0;
+	m_gt_width = m_gt_height = 0;
+
+	SAFE_RELEASE_KERNEL(m_clStatisticsKernel);
+	SAFE_RELEASE_PROGRAM(m_clProgram);
+}
+
+bool FlowStatistics::setGroundTruth(const Image& u_gt, const Image& v_gt)
+{
+	cl_int cl_error;
+	clearGroundTruth();
+
+	// packed without borders and padding
+	int width = u_gt.actual_width();
+	int height = u_gt.actual_height();
+	if (width <= 0 || height <= 0) {
+		return false;
+	}
+	std::vector<float> u_data((size_t)width * height);
+	std::vector<float> v_data((size_t)width * height);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			u_data[(size_t)y * width + x] = u_gt.pixel_r(x, y);
+			v_data[(size_t)y * width + x] = v_gt.pixel_r(x, y);
+		}
+	}
+
+	m_d_u_gt = clCreateBuffer(m_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, u_data.size() * sizeof(float), &u_data[0], &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating ground truth");
+	m_d_v_gt = clCreateBuffer(m_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, v_data.size() * sizeof(float), &v_data[0], &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating ground truth");
+
+	m_gt_width = width;
+	m_gt_height = height;
+	return true;
+}
+
+void FlowStatistics::clearGroundTruth()
+{
+	SAFE_RELEASE_MEMOBJECT(m_d_u_gt);
+	SAFE_RELEASE_MEMOBJECT(m_d_v_gt);
+	m_gt_width = m_gt_height = 0;
+}
+
+bool FlowStatistics::compute(const DeviceFlow& flow, FlowMeasures& measures)
+{
+	cl_int cl_error;
+	if (flow.half_storage != m_half_storage) {
+		std::cout << "Error: flow storage differs from the one the statistics were built for" << std::endl;
+		return false;
+	}
+	cl_int has_gt = m_d_u_gt ? 1 : 0;
+	if (has_gt && (flow.width != m_gt_width || flow.height != m_gt_height)) {
+		std::cout << "Error: flow (" << flow.width << "x" << flow.height << ") and ground truth (" << m_gt_width << "x" << m_gt_height << ") differ in size" << std::endl;
+		return false;
+	}
+
+	size_t globalWorkSize = GetGlobalWorkSize((size_t)flow.width * flow.height, m_localWorkSize);
+	size_t groups = globalWorkSize / m_localWorkSize;
+	if (groups > m_partial_groups) {
+		SAFE_RELEASE_MEMOBJECT(m_d_partial);
+		m_d_partial = clCreateBuffer(m_clContext, CL_MEM_WRITE_ONLY, groups * 8 * sizeof(cl_float), NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		m_partial_groups = groups;
+	}
+
+	std::vector<cl_uint> zeros(m_bins, 0);
+	V_RETURN_FALSE_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_epe_histogram, CL_FALSE, 0, m_bins * sizeof(cl_uint), &zeros[0], 0, NULL, NULL), "Error writing device memory");
+	V_RETURN_FALSE_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_magnitude_histogram, CL_FALSE, 0, m_bins * sizeof(cl_uint), &zeros[0], 0, NULL, NULL), "Error writing device memory");
+
+	// without ground truth the flow buffer stands in for it (never read)
+	cl_mem u_gt = has_gt ? m_d_u_gt : flow.u;
+	cl_mem v_gt = has_gt ? m_d_v_gt : flow.v;
+	cl_error  = clSetKernelArg(m_clStatisticsKernel, 0, sizeof(cl_mem), (void*)&flow.u);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 1, sizeof(cl_mem), (void*)&flow.v);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 2, sizeof(cl_int), (void*)&flow.offset);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 3, sizeof(cl_int), (void*)&flow.stride);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 4, sizeof(cl_int), (void*)&flow.v_offset);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 5, sizeof(cl_int), (void*)&flow.bx);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 6, sizeof(cl_int), (void*)&flow.by);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 7, sizeof(cl_int), (void*)&flow.width);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 8, sizeof(cl_int), (void*)&flow.height);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 9, sizeof(cl_int), (void*)&flow.pitch);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 10, sizeof(cl_mem), (void*)&u_gt);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 11, sizeof(cl_mem), (void*)&v_gt);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 12, sizeof(cl_int), (void*)&has_gt);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 13, sizeof(cl_float), (void*)&m_epe_bin);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 14, sizeof(cl_float), (void*)&m_magnitude_bin);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 15, sizeof(cl_mem), (void*)&m_d_partial);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 16, sizeof(cl_mem), (void*)&m_d_epe_histogram);
+	cl_error |= clSetKernelArg(m_clStatisticsKernel, 17, sizeof(cl_mem), (void*)&m_d_magnitude_histogram);
+	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+
+	V_RETURN_FALSE_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clStatisticsKernel, 1, NULL, &globalWorkSize, &m_localWorkSize, 0, NULL, Profiler::event(m_clStatisticsKernel)), "Error executing kernel!");
+
+	// only the partial results and the histograms come back
+	std::vector<cl_float> partial(groups * 8);
+	measures.epe_histogram.assign(m_bins, 0);
+	measures.magnitude_histogram.assign(m_bins, 0);
+	V_RETURN_FALSE_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_partial, CL_FALSE, 0, partial.size() * sizeof(cl_float), &partial[0], 0, NULL, NULL), "Error reading device memory");
+	V_RETURN_FALSE_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_epe_histogram, CL_FALSE, 0, m_bins * sizeof(cl_uint), &measures.epe_histogram[0], 0, NULL, NULL), "Error reading device memory");
+	V_RETURN_FALSE_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_magnitude_histogram, CL_TRUE, 0, m_bins * sizeof(cl_uint), &measures.magnitude_histogram[0], 0, NULL, NULL), "Error reading device memory");
+
+	double sum_epe = 0.0;
+	double sum_aae = 0.0;
+	double sum_magnitude = 0.0;
+	double known = 0.0;
+	measures.max_epe = 0.f;
+	measures.max_magnitude = 0.f;
+	for (size_t g = 0; g < groups; g++) {
+		const cl_float* p = &partial[8 * g];
+		sum_epe += p[0];
+		sum_aae += p[1];
+		measures.max_epe = std::max(measures.max_epe, p[2]);
+		known += p[3];
+		sum_magnitude += p[4];
+		measures.max_magnitude = std::max(measures.max_magnitude, p[5]);
+	}
+	measures.pixels = flow.width * flow.height;
+	measures.known = (int)known;
+	finish(sum_epe, sum_aae, sum_magnitude, measures);
+	return true;
+}
+
+void FlowStatistics::computeHost(const Image& u, const Image& v, const Image* u_gt, const Image* v_gt, FlowMeasures& measures) const
+{
+	int width = u.actual_width();
+	int height = u.actual_height();
+	bool has_gt = u_gt && v_gt && u_gt->actual_width() == width && u_gt->actual_height() == height;
+
+	double sum_epe = 0.0;
+	double sum_aae = 0.0;
+	double sum_magnitude = 0.0;
+	int known = 0;
+	float max_epe = 0.f;
+	float max_magnitude = 0.f;
+	measures.epe_histogram.assign(m_bins, 0);
+	measures.magnitude_histogram.assign(m_bins, 0);
+
+	#pragma omp parallel
+	{
+		// per thread: the row is measured into arrays by a branch-free loop the compiler can vectorize,
+		// then accumulated and binned
+		std::vector<float> epe(width);
+		std::vector<float> aae(width);
+		std::vector<float> magnitude(width);
+		std::vector<float> valid(width);
+		std::vector<unsigned int> epe_histogram(m_bins, 0);
+		std::vector<unsigned int> magnitude_histogram(m_bins, 0);
+		double t_sum_epe = 0.0;
+		double t_sum_aae = 0.0;
+		double t_sum_magnitude = 0.0;
+		int t_known = 0;
+		float t_max_epe = 0.f;
+		float t_max_magnitude = 0.f;
+
+		#pragma omp for schedule(static)
+		for (int y = 0; y < height; y++) {
+			const float* pu = &u.pixel_r(0, y);
+			const float* pv = &v.pixel_r(0, y);
+			const float* pu_gt = has_gt ? &u_gt->pixel_r(0, y) : pu;
+			const float* pv_gt = has_gt ? &v_gt->pixel_r(0, y) : pv;
+			for (int x = 0; x < width; x++) {
+				float fu = pu[x];
+				float fv = pv[x];
+				float gu = pu_gt[x];
+				float gv = pv_gt[x];
+				magnitude[x] = sqrtf(fu * fu + fv * fv);
+				epe[x] = sqrtf((fu - gu) * (fu - gu) + (fv - gv) * (fv - gv));
+				float cosine = (fu * gu + fv * gv + 1.f) / sqrtf((fu * fu + fv * fv + 1.f) * (gu * gu + gv * gv + 1.f));
+				aae[x] = cosine;
+				// NaN fails both comparisons and is unknown as well
+				valid[x] = (std::fabs(gu) <= 1e6f && std::fabs(gv) <= 1e6f) ? 1.f : 0.f;
+			}
+
+			for (int x = 0; x < width; x++) {
+				t_sum_magnitude += magnitude[x];
+				t_max_magnitude = std::max(t_max_magnitude, magnitude[x]);
+				int magnitude_bin = HistogramBin(magnitude[x], m_magnitude_bin, m_bins);
+				if (magnitude_bin >= 0)
+					magnitude_histogram[magnitude_bin]++;
+				if (has_gt && valid[x] != 0.f) {
+					t_sum_epe += epe[x];
+					t_sum_aae += acos(std::min(1.f, std::max(-1.f, aae[x]))) * 180.0 / 3.14159265358979;
+					t_max_epe = std::max(t_max_epe, epe[x]);
+					int epe_bin = HistogramBin(epe[x], m_epe_bin, m_bins);
+					if (epe_bin >= 0)
+						epe_histogram[epe_bin]++;
+					t_known++;
+				}
+			}
+		}
+
+		#pragma omp critical
+		{
+			sum_epe += t_sum_epe;
+			sum_aae += t_sum_aae;
+			sum_magnitude += t_sum_magnitude;
+			known += t_known;
+			max_epe = std::max(max_epe, t_max_epe);
+			max_magnitude = std::max(max_magnitude, t_max_magnitude);
+			for (int b = 0; b < m_bins; b++) {
+				measures.epe_histogram[b] += epe_histogram[b];
+				measures.magnitude_histogram[b] += magnitude_histogram[b];
+			}
+		}
+	}
+
+	measures.pixels = width * height;
+	measures.known = known;
+	measures.max_epe = max_epe;
+	measures.max_magnitude = max_magnitude;
+	finish(sum_epe, sum_aae, sum_magnitude, measures);
+}
+
+void FlowStatistics::finish(double sum_epe, double sum_aae, double sum_magnitude, FlowMeasures& measures) const
+{
+	measures.mean_epe = measures.known ? (float)(sum_epe / measures.known) : 0.f;
+	measures.mean_aae = measures.known ? (float)(sum_aae / measures.known) : 0.f;
+	measures.mean_magnitude = measures.pixels ? (float)(sum_magnitude / measures.pixels) : 0.f;
+	measures.epe_p50 = percentile(measures.epe_histogram, measures.known, 0.50f, measures.max_epe);
+	measures.epe_p90 = percentile(measures.epe_histogram, measures.known, 0.90f, measures.max_epe);
+	measures.epe_p95 = percentile(measures.epe_histogram, measures.known, 0.95f, measures.max_epe);
+	measures.epe_p99 = percentile(measures.epe_histogram, measures.known, 0.99f, measures.max_epe);
+}
+
+/**
+* Upper edge of the first bin the cumulative count reaches the fraction in, the maximum for the last (open) bin
+*/
+float FlowStatistics::percentile(const std::vector<unsigned int>& histogram, int count, float fraction, float max_value) const
+{
+	if (count <= 0) {
+		return 0.f;
+	}
+	double target = fraction * (double)count;
+	double cumulative = 0.0;
+	for (int b = 0; b < m_bins; b++) {
+		cumulative += histogram[b];
+		if (cumulative >= target) {
+			return b + 1 < m_bins ? std::min((b + 1) * m_epe_bin, max_value) : max_value;
+		}
+	}
+	return max_value;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Common.h"
+#include "Image.h"
+
+#include <vector>
+
+/* flow field resident on the device: pixel (x, y) is u[offset + stride * IND(x, y)] and
+   v[offset + stride * IND(x, y) + v_offset], so separate (stride 1) and interleaved (stride 2) buffers are described */
+struct DeviceFlow
+{
+	cl_mem u;
+	cl_mem v;
+	int offset;
+	int stride;
+	int v_offset;
+	int bx;
+	int by;
+	int width;
+	int height;
+	int pitch;
+	bool half_storage;
+};
+
+/* error and magnitude statistics of one flow field */
+struct FlowMeasures
+{
+	int pixels;					// pixels of the flow field
+	int known;					// pixels with known ground truth
+	float mean_epe;				// endpoint error
+	float max_epe;
+	float mean_aae;				// angular error in degrees
+	float epe_p50;				// percentiles of the endpoint error (upper edge of the histogram bin)
+	float epe_p90;
+	float epe_p95;
+	float epe_p99;
+	float mean_magnitude;
+	float max_magnitude;
+	std::vector<unsigned int> epe_histogram;
+	std::vector<unsigned int> magnitude_histogram;
+};
+
+/* Error metrics (endpoint / angular error, percentiles, flow magnitude histogram) computed on the device
+   directly on the flow buffers of an engine against a device-resident ground truth: one reduction launch,
+   only the per work-group partial results and the histograms are read back. computeHost is the same
+   measure for host images (OpenMP over rows). Unknown ground truth (> 1e6 or NaN) is skipped. */
+class FlowStatistics
+{
+private:
+	cl_context m_clContext;
+	cl_command_queue m_clCommandQueue;
+	size_t m_localWorkSize;
+
+	cl_program m_clProgram;
+	cl_kernel m_clStatisticsKernel;
+
+	cl_mem m_d_u_gt;
+	cl_mem m_d_v_gt;
+	cl_mem m_d_partial;
+	cl_mem m_d_epe_histogram;
+	cl_mem m_d_magnitude_histogram;
+	size_t m_partial_groups;	// work-groups m_d_partial has room for
+
+	int m_gt_width;
+	int m_gt_height;
+	int m_bins;
+	float m_epe_bin;
+	float m_magnitude_bin;
+	bool m_half_storage;
+
+public:
+	FlowStatistics(cl_context clContext, cl_command_queue clCommandQueue, int bins = 1024, float epe_bin = 0.01f, float magnitude_bin = 0.1f);
+	~FlowStatistics();
+
+	/* half_storage: flow buffers of a GPUFullOpticalFlow with half storage */
+	bool initResources(cl_context context, cl_device_id device, bool half_storage = false);
+	void releaseResources();
+
+	/* uploads the ground truth once, compute() measures the errors against it until it is cleared */
+	bool setGroundTruth(const Image& u_gt, const Image& v_gt);
+	void clearGroundTruth();
+
+	bool compute(const DeviceFlow& flow, FlowMeasures& measures);
+	/* u_gt, v_gt may be NULL for magnitude statistics only */
+	void computeHost(const Image& u, const Image& v, const Image* u_gt, const Image* v_gt, FlowMeasures& measures) const;
+
+private:
+	void finish(double sum_epe, double sum_aae, double sum_magnitude, FlowMeasures& measures) const;
+	float percentile(const std::vector<unsigned int>& histogram, int count, float fraction, float max_value) const;
+};
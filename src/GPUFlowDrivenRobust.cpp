@@ -1,16 +1,19 @@
 #include "GPUFlowDrivenRobust.h"
 
 #include "CTimer.h"
+#include "Profiler.h"
+#include "Timing.h"
 #include <algorithm>
 #include <sstream>
 
 GPUFlowDrivenRobust::GPUFlowDrivenRobust(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, int inner_iterations, float alpha, float omega, float e_smooth, float e_data, 
-	cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2])
-	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega), m_inner_iterations(inner_iterations), m_e_smooth(e_smooth), m_e_data(e_data),
+	cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], SolverScheme scheme,
+	RobustKernels kernels)
+	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega),
 	m_clContext(clContext), m_clCommandQueue(clCommandQueue),
-	m_clProgram(NULL), m_clSolverKernel(NULL), m_clComputePhiKsiKernel(NULL),
-	m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_du(NULL), m_d_dv(NULL), m_d_u(NULL), m_d_v(NULL), m_d_phi(NULL),
-	m_data_size(0)
+	m_clProgram(NULL), m_clSolverKernel(NULL), m_clComputePhiKsiKernel(NULL), m_clComputeMotionTensorKernel(NULL), m_clSolverPhiKsiKernel(NULL),
+	m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_du(NULL), m_d_dv(NULL), m_d_du_r(NULL), m_d_dv_r(NULL), m_d_u(NULL), m_d_v(NULL), m_d_phi(NULL), m_d_ksi(NULL), m_d_J(NULL),
+	m_data_size(0), m_inner_iterations(inner_iterations), m_e_smooth(e_smooth), m_e_data(e_data), m_scheme(scheme), m_kernels(kernels)
 {
 	m_localWorkSize[0] = localWorkSize[0];
 	m_localWorkSize[1] = localWorkSize[1];
@@ -26,14 +29,23 @@ bool GPUFlowDrivenRobust::initResources(cl_context context, cl_device_id device)
 	char * program_code;
 	size_t program_size;
 
-	LoadProgram("./src/kernels/FlowDrivenSolver.cl", &program_code, &program_size);
+	// the tiled kernels are Jacobi only, red-black would silently run a different scheme
+	if (m_kernels != ROBUST_GLOBAL && m_scheme == SOLVER_RED_BLACK) {
+		std::cout << "Error: Tiled robust kernels support only the Jacobi scheme." << std::endl;
+		return false;
+	}
+
+	LoadProgram(KernelPath("FlowDrivenSolver.cl").c_str(), &program_code, &program_size);
 
 	// create a program object
 	m_clProgram = clCreateProgramWithSource(context, 1, (const char**)&program_code, &program_size, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create program from file.");
 
-	// buid program
-	cl_error = clBuildProgram(m_clProgram, 1, &device, NULL, NULL, NULL);
+	// buid program, the kernel directory is the include path of SolverCommon.cl
+	std::ostringstream compileOptions;
+	compileOptions << KernelIncludeOption() << " -D TILE_SIZE_X=" << (int)m_localWorkSize[0] << " -D TILE_SIZE_Y=" << (int)m_localWorkSize[1];
+
+	cl_error = clBuildProgram(m_clProgram, 1, &device, compileOptions.str().c_str(), NULL, NULL);
 	if (cl_error != CL_SUCCESS)
 	{
 		PrintBuildLog(m_clProgram, device);
@@ -41,10 +53,20 @@ bool GPUFlowDrivenRobust::initResources(cl_context context, cl_device_id device)
 	}
 
 	// create kernels
-	m_clSolverKernel = clCreateKernel(m_clProgram, "Solver", &cl_error);
+	bool tiled = (m_kernels != ROBUST_GLOBAL);
+	m_clSolverKernel = clCreateKernel(m_clProgram, (m_scheme == SOLVER_RED_BLACK) ? "SolverRedBlack" : (tiled ? "SolverTiled" : "Solver"), &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
-	m_clComputePhiKsiKernel = clCreateKernel(m_clProgram, "ComputePhiKsi", &cl_error);
+	// the fused kernel updates phi/ksi itself
+	if (m_kernels != ROBUST_TILED_FUSED) {
+		m_clComputePhiKsiKernel = clCreateKernel(m_clProgram, tiled ? "ComputePhiKsiTiled" : "ComputePhiKsi", &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+	} else {
+		m_clSolverPhiKsiKernel = clCreateKernel(m_clProgram, "SolverTiledPhiKsi", &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+	}
+
+	m_clComputeMotionTensorKernel = clCreateKernel(m_clProgram, "ComputeMotionTensor", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
 
@@ -69,47 +91,84 @@ bool GPUFlowDrivenRobust::initResources(cl_context context, cl_device_id device)
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
 	m_d_dv = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	// red-black SOR updates the increments in place, double buffers are needed only by Jacobi
+	if (m_scheme == SOLVER_JACOBI) {
+		m_d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		m_d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	}
 	m_d_phi = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
 	m_d_ksi = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	m_d_J = clCreateBuffer(context, CL_MEM_READ_WRITE, pitch * (height + 2 * by) * sizeof(cl_float8), NULL, &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
 
 	// bind kernel arguments (constant for all iterations)
-	cl_error = clSetKernelArg(m_clSolverKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 1, sizeof(cl_mem), (void*)&m_d_Img_2);
+	cl_error = clSetKernelArg(m_clSolverKernel, 0, sizeof(cl_mem), (void*)&m_d_J);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 4, sizeof(cl_mem), (void*)&m_d_u);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 5, sizeof(cl_mem), (void*)&m_d_v);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 3, sizeof(cl_mem), (void*)&m_d_u);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 4, sizeof(cl_mem), (void*)&m_d_v);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 8, sizeof(cl_float), (void*)&m_alpha);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 9, sizeof(cl_float), (void*)&m_omega);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 10, sizeof(cl_int), (void*)&bx);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 11, sizeof(cl_int), (void*)&by);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 7, sizeof(cl_float), (void*)&m_alpha);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 8, sizeof(cl_float), (void*)&m_omega);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 9, sizeof(cl_int), (void*)&bx);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 10, sizeof(cl_int), (void*)&by);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 14, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 13, sizeof(cl_int), (void*)&pitch);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 17, sizeof(cl_mem), (void*)&m_d_phi);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 18, sizeof(cl_mem), (void*)&m_d_ksi);
+	// red-black kernel has a single color argument instead of the two result buffers
+	int phi_index = (m_scheme == SOLVER_RED_BLACK) ? 15 : 16;
+	cl_error |= clSetKernelArg(m_clSolverKernel, phi_index, sizeof(cl_mem), (void*)&m_d_phi);
+	cl_error |= clSetKernelArg(m_clSolverKernel, phi_index + 1, sizeof(cl_mem), (void*)&m_d_ksi);
 	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
 
-	cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 0, sizeof(cl_mem), (void*)&m_d_u);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 1, sizeof(cl_mem), (void*)&m_d_v);
-	
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 4, sizeof(cl_mem), (void*)&m_d_phi);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 5, sizeof(cl_mem), (void*)&m_d_ksi);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 6, sizeof(cl_float), (void*)&m_e_smooth);
+	// fused kernel shares the Jacobi solver arguments and adds both epsilons
+	if (m_kernels == ROBUST_TILED_FUSED) {
+		cl_error  = clSetKernelArg(m_clSolverPhiKsiKernel, 0, sizeof(cl_mem), (void*)&m_d_J);
+
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 3, sizeof(cl_mem), (void*)&m_d_u);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 4, sizeof(cl_mem), (void*)&m_d_v);
+
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 7, sizeof(cl_float), (void*)&m_alpha);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 8, sizeof(cl_float), (void*)&m_omega);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 9, sizeof(cl_int), (void*)&bx);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 10, sizeof(cl_int), (void*)&by);
+
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 13, sizeof(cl_int), (void*)&pitch);
+
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 16, sizeof(cl_mem), (void*)&m_d_phi);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 17, sizeof(cl_mem), (void*)&m_d_ksi);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 18, sizeof(cl_float), (void*)&m_e_smooth);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 19, sizeof(cl_float), (void*)&m_e_data);
+		V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	}
+
+	if (m_kernels != ROBUST_TILED_FUSED) {
+		cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 0, sizeof(cl_mem), (void*)&m_d_u);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 1, sizeof(cl_mem), (void*)&m_d_v);
+
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 4, sizeof(cl_mem), (void*)&m_d_phi);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 5, sizeof(cl_mem), (void*)&m_d_ksi);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 6, sizeof(cl_float), (void*)&m_e_smooth);
+
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 9, sizeof(cl_int), (void*)&bx);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 10, sizeof(cl_int), (void*)&by);
+
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 13, sizeof(cl_int), (void*)&pitch);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 14, sizeof(cl_mem), (void*)&m_d_J);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 15, sizeof(cl_float), (void*)&m_e_data);
+		V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	}
 
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 9, sizeof(cl_int), (void*)&bx);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 10, sizeof(cl_int), (void*)&by);
+	cl_error  = clSetKernelArg(m_clComputeMotionTensorKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 1, sizeof(cl_mem), (void*)&m_d_Img_2);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 4, sizeof(cl_int), (void*)&bx);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 5, sizeof(cl_int), (void*)&by);
 
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 13, sizeof(cl_int), (void*)&pitch);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 14, sizeof(cl_mem), (void*)&m_d_Img_1);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 15, sizeof(cl_mem), (void*)&m_d_Img_2);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 16, sizeof(cl_float), (void*)&m_e_data);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 8, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 9, sizeof(cl_mem), (void*)&m_d_J);
 	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
 
 	return true;
@@ -127,9 +186,12 @@ void GPUFlowDrivenRobust::releaseResources()
 	SAFE_RELEASE_MEMOBJECT(m_d_v);
 	SAFE_RELEASE_MEMOBJECT(m_d_phi);
 	SAFE_RELEASE_MEMOBJECT(m_d_ksi);
+	SAFE_RELEASE_MEMOBJECT(m_d_J);
 
 	SAFE_RELEASE_KERNEL(m_clSolverKernel);
 	SAFE_RELEASE_KERNEL(m_clComputePhiKsiKernel);
+	SAFE_RELEASE_KERNEL(m_clComputeMotionTensorKernel);
+	SAFE_RELEASE_KERNEL(m_clSolverPhiKsiKernel);
 	SAFE_RELEASE_PROGRAM(m_clProgram);
 }
 
@@ -147,13 +209,21 @@ void GPUFlowDrivenRobust::computeFlow(Image& u, Image& v)
 	Image du(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// x-component of flow increment
 	Image dv(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// y-component of flow increment
 
-	int current_warp_level = min(m_warp_levels, computeMaxWarpLevels()) - 1;
+	// host side of the transfers of solveDifference
+	pinImage(img_1_res);
+	pinImage(img_2_br);
+	pinImage(du);
+	pinImage(dv);
 
-	// initialize output flow arrays
-	u.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 1, 1);
-	v.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 1, 1);
+	int current_warp_level = startWarpLevel();
+
+	// initialize output flow arrays, with the initial flow for a warm start
+	initializeFlow(u, v);
 
 	while (current_warp_level >= 0) {
+		Profiler::setLevel(current_warp_level);
+		TIMING_LEVEL(current_warp_level);
+
 		// compute level sizes
 		level_width = static_cast<int>(ceil(m_source_img_1.width() * pow(m_warp_scale, current_warp_level)));
 		level_height = static_cast<int>(ceil(m_source_img_1.height() * pow(m_warp_scale, current_warp_level)));
@@ -163,6 +233,7 @@ void GPUFlowDrivenRobust::computeFlow(Image& u, Image& v)
 		std::cout << "Solve level: " << current_warp_level << " (" << level_width << "x" << level_height << ") \t "; // << std::endl;
 
 		// perform resampling of images
+		TIMING_BEGIN("pyramid");
 		if (current_warp_level == 0) {
 			img_1_res = m_source_img_1;
 			img_2_res = m_source_img_2;
@@ -175,16 +246,21 @@ void GPUFlowDrivenRobust::computeFlow(Image& u, Image& v)
 		Image::resampleAreaBasedWithoutReallocating(v, dv, level_width, level_height);
 		u = du;
 		v = dv;
+		TIMING_END();
 
 		// perform backward registration
+		TIMING_BEGIN("warp");
 		Image::backwardRegistration(img_1_res, img_2_res, img_2_br, u, v, hx, hy);
+		TIMING_END();
 
 		// solve difference problem at current resolution to obtain increment
 		solveDifference(img_1_res, img_2_br, du, dv, u, v, hx, hy);
 
 		// add solved increment to the global flow
+		TIMING_BEGIN("add");
 		u += du;
 		v += dv;
+		TIMING_END();
 
 		// go to the next level
 		current_warp_level--;
@@ -205,73 +281,122 @@ void GPUFlowDrivenRobust::solveDifference(Image& img_1, Image& img_2, Image& du,
 	dv.zeroData();
 
 	// copy data to device
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_1, CL_FALSE, 0, m_data_size, img_1.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_2, CL_FALSE, 0, m_data_size, img_2.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv, CL_FALSE, 0, m_data_size, dv.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du_r, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv_r, CL_FALSE, 0, m_data_size, dv.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_u, CL_FALSE, 0, m_data_size, u.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_v, CL_FALSE, 0, m_data_size, v.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_phi, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_ksi, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
+	TIMING_BEGIN("upload");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_1, CL_FALSE, 0, m_data_size, img_1.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_2, CL_FALSE, 0, m_data_size, img_2.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv, CL_FALSE, 0, m_data_size, dv.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	if (m_scheme == SOLVER_JACOBI) {
+		V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du_r, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv_r, CL_FALSE, 0, m_data_size, dv.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	}
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_u, CL_FALSE, 0, m_data_size, u.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_v, CL_FALSE, 0, m_data_size, v.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_phi, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_ksi, CL_FALSE, 0, m_data_size, du.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
 
 	// wait until all data are copied
 	clFinish(m_clCommandQueue);
+	TIMING_END();
+
+	TIMING_BEGIN("solve");
+	TIMING_COUNT("pixel updates", (double)width * height * solverIterations() * m_inner_iterations);
 
 	// bind kernel arguments (varying during warp levels iterations)
 	cl_int cl_error;
-	cl_error  = clSetKernelArg(m_clSolverKernel, 6, sizeof(cl_float), (void*)&hx);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 7, sizeof(cl_float), (void*)&hy);
+	cl_error  = clSetKernelArg(m_clSolverKernel, 5, sizeof(cl_float), (void*)&hx);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 6, sizeof(cl_float), (void*)&hy);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 12, sizeof(cl_int), (void*)&width);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 13, sizeof(cl_int), (void*)&height);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 11, sizeof(cl_int), (void*)&width);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 12, sizeof(cl_int), (void*)&height);
 	V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-	cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 7, sizeof(cl_float), (void*)&hx);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 8, sizeof(cl_float), (void*)&hy);
+	if (m_kernels == ROBUST_TILED_FUSED) {
+		cl_error  = clSetKernelArg(m_clSolverPhiKsiKernel, 5, sizeof(cl_float), (void*)&hx);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 6, sizeof(cl_float), (void*)&hy);
+
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 11, sizeof(cl_int), (void*)&width);
+		cl_error |= clSetKernelArg(m_clSolverPhiKsiKernel, 12, sizeof(cl_int), (void*)&height);
+		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+	} else {
+		cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 7, sizeof(cl_float), (void*)&hx);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 8, sizeof(cl_float), (void*)&hy);
+
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 11, sizeof(cl_int), (void*)&width);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 12, sizeof(cl_int), (void*)&height);
+		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+	}
+
+	cl_error  = clSetKernelArg(m_clComputeMotionTensorKernel, 2, sizeof(cl_float), (void*)&hx);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 3, sizeof(cl_float), (void*)&hy);
 
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 11, sizeof(cl_int), (void*)&width);
-	cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 12, sizeof(cl_int), (void*)&height);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 6, sizeof(cl_int), (void*)&width);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 7, sizeof(cl_int), (void*)&height);
 	V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-	size_t globalWorkSize[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[0]) };
+	size_t globalWorkSize[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[1]) };
 
 	CTimer timer;
 	timer.Start();
+
+	// motion tensor depends only on the images, compute it once per warp level
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clComputeMotionTensorKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clComputeMotionTensorKernel)), "Error executing kernel!");
+
 	// run kernel many times	
 	// outer iterations
-	for (int i = 0; i < m_solver_iterations; i++) {
+	for (int i = 0; i < solverIterations(); i++) {
 		
-		// precompute weight values for flow-driven smoothenss
-		cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
-		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
-		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+		// precompute weight values for flow-driven smoothenss (the fused kernel does it in the first inner iteration)
+		if (m_kernels != ROBUST_TILED_FUSED) {
+			cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
+			cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
+			V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-		V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clComputePhiKsiKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, NULL), "Error executing kernel!");
+			V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clComputePhiKsiKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clComputePhiKsiKernel)), "Error executing kernel!");
+		}
 
 		// inner iterations
-		for (int j = 0; j < m_inner_iterations; j++) {
-			// bind input and output buffers
-			cl_error  = clSetKernelArg(m_clSolverKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
-			cl_error |= clSetKernelArg(m_clSolverKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
-
-			cl_error |= clSetKernelArg(m_clSolverKernel, 15, sizeof(cl_mem), (void*)&m_d_du_r);
-			cl_error |= clSetKernelArg(m_clSolverKernel, 16, sizeof(cl_mem), (void*)&m_d_dv_r);
+		if (m_scheme == SOLVER_RED_BLACK) {
+			// increments are updated in place
+			cl_error  = clSetKernelArg(m_clSolverKernel, 1, sizeof(cl_mem), (void*)&m_d_du);
+			cl_error |= clSetKernelArg(m_clSolverKernel, 2, sizeof(cl_mem), (void*)&m_d_dv);
 			V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-			V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clSolverKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, NULL), "Error executing kernel!");
+			for (int j = 0; j < m_inner_iterations; j++) {
+				// red pixels first, then black pixels using the updated red ones
+				for (int color = 0; color < 2; color++) {
+					V_RETURN_CL(clSetKernelArg(m_clSolverKernel, 14, sizeof(cl_int), (void*)&color), "Error setting kernel arguments");
+					V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clSolverKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clSolverKernel)), "Error executing kernel!");
+				}
+			}
+		} else {
+			for (int j = 0; j < m_inner_iterations; j++) {
+				cl_kernel kernel = (m_kernels == ROBUST_TILED_FUSED && j == 0) ? m_clSolverPhiKsiKernel : m_clSolverKernel;
+
+				// bind input and output buffers
+				cl_error  = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&m_d_du);
+				cl_error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&m_d_dv);
+
+				cl_error |= clSetKernelArg(kernel, 14, sizeof(cl_mem), (void*)&m_d_du_r);
+				cl_error |= clSetKernelArg(kernel, 15, sizeof(cl_mem), (void*)&m_d_dv_r);
+				V_RETURN_CL(cl_error, "Error setting kernel arguments");
+
+				V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, kernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(kernel)), "Error executing kernel!");
 
-			// swap input and output pointers (ping-ponging)
-			std::swap(m_d_du, m_d_du_r);
-			std::swap(m_d_dv, m_d_dv_r);
+				// swap input and output pointers (ping-ponging)
+				std::swap(m_d_du, m_d_du_r);
+				std::swap(m_d_dv, m_d_dv_r);
+			}
 		}
 	}
 	clFinish(m_clCommandQueue);
+	TIMING_END();
 	timer.Stop();
 	std::cout << timer.GetElapsedTime() << std::endl;
 
 	// copy data back to host
-	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_du, CL_TRUE, 0, m_data_size, du.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
-	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_dv, CL_TRUE, 0, m_data_size, dv.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
+	TIMING_BEGIN("readback");
+	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_du, CL_TRUE, 0, m_data_size, du.data_ptr(), 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_dv, CL_TRUE, 0, m_data_size, dv.data_ptr(), 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	TIMING_END();
 }
\ No newline at end of file
@@ -3,6 +3,14 @@
 #include "OpticalFlowBase.h"
 #include "Common.h"
 
+/* kernel variant of the robust solver */
+enum RobustKernels
+{
+	ROBUST_GLOBAL,		// all stencil operands from global memory
+	ROBUST_TILED,		// local memory tiles with halo (Jacobi only)
+	ROBUST_TILED_FUSED	// tiled, phi/ksi update fused into the first inner iteration (Jacobi only)
+};
+
 class GPUFlowDrivenRobust :
 	public OpticalFlowBase
 {
@@ -14,6 +22,8 @@ private:
 	cl_program m_clProgram;
 	cl_kernel m_clSolverKernel;
 	cl_kernel m_clComputePhiKsiKernel;
+	cl_kernel m_clComputeMotionTensorKernel;
+	cl_kernel m_clSolverPhiKsiKernel;	// fused phi/ksi update and first inner iteration
 
 	cl_mem m_d_Img_1;
 	cl_mem m_d_Img_2;
@@ -25,14 +35,18 @@ private:
 	cl_mem m_d_v;
 	cl_mem m_d_phi;
 	cl_mem m_d_ksi;
+	cl_mem m_d_J;		// packed motion tensor, float8 per pixel
 
 	int m_data_size;
 	int m_inner_iterations;
 	float m_e_smooth;
 	float m_e_data;
+	SolverScheme m_scheme;
+	RobustKernels m_kernels;	// ROBUST_TILED and ROBUST_TILED_FUSED require SOLVER_JACOBI, initResources fails otherwise
 public:
 	GPUFlowDrivenRobust(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, int inner_iterations, float alpha, float omega, float e_smooth, float e_data,
-		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2]);
+		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], SolverScheme scheme = SOLVER_JACOBI,
+		RobustKernels kernels = ROBUST_GLOBAL);
 	~GPUFlowDrivenRobust();
 	void computeFlow(Image& u, Image& v);
 	bool initResources(cl_context context, cl_device_id device);
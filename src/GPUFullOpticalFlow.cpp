@@ -1,20 +1,31 @@
 #include "GPUFullOpticalFlow.h"
 
+#include "CTimer.h"
+#include "Profiler.h"
+#include "Timing.h"
 #include <algorithm>
+#include <sstream>
+#include <vector>
 
 GPUFullOpticalFlow::GPUFullOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
-	cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2])
+	cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], SolverScheme scheme,
+	WarpMode warp_mode, bool half_storage, SolverStage stage, int inner_iterations, float e_smooth, float e_data, int batch_size)
 	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega),
 	m_clContext(clContext), m_clCommandQueue(clCommandQueue),
-	m_clProgram(NULL), m_clSolverKernel(NULL), m_clZeroKernel(NULL), m_clAddKernel(NULL),
+	m_clProgram(NULL), m_clSolverKernel(NULL), m_clComputeMotionTensorKernel(NULL), m_clComputePhiKsiKernel(NULL), m_clZeroKernel(NULL), m_clAddKernel(NULL),
+	m_clBackwardRegistrationKernel(NULL), m_clBackwardRegistrationImageKernel(NULL),
 	m_clReflectHorizontalBoudariesKernel(NULL), m_clReflectVerticalBoudariesKernel(NULL),
-	m_clResampleXKernel(NULL), m_clResampleYKernel(NULL),
-	m_d_src_Img1(NULL), m_d_src_Img2(NULL), m_d_Img_2_br(NULL),
-	m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_du(NULL), m_d_dv(NULL), m_d_u(NULL), m_d_v(NULL),
-	m_data_size(0)
+	m_clResampleXKernel(NULL), m_clResampleYKernel(NULL), m_clResampleXFlowKernel(NULL), m_clResampleYFlowKernel(NULL),
+	m_clConvertFromFloatKernel(NULL), m_clConvertToFloatKernel(NULL),
+	m_d_src_Img1(NULL), m_d_src_Img2(NULL),
+	m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_Img_2_br(NULL), m_d_Img_2_tex(NULL), m_d_duv(NULL), m_d_duv_r(NULL), m_d_uv(NULL), m_d_J(NULL), m_d_phi(NULL), m_d_ksi(NULL), m_d_staging(NULL),
+	m_buffer_elements(0), m_element_size(0), m_data_size(0), m_flow_data_size(0), m_tensor_data_size(0), m_pitch(0), m_by(0), m_scheme(scheme), m_warp_mode(warp_mode), m_half_storage(half_storage), m_map_transfers(false),
+	m_stage(stage), m_inner_iterations(std::max(inner_iterations, 1)), m_e_smooth(e_smooth), m_e_data(e_data),
+	m_batch_size(std::max(batch_size, 1)), m_active_pairs(1), m_readback(true)
 {
 	m_localWorkSize[0] = localWorkSize[0];
 	m_localWorkSize[1] = localWorkSize[1];
+	m_localWorkSize[2] = 1;
 }
 
 GPUFullOpticalFlow::~GPUFullOpticalFlow()
@@ -27,22 +38,71 @@ bool GPUFullOpticalFlow::initResources(cl_context context, cl_device_id device)
 	char * program_code;
 	size_t program_size;
 	
-	LoadProgram("./src/kernels/FullGPUSolver.cl", &program_code, &program_size);
+	// the image object holds one 2nd image, batches warp from the buffers
+	if (m_batch_size > 1 && m_warp_mode != WARP_BUFFER) {
+		std::cout << "Batched solve uses buffer warping" << std::endl;
+		m_warp_mode = WARP_BUFFER;
+	}
+
+	// sampling from an image object needs image support, fall back to the buffer path otherwise
+	if (m_warp_mode != WARP_BUFFER) {
+		cl_bool image_support = CL_FALSE;
+		V_RETURN_FALSE_CL(clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof(cl_bool), &image_support, NULL), "Error querying device info");
+		if (!image_support) {
+			std::cout << "Device has no image support, using buffer warping" << std::endl;
+			m_warp_mode = WARP_BUFFER;
+		}
+	}
+
+	// on integrated GPUs and CPU devices the buffers used for host transfers are allocated in host memory and mapped
+	cl_bool unified_memory = CL_FALSE;
+	V_RETURN_FALSE_CL(clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified_memory, NULL), "Error querying device info");
+	m_map_transfers = (unified_memory == CL_TRUE);
+	cl_mem_flags transfer_flags = m_map_transfers ? CL_MEM_ALLOC_HOST_PTR : 0;
+
+	LoadProgram(KernelPath("FullGPUSolver.cl").c_str(), &program_code, &program_size);
 
 	// create a program object
 	m_clProgram = clCreateProgramWithSource(context, 1, (const char**)&program_code, &program_size, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create program from file.");
 
-	// buid program
-	cl_error = clBuildProgram(m_clProgram, 1, &device, NULL, NULL, NULL);
+	// create device resources
+	int bx = 1;
+	int by = 1;
+	// temporal image to get right image sizes
+	Image img(m_source_img_1.width(), m_source_img_1.height(), bx, by);
+	int height = img.height();
+	int pitch = img.pitch();
+	m_buffer_elements = pitch * (height + 2 * by);
+
+	// buid program, the pairs of a batch are BATCH_STRIDE pixels apart in every buffer,
+	// the kernel directory is the include path of SolverCommon.cl
+	std::ostringstream compileOptions;
+	compileOptions << KernelIncludeOption() << " -D TILE_SIZE_X=" << (int)m_localWorkSize[0] << " -D TILE_SIZE_Y=" << (int)m_localWorkSize[1]
+				   << " -D BATCH_STRIDE=" << m_buffer_elements << (m_half_storage ? " -D HALF_STORAGE" : "");
+
+	cl_error = clBuildProgram(m_clProgram, 1, &device, compileOptions.str().c_str(), NULL, NULL);
 	if (cl_error != CL_SUCCESS)
 	{
 		PrintBuildLog(m_clProgram, device);
 		return false;
 	}
 
-	// create kernels
-	m_clSolverKernel = clCreateKernel(m_clProgram, "Solver", &cl_error);
+	// create kernels, all solver stages share the arguments 0 - 12
+	const char* solverKernelNames[3][2] = {
+		{ "Solver",			"SolverRedBlack" },
+		{ "SolverTiled",	"SolverTiledRedBlack" },
+		{ "SolverRobust",	"SolverRobustRedBlack" }
+	};
+	m_clSolverKernel = clCreateKernel(m_clProgram, solverKernelNames[m_stage][m_scheme == SOLVER_RED_BLACK], &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+
+	if (m_stage == STAGE_ROBUST) {
+		m_clComputePhiKsiKernel = clCreateKernel(m_clProgram, "ComputePhiKsi", &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+	}
+
+	m_clComputeMotionTensorKernel = clCreateKernel(m_clProgram, "ComputeMotionTensor", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
 	m_clZeroKernel = clCreateKernel(m_clProgram, "Zero", &cl_error);
@@ -54,6 +114,11 @@ bool GPUFullOpticalFlow::initResources(cl_context context, cl_device_id device)
 	m_clBackwardRegistrationKernel = clCreateKernel(m_clProgram, "BackwardRegistration", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
+	if (m_warp_mode != WARP_BUFFER) {
+		m_clBackwardRegistrationImageKernel = clCreateKernel(m_clProgram, "BackwardRegistrationImage", &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+	}
+
 	m_clReflectHorizontalBoudariesKernel = clCreateKernel(m_clProgram, "ReflectHorizontalBoudaries", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");	
 	
@@ -66,60 +131,148 @@ bool GPUFullOpticalFlow::initResources(cl_context context, cl_device_id device)
 	m_clResampleYKernel = clCreateKernel(m_clProgram, "ResampleY", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
-	// create device resources
-	int bx = 1;
-	int by = 1;
-	// temporal image to get right image sizes
-	Image img(m_source_img_1.width(), m_source_img_1.height(), bx, by);
-	int height = img.height();
-	int pitch = img.pitch();
-	m_data_size = pitch * (height + 2 * by) * sizeof(cl_float);
+	m_clResampleXFlowKernel = clCreateKernel(m_clProgram, "ResampleXFlow", &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+
+	m_clResampleYFlowKernel = clCreateKernel(m_clProgram, "ResampleYFlow", &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
-	m_d_src_Img1 = clCreateBuffer(context, CL_MEM_READ_ONLY, m_data_size, NULL, &cl_error);
+	if (m_half_storage) {
+		m_clConvertFromFloatKernel = clCreateKernel(m_clProgram, "ConvertFromFloat", &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+
+		m_clConvertToFloatKernel = clCreateKernel(m_clProgram, "ConvertToFloat", &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+	}
+
+	// buffers hold m_batch_size pairs, the sizes below are per pair
+	m_element_size = m_half_storage ? sizeof(cl_half) : sizeof(cl_float);
+	m_data_size = m_buffer_elements * m_element_size;
+	m_flow_data_size = 2 * m_buffer_elements * m_element_size;
+	m_tensor_data_size = 8 * m_buffer_elements * m_element_size;
+	m_pitch = pitch;
+	m_by = by;
+
+	// the batch must fit the device: all buffers in global memory, the largest one (motion tensor) in one allocation
+	size_t pair_footprint = (size_t)((m_stage == STAGE_ROBUST) ? 7 : 5) * m_data_size + (size_t)((m_scheme == SOLVER_JACOBI) ? 3 : 2) * m_flow_data_size + m_tensor_data_size;
+	size_t footprint = m_batch_size * pair_footprint + ((m_warp_mode != WARP_BUFFER) ? m_data_size : 0) + (m_half_storage ? 2 * m_buffer_elements * sizeof(cl_float) : 0);
+	std::cout << "Device memory: " << footprint / (1024.0 * 1024.0) << " MB" << (m_half_storage ? " (half storage)" : "") << (m_map_transfers ? " (mapped transfers)" : "");
+	if (m_batch_size > 1) {
+		std::cout << " (batch of " << m_batch_size << " pairs, " << pair_footprint / (1024.0 * 1024.0) << " MB per pair)";
+	}
+	std::cout << std::endl;
+
+	cl_ulong global_mem_size = 0;
+	cl_ulong max_alloc_size = 0;
+	V_RETURN_FALSE_CL(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &global_mem_size, NULL), "Unable to query device memory size.");
+	V_RETURN_FALSE_CL(clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &max_alloc_size, NULL), "Unable to query device allocation size.");
+	if (footprint > global_mem_size || (cl_ulong)m_batch_size * m_tensor_data_size > max_alloc_size) {
+		std::cout << "Error: " << m_batch_size << " pair(s) do not fit the device memory (" << global_mem_size / (1024 * 1024) << " MB, largest allocation "
+				  << max_alloc_size / (1024 * 1024) << " MB), reduce the batch size." << std::endl;
+		return false;
+	}
+
+	m_d_src_Img1 = clCreateBuffer(context, CL_MEM_READ_WRITE | transfer_flags, m_batch_size * m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_src_Img2 = clCreateBuffer(context, CL_MEM_READ_ONLY, m_data_size, NULL, &cl_error);
+	m_d_src_Img2 = clCreateBuffer(context, CL_MEM_READ_WRITE | transfer_flags, m_batch_size * m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
 
 	
-	m_d_Img_1 = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_Img_2 = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_Img_2_br = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_u = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+	m_d_Img_1 = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_v = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+	m_d_Img_2 = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_du = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+	m_d_Img_2_br = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_dv = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+	if (m_warp_mode != WARP_BUFFER) {
+		// same layout as the buffers (pitch x rows including borders), one float per texel
+		cl_image_format format = { CL_R, (cl_channel_type)(m_half_storage ? CL_HALF_FLOAT : CL_FLOAT) };
+		m_d_Img_2_tex = clCreateImage2D(context, CL_MEM_READ_ONLY, &format, pitch, height + 2 * by, 0, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	}
+	m_d_uv = clCreateBuffer(context, CL_MEM_READ_WRITE | transfer_flags, m_batch_size * m_flow_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+	m_d_duv = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_flow_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+	m_d_J = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_tensor_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	// red-black SOR updates the increments in place, double buffers are needed only by Jacobi
+	if (m_scheme == SOLVER_JACOBI) {
+		m_d_duv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_flow_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	}
+	if (m_stage == STAGE_ROBUST) {
+		m_d_phi = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		m_d_ksi = clCreateBuffer(context, CL_MEM_READ_WRITE, m_batch_size * m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		// phi of the border pixels is read by the stencil (with zero weight), it must not hold garbage
+		zeroDeviceBuffer(m_d_phi, m_batch_size * m_buffer_elements / 2);
+		zeroDeviceBuffer(m_d_ksi, m_batch_size * m_buffer_elements / 2);
+	}
+	// host data is float, half buffers are converted on the device (largest transfer is the flow field of one pair)
+	if (m_half_storage) {
+		m_d_staging = clCreateBuffer(context, CL_MEM_READ_WRITE | transfer_flags, 2 * m_buffer_elements * sizeof(cl_float), NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	}
 
 	// bind kernel arguments (constant for all iterations)
 	/* SolverKernel */
-	cl_error |= clSetKernelArg(m_clSolverKernel, 1, sizeof(cl_mem), (void*)&m_d_Img_2_br);
+	cl_error  = clSetKernelArg(m_clSolverKernel, 0, sizeof(cl_mem), (void*)&m_d_J);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 8, sizeof(cl_float), (void*)&m_alpha);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 9, sizeof(cl_float), (void*)&m_omega);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 10, sizeof(cl_int), (void*)&bx);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 11, sizeof(cl_int), (void*)&by);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 5, sizeof(cl_float), (void*)&m_alpha);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 6, sizeof(cl_float), (void*)&m_omega);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 7, sizeof(cl_int), (void*)&bx);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 8, sizeof(cl_int), (void*)&by);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 14, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 11, sizeof(cl_int), (void*)&pitch);
+	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+
+	/* ComputePhiKsiKernel */
+	if (m_stage == STAGE_ROBUST) {
+		cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 2, sizeof(cl_mem), (void*)&m_d_phi);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 3, sizeof(cl_mem), (void*)&m_d_ksi);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 4, sizeof(cl_float), (void*)&m_e_smooth);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 7, sizeof(cl_int), (void*)&bx);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 8, sizeof(cl_int), (void*)&by);
+
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 11, sizeof(cl_int), (void*)&pitch);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 12, sizeof(cl_mem), (void*)&m_d_J);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 13, sizeof(cl_float), (void*)&m_e_data);
+
+		cl_error |= clSetKernelArg(m_clSolverKernel, 13, sizeof(cl_mem), (void*)&m_d_phi);
+		cl_error |= clSetKernelArg(m_clSolverKernel, 14, sizeof(cl_mem), (void*)&m_d_ksi);
+		V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	}
+
+	/* ComputeMotionTensorKernel */
+	cl_error  = clSetKernelArg(m_clComputeMotionTensorKernel, 1, sizeof(cl_mem), (void*)&m_d_Img_2_br);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 4, sizeof(cl_int), (void*)&bx);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 5, sizeof(cl_int), (void*)&by);
+
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 8, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 9, sizeof(cl_mem), (void*)&m_d_J);
 	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
 
 	/* BackwardRegistrationKernel */
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 6, sizeof(cl_int), (void*)&bx);
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 7, sizeof(cl_int), (void*)&by);
+	cl_error  = clSetKernelArg(m_clBackwardRegistrationKernel, 5, sizeof(cl_int), (void*)&bx);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 6, sizeof(cl_int), (void*)&by);
 	
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 10, sizeof(cl_int), (void*)&pitch);
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 11, sizeof(cl_mem), (void*)&m_d_Img_2_br);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 9, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 10, sizeof(cl_mem), (void*)&m_d_Img_2_br);
 	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
 
+	/* BackwardRegistrationImageKernel */
+	if (m_warp_mode != WARP_BUFFER) {
+		cl_error  = clSetKernelArg(m_clBackwardRegistrationImageKernel, 1, sizeof(cl_mem), (void*)&m_d_Img_2_tex);
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 5, sizeof(cl_int), (void*)&bx);
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 6, sizeof(cl_int), (void*)&by);
+
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 9, sizeof(cl_int), (void*)&pitch);
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 10, sizeof(cl_mem), (void*)&m_d_Img_2_br);
+		V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	}
+
 	/* ReflectHorizontalBoudaries and ReflectVerticalBoudaries */
 	cl_error  = clSetKernelArg(m_clReflectHorizontalBoudariesKernel, 1, sizeof(cl_int), (void*)&bx);
 	cl_error |= clSetKernelArg(m_clReflectHorizontalBoudariesKernel, 2, sizeof(cl_int), (void*)&by);
@@ -131,8 +284,10 @@ bool GPUFullOpticalFlow::initResources(cl_context context, cl_device_id device)
 	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
 
 	/* ResampleX and ResampleY */
-	cl_error  = clSetKernelArg(m_clResampleXKernel, 5, sizeof(cl_int), (void*)&pitch);
-	cl_error |= clSetKernelArg(m_clResampleYKernel, 5, sizeof(cl_int), (void*)&pitch);
+	cl_error  = clSetKernelArg(m_clResampleXKernel, 7, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clResampleYKernel, 7, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clResampleXFlowKernel, 7, sizeof(cl_int), (void*)&pitch);
+	cl_error |= clSetKernelArg(m_clResampleYFlowKernel, 7, sizeof(cl_int), (void*)&pitch);
 	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
 
 
@@ -146,25 +301,49 @@ void GPUFullOpticalFlow::releaseResources()
 	SAFE_RELEASE_MEMOBJECT(m_d_Img_1);
 	SAFE_RELEASE_MEMOBJECT(m_d_Img_2);
 	SAFE_RELEASE_MEMOBJECT(m_d_Img_2_br);
-	SAFE_RELEASE_MEMOBJECT(m_d_du);
-	SAFE_RELEASE_MEMOBJECT(m_d_dv);
-	SAFE_RELEASE_MEMOBJECT(m_d_du_r);
-	SAFE_RELEASE_MEMOBJECT(m_d_dv_r);
-	SAFE_RELEASE_MEMOBJECT(m_d_u);
-	SAFE_RELEASE_MEMOBJECT(m_d_v);
+	SAFE_RELEASE_MEMOBJECT(m_d_Img_2_tex);
+	SAFE_RELEASE_MEMOBJECT(m_d_duv);
+	SAFE_RELEASE_MEMOBJECT(m_d_duv_r);
+	SAFE_RELEASE_MEMOBJECT(m_d_uv);
+	SAFE_RELEASE_MEMOBJECT(m_d_J);
+	SAFE_RELEASE_MEMOBJECT(m_d_phi);
+	SAFE_RELEASE_MEMOBJECT(m_d_ksi);
+	SAFE_RELEASE_MEMOBJECT(m_d_staging);
+
+	for (std::map<std::pair<int, int>, ResampleTable>::iterator it = m_resample_tables.begin(); it != m_resample_tables.end(); ++it) {
+		SAFE_RELEASE_MEMOBJECT(it->second.index);
+		SAFE_RELEASE_MEMOBJECT(it->second.weights);
+	}
+	m_resample_tables.clear();
 
 	SAFE_RELEASE_KERNEL(m_clZeroKernel);
 	SAFE_RELEASE_KERNEL(m_clAddKernel);
 	SAFE_RELEASE_KERNEL(m_clSolverKernel);
+	SAFE_RELEASE_KERNEL(m_clComputeMotionTensorKernel);
+	SAFE_RELEASE_KERNEL(m_clComputePhiKsiKernel);
 	SAFE_RELEASE_KERNEL(m_clBackwardRegistrationKernel);
+	SAFE_RELEASE_KERNEL(m_clBackwardRegistrationImageKernel);
 	SAFE_RELEASE_KERNEL(m_clReflectHorizontalBoudariesKernel);
 	SAFE_RELEASE_KERNEL(m_clReflectVerticalBoudariesKernel);
 	SAFE_RELEASE_KERNEL(m_clResampleXKernel);
 	SAFE_RELEASE_KERNEL(m_clResampleYKernel);
+	SAFE_RELEASE_KERNEL(m_clResampleXFlowKernel);
+	SAFE_RELEASE_KERNEL(m_clResampleYFlowKernel);
+	SAFE_RELEASE_KERNEL(m_clConvertFromFloatKernel);
+	SAFE_RELEASE_KERNEL(m_clConvertToFloatKernel);
 	SAFE_RELEASE_PROGRAM(m_clProgram);
 }
 
 void GPUFullOpticalFlow::computeFlow(Image& u, Image& v)
+{
+	const Image* img1[1] = { &m_source_img_1 };
+	const Image* img2[1] = { &m_source_img_2 };
+	Image* u_batch[1] = { &u };
+	Image* v_batch[1] = { &v };
+	computeFlowBatch(img1, img2, u_batch, v_batch, 1);
+}
+
+void GPUFullOpticalFlow::computeFlowBatch(const Image* img1[], const Image* img2[], Image* u[], Image* v[], int count)
 {
 	int source_width;	// size in x-direction(source image resolution)
 	int source_height;	// size in y-direction(source image resolution)
@@ -179,21 +358,42 @@ void GPUFullOpticalFlow::computeFlow(Image& u, Image& v)
 	source_width = m_source_img_1.width();
 	source_height = m_source_img_1.height();
 	
-	int current_warp_level = std::min(m_warp_levels, computeMaxWarpLevels()) - 1;
+	int current_warp_level = startWarpLevel();
 
-	// initialize output flow arrays and copy source images to device
-	u.reinit(source_width, source_height, source_width, source_height, 1, 1);
-	u = m_source_img_1;
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_src_Img1, CL_FALSE, 0, m_data_size, u.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	v.reinit(source_width, source_height, source_width, source_height, 1, 1);
-	v = m_source_img_2;
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_src_Img2, CL_FALSE, 0, m_data_size, v.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
+	// the buffers are laid out for the size of the source images
+	if (count < 1 || count > m_batch_size) {
+		std::cout << "Error: batch of " << count << " pairs, buffers are allocated for " << m_batch_size << std::endl;
+		return;
+	}
+	for (int p = 0; p < count; p++) {
+		if (img1[p]->width() != source_width || img1[p]->height() != source_height ||
+			img2[p]->width() != source_width || img2[p]->height() != source_height) {
+			std::cout << "Error: image pair " << p << " of the batch differs in size from the source images" << std::endl;
+			return;
+		}
+	}
+	m_active_pairs = count;
+
+	// initialize output flow arrays and copy source images to device, pair p starts at p * m_buffer_elements
+	TIMING_BEGIN("upload");
+	for (int p = 0; p < count; p++) {
+		u[p]->reinit(source_width, source_height, source_width, source_height, 1, 1);
+		*u[p] = *img1[p];
+		writeDeviceBuffer(m_d_src_Img1, u[p]->data_ptr(), m_buffer_elements, p * m_buffer_elements);
+		v[p]->reinit(source_width, source_height, source_width, source_height, 1, 1);
+		*v[p] = *img2[p];
+		writeDeviceBuffer(m_d_src_Img2, v[p]->data_ptr(), m_buffer_elements, p * m_buffer_elements);
+	}
 
 	prev_width = 0;
 	prev_height = 0;
 	clFinish(m_clCommandQueue);
+	TIMING_END();
 
 	while (current_warp_level >= 0) {
+		Profiler::setLevel(current_warp_level);
+		TIMING_LEVEL(current_warp_level);
+
 		// compute level sizes
 		level_width = static_cast<int>(ceil(source_width * pow(m_warp_scale, current_warp_level)));
 		level_height = static_cast<int>(ceil(source_height * pow(m_warp_scale, current_warp_level)));
@@ -207,54 +407,76 @@ void GPUFullOpticalFlow::computeFlow(Image& u, Image& v)
 		// dst			: out
 		// m_d_Img_2_br : temporary buffer
 		// image resampling
+		TIMING_BEGIN("pyramid");
+		bool resampled = true;
 		if (current_warp_level == 0) {
 			std::swap(m_d_Img_1, m_d_src_Img1);
 			std::swap(m_d_Img_2, m_d_src_Img2);
 		} else {
-			resampleAreaBased(m_d_src_Img1, m_d_Img_1, source_width, source_height, level_width, level_height);
-			resampleAreaBased(m_d_src_Img2, m_d_Img_2, source_width, source_height, level_width, level_height);
+			resampled = resampleAreaBased(m_d_src_Img1, m_d_Img_1, source_width, source_height, level_width, level_height) &&
+						resampleAreaBased(m_d_src_Img2, m_d_Img_2, source_width, source_height, level_width, level_height);
 		}
 
 		// displacement field resampling
-		if (prev_width == 0) {
+		if (prev_width == 0 && warmStart() && m_active_pairs == 1) {
+			// first iteration of a warm start (single pair), initial flow restricted to the level
+			writeInitialFlow();
+			if (level_width != source_width || level_height != source_height) {
+				resampled = resampled && resampleFlow(source_width, source_height, level_width, level_height);
+			}
+		} else if (prev_width == 0) {
 			// first iteration, initialize with zeros
-			zeroDeviceBuffer(m_d_u);
-			zeroDeviceBuffer(m_d_v);
+			zeroDeviceBuffer(m_d_uv, m_active_pairs * m_buffer_elements);
 		} else {
-			resampleAreaBased(m_d_u, m_d_du, prev_width, prev_height, level_width, level_height);
-			resampleAreaBased(m_d_v, m_d_dv, prev_width, prev_height, level_width, level_height);
-			std::swap(m_d_u, m_d_du);
-			std::swap(m_d_v, m_d_dv);
+			resampled = resampled && resampleFlow(prev_width, prev_height, level_width, level_height);
+		}
+		TIMING_FENCE(m_clCommandQueue);
+		TIMING_END();
+		if (!resampled) {
+			std::cout << "Error: resampling to level " << current_warp_level << " failed" << std::endl;
+			return;
 		}
 
 		// perform backward registration
 		// m_d_Img_1	: in
 		// m_d_Img_2	: in
-		// m_d_u		: in
-		// m_d_v		: in
+		// m_d_uv		: in
 		// m_d_Img_2_br	: out
+		TIMING_BEGIN("warp");
 		backwardRegistration(hx, hy, level_width, level_height);
 	
 		// reflect bouundaries
 		// m_d_Img_1	: in:out
 		// m_d_Img_2_br	: in:out
 		reflectBoudaries(level_width, level_height);
+		TIMING_FENCE(m_clCommandQueue);
+		TIMING_END();
 
-		// solve difference problem at current resolution to obtain increment
+		// compute motion tensor once for all solver iterations
 		// m_d_Img_1	: in
 		// m_d_Img_2_br	: in
-		// m_d_u		: in
-		// m_d_v		: in
-		// m_d_du		: in:out
-		// m_d_dv		: in:out
+		// m_d_J		: out
+		TIMING_BEGIN("tensor");
+		computeMotionTensor(hx, hy, level_width, level_height);
+		TIMING_FENCE(m_clCommandQueue);
+		TIMING_END();
+
+		// solve difference problem at current resolution to obtain increment
+		// m_d_J		: in
+		// m_d_uv		: in
+		// m_d_duv		: in:out
+		TIMING_BEGIN("solve");
 		solveDifference(hx, hy, level_width, level_height);
+		TIMING_FENCE(m_clCommandQueue);
+		TIMING_END();
 
 		// add solved increment to the global flow
-		// m_d_u		: in:out
-		// m_d_v		: in:out
-		// m_d_du		: in
-		// m_d_dv		: in
+		// m_d_uv		: in:out
+		// m_d_duv		: in
+		TIMING_BEGIN("add");
 		addFlowIncrement();
+		TIMING_FENCE(m_clCommandQueue);
+		TIMING_END();
 		//u += du;
 		//v += dv;
 
@@ -263,55 +485,148 @@ void GPUFullOpticalFlow::computeFlow(Image& u, Image& v)
 		prev_height = level_height;
 		current_warp_level--;
 	}
-	// copy data back to host
-	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_u, CL_TRUE, 0, m_data_size, u.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
-	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_v, CL_TRUE, 0, m_data_size, v.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
+	if (!m_readback) {
+		return;
+	}
+	// copy data back to host and split the interleaved flow into u and v
+	TIMING_BEGIN("readback");
+	float* uv = new float[2 * m_buffer_elements];
+	for (int p = 0; p < count; p++) {
+		readDeviceBuffer(m_d_uv, uv, 2 * m_buffer_elements, 2 * p * m_buffer_elements);
+
+		float* u_data = u[p]->data_ptr();
+		float* v_data = v[p]->data_ptr();
+		for (int i = 0; i < m_buffer_elements; ++i) {
+			u_data[i] = uv[2 * i];
+			v_data[i] = uv[2 * i + 1];
+		}
+	}
+	delete[] uv;
+	TIMING_END();
+}
+
+void GPUFullOpticalFlow::setReadback(bool readback)
+{
+	m_readback = readback;
+}
+
+DeviceFlow GPUFullOpticalFlow::deviceFlow(int pair) const
+{
+	DeviceFlow flow;
+	flow.u = m_d_uv;
+	flow.v = m_d_uv;
+	flow.offset = 2 * pair * m_buffer_elements;
+	flow.stride = 2;
+	flow.v_offset = 1;
+	flow.bx = 1;
+	flow.by = m_by;
+	flow.width = m_source_img_1.actual_width();
+	flow.height = m_source_img_1.actual_height();
+	flow.pitch = m_pitch;
+	flow.half_storage = m_half_storage;
+	return flow;
+}
+
+void GPUFullOpticalFlow::computeMotionTensor(float hx, float hy, int width, int height)
+{
+	cl_int cl_error;
+	cl_error  = clSetKernelArg(m_clComputeMotionTensorKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 2, sizeof(cl_float), (void*)&hx);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 3, sizeof(cl_float), (void*)&hy);
+
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 6, sizeof(cl_int), (void*)&width);
+	cl_error |= clSetKernelArg(m_clComputeMotionTensorKernel, 7, sizeof(cl_int), (void*)&height);
+	V_RETURN_CL(cl_error, "Error setting kernel arguments");
+
+	size_t globalWorkSize[3] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[1]), (size_t)m_active_pairs };
+
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clComputeMotionTensorKernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clComputeMotionTensorKernel)), "Error executing kernel!");
+
+	clFinish(m_clCommandQueue);
 }
 
 void GPUFullOpticalFlow::solveDifference(float hx, float hy, int width, int height)
 {
-	// we run Zero kernel to initialize du, dv, du_r and dv_r with zeros
-	size_t globalWorkSizeZeroKernel = m_data_size / sizeof(float);
-	zeroDeviceBuffer(m_d_du);
-	zeroDeviceBuffer(m_d_dv);
-	zeroDeviceBuffer(m_d_du_r);
-	zeroDeviceBuffer(m_d_dv_r);
+	// we run Zero kernel to initialize duv and duv_r with zeros
+	zeroDeviceBuffer(m_d_duv, m_active_pairs * m_buffer_elements);
+	if (m_scheme == SOLVER_JACOBI) {
+		zeroDeviceBuffer(m_d_duv_r, m_active_pairs * m_buffer_elements);
+	}
 
 	// wait until all data are initialized
 	clFinish(m_clCommandQueue);
 
 	// bind kernel arguments (varying during warp levels iterations)
 	cl_int cl_error;
-	cl_error  = clSetKernelArg(m_clSolverKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
-
-	cl_error |= clSetKernelArg(m_clSolverKernel, 4, sizeof(cl_mem), (void*)&m_d_u);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 5, sizeof(cl_mem), (void*)&m_d_v);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 6, sizeof(cl_float), (void*)&hx);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 7, sizeof(cl_float), (void*)&hy);
+	cl_error  = clSetKernelArg(m_clSolverKernel, 2, sizeof(cl_mem), (void*)&m_d_uv);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 3, sizeof(cl_float), (void*)&hx);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 4, sizeof(cl_float), (void*)&hy);
 
-	cl_error |= clSetKernelArg(m_clSolverKernel, 12, sizeof(cl_int), (void*)&width);
-	cl_error |= clSetKernelArg(m_clSolverKernel, 13, sizeof(cl_int), (void*)&height);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 9, sizeof(cl_int), (void*)&width);
+	cl_error |= clSetKernelArg(m_clSolverKernel, 10, sizeof(cl_int), (void*)&height);
 	V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-	size_t globalWorkSize[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[0]) };
+	size_t globalWorkSize[3] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[1]), (size_t)m_active_pairs };
 
-	// run kernel many times	
-	for (int i = 0; i < m_solver_iterations; i++) {
-		// bind input and output buffers
-		cl_error  = clSetKernelArg(m_clSolverKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
-		cl_error |= clSetKernelArg(m_clSolverKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
+	// the robust stage iterates the lagged nonlinearity (outer) around the linear solver (inner)
+	int outer_iterations = (m_stage == STAGE_ROBUST) ? solverIterations() : 1;
+	int inner_iterations = (m_stage == STAGE_ROBUST) ? m_inner_iterations : solverIterations();
 
-		cl_error |= clSetKernelArg(m_clSolverKernel, 15, sizeof(cl_mem), (void*)&m_d_du_r);
-		cl_error |= clSetKernelArg(m_clSolverKernel, 16, sizeof(cl_mem), (void*)&m_d_dv_r);
+	if (m_stage == STAGE_ROBUST) {
+		cl_error  = clSetKernelArg(m_clComputePhiKsiKernel, 0, sizeof(cl_mem), (void*)&m_d_uv);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 5, sizeof(cl_float), (void*)&hx);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 6, sizeof(cl_float), (void*)&hy);
+
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 9, sizeof(cl_int), (void*)&width);
+		cl_error |= clSetKernelArg(m_clComputePhiKsiKernel, 10, sizeof(cl_int), (void*)&height);
 		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+	}
+
+	TIMING_COUNT("pixel updates", (double)width * height * outer_iterations * inner_iterations * m_active_pairs);
 
-		V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clSolverKernel , 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, NULL), "Error executing kernel!");
+	CTimer timer;
+	timer.Start();
 
-		// swap input and output pointers (ping-ponging)
-		std::swap(m_d_du, m_d_du_r);
-		std::swap(m_d_dv, m_d_dv_r);
+	// run kernel many times	
+	for (int k = 0; k < outer_iterations; k++) {
+		if (m_stage == STAGE_ROBUST) {
+			// precompute weight values for flow-driven smoothness and robust data term
+			V_RETURN_CL(clSetKernelArg(m_clComputePhiKsiKernel, 1, sizeof(cl_mem), (void*)&m_d_duv), "Error setting kernel arguments");
+			V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clComputePhiKsiKernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clComputePhiKsiKernel)), "Error executing kernel!");
+		}
+
+		if (m_scheme == SOLVER_RED_BLACK) {
+			// increments are updated in place
+			V_RETURN_CL(clSetKernelArg(m_clSolverKernel, 1, sizeof(cl_mem), (void*)&m_d_duv), "Error setting kernel arguments");
+
+			for (int i = 0; i < inner_iterations; i++) {
+				// red pixels first, then black pixels using the updated red ones
+				for (int color = 0; color < 2; color++) {
+					V_RETURN_CL(clSetKernelArg(m_clSolverKernel, 12, sizeof(cl_int), (void*)&color), "Error setting kernel arguments");
+					V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clSolverKernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clSolverKernel)), "Error executing kernel!");
+				}
+			}
+		} else {
+			for (int i = 0; i < inner_iterations; i++) {
+				// bind input and output buffers
+				cl_error  = clSetKernelArg(m_clSolverKernel, 1, sizeof(cl_mem), (void*)&m_d_duv);
+				cl_error |= clSetKernelArg(m_clSolverKernel, 12, sizeof(cl_mem), (void*)&m_d_duv_r);
+				V_RETURN_CL(cl_error, "Error setting kernel arguments");
+
+				V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clSolverKernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clSolverKernel)), "Error executing kernel!");
+
+				// swap input and output pointers (ping-ponging)
+				std::swap(m_d_duv, m_d_duv_r);
+			}
+		}
 	}
 	clFinish(m_clCommandQueue);
+	timer.Stop();
+
+	// effective bandwidth: every iteration reads J, uv, duv (robust: phi, ksi) and writes duv once per pixel
+	int values_per_pixel = 8 + 3 * 2 + ((m_stage == STAGE_ROBUST) ? 2 : 0);
+	double bytes = (double)outer_iterations * inner_iterations * width * height * values_per_pixel * m_element_size * m_active_pairs;
+	std::cout << "  solver: " << timer.GetElapsedTime() << " s, " << bytes / timer.GetElapsedTime() * 1e-9 << " GB/s" << std::endl;
 }
 
 void GPUFullOpticalFlow::backwardRegistration(float hx, float hy, int width, int height)
@@ -330,34 +645,90 @@ void GPUFullOpticalFlow::backwardRegistration(float hx, float hy, int width, int
 	V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
 
-	size_t globalWorkSize1D = GetGlobalWorkSize(width, m_localWorkSize[0]);
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectHorizontalBoudariesKernel, 1, NULL, &globalWorkSize1D, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
-	globalWorkSize1D = GetGlobalWorkSize(height, m_localWorkSize[0]);
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectVerticalBoudariesKernel, 1, NULL, &globalWorkSize1D, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
+	// one line of work-items per pair
+	size_t localWorkSizeLine[2] = { m_localWorkSize[0], 1 };
+	size_t globalWorkSizeLine[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), (size_t)m_active_pairs };
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectHorizontalBoudariesKernel, 2, NULL, globalWorkSizeLine, localWorkSizeLine, 0, NULL, Profiler::event(m_clReflectHorizontalBoudariesKernel)), "Error executing kernel!");
+	globalWorkSizeLine[0] = GetGlobalWorkSize(height, m_localWorkSize[0]);
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectVerticalBoudariesKernel, 2, NULL, globalWorkSizeLine, localWorkSizeLine, 0, NULL, Profiler::event(m_clReflectVerticalBoudariesKernel)), "Error executing kernel!");
    
+	size_t globalWorkSize[3] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[1]), (size_t)m_active_pairs };
+	CTimer timer;
+
+	if (m_warp_mode != WARP_BUFFER) {
+		// copy the reflected img_2 into the image object (rows of the current level only)
+		size_t origin[3] = { 0, 0, 0 };
+		size_t region[3] = { (size_t)m_pitch, (size_t)(height + 2 * m_by), 1 };
+		V_RETURN_CL(clEnqueueCopyBufferToImage(m_clCommandQueue, m_d_Img_2, m_d_Img_2_tex, 0, origin, region, 0, NULL, Profiler::event("CopyBufferToImage")), "Error copying buffer to image!");
+		clFinish(m_clCommandQueue);
+
+		// run backward registration kernel with hardware filtering
+		cl_error  = clSetKernelArg(m_clBackwardRegistrationImageKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 2, sizeof(cl_mem), (void*)&m_d_uv);
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 3, sizeof(cl_float), (void*)&hx);
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 4, sizeof(cl_float), (void*)&hy);
+
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 7, sizeof(cl_int), (void*)&width);
+		cl_error |= clSetKernelArg(m_clBackwardRegistrationImageKernel, 8, sizeof(cl_int), (void*)&height);
+		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+
+		timer.Start();
+		V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clBackwardRegistrationImageKernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clBackwardRegistrationImageKernel)), "Error executing kernel!");
+		clFinish(m_clCommandQueue);
+		timer.Stop();
+
+		if (m_warp_mode == WARP_IMAGE) {
+			std::cout << "  warp (image): " << timer.GetElapsedTime() << std::endl;
+			return;
+		}
+		std::cout << "  warp (image): " << timer.GetElapsedTime() << "\t ";
+	}
+
 	// run backward registration kernel
+	// in compare mode the result goes to m_d_duv, which is free until the solver zeroes it
+	cl_mem d_img_2_br = (m_warp_mode == WARP_COMPARE) ? m_d_duv : m_d_Img_2_br;
 	cl_error  = clSetKernelArg(m_clBackwardRegistrationKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
 	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 1, sizeof(cl_mem), (void*)&m_d_Img_2);
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 2, sizeof(cl_mem), (void*)&m_d_u);
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 3, sizeof(cl_mem), (void*)&m_d_v);
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 4, sizeof(cl_float), (void*)&hx);
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 5, sizeof(cl_float), (void*)&hy);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 2, sizeof(cl_mem), (void*)&m_d_uv);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 3, sizeof(cl_float), (void*)&hx);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 4, sizeof(cl_float), (void*)&hy);
 
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 8, sizeof(cl_int), (void*)&width);
-	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 9, sizeof(cl_int), (void*)&height);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 7, sizeof(cl_int), (void*)&width);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 8, sizeof(cl_int), (void*)&height);
+	cl_error |= clSetKernelArg(m_clBackwardRegistrationKernel, 10, sizeof(cl_mem), (void*)&d_img_2_br);
 	V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-	size_t globalWorkSize[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[0]) };
-
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clBackwardRegistrationKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, NULL), "Error executing kernel!");
-	
+	timer.Start();
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clBackwardRegistrationKernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clBackwardRegistrationKernel)), "Error executing kernel!");
 	clFinish(m_clCommandQueue);
+	timer.Stop();
+
+	if (m_warp_mode == WARP_BUFFER) {
+		return;
+	}
+	std::cout << "warp (buffer): " << timer.GetElapsedTime() << "\t ";
+
+	// precision check of the hardware filtered result against the buffer kernel (same borders as in initResources)
+	Image img_2_br_image(m_source_img_1.width(), m_source_img_1.height(), 1, 1);
+	Image img_2_br_buffer(m_source_img_1.width(), m_source_img_1.height(), 1, 1);
+	readDeviceBuffer(m_d_Img_2_br, img_2_br_image.data_ptr(), m_buffer_elements);
+	readDeviceBuffer(m_d_duv, img_2_br_buffer.data_ptr(), m_buffer_elements);
+
+	float max_diff = 0.f;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			max_diff = std::max(max_diff, std::fabs(img_2_br_image.pixel_r(x, y) - img_2_br_buffer.pixel_r(x, y)));
+		}
+	}
+	std::cout << "max. difference: " << max_diff << std::endl;
 }
 
 void GPUFullOpticalFlow::reflectBoudaries(int width, int height)
 {
 	cl_int cl_error;
-	size_t globalWorkSize1D;
+	// one line of work-items per pair
+	size_t localWorkSizeLine[2] = { m_localWorkSize[0], 1 };
+	size_t globalWorkSizeLine[2] = { 0, (size_t)m_active_pairs };
 
 	cl_error  = clSetKernelArg(m_clReflectHorizontalBoudariesKernel, 3, sizeof(cl_int), (void*)&width);
 	cl_error |= clSetKernelArg(m_clReflectHorizontalBoudariesKernel, 4, sizeof(cl_int), (void*)&height);
@@ -369,17 +740,17 @@ void GPUFullOpticalFlow::reflectBoudaries(int width, int height)
 	V_RETURN_CL(clSetKernelArg(m_clReflectHorizontalBoudariesKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1), "Error setting kernel arguments");
 	V_RETURN_CL(clSetKernelArg(m_clReflectVerticalBoudariesKernel,   0, sizeof(cl_mem), (void*)&m_d_Img_1), "Error setting kernel arguments");
 
-	globalWorkSize1D = GetGlobalWorkSize(width, m_localWorkSize[0]);
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectHorizontalBoudariesKernel, 1, NULL, &globalWorkSize1D, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
-	globalWorkSize1D = GetGlobalWorkSize(height, m_localWorkSize[0]);
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectVerticalBoudariesKernel,   1, NULL, &globalWorkSize1D, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
+	globalWorkSizeLine[0] = GetGlobalWorkSize(width, m_localWorkSize[0]);
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectHorizontalBoudariesKernel, 2, NULL, globalWorkSizeLine, localWorkSizeLine, 0, NULL, Profiler::event(m_clReflectHorizontalBoudariesKernel)), "Error executing kernel!");
+	globalWorkSizeLine[0] = GetGlobalWorkSize(height, m_localWorkSize[0]);
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectVerticalBoudariesKernel,   2, NULL, globalWorkSizeLine, localWorkSizeLine, 0, NULL, Profiler::event(m_clReflectVerticalBoudariesKernel)), "Error executing kernel!");
 
 	V_RETURN_CL(clSetKernelArg(m_clReflectHorizontalBoudariesKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_2_br), "Error setting kernel arguments");
 	V_RETURN_CL(clSetKernelArg(m_clReflectVerticalBoudariesKernel,   0, sizeof(cl_mem), (void*)&m_d_Img_2_br), "Error setting kernel arguments");
-	globalWorkSize1D = GetGlobalWorkSize(width, m_localWorkSize[0]);
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectHorizontalBoudariesKernel, 1, NULL, &globalWorkSize1D, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
-	globalWorkSize1D = GetGlobalWorkSize(height, m_localWorkSize[0]);
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectVerticalBoudariesKernel,   1, NULL, &globalWorkSize1D, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
+	globalWorkSizeLine[0] = GetGlobalWorkSize(width, m_localWorkSize[0]);
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectHorizontalBoudariesKernel, 2, NULL, globalWorkSizeLine, localWorkSizeLine, 0, NULL, Profiler::event(m_clReflectHorizontalBoudariesKernel)), "Error executing kernel!");
+	globalWorkSizeLine[0] = GetGlobalWorkSize(height, m_localWorkSize[0]);
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clReflectVerticalBoudariesKernel,   2, NULL, globalWorkSizeLine, localWorkSizeLine, 0, NULL, Profiler::event(m_clReflectVerticalBoudariesKernel)), "Error executing kernel!");
 
 	clFinish(m_clCommandQueue);
 }
@@ -387,69 +758,195 @@ void GPUFullOpticalFlow::reflectBoudaries(int width, int height)
 void GPUFullOpticalFlow::addFlowIncrement()
 {
 	cl_int cl_error;
-	size_t globalWorkSizeAddKernel = m_data_size / sizeof(float) / 4;
+	size_t globalWorkSizeAddKernel = 2 * m_active_pairs * m_buffer_elements / 4;
 	
-	// u += du
-	cl_error  = clSetKernelArg(m_clAddKernel, 0, sizeof(cl_mem), (void*)&m_d_u);
-	cl_error |= clSetKernelArg(m_clAddKernel, 1, sizeof(cl_mem), (void*)&m_d_du);
-	V_RETURN_CL(cl_error, "Error setting kernel arguments");
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clAddKernel, 1, NULL, &globalWorkSizeAddKernel, NULL, 0, NULL, NULL), "Error executing kernel!");
-
-	// v += dv
-	cl_error  = clSetKernelArg(m_clAddKernel, 0, sizeof(cl_mem), (void*)&m_d_v);
-	cl_error |= clSetKernelArg(m_clAddKernel, 1, sizeof(cl_mem), (void*)&m_d_dv);
+	// (u, v) += (du, dv), both components in one launch
+	cl_error  = clSetKernelArg(m_clAddKernel, 0, sizeof(cl_mem), (void*)&m_d_uv);
+	cl_error |= clSetKernelArg(m_clAddKernel, 1, sizeof(cl_mem), (void*)&m_d_duv);
 	V_RETURN_CL(cl_error, "Error setting kernel arguments");
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clAddKernel, 1, NULL, &globalWorkSizeAddKernel, NULL, 0, NULL, NULL), "Error executing kernel!");
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clAddKernel, 1, NULL, &globalWorkSizeAddKernel, NULL, 0, NULL, Profiler::event(m_clAddKernel)), "Error executing kernel!");
 
 	clFinish(m_clCommandQueue);
 }
 
-void GPUFullOpticalFlow::resample_x(cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width, int dst_height)
+bool GPUFullOpticalFlow::getResampleTable(int src_size, int dst_size, ResampleTable& table)
 {
+	std::pair<int, int> key(src_size, dst_size);
+	std::map<std::pair<int, int>, ResampleTable>::iterator it = m_resample_tables.find(key);
+	if (it != m_resample_tables.end()) {
+		table = it->second;
+		return true;
+	}
+
+	vector<cl_int> index;
+	vector<float> weights;
+	int taps;
+	BuildResampleTable(src_size, dst_size, index, weights, taps);
+
+	// only complete tables are cached, a failed size is retried by the next resampling
 	cl_int cl_error;
-	size_t globalWorkSize = GetGlobalWorkSize(src_height, m_localWorkSize[0]);
+	table.taps = taps;
+	table.index = clCreateBuffer(m_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, index.size() * sizeof(cl_int), &index[0], &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating resample table");
+	table.weights = clCreateBuffer(m_clContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, weights.size() * sizeof(float), &weights[0], &cl_error);
+	if (cl_error != CL_SUCCESS) {
+		SAFE_RELEASE_MEMOBJECT(table.index);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating resample table");
+	}
 
-	cl_error  = clSetKernelArg(m_clResampleXKernel, 0, sizeof(cl_mem), (void*)&src);
-	cl_error |= clSetKernelArg(m_clResampleXKernel, 1, sizeof(cl_mem), (void*)&dst);
-	cl_error |= clSetKernelArg(m_clResampleXKernel, 2, sizeof(cl_int), (void*)&src_height);
-	cl_error |= clSetKernelArg(m_clResampleXKernel, 3, sizeof(cl_int), (void*)&src_width);
-	cl_error |= clSetKernelArg(m_clResampleXKernel, 4, sizeof(cl_int), (void*)&dst_width);
-	V_RETURN_CL(cl_error, "Error setting kernel arguments");
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clResampleXKernel, 1, NULL, &globalWorkSize, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
+	m_resample_tables[key] = table;
+	return true;
+}
+
+bool GPUFullOpticalFlow::resample_x(cl_kernel kernel, cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width)
+{
+	cl_int cl_error;
+	ResampleTable table;
+	if (!getResampleTable(src_width, dst_width, table)) {
+		return false;
+	}
+	size_t globalWorkSize[3] = { GetGlobalWorkSize(dst_width, m_localWorkSize[0]), GetGlobalWorkSize(src_height, m_localWorkSize[1]), (size_t)m_active_pairs };
+
+	cl_error  = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&src);
+	cl_error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&dst);
+	cl_error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&table.index);
+	cl_error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&table.weights);
+	cl_error |= clSetKernelArg(kernel, 4, sizeof(cl_int), (void*)&table.taps);
+	cl_error |= clSetKernelArg(kernel, 5, sizeof(cl_int), (void*)&dst_width);
+	cl_error |= clSetKernelArg(kernel, 6, sizeof(cl_int), (void*)&src_height);
+	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	V_RETURN_FALSE_CL(clEnqueueNDRangeKernel(m_clCommandQueue, kernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(kernel)), "Error executing kernel!");
+	return true;
 }
 
-void GPUFullOpticalFlow::resample_y(cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width, int dst_height)
+bool GPUFullOpticalFlow::resample_y(cl_kernel kernel, cl_mem src, cl_mem dst, int src_width, int src_height, int dst_height)
 {
 	cl_int cl_error;
-	size_t globalWorkSize = GetGlobalWorkSize(src_width, m_localWorkSize[0]);
+	ResampleTable table;
+	if (!getResampleTable(src_height, dst_height, table)) {
+		return false;
+	}
+	size_t globalWorkSize[3] = { GetGlobalWorkSize(src_width, m_localWorkSize[0]), GetGlobalWorkSize(dst_height, m_localWorkSize[1]), (size_t)m_active_pairs };
+
+	cl_error  = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&src);
+	cl_error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&dst);
+	cl_error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&table.index);
+	cl_error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&table.weights);
+	cl_error |= clSetKernelArg(kernel, 4, sizeof(cl_int), (void*)&table.taps);
+	cl_error |= clSetKernelArg(kernel, 5, sizeof(cl_int), (void*)&src_width);
+	cl_error |= clSetKernelArg(kernel, 6, sizeof(cl_int), (void*)&dst_height);
+	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	V_RETURN_FALSE_CL(clEnqueueNDRangeKernel(m_clCommandQueue, kernel, 3, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(kernel)), "Error executing kernel!");
+	return true;
+}
 
-	cl_error  = clSetKernelArg(m_clResampleYKernel, 0, sizeof(cl_mem), (void*)&src);
-	cl_error |= clSetKernelArg(m_clResampleYKernel, 1, sizeof(cl_mem), (void*)&dst);
-	cl_error |= clSetKernelArg(m_clResampleYKernel, 2, sizeof(cl_int), (void*)&src_width);
-	cl_error |= clSetKernelArg(m_clResampleYKernel, 3, sizeof(cl_int), (void*)&src_height);
-	cl_error |= clSetKernelArg(m_clResampleYKernel, 4, sizeof(cl_int), (void*)&dst_height);
-	V_RETURN_CL(cl_error, "Error setting kernel arguments");
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clResampleYKernel, 1, NULL, &globalWorkSize, &m_localWorkSize[0], 0, NULL, NULL), "Error executing kernel!");
+bool GPUFullOpticalFlow::resampleAreaBased(cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width, int dst_height)
+{
+	bool ok;
+	/* if interpolation */
+	if (dst_height >= src_height) {
+		ok = resample_x(m_clResampleXKernel, src, m_d_Img_2_br, src_width, src_height, dst_width) &&
+			 resample_y(m_clResampleYKernel, m_d_Img_2_br, dst, dst_width, src_height, dst_height);
+	}
+	/* if restriction */
+	else {
+		ok = resample_y(m_clResampleYKernel, src, m_d_Img_2_br, src_width, src_height, dst_height) &&
+			 resample_x(m_clResampleXKernel, m_d_Img_2_br, dst, src_width, dst_height, dst_width);
+	}
+	clFinish(m_clCommandQueue);
+	return ok;
 }
 
-void GPUFullOpticalFlow::resampleAreaBased(cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width, int dst_height)
+bool GPUFullOpticalFlow::resampleFlow(int src_width, int src_height, int dst_width, int dst_height)
 {
+	bool ok;
+	// m_d_uv is resampled in place, m_d_duv serves as temporary buffer (it is zeroed before solving)
 	/* if interpolation */
 	if (dst_height >= src_height) {
-		resample_x(src, m_d_Img_2_br, src_width, src_height, dst_width, src_height);
-		resample_y(m_d_Img_2_br, dst, dst_width, src_height, dst_width, dst_height);
+		ok = resample_x(m_clResampleXFlowKernel, m_d_uv, m_d_duv, src_width, src_height, dst_width) &&
+			 resample_y(m_clResampleYFlowKernel, m_d_duv, m_d_uv, dst_width, src_height, dst_height);
 	}
 	/* if restriction */
 	else {
-		resample_y(src, m_d_Img_2_br, src_width, src_height, src_width, dst_height);
-		resample_x(m_d_Img_2_br, dst, src_width, dst_height, dst_width, dst_height);
+		ok = resample_y(m_clResampleYFlowKernel, m_d_uv, m_d_duv, src_width, src_height, dst_height) &&
+			 resample_x(m_clResampleXFlowKernel, m_d_duv, m_d_uv, src_width, dst_height, dst_width);
 	}
 	clFinish(m_clCommandQueue);
+	return ok;
 }
 
-void GPUFullOpticalFlow::zeroDeviceBuffer(cl_mem mem)
+void GPUFullOpticalFlow::writeInitialFlow()
 {
-	size_t globalWorkSizeZeroKernel = m_data_size / sizeof(float);
+	// interleaved (u, v) of the source size in the layout of the flow buffers
+	float* uv = new float[2 * m_buffer_elements];
+	std::fill(uv, uv + 2 * m_buffer_elements, 0.f);
+	for (int y = 0; y < m_source_img_1.height(); y++) {
+		for (int x = 0; x < m_source_img_1.width(); x++) {
+			int i = (y + m_by) * m_pitch + (x + 1);
+			uv[2 * i] = m_initial_u->pixel_r(x, y);
+			uv[2 * i + 1] = m_initial_v->pixel_r(x, y);
+		}
+	}
+	writeDeviceBuffer(m_d_uv, uv, 2 * m_buffer_elements);
+	delete[] uv;
+}
+
+void GPUFullOpticalFlow::zeroDeviceBuffer(cl_mem mem, int elements)
+{
+	// elements: number of 2-vectors (over all pairs of the batch)
+	size_t globalWorkSizeZeroKernel = elements;
 	V_RETURN_CL(clSetKernelArg(m_clZeroKernel, 0, sizeof(cl_mem), (void*)&mem), "Error setting kernel arguments");
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clZeroKernel, 1, NULL, &globalWorkSizeZeroKernel, NULL, 0, NULL, NULL), "Error executing kernel!");
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clZeroKernel, 1, NULL, &globalWorkSizeZeroKernel, NULL, 0, NULL, Profiler::event(m_clZeroKernel)), "Error executing kernel!");
+}
+
+void GPUFullOpticalFlow::writeDeviceBuffer(cl_mem dst, float* src, int elements, int offset)
+{
+	// half storage uploads floats to the staging buffer and converts them on the device
+	// offset: first destination value, the staging buffer always starts at 0
+	cl_mem d_float = m_half_storage ? m_d_staging : dst;
+	size_t float_offset = m_half_storage ? 0 : offset * sizeof(cl_float);
+	if (m_map_transfers) {
+		V_RETURN_CL(WriteBufferMapped(m_clCommandQueue, d_float, elements * sizeof(cl_float), src, float_offset), "Error copying input data to device!");
+	} else {
+		V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, d_float, CL_TRUE, float_offset, elements * sizeof(cl_float), src, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	}
+	if (!m_half_storage) {
+		return;
+	}
+
+	size_t globalWorkSize = elements;
+
+	cl_int cl_error;
+	cl_error  = clSetKernelArg(m_clConvertFromFloatKernel, 0, sizeof(cl_mem), (void*)&m_d_staging);
+	cl_error |= clSetKernelArg(m_clConvertFromFloatKernel, 1, sizeof(cl_mem), (void*)&dst);
+	cl_error |= clSetKernelArg(m_clConvertFromFloatKernel, 2, sizeof(cl_int), (void*)&offset);
+	V_RETURN_CL(cl_error, "Error setting kernel arguments");
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clConvertFromFloatKernel, 1, NULL, &globalWorkSize, NULL, 0, NULL, Profiler::event(m_clConvertFromFloatKernel)), "Error executing kernel!");
+
+	clFinish(m_clCommandQueue);
+}
+
+void GPUFullOpticalFlow::readDeviceBuffer(cl_mem src, float* dst, int elements, int offset)
+{
+	// half storage converts to float on the device, then downloads the staging buffer
+	// offset: first source value, the staging buffer always starts at 0
+	cl_mem d_float = src;
+	size_t float_offset = offset * sizeof(cl_float);
+	if (m_half_storage) {
+		size_t globalWorkSize = elements;
+		cl_int cl_error;
+		cl_error  = clSetKernelArg(m_clConvertToFloatKernel, 0, sizeof(cl_mem), (void*)&src);
+		cl_error |= clSetKernelArg(m_clConvertToFloatKernel, 1, sizeof(cl_mem), (void*)&m_d_staging);
+		cl_error |= clSetKernelArg(m_clConvertToFloatKernel, 2, sizeof(cl_int), (void*)&offset);
+		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+		V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clConvertToFloatKernel, 1, NULL, &globalWorkSize, NULL, 0, NULL, Profiler::event(m_clConvertToFloatKernel)), "Error executing kernel!");
+		d_float = m_d_staging;
+		float_offset = 0;
+	}
+
+	if (m_map_transfers) {
+		V_RETURN_CL(ReadBufferMapped(m_clCommandQueue, d_float, elements * sizeof(cl_float), dst, float_offset), "Error reading back results from the device!");
+	} else {
+		V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, d_float, CL_TRUE, float_offset, elements * sizeof(cl_float), dst, 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	}
 }
\ No newline at end of file
@@ -2,6 +2,33 @@
 
 #include "OpticalFlowBase.h"
 #include "Common.h"
+#include "FlowStatistics.h"
+#include <map>
+#include <utility>
+
+/* how the 2nd image is sampled during backward registration */
+enum WarpMode
+{
+	WARP_BUFFER,	// manual bilinear interpolation from the global buffer
+	WARP_IMAGE,		// linear filtering sampler on an image object (texture cache)
+	WARP_COMPARE	// runs both, reports warp times and the max. difference per level
+};
+
+/* solver stage plugged into the device-resident pyramid/warp/accumulate pipeline */
+enum SolverStage
+{
+	STAGE_NAIVE,	// one work-item per pixel, all operands from global memory
+	STAGE_TILED,	// (u, v) and (du, dv) tiles with halo in local memory
+	STAGE_ROBUST	// flow-driven robust model, phi/ksi recomputed every outer iteration
+};
+
+/* per output column (row) source span and area weights for one (src_size, dst_size) pair */
+struct ResampleTable
+{
+	cl_mem index;		// int2 (first source index, taps used)
+	cl_mem weights;		// taps floats per output index
+	int taps;
+};
 
 class GPUFullOpticalFlow :
 	public OpticalFlowBase
@@ -9,47 +36,90 @@ class GPUFullOpticalFlow :
 private:
 	cl_context m_clContext;
 	cl_command_queue m_clCommandQueue;
-	size_t m_localWorkSize[2];
+	size_t m_localWorkSize[3];	// (x, y, 1), the pairs of a batch are the third NDRange dimension
 
 	cl_program m_clProgram;
 	cl_kernel m_clSolverKernel;
+	cl_kernel m_clComputeMotionTensorKernel;
+	cl_kernel m_clComputePhiKsiKernel;
 	cl_kernel m_clZeroKernel;
 	cl_kernel m_clAddKernel;
 	cl_kernel m_clBackwardRegistrationKernel;
+	cl_kernel m_clBackwardRegistrationImageKernel;
 	cl_kernel m_clReflectHorizontalBoudariesKernel;
 	cl_kernel m_clReflectVerticalBoudariesKernel;
 	cl_kernel m_clResampleXKernel;
 	cl_kernel m_clResampleYKernel;
+	cl_kernel m_clResampleXFlowKernel;
+	cl_kernel m_clResampleYFlowKernel;
+	cl_kernel m_clConvertFromFloatKernel;
+	cl_kernel m_clConvertToFloatKernel;
 
 	cl_mem m_d_src_Img1;
 	cl_mem m_d_src_Img2;
 	cl_mem m_d_Img_1;
 	cl_mem m_d_Img_2;
 	cl_mem m_d_Img_2_br;
-	cl_mem m_d_du;
-	cl_mem m_d_dv;
-	cl_mem m_d_du_r;
-	cl_mem m_d_dv_r;
-	cl_mem m_d_u;
-	cl_mem m_d_v;
+	cl_mem m_d_Img_2_tex;
+	cl_mem m_d_duv;		// interleaved (du, dv)
+	cl_mem m_d_duv_r;
+	cl_mem m_d_uv;		// interleaved (u, v)
+	cl_mem m_d_J;		// packed motion tensor, 8 values per pixel
+	cl_mem m_d_phi;		// robust stage only
+	cl_mem m_d_ksi;		// robust stage only
+	cl_mem m_d_staging;	// float buffer for host transfers in half storage mode
+
+	std::map<std::pair<int, int>, ResampleTable> m_resample_tables;
 
+	int m_buffer_elements;	// pixels of one buffer including padding and borders
+	int m_element_size;		// sizeof(cl_float) or sizeof(cl_half)
 	int m_data_size;
+	int m_flow_data_size;
+	int m_tensor_data_size;
+	int m_pitch;
+	int m_by;
+	SolverScheme m_scheme;
+	WarpMode m_warp_mode;
+	bool m_half_storage;
+	bool m_map_transfers;	// device shares memory with the host, transfers map CL_MEM_ALLOC_HOST_PTR buffers
+	SolverStage m_stage;
+	int m_inner_iterations;
+	float m_e_smooth;
+	float m_e_data;
+	int m_batch_size;		// image pairs the buffers are allocated for
+	int m_active_pairs;		// image pairs of the current computeFlowBatch call
+	bool m_readback;		// copy the flow into the host images at the end of computeFlowBatch
 public:
 	GPUFullOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
-		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2]);
+		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], SolverScheme scheme = SOLVER_JACOBI,
+		WarpMode warp_mode = WARP_BUFFER, bool half_storage = false,
+		SolverStage stage = STAGE_NAIVE, int inner_iterations = 1, float e_smooth = 0.001f, float e_data = 0.001f, int batch_size = 1);
 	~GPUFullOpticalFlow();
 
 	void computeFlow(Image& u, Image& v);
+	// solves up to batch_size pairs with the size of the source images in the same launches (warm start only for a single pair)
+	void computeFlowBatch(const Image* img1[], const Image* img2[], Image* u[], Image* v[], int count);
 	bool initResources(cl_context context, cl_device_id device);
 	void releaseResources();
+	// false: the flow stays on the device only (deviceFlow), u and v are not written
+	void setReadback(bool readback);
+	// resident flow of a batch pair after computeFlowBatch, for device-side statistics
+	DeviceFlow deviceFlow(int pair = 0) const;
 private:
+	void computeMotionTensor(float hx, float hy, int width, int height);
 	void solveDifference(float hx, float hy, int width, int height);
 	void backwardRegistration(float hx, float hy, int width, int height);
 	void reflectBoudaries(int width, int height);
-	void resampleAreaBased(cl_mem src, cl_mem dst, int src_width, int src_height,  int dst_width, int dst_height);
-	void resample_y(cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width, int dst_height);
-	void resample_x(cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width, int dst_height);
+	bool resampleAreaBased(cl_mem src, cl_mem dst, int src_width, int src_height,  int dst_width, int dst_height);
+	bool resampleFlow(int src_width, int src_height, int dst_width, int dst_height);
+	bool resample_y(cl_kernel kernel, cl_mem src, cl_mem dst, int src_width, int src_height, int dst_height);
+	bool resample_x(cl_kernel kernel, cl_mem src, cl_mem dst, int src_width, int src_height, int dst_width);
+	// table of the cache, created on first use; false (nothing cached) if its buffers cannot be allocated
+	bool getResampleTable(int src_size, int dst_size, ResampleTable& table);
 	void addFlowIncrement();
-	void zeroDeviceBuffer(cl_mem mem);
+	void writeInitialFlow();
+	void zeroDeviceBuffer(cl_mem mem, int elements);
+	void writeDeviceBuffer(cl_mem dst, float* src, int elements, int offset = 0);
+	void readDeviceBuffer(cl_mem src, float* dst, int elements, int offset = 0);
 };
 
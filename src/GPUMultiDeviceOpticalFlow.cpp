@@ -0,0 +1,374 @@
+#include "GPUMultiDeviceOpticalFlow.h"
+
+#include "CTimer.h"
+#include "Profiler.h"
+#include "Timing.h"
+#include <algorithm>
+
+GPUMultiDeviceOpticalFlow::GPUMultiDeviceOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
+													 const std::vector<ComputeDevice>& devices, int localWorkSize[2], int exchange_interval, int min_stripe_rows)
+	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega),
+	  m_devices(devices), m_exchange_interval(max(exchange_interval, 1)), m_min_stripe_rows(max(min_stripe_rows, 1)), m_stripe_data_size(0)
+{
+	m_localWorkSize[0] = localWorkSize[0];
+	m_localWorkSize[1] = localWorkSize[1];
+}
+
+GPUMultiDeviceOpticalFlow::~GPUMultiDeviceOpticalFlow()
+{
+}
+
+bool GPUMultiDeviceOpticalFlow::initResources()
+{
+	cl_int cl_error;
+	char * program_code;
+	size_t program_size;
+
+	if (m_devices.empty()) {
+		std::cout << "No devices for the multi-device solver." << std::endl;
+		return false;
+	}
+
+	LoadProgram(KernelPath("MultiDeviceSolver.cl").c_str(), &program_code, &program_size);
+
+	int bx = 1;
+	int by = 1;
+	// temporal image to get right image sizes
+	Image img(m_source_img_1.width(), m_source_img_1.height(), bx, by);
+	int pitch = img.pitch();
+
+	// stripe buffers are sized for the largest stripe of all levels (coarse levels use fewer, taller stripes)
+	m_stripes.resize(m_devices.size());
+	int max_rows = 0;
+	for (int level = computeMaxWarpLevels(m_source_img_1.width(), m_source_img_1.height(), m_warp_scale, m_warp_levels) - 1; level >= 0; level--) {
+		int level_height = static_cast<int>(ceil(m_source_img_1.height() * pow(m_warp_scale, level)));
+		int stripe_count = splitLevel(level_height);
+		for (int d = 0; d < stripe_count; d++) {
+			max_rows = max(max_rows, m_stripes[d].compute_end - m_stripes[d].compute_begin);
+		}
+	}
+	m_stripe_data_size = pitch * (max_rows + 2 * by) * sizeof(cl_float);
+
+	for (size_t d = 0; d < m_devices.size(); d++) {
+		Stripe& s = m_stripes[d];
+
+		cl_context context = m_devices[d].context;
+		cl_device_id device = m_devices[d].device;
+
+		char deviceName[256];
+		V_RETURN_FALSE_CL(clGetDeviceInfo(device, CL_DEVICE_NAME, 256, &deviceName, NULL), "Unable to query device name.");
+		std::cout << "Stripe device " << d << ": " << deviceName << std::endl;
+
+		// every device gets its own program and kernel, kernel arguments are set per stripe
+		s.program = clCreateProgramWithSource(context, 1, (const char**) &program_code, &program_size, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create program from file.");
+
+		cl_error = clBuildProgram(s.program, 1, &device, NULL, NULL, NULL);
+		if (cl_error != CL_SUCCESS)
+		{
+			PrintBuildLog(s.program, device);
+			return false;
+		}
+
+		s.kernel = clCreateKernel(s.program, "StripeSolver", &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+
+		s.d_Img_1 = clCreateBuffer(context, CL_MEM_READ_ONLY, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		s.d_Img_2 = clCreateBuffer(context, CL_MEM_READ_ONLY, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		s.d_u = clCreateBuffer(context, CL_MEM_READ_ONLY, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		s.d_v = clCreateBuffer(context, CL_MEM_READ_ONLY, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		s.d_du = clCreateBuffer(context, CL_MEM_READ_WRITE, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		s.d_dv = clCreateBuffer(context, CL_MEM_READ_WRITE, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		s.d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		s.d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_stripe_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+
+		// bind kernel arguments (constant for all iterations)
+		cl_error  = clSetKernelArg(s.kernel, 0, sizeof(cl_mem), (void*)&s.d_Img_1);
+		cl_error |= clSetKernelArg(s.kernel, 1, sizeof(cl_mem), (void*)&s.d_Img_2);
+
+		cl_error |= clSetKernelArg(s.kernel, 4, sizeof(cl_mem), (void*)&s.d_u);
+		cl_error |= clSetKernelArg(s.kernel, 5, sizeof(cl_mem), (void*)&s.d_v);
+
+		cl_error |= clSetKernelArg(s.kernel, 8, sizeof(cl_float), (void*)&m_alpha);
+		cl_error |= clSetKernelArg(s.kernel, 9, sizeof(cl_float), (void*)&m_omega);
+		cl_error |= clSetKernelArg(s.kernel, 10, sizeof(cl_int), (void*)&bx);
+		cl_error |= clSetKernelArg(s.kernel, 11, sizeof(cl_int), (void*)&by);
+
+		cl_error |= clSetKernelArg(s.kernel, 14, sizeof(cl_int), (void*)&pitch);
+		V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	}
+
+	delete [] program_code;
+
+	return true;
+}
+
+void GPUMultiDeviceOpticalFlow::releaseResources()
+{
+	for (size_t d = 0; d < m_stripes.size(); d++) {
+		Stripe& s = m_stripes[d];
+		SAFE_RELEASE_MEMOBJECT(s.d_Img_1);
+		SAFE_RELEASE_MEMOBJECT(s.d_Img_2);
+		SAFE_RELEASE_MEMOBJECT(s.d_du);
+		SAFE_RELEASE_MEMOBJECT(s.d_dv);
+		SAFE_RELEASE_MEMOBJECT(s.d_du_r);
+		SAFE_RELEASE_MEMOBJECT(s.d_dv_r);
+		SAFE_RELEASE_MEMOBJECT(s.d_u);
+		SAFE_RELEASE_MEMOBJECT(s.d_v);
+
+		SAFE_RELEASE_KERNEL(s.kernel);
+		SAFE_RELEASE_PROGRAM(s.program);
+	}
+	m_stripes.clear();
+}
+
+void GPUMultiDeviceOpticalFlow::computeFlow(Image& u, Image& v)
+{
+	int level_width;	// size in x - direction(current resolution)
+	int level_height;	// size in x-direction (current resolution)
+	float hx;			// spacing in x-direction (current resol.)
+	float hy;			// spacing in y-direction (current resol.)
+
+	Image img_1_res(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// 1st resampled image
+	Image img_2_res(m_source_img_1.width(), m_source_img_1.height(), 1, 1); // 2nd resampled image
+	Image img_2_br(m_source_img_1.width(), m_source_img_1.height(), 1, 1);  // 2nd warped image
+
+	Image du(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// x-component of flow increment
+	Image dv(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// y-component of flow increment
+
+	int current_warp_level = startWarpLevel();
+
+	// initialize output flow arrays, with the initial flow for a warm start
+	initializeFlow(u, v);
+
+	while (current_warp_level >= 0) {
+		Profiler::setLevel(current_warp_level);
+		TIMING_LEVEL(current_warp_level);
+
+		// compute level sizes
+		level_width = static_cast<int>(ceil(m_source_img_1.width() * pow(m_warp_scale, current_warp_level)));
+		level_height = static_cast<int>(ceil(m_source_img_1.height() * pow(m_warp_scale, current_warp_level)));
+		hx = m_source_img_1.width() / static_cast<float>(level_width);
+		hy = m_source_img_1.height() / static_cast<float>(level_height);
+
+		std::cout << "Solve level: " << current_warp_level << " (" << level_width << "x" << level_height << ") \t ";
+
+		// perform resampling of images
+		TIMING_BEGIN("pyramid");
+		if (current_warp_level == 0) {
+			img_1_res = m_source_img_1;
+			img_2_res = m_source_img_2;
+		} else {
+			Image::resampleAreaBasedWithoutReallocating(m_source_img_1, img_1_res, level_width, level_height);
+			Image::resampleAreaBasedWithoutReallocating(m_source_img_2, img_2_res, level_width, level_height);
+		}
+		// perform resampling of displacement field
+		Image::resampleAreaBasedWithoutReallocating(u, du, level_width, level_height);
+		Image::resampleAreaBasedWithoutReallocating(v, dv, level_width, level_height);
+		u = du;
+		v = dv;
+		TIMING_END();
+
+		// perform backward registration
+		TIMING_BEGIN("warp");
+		Image::backwardRegistration(img_1_res, img_2_res, img_2_br, u, v, hx, hy);
+		TIMING_END();
+
+		// solve difference problem at current resolution to obtain increment
+		solveDifference(img_1_res, img_2_br, du, dv, u, v, hx, hy);
+
+		// add solved increment to the global flow
+		TIMING_BEGIN("add");
+		u += du;
+		v += dv;
+		TIMING_END();
+
+		// go to the next level
+		current_warp_level--;
+	}
+}
+
+int GPUMultiDeviceOpticalFlow::splitLevel(int height)
+{
+	// coarse levels collapse onto fewer devices
+	int count = max(1, min(static_cast<int>(m_stripes.size()), height / m_min_stripe_rows));
+
+	for (int d = 0; d < count; d++) {
+		Stripe& s = m_stripes[d];
+		s.row_begin = height * d / count;
+		s.row_end = height * (d + 1) / count;
+		s.compute_begin = max(s.row_begin - m_exchange_interval, 0);
+		s.compute_end = min(s.row_end + m_exchange_interval, height);
+	}
+	return count;
+}
+
+bool GPUMultiDeviceOpticalFlow::exchangeHalos(int stripe_count, Image& du, Image& dv)
+{
+	int pitch = du.pitch();
+
+	// gather the owned rows of all stripes on the host ...
+	for (int d = 0; d < stripe_count; d++) {
+		Stripe& s = m_stripes[d];
+		cl_command_queue queue = m_devices[d].queue;
+		size_t offset = (s.row_begin - s.compute_begin + 1) * pitch * sizeof(cl_float);
+		size_t size = (s.row_end - s.row_begin) * pitch * sizeof(cl_float);
+		size_t host_offset = (s.row_begin + 1) * pitch;
+
+		V_RETURN_FALSE_CL(clEnqueueReadBuffer(queue, s.d_du, CL_FALSE, offset, size, du.data_ptr() + host_offset, 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+		V_RETURN_FALSE_CL(clEnqueueReadBuffer(queue, s.d_dv, CL_FALSE, offset, size, dv.data_ptr() + host_offset, 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	}
+	for (int d = 0; d < stripe_count; d++) {
+		clFinish(m_devices[d].queue);
+	}
+
+	// ... and scatter the rows around them (halo and the outer stencil row) back to the neighbours
+	for (int d = 0; d < stripe_count; d++) {
+		Stripe& s = m_stripes[d];
+		cl_command_queue queue = m_devices[d].queue;
+
+		// buffer row 0 is image row compute_begin - 1
+		size_t top_rows = s.row_begin - s.compute_begin + 1;
+		size_t top_host = s.compute_begin * pitch;
+		size_t bottom_rows = s.compute_end - s.row_end + 1;
+		size_t bottom_offset = (s.row_end - s.compute_begin + 1) * pitch * sizeof(cl_float);
+		size_t bottom_host = (s.row_end + 1) * pitch;
+
+		V_RETURN_FALSE_CL(clEnqueueWriteBuffer(queue, s.d_du, CL_FALSE, 0, top_rows * pitch * sizeof(cl_float), du.data_ptr() + top_host, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_FALSE_CL(clEnqueueWriteBuffer(queue, s.d_dv, CL_FALSE, 0, top_rows * pitch * sizeof(cl_float), dv.data_ptr() + top_host, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_FALSE_CL(clEnqueueWriteBuffer(queue, s.d_du, CL_FALSE, bottom_offset, bottom_rows * pitch * sizeof(cl_float), du.data_ptr() + bottom_host, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_FALSE_CL(clEnqueueWriteBuffer(queue, s.d_dv, CL_FALSE, bottom_offset, bottom_rows * pitch * sizeof(cl_float), dv.data_ptr() + bottom_host, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	}
+	for (int d = 0; d < stripe_count; d++) {
+		clFinish(m_devices[d].queue);
+	}
+
+	return true;
+}
+
+void GPUMultiDeviceOpticalFlow::solveDifference(Image& img_1, Image& img_2, Image& du, Image& dv, Image& u, Image& v, float hx, float hy)
+{
+	int width = img_1.actual_width();
+	int height = img_1.actual_height();
+	int pitch = img_1.pitch();
+
+	img_1.fillBoudaries();
+	img_2.fillBoudaries();
+
+	du.setActualSize(width, height);
+	dv.setActualSize(width, height);
+	du.zeroData();
+	dv.zeroData();
+
+	int stripe_count = splitLevel(height);
+
+	TIMING_BEGIN("upload");
+	cl_int cl_error;
+	for (int d = 0; d < stripe_count; d++) {
+		Stripe& s = m_stripes[d];
+		cl_command_queue queue = m_devices[d].queue;
+
+		// copy the computed rows and one row above and below (padded rows compute_begin ... compute_end + 1)
+		int rows = s.compute_end - s.compute_begin;
+		size_t size = (rows + 2) * pitch * sizeof(cl_float);
+		size_t host_offset = s.compute_begin * pitch;
+
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_Img_1, CL_FALSE, 0, size, img_1.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_Img_2, CL_FALSE, 0, size, img_2.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_du	 , CL_FALSE, 0, size,	 du.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_dv	 , CL_FALSE, 0, size,	 dv.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_du_r , CL_FALSE, 0, size,	 du.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_dv_r , CL_FALSE, 0, size,	 dv.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_u	 , CL_FALSE, 0, size,	  u.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(queue, s.d_v	 , CL_FALSE, 0, size,	  v.data_ptr() + host_offset, 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+
+		// bind kernel arguments (varying during warp levels iterations)
+		cl_error  = clSetKernelArg(s.kernel, 6, sizeof(cl_float), (void*)&hx);
+		cl_error |= clSetKernelArg(s.kernel, 7, sizeof(cl_float), (void*)&hy);
+
+		cl_error |= clSetKernelArg(s.kernel, 12, sizeof(cl_int), (void*)&width);
+		cl_error |= clSetKernelArg(s.kernel, 13, sizeof(cl_int), (void*)&rows);
+
+		cl_error |= clSetKernelArg(s.kernel, 17, sizeof(cl_int), (void*)&s.compute_begin);
+		cl_error |= clSetKernelArg(s.kernel, 18, sizeof(cl_int), (void*)&height);
+		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+	}
+
+	// wait until all data are copied
+	for (int d = 0; d < stripe_count; d++) {
+		clFinish(m_devices[d].queue);
+	}
+	TIMING_END();
+
+	TIMING_BEGIN("solve");
+	TIMING_COUNT("pixel updates", (double)width * height * solverIterations());
+
+	CTimer timer;
+	timer.Start();
+	for (int i = 0; i < solverIterations(); ) {
+		// the halo is exchange_interval rows wide: the owned rows stay exact for that many iterations
+		int steps = min(m_exchange_interval, solverIterations() - i);
+
+		for (int d = 0; d < stripe_count; d++) {
+			Stripe& s = m_stripes[d];
+			cl_command_queue queue = m_devices[d].queue;
+			size_t globalWorkSize[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(s.compute_end - s.compute_begin, m_localWorkSize[1]) };
+
+			for (int k = 0; k < steps; k++) {
+				// bind input and output buffers
+				cl_error  = clSetKernelArg(s.kernel, 2, sizeof(cl_mem), (void*)&s.d_du);
+				cl_error |= clSetKernelArg(s.kernel, 3, sizeof(cl_mem), (void*)&s.d_dv);
+
+				cl_error |= clSetKernelArg(s.kernel, 15, sizeof(cl_mem), (void*)&s.d_du_r);
+				cl_error |= clSetKernelArg(s.kernel, 16, sizeof(cl_mem), (void*)&s.d_dv_r);
+				V_RETURN_CL(cl_error, "Error setting kernel arguments");
+
+				V_RETURN_CL(clEnqueueNDRangeKernel(queue, s.kernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(s.kernel)), "Error executing kernel!");
+
+				// swap input and output pointers (ping-ponging)
+				std::swap(s.d_du, s.d_du_r);
+				std::swap(s.d_dv, s.d_dv_r);
+			}
+			// start the devices concurrently
+			clFlush(queue);
+		}
+		i += steps;
+
+		if (i < solverIterations() && stripe_count > 1) {
+			if (!exchangeHalos(stripe_count, du, dv)) {
+				return;
+			}
+		}
+	}
+	for (int d = 0; d < stripe_count; d++) {
+		clFinish(m_devices[d].queue);
+	}
+	TIMING_END();
+	timer.Stop();
+	std::cout << timer.GetElapsedTime() << " (" << stripe_count << (stripe_count > 1 ? " devices)" : " device)") << std::endl;
+
+	// copy the owned rows back to host
+	TIMING_BEGIN("readback");
+	for (int d = 0; d < stripe_count; d++) {
+		Stripe& s = m_stripes[d];
+		cl_command_queue queue = m_devices[d].queue;
+		size_t offset = (s.row_begin - s.compute_begin + 1) * pitch * sizeof(cl_float);
+		size_t size = (s.row_end - s.row_begin) * pitch * sizeof(cl_float);
+		size_t host_offset = (s.row_begin + 1) * pitch;
+
+		V_RETURN_CL(clEnqueueReadBuffer(queue, s.d_du, CL_FALSE, offset, size, du.data_ptr() + host_offset, 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+		V_RETURN_CL(clEnqueueReadBuffer(queue, s.d_dv, CL_FALSE, offset, size, dv.data_ptr() + host_offset, 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	}
+	for (int d = 0; d < stripe_count; d++) {
+		clFinish(m_devices[d].queue);
+	}
+	TIMING_END();
+}
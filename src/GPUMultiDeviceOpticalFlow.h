@@ -0,0 +1,64 @@
+#pragma once
+
+#include "OpticalFlowBase.h"
+#include "Common.h"
+
+#include <vector>
+
+/* OpenCL device used by the multi-device solver, devices may belong to different contexts */
+struct ComputeDevice
+{
+	cl_context context;
+	cl_device_id device;
+	cl_command_queue queue;
+};
+
+/* Domain decomposition over several devices: every pyramid level is split into horizontal
+   stripes, one per device. Stripes are computed with a halo of exchange_interval rows and the
+   halo rows are refreshed through the host every exchange_interval Jacobi iterations. Levels
+   with less than min_stripe_rows rows per device use fewer devices (coarse levels run on one). */
+class GPUMultiDeviceOpticalFlow :
+	public OpticalFlowBase
+{
+private:
+	struct Stripe
+	{
+		cl_program program;
+		cl_kernel kernel;
+
+		cl_mem d_Img_1;
+		cl_mem d_Img_2;
+		cl_mem d_du;
+		cl_mem d_dv;
+		cl_mem d_du_r;
+		cl_mem d_dv_r;
+		cl_mem d_u;
+		cl_mem d_v;
+
+		int row_begin;		// first owned image row
+		int row_end;		// one past the last owned image row
+		int compute_begin;	// first computed image row (owned rows and halo)
+		int compute_end;	// one past the last computed image row
+	};
+
+	std::vector<ComputeDevice> m_devices;
+	std::vector<Stripe> m_stripes;
+	size_t m_localWorkSize[2];
+
+	int m_exchange_interval;	// Jacobi iterations between halo exchanges, equals the halo width
+	int m_min_stripe_rows;
+	int m_stripe_data_size;		// bytes of the largest stripe buffer
+
+public:
+	GPUMultiDeviceOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
+		const std::vector<ComputeDevice>& devices, int localWorkSize[2], int exchange_interval = 1, int min_stripe_rows = 64);
+	~GPUMultiDeviceOpticalFlow();
+
+	void computeFlow(Image& u, Image& v);
+	bool initResources();
+	void releaseResources();
+private:
+	void solveDifference(Image& img_1, Image& img_2, Image& du, Image& dv, Image& u, Image& v, float hx, float hy);
+	int splitLevel(int height);
+	bool exchangeHalos(int stripe_count, Image& du, Image& dv);
+};
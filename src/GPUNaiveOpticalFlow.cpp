@@ -1,16 +1,18 @@
 #include "GPUNaiveOpticalFlow.h"
 
 #include "CTimer.h"
+#include "Profiler.h"
+#include "Timing.h"
 #include <algorithm>
 #include <sstream>
 
 GPUNaiveOpticalFlow::GPUNaiveOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega, 
-										 cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2]) 
+										 cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], SolverScheme scheme) 
 	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega),
 	  m_clContext(clContext), m_clCommandQueue(clCommandQueue),
 	  m_clProgram(NULL), m_clNaiveSolverKernel(NULL),
-	  m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_du(NULL), m_d_dv(NULL), m_d_u(NULL), m_d_v(NULL),
-	  m_data_size(0)
+	  m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_du(NULL), m_d_dv(NULL), m_d_du_r(NULL), m_d_dv_r(NULL), m_d_u(NULL), m_d_v(NULL),
+	  m_data_size(0), m_scheme(scheme)
 {
 	m_localWorkSize[0] = localWorkSize[0];
 	m_localWorkSize[1] = localWorkSize[1];
@@ -26,7 +28,7 @@ bool GPUNaiveOpticalFlow::initResources(cl_context context, cl_device_id device)
 	char * program_code;
 	size_t program_size;
 
-	LoadProgram("./src/kernels/NaiveSolver.cl", &program_code, &program_size);
+	LoadProgram(KernelPath("NaiveSolver.cl").c_str(), &program_code, &program_size);
 
 	// create a program object
 	m_clProgram = clCreateProgramWithSource(context, 1, (const char**) &program_code, &program_size, &cl_error);
@@ -41,7 +43,7 @@ bool GPUNaiveOpticalFlow::initResources(cl_context context, cl_device_id device)
 	}
 
 	// create kernel
-	m_clNaiveSolverKernel = clCreateKernel(m_clProgram, "NaiveSolver", &cl_error);
+	m_clNaiveSolverKernel = clCreateKernel(m_clProgram, (m_scheme == SOLVER_RED_BLACK) ? "NaiveSolverRedBlack" : "NaiveSolver", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
 	// create device resources
@@ -65,10 +67,13 @@ bool GPUNaiveOpticalFlow::initResources(cl_context context, cl_device_id device)
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
 	m_d_dv = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	// red-black SOR updates the increments in place, double buffers are needed only by Jacobi
+	if (m_scheme == SOLVER_JACOBI) {
+		m_d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		m_d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	}
 
 	// bind kernel arguments (constant for all iterations)
 	cl_error  = clSetKernelArg(m_clNaiveSolverKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
@@ -118,13 +123,21 @@ void GPUNaiveOpticalFlow::computeFlow(Image& u, Image& v)
 	Image du(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// x-component of flow increment
 	Image dv(m_source_img_1.width(), m_source_img_1.height(), 1, 1);	// y-component of flow increment
 
-	int current_warp_level = min(m_warp_levels, computeMaxWarpLevels()) - 1;
+	// host side of the transfers of solveDifference
+	pinImage(img_1_res);
+	pinImage(img_2_br);
+	pinImage(du);
+	pinImage(dv);
+
+	int current_warp_level = startWarpLevel();
 
-	// initialize output flow arrays
-	u.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 1, 1);
-	v.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 1, 1);
+	// initialize output flow arrays, with the initial flow for a warm start
+	initializeFlow(u, v);
 
 	while (current_warp_level >= 0) {
+		Profiler::setLevel(current_warp_level);
+		TIMING_LEVEL(current_warp_level);
+
 		// compute level sizes
 		level_width = static_cast<int>(ceil(m_source_img_1.width() * pow(m_warp_scale, current_warp_level)));
 		level_height = static_cast<int>(ceil(m_source_img_1.height() * pow(m_warp_scale, current_warp_level)));
@@ -134,6 +147,7 @@ void GPUNaiveOpticalFlow::computeFlow(Image& u, Image& v)
 		std::cout << "Solve level: " << current_warp_level << " (" << level_width << "x" << level_height << ") \t "; // << std::endl;
 
 		// perform resampling of images
+		TIMING_BEGIN("pyramid");
 		if (current_warp_level == 0) {
 			img_1_res = m_source_img_1;
 			img_2_res = m_source_img_2;
@@ -146,16 +160,21 @@ void GPUNaiveOpticalFlow::computeFlow(Image& u, Image& v)
 		Image::resampleAreaBasedWithoutReallocating(v, dv, level_width, level_height);
 		u = du;
 		v = dv;
+		TIMING_END();
 
 		// perform backward registration
+		TIMING_BEGIN("warp");
 		Image::backwardRegistration(img_1_res, img_2_res, img_2_br, u, v, hx, hy);
+		TIMING_END();
 
 		// solve difference problem at current resolution to obtain increment
 		solveDifference(img_1_res, img_2_br, du, dv, u, v, hx, hy);
 
 		// add solved increment to the global flow
+		TIMING_BEGIN("add");
 		u += du;
 		v += dv;
+		TIMING_END();
 
 		// go to the next level
 		current_warp_level--;
@@ -176,17 +195,24 @@ void GPUNaiveOpticalFlow::solveDifference(Image& img_1, Image& img_2, Image& du,
 	dv.zeroData();
 
 	// copy data to device
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_1, CL_FALSE, 0, m_data_size, img_1.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_2, CL_FALSE, 0, m_data_size, img_2.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du	, CL_FALSE, 0, m_data_size,	   du.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv	, CL_FALSE, 0, m_data_size,    dv.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du_r , CL_FALSE, 0, m_data_size,    du.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv_r , CL_FALSE, 0, m_data_size,	   dv.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_u	, CL_FALSE, 0, m_data_size,		u.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_v	, CL_FALSE, 0, m_data_size,		v.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
+	TIMING_BEGIN("upload");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_1, CL_FALSE, 0, m_data_size, img_1.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_2, CL_FALSE, 0, m_data_size, img_2.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du	, CL_FALSE, 0, m_data_size,	   du.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv	, CL_FALSE, 0, m_data_size,    dv.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	if (m_scheme == SOLVER_JACOBI) {
+		V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_du_r , CL_FALSE, 0, m_data_size,    du.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+		V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_dv_r , CL_FALSE, 0, m_data_size,	   dv.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	}
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_u	, CL_FALSE, 0, m_data_size,		u.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_v	, CL_FALSE, 0, m_data_size,		v.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
 
 	// wait until all data are copied
 	clFinish(m_clCommandQueue);
+	TIMING_END();
+
+	TIMING_BEGIN("solve");
+	TIMING_COUNT("pixel updates", (double)width * height * solverIterations());
 
 	// bind kernel arguments (varying during warp levels iterations)
 	cl_int cl_error;
@@ -197,31 +223,68 @@ void GPUNaiveOpticalFlow::solveDifference(Image& img_1, Image& img_2, Image& du,
 	cl_error |= clSetKernelArg(m_clNaiveSolverKernel, 13, sizeof(cl_int), (void*)&height);
 	V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-	size_t globalWorkSize[2] = {GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[0])};
+	size_t globalWorkSize[2] = {GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[1])};
+
+	if (m_residual_report) {
+		m_residuals.clear();
+		recordResidual(img_1, img_2, du, dv, u, v, hx, hy);
+	}
 
 	CTimer timer;
 	timer.Start();
 	// run kernel many times	
-	for (int i = 0; i < m_solver_iterations; i++) {
-		// bind input and output buffers
+	if (m_scheme == SOLVER_RED_BLACK) {
+		// increments are updated in place, buffers are bound once
 		cl_error  = clSetKernelArg(m_clNaiveSolverKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
 		cl_error |= clSetKernelArg(m_clNaiveSolverKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
-
-		cl_error |= clSetKernelArg(m_clNaiveSolverKernel, 15, sizeof(cl_mem), (void*)&m_d_du_r);
-		cl_error |= clSetKernelArg(m_clNaiveSolverKernel, 16, sizeof(cl_mem), (void*)&m_d_dv_r);
 		V_RETURN_CL(cl_error, "Error setting kernel arguments");
 
-		V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clNaiveSolverKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, NULL), "Error executing kernel!");
-
-		// swap input and output pointers (ping-ponging)
-		std::swap(m_d_du, m_d_du_r);
-		std::swap(m_d_dv, m_d_dv_r);
+		for (int i = 0; i < solverIterations(); i++) {
+			// red pixels first, then black pixels using the updated red ones
+			for (int color = 0; color < 2; color++) {
+				V_RETURN_CL(clSetKernelArg(m_clNaiveSolverKernel, 15, sizeof(cl_int), (void*)&color), "Error setting kernel arguments");
+				V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clNaiveSolverKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clNaiveSolverKernel)), "Error executing kernel!");
+			}
+			if (m_residual_report) {
+				readResidual(img_1, img_2, du, dv, u, v, hx, hy);
+			}
+		}
+	} else {
+		for (int i = 0; i < solverIterations(); i++) {
+			// bind input and output buffers
+			cl_error  = clSetKernelArg(m_clNaiveSolverKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
+			cl_error |= clSetKernelArg(m_clNaiveSolverKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
+
+			cl_error |= clSetKernelArg(m_clNaiveSolverKernel, 15, sizeof(cl_mem), (void*)&m_d_du_r);
+			cl_error |= clSetKernelArg(m_clNaiveSolverKernel, 16, sizeof(cl_mem), (void*)&m_d_dv_r);
+			V_RETURN_CL(cl_error, "Error setting kernel arguments");
+
+			V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clNaiveSolverKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clNaiveSolverKernel)), "Error executing kernel!");
+
+			// swap input and output pointers (ping-ponging)
+			std::swap(m_d_du, m_d_du_r);
+			std::swap(m_d_dv, m_d_dv_r);
+			if (m_residual_report) {
+				readResidual(img_1, img_2, du, dv, u, v, hx, hy);
+			}
+		}
 	}
 	clFinish(m_clCommandQueue);
+	TIMING_END();
 	timer.Stop();
 	std::cout << timer.GetElapsedTime() << std::endl;
 
 	// copy data back to host
+	TIMING_BEGIN("readback");
+	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_du, CL_TRUE, 0, m_data_size, du.data_ptr(), 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_dv, CL_TRUE, 0, m_data_size, dv.data_ptr(), 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	TIMING_END();
+ }
+
+void GPUNaiveOpticalFlow::readResidual(const Image& img_1, const Image& img_2, Image& du, Image& dv, const Image& u, const Image& v, float hx, float hy)
+{
+	// blocking read of the current increments, the report slows the solver down
 	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_du, CL_TRUE, 0, m_data_size, du.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
 	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_dv, CL_TRUE, 0, m_data_size, dv.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
- }
\ No newline at end of file
+	recordResidual(img_1, img_2, du, dv, u, v, hx, hy);
+}
@@ -24,9 +24,10 @@ private:
 	cl_mem m_d_v;
 
 	int m_data_size;
+	SolverScheme m_scheme;
 public:
 	GPUNaiveOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
-		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2]);
+		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], SolverScheme scheme = SOLVER_JACOBI);
 	~GPUNaiveOpticalFlow();
 
 	void computeFlow(Image& u, Image& v);
@@ -34,5 +35,6 @@ public:
 	void releaseResources();
 private:
 	void solveDifference(Image& img_1, Image& img_2, Image& du, Image& dv, Image& u, Image& v, float hx, float hy);
+	void readResidual(const Image& img_1, const Image& img_2, Image& du, Image& dv, const Image& u, const Image& v, float hx, float hy);
 };
 
@@ -2,14 +2,16 @@
 
 #include <algorithm>
 #include "CTimer.h"
+#include "Profiler.h"
+#include "Timing.h"
 
 GPUOptimizedOpticalFlow::GPUOptimizedOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
-												 cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2])
+												 cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], int temporal_iterations, SolverScheme scheme)
 	: OpticalFlowBase(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega),
 	  m_clContext(clContext), m_clCommandQueue(clCommandQueue),
-	  m_clProgram(NULL), m_clOptimizedSolverKernel(NULL), m_clZeroKernel(NULL),
-	  m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_du(NULL), m_d_dv(NULL), m_d_u(NULL), m_d_v(NULL),
-	  m_data_size(0)
+	  m_clProgram(NULL), m_clOptimizedSolverKernel(NULL), m_clOptimizedSolverTemporalKernel(NULL), m_clOptimizedSolverRedBlackKernel(NULL), m_clZeroKernel(NULL),
+	  m_d_Img_1(NULL), m_d_Img_2(NULL), m_d_du(NULL), m_d_dv(NULL), m_d_du_r(NULL), m_d_dv_r(NULL), m_d_u(NULL), m_d_v(NULL),
+	  m_data_size(0), m_temporal_iterations(std::max(temporal_iterations, 1)), m_scheme(scheme)
 {
 	m_localWorkSize[0] = localWorkSize[0];
 	m_localWorkSize[1] = localWorkSize[1];
@@ -25,7 +27,7 @@ bool GPUOptimizedOpticalFlow::initResources(cl_context context, cl_device_id dev
 	char * program_code;
 	size_t program_size;
 
-	LoadProgram("./src/kernels/OptimizedSolver.cl", &program_code, &program_size);
+	LoadProgram(KernelPath("OptimizedSolver.cl").c_str(), &program_code, &program_size);
 
 	// create a program object
 	m_clProgram = clCreateProgramWithSource(context, 1, (const char**)&program_code, &program_size, &cl_error);
@@ -34,9 +36,9 @@ bool GPUOptimizedOpticalFlow::initResources(cl_context context, cl_device_id dev
 	// buid program
 	char compileOptions[128];
 	#ifdef _WIN32   // Windows version
-		sprintf_s(compileOptions, "-D TILE_SIZE_X=%d -D TILE_SIZE_Y=%d", m_localWorkSize[0], m_localWorkSize[1]);
+		sprintf_s(compileOptions, "-D TILE_SIZE_X=%d -D TILE_SIZE_Y=%d -D TEMPORAL_ITERATIONS=%d", (int)m_localWorkSize[0], (int)m_localWorkSize[1], m_temporal_iterations);
 	#else           // Linux version
-		sprintf(compileOptions, "-D TILE_SIZE_X=%d -D TILE_SIZE_Y=%d", m_localWorkSize[0], m_localWorkSize[1]);
+		sprintf(compileOptions, "-D TILE_SIZE_X=%d -D TILE_SIZE_Y=%d -D TEMPORAL_ITERATIONS=%d", (int)m_localWorkSize[0], (int)m_localWorkSize[1], m_temporal_iterations);
 	#endif
 
 	cl_error = clBuildProgram(m_clProgram, 1, &device, compileOptions, NULL, NULL);
@@ -50,6 +52,12 @@ bool GPUOptimizedOpticalFlow::initResources(cl_context context, cl_device_id dev
 	m_clOptimizedSolverKernel = clCreateKernel(m_clProgram, "OptimizedSolver", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
+	m_clOptimizedSolverTemporalKernel = clCreateKernel(m_clProgram, "OptimizedSolverTemporal", &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+
+	m_clOptimizedSolverRedBlackKernel = clCreateKernel(m_clProgram, "OptimizedSolverRedBlack", &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
+
 	m_clZeroKernel = clCreateKernel(m_clProgram, "Zero", &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel.");
 
@@ -74,24 +82,30 @@ bool GPUOptimizedOpticalFlow::initResources(cl_context context, cl_device_id dev
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
 	m_d_dv = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
 	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
-	m_d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
-	V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	// red-black SOR updates the increments in place, double buffers are needed only by Jacobi
+	if (m_scheme == SOLVER_JACOBI) {
+		m_d_du_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+		m_d_dv_r = clCreateBuffer(context, CL_MEM_READ_WRITE, m_data_size, NULL, &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating device memory");
+	}
 
-	// bind kernel arguments (constant for all iterations)
-	cl_error  = clSetKernelArg(m_clOptimizedSolverKernel, 0, sizeof(cl_mem), (void*)&m_d_Img_1);
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 1, sizeof(cl_mem), (void*)&m_d_Img_2);
+	// bind kernel arguments (constant for all iterations), all solver kernels share the first 13 arguments
+	cl_kernel solverKernels[3] = { m_clOptimizedSolverKernel, m_clOptimizedSolverTemporalKernel, m_clOptimizedSolverRedBlackKernel };
+	for (int k = 0; k < 3; k++) {
+		cl_error  = clSetKernelArg(solverKernels[k], 0, sizeof(cl_mem), (void*)&m_d_Img_1);
+		cl_error |= clSetKernelArg(solverKernels[k], 1, sizeof(cl_mem), (void*)&m_d_Img_2);
 
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 4, sizeof(cl_mem), (void*)&m_d_u);
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 5, sizeof(cl_mem), (void*)&m_d_v);
+		cl_error |= clSetKernelArg(solverKernels[k], 4, sizeof(cl_mem), (void*)&m_d_u);
+		cl_error |= clSetKernelArg(solverKernels[k], 5, sizeof(cl_mem), (void*)&m_d_v);
 
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 8, sizeof(cl_float), (void*)&m_alpha);
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 9, sizeof(cl_float), (void*)&m_omega);
+		cl_error |= clSetKernelArg(solverKernels[k], 8, sizeof(cl_float), (void*)&m_alpha);
+		cl_error |= clSetKernelArg(solverKernels[k], 9, sizeof(cl_float), (void*)&m_omega);
 
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 12, sizeof(cl_int), (void*)&pitch);
+		cl_error |= clSetKernelArg(solverKernels[k], 12, sizeof(cl_int), (void*)&pitch);
 
-	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+		V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+	}
 
 	return true;
 }
@@ -109,6 +123,8 @@ void GPUOptimizedOpticalFlow::releaseResources()
 
 	SAFE_RELEASE_KERNEL(m_clZeroKernel);
 	SAFE_RELEASE_KERNEL(m_clOptimizedSolverKernel);
+	SAFE_RELEASE_KERNEL(m_clOptimizedSolverTemporalKernel);
+	SAFE_RELEASE_KERNEL(m_clOptimizedSolverRedBlackKernel);
 	SAFE_RELEASE_PROGRAM(m_clProgram);
 }
 
@@ -128,13 +144,21 @@ void GPUOptimizedOpticalFlow::computeFlow(Image& u, Image& v)
 	Image du(m_source_img_1.width(), m_source_img_1.height());			// x-component of flow increment
 	Image dv(m_source_img_1.width(), m_source_img_1.height());			// y-component of flow increment
 
-	int current_warp_level = min(m_warp_levels, computeMaxWarpLevels()) - 1;
+	// host side of the transfers of solveDifference
+	pinImage(img_1_res);
+	pinImage(img_2_br);
+	pinImage(du);
+	pinImage(dv);
+
+	int current_warp_level = startWarpLevel();
 
-	// initialize output flow arrays
-	u.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 0, 0);
-	v.reinit(m_source_img_1.width(), m_source_img_1.height(), 1, 1, 0, 0);
+	// initialize output flow arrays, with the initial flow for a warm start
+	initializeFlow(u, v, 0);
 
 	while (current_warp_level >= 0) {
+		Profiler::setLevel(current_warp_level);
+		TIMING_LEVEL(current_warp_level);
+
 		// compute level sizes
 		level_width = static_cast<int>(ceil(m_source_img_1.width() * pow(m_warp_scale, current_warp_level)));
 		level_height = static_cast<int>(ceil(m_source_img_1.height() * pow(m_warp_scale, current_warp_level)));
@@ -144,6 +168,7 @@ void GPUOptimizedOpticalFlow::computeFlow(Image& u, Image& v)
 		std::cout << "Solve level: " << current_warp_level << " (" << level_width << "x" << level_height << ") \t "; // << std::endl;
 
 		// perform resampling of images
+		TIMING_BEGIN("pyramid");
 		if (current_warp_level == 0) {
 			img_1_res = m_source_img_1;
 			img_2_res = m_source_img_2;
@@ -156,16 +181,21 @@ void GPUOptimizedOpticalFlow::computeFlow(Image& u, Image& v)
 		Image::resampleAreaBasedWithoutReallocating(v, dv, level_width, level_height);
 		u = du;
 		v = dv;
+		TIMING_END();
 
 		// perform backward registration
+		TIMING_BEGIN("warp");
 		Image::backwardRegistration(img_1_res, img_2_res, img_2_br, u, v, hx, hy);
+		TIMING_END();
 
 		// solve difference problem at current resolution to obtain increment
 		solveDifference(img_1_res, img_2_br, du, dv, u, v, hx, hy);
    
 		// add solved increment to the global flow
+		TIMING_BEGIN("add");
 		u += du;
 		v += dv;
+		TIMING_END();
 
 		// go to the next level
 		current_warp_level--;
@@ -184,52 +214,99 @@ void GPUOptimizedOpticalFlow::solveDifference(Image& img_1, Image& img_2, Image&
 	dv.setActualSize(width, height);
 	
 	// copy data to device
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_1, CL_FALSE, 0, m_data_size, img_1.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_2, CL_FALSE, 0, m_data_size, img_2.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_u	, CL_FALSE, 0, m_data_size, u.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
-	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_v	, CL_FALSE, 0, m_data_size, v.data_ptr(), 0, NULL, NULL), "Error copying input data to device!");
+	TIMING_BEGIN("upload");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_1, CL_FALSE, 0, m_data_size, img_1.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_Img_2, CL_FALSE, 0, m_data_size, img_2.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_u	, CL_FALSE, 0, m_data_size, u.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
+	V_RETURN_CL(clEnqueueWriteBuffer(m_clCommandQueue, m_d_v	, CL_FALSE, 0, m_data_size, v.data_ptr(), 0, NULL, Profiler::event("WriteBuffer")), "Error copying input data to device!");
 
 	// we run Zero kernel to initialize du and dv with zeros
 	size_t globalWorkSizeZeroKernel = m_data_size / sizeof(float);
 	V_RETURN_CL(clSetKernelArg(m_clZeroKernel, 0, sizeof(cl_mem), (void*)&m_d_du), "Error setting kernel arguments");
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clZeroKernel, 1, NULL, &globalWorkSizeZeroKernel, NULL, 0, NULL, NULL), "Error executing kernel!");
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clZeroKernel, 1, NULL, &globalWorkSizeZeroKernel, NULL, 0, NULL, Profiler::event(m_clZeroKernel)), "Error executing kernel!");
 	V_RETURN_CL(clSetKernelArg(m_clZeroKernel, 0, sizeof(cl_mem), (void*)&m_d_dv), "Error setting kernel arguments");
-	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clZeroKernel, 1, NULL, &globalWorkSizeZeroKernel, NULL, 0, NULL, NULL), "Error executing kernel!");
+	V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clZeroKernel, 1, NULL, &globalWorkSizeZeroKernel, NULL, 0, NULL, Profiler::event(m_clZeroKernel)), "Error executing kernel!");
 
 	// wait until all data are prepaired
 	clFinish(m_clCommandQueue);
+	TIMING_END();
 
-	cl_error  = clSetKernelArg(m_clOptimizedSolverKernel, 6, sizeof(cl_float), (void*)&hx);
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 7, sizeof(cl_float), (void*)&hy);
+	TIMING_BEGIN("solve");
+	TIMING_COUNT("pixel updates", (double)width * height * solverIterations());
 
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 10, sizeof(cl_int), (void*)&width);
-	cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 11, sizeof(cl_int), (void*)&height);
-	V_RETURN_CL(cl_error, "Error setting kernel arguments");
+	cl_kernel solverKernels[3] = { m_clOptimizedSolverKernel, m_clOptimizedSolverTemporalKernel, m_clOptimizedSolverRedBlackKernel };
+	for (int k = 0; k < 3; k++) {
+		cl_error  = clSetKernelArg(solverKernels[k], 6, sizeof(cl_float), (void*)&hx);
+		cl_error |= clSetKernelArg(solverKernels[k], 7, sizeof(cl_float), (void*)&hy);
 
-	size_t globalWorkSize[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[0]) };
+		cl_error |= clSetKernelArg(solverKernels[k], 10, sizeof(cl_int), (void*)&width);
+		cl_error |= clSetKernelArg(solverKernels[k], 11, sizeof(cl_int), (void*)&height);
+		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+	}
+
+	size_t globalWorkSize[2] = { GetGlobalWorkSize(width, m_localWorkSize[0]), GetGlobalWorkSize(height, m_localWorkSize[1]) };
 
 	CTimer timer;
 	timer.Start();
-	// run kernel many times	
-	for (int i = 0; i < m_solver_iterations; i++) {
-		// bind input and output buffers
-		cl_error  = clSetKernelArg(m_clOptimizedSolverKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
-		cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
-
-		cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 13, sizeof(cl_mem), (void*)&m_d_du_r);
-		cl_error |= clSetKernelArg(m_clOptimizedSolverKernel, 14, sizeof(cl_mem), (void*)&m_d_dv_r);
-
-		V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clOptimizedSolverKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, NULL), "Error executing kernel!");
-
-		// swap input and output pointers (ping-ponging)
-		std::swap(m_d_du, m_d_du_r);
-		std::swap(m_d_dv, m_d_dv_r);
+	if (m_scheme == SOLVER_RED_BLACK) {
+		// increments are updated in place, buffers are bound once
+		cl_error  = clSetKernelArg(m_clOptimizedSolverRedBlackKernel, 2, sizeof(cl_mem), (void*)&m_d_du);
+		cl_error |= clSetKernelArg(m_clOptimizedSolverRedBlackKernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
+		V_RETURN_CL(cl_error, "Error setting kernel arguments");
+
+		for (int i = 0; i < solverIterations(); i++) {
+			// red pixels first, then black pixels using the updated red ones
+			for (int color = 0; color < 2; color++) {
+				V_RETURN_CL(clSetKernelArg(m_clOptimizedSolverRedBlackKernel, 13, sizeof(cl_int), (void*)&color), "Error setting kernel arguments");
+				V_RETURN_CL(clEnqueueNDRangeKernel(m_clCommandQueue, m_clOptimizedSolverRedBlackKernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(m_clOptimizedSolverRedBlackKernel)), "Error executing kernel!");
+			}
+		}
+	} else {
+		// run kernel many times: every temporal launch performs m_temporal_iterations iterations,
+		// the remainder is done with the single iteration kernel
+		int temporal_launches = (m_temporal_iterations > 1) ? solverIterations() / m_temporal_iterations : 0;
+		int single_launches = solverIterations() - temporal_launches * m_temporal_iterations;
+
+		for (int i = 0; i < temporal_launches; i++) {
+			if (!runSolverKernel(m_clOptimizedSolverTemporalKernel, globalWorkSize)) {
+				return;
+			}
+		}
+		for (int i = 0; i < single_launches; i++) {
+			if (!runSolverKernel(m_clOptimizedSolverKernel, globalWorkSize)) {
+				return;
+			}
+		}
 	}
 	clFinish(m_clCommandQueue);
+	TIMING_END();
 	timer.Stop();
 	std::cout << timer.GetElapsedTime() << std::endl;
 
 	// copy data back to host
-	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_du, CL_TRUE, 0, m_data_size, du.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
-	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_dv, CL_TRUE, 0, m_data_size, dv.data_ptr(), 0, NULL, NULL), "Error reading back results from the device!");
+	TIMING_BEGIN("readback");
+	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_du, CL_TRUE, 0, m_data_size, du.data_ptr(), 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	V_RETURN_CL(clEnqueueReadBuffer(m_clCommandQueue, m_d_dv, CL_TRUE, 0, m_data_size, dv.data_ptr(), 0, NULL, Profiler::event("ReadBuffer")), "Error reading back results from the device!");
+	TIMING_END();
+}
+
+bool GPUOptimizedOpticalFlow::runSolverKernel(cl_kernel kernel, size_t globalWorkSize[2])
+{
+	cl_int cl_error;
+
+	// bind input and output buffers
+	cl_error  = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&m_d_du);
+	cl_error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)&m_d_dv);
+
+	cl_error |= clSetKernelArg(kernel, 13, sizeof(cl_mem), (void*)&m_d_du_r);
+	cl_error |= clSetKernelArg(kernel, 14, sizeof(cl_mem), (void*)&m_d_dv_r);
+	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments");
+
+	V_RETURN_FALSE_CL(clEnqueueNDRangeKernel(m_clCommandQueue, kernel, 2, NULL, globalWorkSize, m_localWorkSize, 0, NULL, Profiler::event(kernel)), "Error executing kernel!");
+
+	// swap input and output pointers (ping-ponging)
+	std::swap(m_d_du, m_d_du_r);
+	std::swap(m_d_dv, m_d_dv_r);
+
+	return true;
 }
@@ -13,6 +13,8 @@ private:
 
 	cl_program m_clProgram;
 	cl_kernel m_clOptimizedSolverKernel;
+	cl_kernel m_clOptimizedSolverTemporalKernel;
+	cl_kernel m_clOptimizedSolverRedBlackKernel;
 	cl_kernel m_clZeroKernel;
 
 	cl_mem m_d_Img_1;
@@ -25,9 +27,11 @@ private:
 	cl_mem m_d_v;
 
 	size_t m_data_size;
+	int m_temporal_iterations;	// solver iterations performed in local memory per kernel launch
+	SolverScheme m_scheme;
 public:
 	GPUOptimizedOpticalFlow(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
-		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2]);
+		cl_context clContext, cl_command_queue clCommandQueue, int localWorkSize[2], int temporal_iterations = 1, SolverScheme scheme = SOLVER_JACOBI);
 	~GPUOptimizedOpticalFlow();
 
 	void computeFlow(Image& u, Image& v);
@@ -35,5 +39,6 @@ public:
 	void releaseResources();
 private:
 	void solveDifference(Image& img_1, Image& img_2, Image& du, Image& dv, Image& u, Image& v, float hx, float hy);
+	bool runSolverKernel(cl_kernel kernel, size_t globalWorkSize[2]);
 };
 
@@ -1,4 +1,6 @@
 #include "Image.h"
+#include "Common.h"
+#include "Timing.h"
 
 #include <fstream>
 #include <iostream>
@@ -12,25 +14,46 @@
 #define TAG_FLOAT 202021.25
 
 Image::Image() 
-	: m_width(0), m_height(0), m_actual_width(0), m_actual_height(0), m_pitch(0), m_bx(0), m_by(0), m_data(NULL)
+	: m_width(0), m_height(0), m_actual_width(0), m_actual_height(0), m_pitch(0), m_bx(0), m_by(0), m_data(NULL), m_pinned(NULL), m_pinned_queue(NULL), m_external(false), m_pin_context(NULL), m_pin_queue(NULL)
 {
 
 }
 
 Image::Image(int width, int height)
-	: m_width(width), m_height(height), m_actual_width(width), m_actual_height(height), m_pitch(0), m_bx(0), m_by(0), m_data(NULL)
+	: m_width(width), m_height(height), m_actual_width(width), m_actual_height(height), m_pitch(0), m_bx(0), m_by(0), m_data(NULL), m_pinned(NULL), m_pinned_queue(NULL), m_external(false), m_pin_context(NULL), m_pin_queue(NULL)
 {
 	allocateDataMemoryWithPadding();
 	zeroData();
 }
 
 Image::Image(int width, int height, int bx, int by)
-	: m_width(width), m_height(height), m_actual_width(width), m_actual_height(height), m_pitch(0), m_bx(bx), m_by(by), m_data(NULL)
+	: m_width(width), m_height(height), m_actual_width(width), m_actual_height(height), m_pitch(0), m_bx(bx), m_by(by), m_data(NULL), m_pinned(NULL), m_pinned_queue(NULL), m_external(false), m_pin_context(NULL), m_pin_queue(NULL)
 {
 	allocateDataMemoryWithPadding();
 	zeroData();
 }
 
+Image::Image(float* data, int width, int height, int pitch, int bx, int by)
+	: m_width(0), m_height(0), m_actual_width(0), m_actual_height(0), m_pitch(0), m_bx(0), m_by(0), m_data(NULL), m_pinned(NULL), m_pinned_queue(NULL), m_external(false), m_pin_context(NULL), m_pin_queue(NULL)
+{
+	wrap(data, width, height, pitch, bx, by);
+}
+
+void Image::wrap(float* data, int width, int height, int pitch, int bx, int by)
+{
+	_ASSERTE(pitch >= width + 2 * bx);
+	releaseDataMemory();
+	m_width = width;
+	m_height = height;
+	m_actual_width = width;
+	m_actual_height = height;
+	m_pitch = pitch;
+	m_bx = bx;
+	m_by = by;
+	m_data = data;
+	m_external = true;
+}
+
 void Image::reinit(int width, int height, int actual_width, int actual_height, int bx, int by)
 {
 	m_width = width;
@@ -44,16 +67,11 @@ void Image::reinit(int width, int height, int actual_width, int actual_height, i
 }
 
 
-bool Image::readImagePGM(std::string filename)
+bool Image::readPGMHeader(std::istream& file, int& width, int& height)
 {
 	const unsigned int size = 256;
 	char str[size];
-	std::fstream file(filename.c_str(), std::ios::in | std::ios::binary);
 
-	if (!file) {
-		std::cout << "Cannot read file: " << filename << std::endl;
-		return false;
-	}
 	file.getline(str, size); // Type: PGM
 	file.getline(str, size); // Created by
 	while (str[0] == '#') {
@@ -61,16 +79,29 @@ bool Image::readImagePGM(std::string filename)
 	}
 	// Image width and height
 	#ifdef _WIN32   // Windows version
-		sscanf_s(str, "%d %d", &m_width, &m_height);
+		int fields = sscanf_s(str, "%d %d", &width, &height);
 	#else           // Linux version
-		sscanf(str, "%d %d", &m_width, &m_height);
+		int fields = sscanf(str, "%d %d", &width, &height);
 	#endif
 
+	file.getline(str, size); // Max value
+
+	return fields == 2 && file.good();
+}
+
+bool Image::readImagePGM(std::string filename)
+{
+	std::fstream file(filename.c_str(), std::ios::in | std::ios::binary);
+
+	if (!file) {
+		std::cout << "Cannot read file: " << filename << std::endl;
+		return false;
+	}
+	readPGMHeader(file, m_width, m_height);
+
 	m_actual_width = m_width;
 	m_actual_height = m_height;
 
-	file.getline(str, size); // Max value
-
 	// Last position
 	std::streampos pos = file.tellg();
 
@@ -92,6 +123,57 @@ bool Image::readImagePGM(std::string filename)
 	return true;
 }
 
+bool Image::readImagePGMSize(std::string filename, int& width, int& height)
+{
+	std::fstream file(filename.c_str(), std::ios::in | std::ios::binary);
+
+	if (!file || !readPGMHeader(file, width, height)) {
+		std::cout << "Cannot read file: " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool Image::readImagePGMRegion(std::string filename, int x, int y, int width, int height)
+{
+	std::fstream file(filename.c_str(), std::ios::in | std::ios::binary);
+
+	int file_width = 0;
+	int file_height = 0;
+	if (!file || !readPGMHeader(file, file_width, file_height)) {
+		std::cout << "Cannot read file: " << filename << std::endl;
+		return false;
+	}
+	if (x < 0 || y < 0 || x + width > file_width || y + height > file_height) {
+		std::cout << "Region (" << x << ", " << y << ", " << width << "x" << height << ") is outside of " << filename << std::endl;
+		return false;
+	}
+
+	if (m_data == NULL || m_width != width || m_height != height) {
+		m_width = width;
+		m_height = height;
+		allocateDataMemoryWithPadding();
+	}
+	m_actual_width = width;
+	m_actual_height = height;
+
+	// rows are one byte per pixel, the offset of a row in a gigapixel file exceeds 32 bits
+	std::streamoff data_offset = file.tellg();
+	unsigned char* buf = new unsigned char[width];
+
+	for (int row = 0; row < height; row++) {
+		file.seekg(data_offset + (std::streamoff)(y + row) * file_width + x, std::ios::beg);
+		file.read(reinterpret_cast<char*>(buf), width * sizeof(unsigned char));
+		for (int col = 0; col < width; col++) {
+			m_data[IND(col, row)] = buf[col];
+		}
+	}
+
+	delete[] buf;
+
+	return file.good();
+}
+
 bool Image::writeImagePGM(std::string filename)
 {
 	_ASSERTE(m_data != NULL);
@@ -217,6 +299,47 @@ bool Image::readMiddlFlowFile(std::string filename, Image& u, Image& v)
 	return true;
 }
 
+bool Image::writeMiddlFlowFile(std::string filename, const Image& u, const Image& v)
+{
+	const char *dot = strrchr(filename.c_str(), '.');
+	if (dot == NULL || strcmp(dot, ".flo") != 0) {
+		std::cout << "WriteFlowFile (" + filename + "): extension .flo is expected" << std::endl;
+		return false;
+	}
+
+	FILE *stream = fopen(filename.c_str(), "wb");
+	if (stream == 0) {
+		std::cout << "WriteFlowFile: could not open " + filename << std::endl;
+		return false;
+	}
+
+	int width = u.actual_width();
+	int height = u.actual_height();
+	float tag = TAG_FLOAT;
+
+	bool ok = (fwrite(&tag, sizeof(float), 1, stream) == 1) &&
+			  (fwrite(&width, sizeof(int), 1, stream) == 1) &&
+			  (fwrite(&height, sizeof(int), 1, stream) == 1);
+
+	float* ptr = new float[2 * width];
+
+	for (int y = 0; ok && y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			ptr[2 * x] = u.pixel_r(x, y);
+			ptr[2 * x + 1] = v.pixel_r(x, y);
+		}
+		ok = (fwrite(ptr, sizeof(float), 2 * width, stream) == (size_t)(2 * width));
+	}
+
+	delete[] ptr;
+	fclose(stream);
+
+	if (!ok) {
+		std::cout << "WriteFlowFile: problem writing file " + filename << std::endl;
+	}
+	return ok;
+}
+
 void Image::fillBoudaries()
 {
 	_ASSERTE(m_data != NULL);
@@ -283,6 +406,7 @@ void Image::resample(const Image& src, Image& dst, float scale)
 
 void Image::resampleWithoutReallocating(const Image& src, Image& dst, int dst_width, int dst_height)
 {
+	TIMING_SCOPE("resampleWithoutReallocating");
 	_ASSERTE(dst.m_width >= dst_width && dst.m_height >= dst_height);
 	
 	dst.m_actual_width = dst_width;
@@ -529,6 +653,7 @@ const Image& src,	/* in   : input image					 */
 
 void Image::resampleAreaBasedWithoutReallocating(const Image& src, Image& dst, int dst_width, int dst_height)
 {
+	TIMING_SCOPE("resampleAreaBased");
 	_ASSERTE(dst.m_width >= dst_width && dst.m_height >= dst_height);
 
 	dst.m_actual_width = dst_width;
@@ -562,6 +687,8 @@ void Image::backwardRegistration(const Image& src1, // in	: 1st image
 	float yy_fp, xx_fp;         // subpixel coordinates                           
 	float delta_y, delta_x;     // subpixel displacement                          
 
+	TIMING_SCOPE("backwardRegistration");
+
 	float hx_1 = 1.f / hx;
 	float hy_1 = 1.f / hy;
 
@@ -604,6 +731,52 @@ void Image::backwardRegistration(const Image& src1, // in	: 1st image
 	}
 }
 
+/**
+* Every vector of (u, v) is moved along itself to the nearest pixel of the next frame, vectors meeting in a pixel
+* are averaged, pixels no vector reaches (disocclusions) keep the flow of the current frame
+*/
+void Image::forwardWarpFlow(const Image& u,		// in	: x-component of flow field (current frame)
+							const Image& v,		// in	: y-component of flow field (current frame)
+								  Image& u_next,// out	: x-component of predicted flow field (next frame)
+								  Image& v_next)// out	: y-component of predicted flow field (next frame)
+{
+	int width = u.m_actual_width;
+	int height = u.m_actual_height;
+
+	TIMING_SCOPE("forwardWarpFlow");
+
+	u_next.reinit(width, height, width, height, 1, 1);
+	v_next.reinit(width, height, width, height, 1, 1);
+	Image weight(width, height);
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float fu = u.pixel_r(x, y);
+			float fv = v.pixel_r(x, y);
+			int xx = static_cast<int>(std::floor(x + fu + 0.5f));
+			int yy = static_cast<int>(std::floor(y + fv + 0.5f));
+			if (xx >= 0 && xx < width && yy >= 0 && yy < height) {
+				u_next.pixel_w(xx, yy) += fu;
+				v_next.pixel_w(xx, yy) += fv;
+				weight.pixel_w(xx, yy) += 1.f;
+			}
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float w = weight.pixel_r(x, y);
+			if (w > 0.f) {
+				u_next.pixel_w(x, y) /= w;
+				v_next.pixel_w(x, y) /= w;
+			} else {
+				u_next.pixel_w(x, y) = u.pixel_r(x, y);
+				v_next.pixel_w(x, y) = v.pixel_r(x, y);
+			}
+		}
+	}
+}
+
 Image& Image::operator+= (const Image& image) 
 {
 	_ASSERTE(this->m_actual_width == image.m_actual_width && this->m_actual_height == image.m_actual_height);
@@ -750,6 +923,21 @@ RGBColor ConvertToRGB(float x, float y)
 	return rgb;
 }
 
+unsigned char Image::syntheticTexture(float x, float y)
+{
+	return (unsigned char)(128.f + 60.f * sinf(0.11f * x) * cosf(0.07f * y) + 40.f * sinf(0.013f * (x + y)));
+}
+
+void Image::fillSyntheticPair(Image& img1, Image& img2, float u, float v)
+{
+	for (int y = 0; y < img1.height(); y++) {
+		for (int x = 0; x < img1.width(); x++) {
+			img1.pixel_w(x, y) = syntheticTexture((float)x, (float)y);
+			img2.pixel_w(x, y) = syntheticTexture(x - u, y - v);
+		}
+	}
+}
+
 void Image::saveOpticalFlowRGB(const Image& u, const Image& v, float flow_scale, std::string filename)
 {
 	std::ofstream file(filename.c_str(), std::ios_base::binary);
@@ -785,18 +973,65 @@ void Image::allocateDataMemoryWithPadding()
 		return;
 	}
 
-	if (m_data) {
-		delete[] m_data;
-	}
+	releaseDataMemory();
+
 	// Fullwidth with boundary pixels
 	int fullWidth = m_width + m_bx * 2;
 	m_pitch = (fullWidth % 32 == 0) ? fullWidth : fullWidth + 32 - (fullWidth % 32);
-	m_data = new float[m_pitch * (m_height  + 2 * m_by)];
+	size_t size = elements() * sizeof(float);
+
+	if (m_pin_context) {
+		// the buffer stays mapped for its whole lifetime, the host works on the mapped pointer
+		cl_int cl_error;
+		m_pinned = clCreateBuffer(m_pin_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, &cl_error);
+		if (cl_error == CL_SUCCESS) {
+			m_data = (float*)clEnqueueMapBuffer(m_pin_queue, m_pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size, 0, NULL, NULL, &cl_error);
+		}
+		if (cl_error == CL_SUCCESS) {
+			m_pinned_queue = m_pin_queue;
+			return;
+		}
+		// fall back to pageable memory
+		std::cout << "Error: Failed to allocate pinned host memory [" << errorToString(cl_error) << "]" << std::endl;
+		SAFE_RELEASE_MEMOBJECT(m_pinned);
+	}
+	m_data = new float[elements()];
 }
 
-Image::~Image()
+void Image::setPinned(cl_context context, cl_command_queue queue)
 {
-	if (m_data) {
-		delete[] m_data;
+	bool move = (m_data != NULL && !m_external && context != m_pin_context);
+	m_pin_context = context;
+	m_pin_queue = queue;
+	if (!move) {
+		return;
 	}
+
+	// reallocate with the new setting and keep the pixels
+	Image old;
+	swap_data(old);
+	allocateDataMemoryWithPadding();
+	std::memcpy(m_data, old.m_data, elements() * sizeof(float));
+}
+
+void Image::releaseDataMemory()
+{
+	if (m_external) {
+		m_data = NULL;
+		m_external = false;
+		return;
+	}
+	if (m_pinned) {
+		clEnqueueUnmapMemObject(m_pinned_queue, m_pinned, m_data, 0, NULL, NULL);
+		clFinish(m_pinned_queue);
+		SAFE_RELEASE_MEMOBJECT(m_pinned);
+		m_pinned_queue = NULL;
+		m_data = NULL;
+	}
+	SAFE_DELETE_ARRAY(m_data);
+}
+
+Image::~Image()
+{
+	releaseDataMemory();
 }
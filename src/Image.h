@@ -1,12 +1,21 @@
 #pragma once
 
 #include <string>
+// cl_mem and cl_command_queue of the pinned allocation
+#if defined(WIN32)
+	#include <CL/cl.h>
+#elif defined (__APPLE__) || defined(MACOSX)
+	#include <OpenCL/cl.h>
+#else
+	#include <CL/cl.h>
+#endif
 // Linux declaration
 #ifndef _WIN32 
 	#include <cstring>
 #endif
 
-#define IND(X, Y) (((Y) + m_by) * m_pitch + ((X) + m_bx))
+// 64-bit index, a padded gigapixel image exceeds the int range
+#define IND(X, Y) ((size_t)((Y) + m_by) * m_pitch + ((X) + m_bx))
 
 class Image
 {
@@ -20,11 +29,19 @@ private:
 	int m_by;			// Boudary size Y
 
 	float* m_data;	// Image data
+	cl_mem m_pinned;				// buffer backing m_data when allocated from pinned memory, NULL otherwise
+	cl_command_queue m_pinned_queue;// queue the buffer is mapped on
+	bool m_external;				// m_data is memory of the caller (view), never released here
+
+	cl_context m_pin_context;		// allocations of this image use pinned memory of this context, NULL: new[]
+	cl_command_queue m_pin_queue;	// queue the pinned allocations are mapped on
 
 public:
 	Image();
 	Image(int width, int height);
 	Image(int width, int height, int bx, int by);
+	/* view of caller memory without copying: pixel (x, y) is data[(y + by) * pitch + x + bx], pitch in floats */
+	Image(float* data, int width, int height, int pitch, int bx = 0, int by = 0);
 	~Image();
 
 	/* returns reference to pixel in data array w - write / r - read */
@@ -39,7 +56,18 @@ public:
 	inline int actual_width() const { return m_actual_width; };
 	inline int actual_height() const { return m_actual_height; };
 	inline float* data_ptr() { return m_data; };
-	void swap_data(Image& swap) { std::swap(this->m_data, swap.m_data); };
+	inline bool pinned() const { return m_pinned != NULL; };
+	inline bool external() const { return m_external; };
+	void swap_data(Image& swap) { std::swap(this->m_data, swap.m_data); std::swap(this->m_pinned, swap.m_pinned); std::swap(this->m_pinned_queue, swap.m_pinned_queue); std::swap(this->m_external, swap.m_external); };
+
+	/* turns the image into a view of caller memory (see the view constructor), its own data is released;
+	   reinit allocates own memory again */
+	void wrap(float* data, int width, int height, int pitch, int bx = 0, int by = 0);
+
+	/* the image keeps its data in a mapped CL_MEM_ALLOC_HOST_PTR buffer (page-locked) of the context, so host <-> device
+	   copies don't need a driver side staging copy; current data is moved, later reallocations stay pinned.
+	   NULL context switches back to new[]. The image must be released before the context */
+	void setPinned(cl_context context, cl_command_queue queue);
 
 	void reinit(int width, int height, int actual_width, int actual_height, int bx, int by);
 	void setActualWidth(int width) { m_actual_width = width; };
@@ -48,12 +76,19 @@ public:
 	
 	/* fills boudaries with mirrored image */
 	void fillBoudaries();
-	void zeroData() { if (m_data) std::memset(m_data, 0, (m_height + 2 * m_by) * m_pitch * sizeof(float)); };
+	void zeroData() { if (m_data) std::memset(m_data, 0, elements() * sizeof(float)); };
+	/* number of floats in the data array (padding and borders included) */
+	inline size_t elements() const { return (size_t)m_pitch * (m_height + 2 * m_by); };
 
 	bool readImagePGM(std::string filename);
+	/* reads the size from the header of a binary PGM file without loading the pixels */
+	static bool readImagePGMSize(std::string filename, int& width, int& height);
+	/* loads the region (x, y, width, height) of a binary PGM file, the image is reallocated only if its size differs */
+	bool readImagePGMRegion(std::string filename, int x, int y, int width, int height);
 	bool writeImagePGM(std::string filename);
 	bool writeImagePGMwithBoundaries(std::string filename);
 	static bool readMiddlFlowFile(std::string filename, Image& u, Image& v);
+	static bool writeMiddlFlowFile(std::string filename, const Image& u, const Image& v);
 
 	static void resample(const Image& src, Image& dst, float scale);
 	static void resampleWithoutReallocating(const Image& src, Image& dst, int dst_width, int dst_height);
@@ -62,12 +97,23 @@ public:
 
 	static void backwardRegistration(const Image& src1, const Image& src2, Image& dst2, const Image& u, const Image& v, float hx, float hy);
 
+	/* flow of the next frame predicted from the flow of the current one (constant motion), u_next and v_next
+	   must not be u and v */
+	static void forwardWarpFlow(const Image& u, const Image& v, Image& u_next, Image& v_next);
+
 	static void saveOpticalFlowRGB(const Image& u, const Image& v, float flow_scale, std::string filename);
 
+	/* smooth texture with several frequencies (8-bit range) of the synthetic test pairs, I_2(x, y) = I_1(x - u, y - v) */
+	static unsigned char syntheticTexture(float x, float y);
+	/* img1 gets the synthetic texture, img2 the texture translated by (u, v); borders are not filled */
+	static void fillSyntheticPair(Image& img1, Image& img2, float u, float v);
+
 	Image& operator+= (const Image& image);
 	Image& operator= (const Image& image);
 
 private:
+	static bool readPGMHeader(std::istream& file, int& width, int& height);
 	void allocateDataMemoryWithPadding();
+	void releaseDataMemory();
 };
 
@@ -1,5 +1,8 @@
 #include "OpticalFlowBase.h"
 
+#include <algorithm>
+#include <iostream>
+
 // Linux declaration
 #ifndef _WIN32 
 	#include <cmath>
@@ -8,35 +11,110 @@
 
 OpticalFlowBase::OpticalFlowBase(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega)
 	: m_source_img_1(img1), m_source_img_2(img2), m_warp_levels(warp_levels), m_warp_scale(warp_scale), m_solver_iterations(solver_iterations),
-	m_alpha(alpha), m_omega(omega)
+	m_alpha(alpha), m_omega(omega), m_initial_u(NULL), m_initial_v(NULL), m_warm_levels(0), m_warm_iterations(0),
+	m_residual_report(false), m_pin_context(NULL), m_pin_queue(NULL)
 {	
 }
 
-int OpticalFlowBase::computeMaxWarpLevels() const
+void OpticalFlowBase::pinImage(Image& image) const
+{
+	if (m_pin_context) {
+		image.setPinned(m_pin_context, m_pin_queue);
+	}
+}
+
+void OpticalFlowBase::setInitialFlow(const Image* u, const Image* v, int warm_levels, int warm_iterations)
+{
+	bool valid = u && v && u->actual_width() == m_source_img_1.width() && u->actual_height() == m_source_img_1.height() &&
+				 v->actual_width() == m_source_img_1.width() && v->actual_height() == m_source_img_1.height();
+	if (u && !valid) {
+		std::cout << "Initial flow differs in size from the source images, cold start" << std::endl;
+	}
+	m_initial_u = valid ? u : NULL;
+	m_initial_v = valid ? v : NULL;
+	m_warm_levels = std::max(warm_levels, 1);
+	m_warm_iterations = std::max(warm_iterations, 0);
+}
+
+int OpticalFlowBase::startWarpLevel() const
+{
+	int levels = computeMaxWarpLevels(m_source_img_1.width(), m_source_img_1.height(), m_warp_scale, m_warp_levels);
+	if (warmStart()) {
+		levels = std::min(levels, m_warm_levels);
+	}
+	return levels - 1;
+}
+
+int OpticalFlowBase::solverIterations() const
+{
+	return (warmStart() && m_warm_iterations > 0) ? m_warm_iterations : m_solver_iterations;
+}
+
+void OpticalFlowBase::initializeFlow(Image& u, Image& v, int border) const
+{
+	int width = m_source_img_1.width();
+	int height = m_source_img_1.height();
+
+	if (warmStart()) {
+		u.reinit(width, height, width, height, border, border);
+		v.reinit(width, height, width, height, border, border);
+		u = *m_initial_u;
+		v = *m_initial_v;
+	} else {
+		u.reinit(width, height, 1, 1, border, border);
+		v.reinit(width, height, 1, 1, border, border);
+	}
+}
+
+void OpticalFlowBase::recordResidual(const Image& img_1, const Image& img_2, const Image& du, const Image& dv, const Image& u, const Image& v, float hx, float hy)
+{
+	int width = img_1.actual_width();
+	int height = img_1.actual_height();
+	float hx_2 = m_alpha / (hx * hx);
+	float hy_2 = m_alpha / (hy * hy);
+
+	// same discretization as the solvers: (J11 + sum) du + J12 dv = -J13 + smoothness terms, likewise for dv
+	double norm = 0.0;
+	#pragma omp parallel for reduction(+:norm)
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float fx = (img_1.pixel_r(x + 1, y) - img_1.pixel_r(x - 1, y) + img_2.pixel_r(x + 1, y) - img_2.pixel_r(x - 1, y)) / (4.f * hx);
+			float fy = (img_1.pixel_r(x, y + 1) - img_1.pixel_r(x, y - 1) + img_2.pixel_r(x, y + 1) - img_2.pixel_r(x, y - 1)) / (4.f * hy);
+			float ft = img_2.pixel_r(x, y) - img_1.pixel_r(x, y);
+
+			float xp = (x < width - 1)	* hx_2;
+			float xm = (x > 0)			* hx_2;
+			float yp = (y < height - 1)	* hy_2;
+			float ym = (y > 0)			* hy_2;
+			float sum = xp + xm + yp + ym;
+
+			float ru = -fx * ft - fx * fy * dv.pixel_r(x, y) - (fx * fx + sum) * du.pixel_r(x, y) +
+					   yp * (u.pixel_r(x, y + 1) - u.pixel_r(x, y) + du.pixel_r(x, y + 1)) + ym * (u.pixel_r(x, y - 1) - u.pixel_r(x, y) + du.pixel_r(x, y - 1)) +
+					   xp * (u.pixel_r(x + 1, y) - u.pixel_r(x, y) + du.pixel_r(x + 1, y)) + xm * (u.pixel_r(x - 1, y) - u.pixel_r(x, y) + du.pixel_r(x - 1, y));
+			float rv = -fy * ft - fx * fy * du.pixel_r(x, y) - (fy * fy + sum) * dv.pixel_r(x, y) +
+					   yp * (v.pixel_r(x, y + 1) - v.pixel_r(x, y) + dv.pixel_r(x, y + 1)) + ym * (v.pixel_r(x, y - 1) - v.pixel_r(x, y) + dv.pixel_r(x, y - 1)) +
+					   xp * (v.pixel_r(x + 1, y) - v.pixel_r(x, y) + dv.pixel_r(x + 1, y)) + xm * (v.pixel_r(x - 1, y) - v.pixel_r(x, y) + dv.pixel_r(x - 1, y));
+			norm += (double)ru * ru + (double)rv * rv;
+		}
+	}
+	m_residuals.push_back((float)sqrt(norm));
+}
+
+int OpticalFlowBase::computeMaxWarpLevels(int width, int height, float scale, int levels)
 // compute maximum number of warping levels for given image size and warping 
 // reduction factor 
 {
-	int nx_orig = m_source_img_1.width();
-	int ny_orig = m_source_img_1.height();
-
 	int   i;               // level counter                                 
 	int nx, ny;           // reduced dimensions                            
-	int nx_old, ny_old;   // reduced dimensions                            
-
-	nx_old = nx_orig;
-	ny_old = ny_orig;
 
 	for (i = 1;; i++)
 	{
-		nx = (int) ceil((float) nx_orig * pow(m_warp_scale, i));
-		ny = (int) ceil((float) ny_orig * pow(m_warp_scale, i));
+		nx = (int) ceil((float) width * pow(scale, i));
+		ny = (int) ceil((float) height * pow(scale, i));
 
 		if ((nx<4) || (ny<4)) break;
-
-		nx_old = nx;
-		ny_old = ny;
 	}
 	if ((nx == 1) || (ny == 1)) i--;
 
-	return i;
+	return std::min(levels, i);
 }
@@ -2,6 +2,16 @@
 
 #include "Image.h"
 
+#include <vector>
+
+/* iteration scheme of the linear solver */
+enum SolverScheme
+{
+	SOLVER_JACOBI,		// Jacobi iterations with double buffered increments (du_r, dv_r)
+	SOLVER_RED_BLACK,	// in-place SOR, pixels updated in red-black order
+	SOLVER_LEXICOGRAPHIC// in-place SOR, pixels updated in lexicographic order (CPU only)
+};
+
 class OpticalFlowBase
 {
 protected:
@@ -14,13 +24,56 @@ protected:
 	float	m_alpha;
 	float	m_omega;
 
+	const Image*	m_initial_u;	// warm start, NULL: the pyramid starts from zero flow
+	const Image*	m_initial_v;
+	int		m_warm_levels;
+	int		m_warm_iterations;
+
+	bool	m_residual_report;
+	std::vector<float> m_residuals;	// residual of the linear system before and after every solver iteration of the last level
+
+	cl_context			m_pin_context;	// pinned host memory of the working images, NULL: pageable
+	cl_command_queue	m_pin_queue;
+
 public:
 	OpticalFlowBase(const Image& img1, const Image& img2, int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega);
+	virtual ~OpticalFlowBase() {}
 
 	virtual void computeFlow(Image& u, Image& v) = 0;
 
+	/* warm start of the following computeFlow calls from the flow (u, v) of the source size, e.g. the flow of the
+	   previous frame: only the warm_levels finest levels are solved, with warm_iterations solver iterations
+	   (0: unchanged). (u, v) must not be the output of computeFlow. NULL returns to the cold start */
+	void setInitialFlow(const Image* u, const Image* v, int warm_levels = 3, int warm_iterations = 0);
+
+	/* records the residual of the linear system after every solver iteration (engines with host increments:
+	   CPU and naive, the naive engine reads the increments back after every iteration, see EngineReportsResidual;
+	   the other engines leave residuals() empty); after computeFlow residuals() holds the finest level, the initial residual first */
+	void setResidualReport(bool enable) { m_residual_report = enable; }
+	const std::vector<float>& residuals() const { return m_residuals; }
+
+	/* working images that are copied to and from the device (GPU engines with a host-driven pyramid) are allocated
+	   in pinned memory of the context (see Image::setPinned); NULL context: pageable memory */
+	void setPinnedHostMemory(cl_context context, cl_command_queue queue) { m_pin_context = context; m_pin_queue = queue; }
+
+	/* number of pyramid levels solved for a width x height source with the reduction factor scale: at most levels,
+	   the coarsest level is at least 4x4 */
+	static int computeMaxWarpLevels(int width, int height, float scale, int levels);
+
 protected:
-	int computeMaxWarpLevels() const;
+	/* coarsest level solved by computeFlow */
+	int startWarpLevel() const;
+	/* solver iterations per level of this computeFlow call */
+	int solverIterations() const;
+	bool warmStart() const { return m_initial_u != NULL; };
+	/* output flow of the source size with the given border: the initial flow for a warm start, otherwise the
+	   coarsest level starts from a 1x1 zero flow */
+	void initializeFlow(Image& u, Image& v, int border = 1) const;
+	/* appends the L2 norm of the residual of the linearized Euler-Lagrange equations of the level (boundaries of
+	   img_1 and img_2 filled) for the increments (du, dv) */
+	void recordResidual(const Image& img_1, const Image& img_2, const Image& du, const Image& dv, const Image& u, const Image& v, float hx, float hy);
+	/* moves a working image to pinned memory if setPinnedHostMemory was called */
+	void pinImage(Image& image) const;
 
 };
 
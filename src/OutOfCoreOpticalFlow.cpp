@@ -0,0 +1,182 @@
+#include "OutOfCoreOpticalFlow.h"
+#include "GPUFullOpticalFlow.h"
+#include "CTimer.h"
+#include "Timing.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define TAG_FLOAT 202021.25
+
+OutOfCoreOpticalFlow::OutOfCoreOpticalFlow(int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
+	cl_context clContext, cl_command_queue clCommandQueue, cl_device_id clDevice, int localWorkSize[2],
+	size_t memory_budget, int max_motion)
+	: m_clContext(clContext), m_clCommandQueue(clCommandQueue), m_clDevice(clDevice),
+	  m_warp_levels(warp_levels), m_warp_scale(warp_scale), m_solver_iterations(solver_iterations), m_alpha(alpha), m_omega(omega),
+	  m_memory_budget(memory_budget), m_max_motion(max_motion),
+	  m_planned_width(0), m_planned_height(0), m_window_width(0), m_window_height(0), m_halo(0), m_levels(0), m_tiles(0)
+{
+	m_localWorkSize[0] = localWorkSize[0];
+	m_localWorkSize[1] = localWorkSize[1];
+}
+
+size_t OutOfCoreOpticalFlow::bytesPerPixel()
+{
+	// device (full GPU pipeline, Jacobi): 5 images, 3 flow fields (2 values), motion tensor (8 values)
+	// host: 2 input windows, u and v, interleaved read back buffer (2 values)
+	return (5 + 3 * 2 + 8) * sizeof(cl_float) + (4 + 2) * sizeof(float);
+}
+
+int OutOfCoreOpticalFlow::haloForLevels(int levels) const
+{
+	/* Jacobi iterations move information one pixel of the level per iteration, derivatives and the
+	   bilinear warp read one more pixel; in source pixels this grows with the grid spacing of the level */
+	double halo = m_max_motion;
+	for (int level = 0; level < levels; level++) {
+		halo += (m_solver_iterations + 2) / pow(m_warp_scale, level);
+	}
+	return (int)ceil(halo);
+}
+
+bool OutOfCoreOpticalFlow::planTiles(int width, int height)
+{
+	m_planned_width = 0;
+	m_planned_height = 0;
+
+	// largest window whose padded buffers fit the budget, square unless the image is narrower
+	size_t budget_pixels = m_memory_budget / bytesPerPixel();
+	int side = (int)sqrt((double)budget_pixels) - 32;
+	if (side < 64) {
+		std::cout << "Error: memory budget of " << m_memory_budget << " bytes is too small for a window" << std::endl;
+		return false;
+	}
+	m_window_width = std::min(width, side);
+	m_window_height = (int)std::min((size_t)height, budget_pixels / (m_window_width + 32) - 2);
+
+	if (m_window_width == width && m_window_height == height) {
+		// whole image fits, no halo needed
+		m_halo = 0;
+		m_levels = m_warp_levels;
+		m_tiles = 1;
+	} else {
+		// drop coarse levels until the halo takes at most a quarter of the window on either side
+		int min_side = std::min(m_window_width, m_window_height);
+		m_levels = OpticalFlowBase::computeMaxWarpLevels(m_window_width, m_window_height, m_warp_scale, m_warp_levels);
+		while (m_levels > 1 && 4 * haloForLevels(m_levels) > min_side) {
+			m_levels--;
+		}
+		m_halo = haloForLevels(m_levels);
+		if (4 * m_halo > min_side) {
+			std::cout << "Error: halo of " << m_halo << " pixels does not fit into a " << m_window_width << "x" << m_window_height << " window" << std::endl;
+			return false;
+		}
+
+		int core_width = (m_window_width == width) ? width : m_window_width - 2 * m_halo;
+		int core_height = (m_window_height == height) ? height : m_window_height - 2 * m_halo;
+		m_tiles = ((width + core_width - 1) / core_width) * ((height + core_height - 1) / core_height);
+	}
+
+	m_planned_width = width;
+	m_planned_height = height;
+	std::cout << "Out-of-core: " << width << "x" << height << " in " << m_tiles << " windows of " << m_window_width << "x" << m_window_height
+			  << ", halo " << m_halo << ", " << m_levels << " levels, budget " << m_memory_budget / (1024.0 * 1024.0) << " MB" << std::endl;
+	return true;
+}
+
+bool OutOfCoreOpticalFlow::writeFlowCore(std::fstream& file, int width, const Image& u, const Image& v, int wx, int wy, int x0, int y0, int x1, int y1)
+{
+	// Middlebury layout: tag, width, height, then interleaved (u, v) rows
+	std::streamoff header = sizeof(float) + 2 * sizeof(int);
+	float* row = new float[2 * (x1 - x0)];
+
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			row[2 * (x - x0)] = u.pixel_r(x - wx, y - wy);
+			row[2 * (x - x0) + 1] = v.pixel_r(x - wx, y - wy);
+		}
+		file.seekp(header + ((std::streamoff)y * width + x0) * 2 * sizeof(float), std::ios::beg);
+		file.write(reinterpret_cast<char*>(row), 2 * (x1 - x0) * sizeof(float));
+	}
+
+	delete[] row;
+	return file.good();
+}
+
+bool OutOfCoreOpticalFlow::computeFlow(const std::string& img1_path, const std::string& img2_path, const std::string& flow_path)
+{
+	int width, height;
+	int width_2, height_2;
+	if (!Image::readImagePGMSize(img1_path, width, height) || !Image::readImagePGMSize(img2_path, width_2, height_2)) {
+		return false;
+	}
+	if (width != width_2 || height != height_2) {
+		std::cout << "Error: input images differ in size" << std::endl;
+		return false;
+	}
+	// planned before (e.g. to check the budget) or planned now
+	if ((width != m_planned_width || height != m_planned_height) && !planTiles(width, height)) {
+		return false;
+	}
+
+	std::fstream file(flow_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cout << "Cannot write file: " << flow_path << std::endl;
+		return false;
+	}
+	float tag = (float)TAG_FLOAT;
+	file.write(reinterpret_cast<char*>(&tag), sizeof(float));
+	file.write(reinterpret_cast<char*>(&width), sizeof(int));
+	file.write(reinterpret_cast<char*>(&height), sizeof(int));
+
+	// all windows have the same size (border windows are shifted inwards), one engine serves every window
+	Image window_1(m_window_width, m_window_height);
+	Image window_2(m_window_width, m_window_height);
+	Image u;
+	Image v;
+	GPUFullOpticalFlow engine(window_1, window_2, m_levels, m_warp_scale, m_solver_iterations, m_alpha, m_omega,
+							  m_clContext, m_clCommandQueue, m_localWorkSize);
+	if (!engine.initResources(m_clContext, m_clDevice)) {
+		engine.releaseResources();
+		return false;
+	}
+
+	int core_width = (m_window_width == width) ? width : m_window_width - 2 * m_halo;
+	int core_height = (m_window_height == height) ? height : m_window_height - 2 * m_halo;
+
+	CTimer timer;
+	timer.Start();
+
+	bool result = true;
+	int tile = 0;
+	for (int y0 = 0; y0 < height && result; y0 += core_height) {
+		for (int x0 = 0; x0 < width && result; x0 += core_width) {
+			int x1 = std::min(x0 + core_width, width);
+			int y1 = std::min(y0 + core_height, height);
+			int wx = std::max(0, std::min(x0 - m_halo, width - m_window_width));
+			int wy = std::max(0, std::min(y0 - m_halo, height - m_window_height));
+
+			std::cout << "Window " << ++tile << "/" << m_tiles << " at (" << wx << ", " << wy << ")" << std::endl;
+			TIMING_FRAME_BEGIN("Out-of-core window");
+			TIMING_BEGIN("read");
+			result = window_1.readImagePGMRegion(img1_path, wx, wy, m_window_width, m_window_height) &&
+					 window_2.readImagePGMRegion(img2_path, wx, wy, m_window_width, m_window_height);
+			TIMING_END();
+			if (result) {
+				engine.computeFlow(u, v);
+				TIMING_BEGIN("write");
+				result = writeFlowCore(file, width, u, v, wx, wy, x0, y0, x1, y1);
+				TIMING_END();
+			}
+			TIMING_FRAME_END();
+		}
+	}
+
+	timer.Stop();
+	engine.releaseResources();
+
+	if (result) {
+		double mpixels = (double)width * height * 1e-6;
+		std::cout << "Out-of-core: " << timer.GetElapsedTime() << " s, " << mpixels / timer.GetElapsedTime() << " Mpixel/s" << std::endl;
+	}
+	return result;
+}
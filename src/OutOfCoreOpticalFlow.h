@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Image.h"
+#include "Common.h"
+
+#include <fstream>
+#include <string>
+
+/* Out-of-core solve for inputs larger than device or host memory. The PGM inputs are read window
+   by window from disk, every window is solved by the full GPU pipeline and only its core (the window
+   without the halo) is written to a Middlebury .flo file, so memory is bounded by one window.
+   The window size follows from memory_budget, the halo from the distance the solver propagates
+   information on the pyramid levels of a window (levels are dropped until the halo fits). */
+class OutOfCoreOpticalFlow
+{
+private:
+	cl_context m_clContext;
+	cl_command_queue m_clCommandQueue;
+	cl_device_id m_clDevice;
+	int m_localWorkSize[2];
+
+	int		m_warp_levels;
+	float	m_warp_scale;
+	int		m_solver_iterations;
+	float	m_alpha;
+	float	m_omega;
+	size_t	m_memory_budget;	// bytes for the device buffers and host images of one window
+	int		m_max_motion;		// largest expected displacement in source pixels
+
+	// tiling of the last planTiles call, for an input of m_planned_width x m_planned_height
+	int m_planned_width;
+	int m_planned_height;
+	int m_window_width;
+	int m_window_height;
+	int m_halo;
+	int m_levels;
+	int m_tiles;
+
+public:
+	OutOfCoreOpticalFlow(int warp_levels, float warp_scale, int solver_iterations, float alpha, float omega,
+		cl_context clContext, cl_command_queue clCommandQueue, cl_device_id clDevice, int localWorkSize[2],
+		size_t memory_budget, int max_motion = 16);
+
+	bool computeFlow(const std::string& img1_path, const std::string& img2_path, const std::string& flow_path);
+
+	/* window layout of a width x height input within the memory budget, printed and kept for computeFlow;
+	   false with a message if the budget holds no window with its halo */
+	bool planTiles(int width, int height);
+
+	int windowWidth() const { return m_window_width; };
+	int windowHeight() const { return m_window_height; };
+	int halo() const { return m_halo; };
+	int levels() const { return m_levels; };
+	int tiles() const { return m_tiles; };
+
+	/* bytes of device buffers and host images per window pixel */
+	static size_t bytesPerPixel();
+private:
+	int haloForLevels(int levels) const;
+	bool writeFlowCore(std::fstream& file, int width, const Image& u, const Image& v, int wx, int wy, int x0, int y0, int x1, int y1);
+};
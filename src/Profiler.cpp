@@ -0,0 +1,181 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+bool Profiler::s_enabled = false;
+bool Profiler::s_recording = false;
+int Profiler::s_level = -1;
+Profiler::Record Profiler::s_pending;
+bool Profiler::s_has_pending = false;
+std::vector<Profiler::Run> Profiler::s_runs;
+
+void Profiler::beginRun(const std::string& name)
+{
+	if (!s_enabled) {
+		return;
+	}
+	s_runs.push_back(Run());
+	s_runs.back().name = name;
+	s_recording = true;
+	s_level = -1;
+	s_has_pending = false;
+}
+
+cl_event* Profiler::event(cl_kernel kernel)
+{
+	if (!s_recording) {
+		return NULL;
+	}
+	char name[128] = "kernel";
+	clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, NULL);
+	return event(name);
+}
+
+cl_event* Profiler::event(const char* name)
+{
+	if (!s_recording) {
+		return NULL;
+	}
+	// the previous slot has been filled by its enqueue call (or stayed NULL if the call failed)
+	flushPending();
+
+	s_pending.name = name;
+	s_pending.level = s_level;
+	s_pending.event = NULL;
+	s_pending.queued = s_pending.submit = s_pending.start = s_pending.end = 0;
+	s_has_pending = true;
+	return &s_pending.event;
+}
+
+void Profiler::flushPending()
+{
+	if (s_has_pending && s_pending.event) {
+		s_runs.back().records.push_back(s_pending);
+	}
+	s_has_pending = false;
+}
+
+void Profiler::endRun()
+{
+	if (!s_recording) {
+		return;
+	}
+	flushPending();
+	s_recording = false;
+
+	std::vector<Record>& records = s_runs.back().records;
+	for (size_t i = 0; i < records.size(); i++) {
+		Record& r = records[i];
+		cl_int cl_error = clWaitForEvents(1, &r.event);
+		cl_error |= clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &r.queued, NULL);
+		cl_error |= clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &r.submit, NULL);
+		cl_error |= clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &r.start, NULL);
+		cl_error |= clGetEventProfilingInfo(r.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &r.end, NULL);
+		if (cl_error != CL_SUCCESS) {
+			// queue without CL_QUEUE_PROFILING_ENABLE
+			r.queued = r.submit = r.start = r.end = 0;
+		}
+		clReleaseEvent(r.event);
+		r.event = NULL;
+	}
+	s_level = -1;
+}
+
+void Profiler::printSummary()
+{
+	for (size_t k = 0; k < s_runs.size(); k++) {
+		const std::vector<Record>& records = s_runs[k].records;
+
+		// per command name: calls, device time, queued -> start wait; per level: device time
+		std::map<std::string, cl_ulong> kernel_time;
+		std::map<std::string, cl_ulong> kernel_wait;
+		std::map<std::string, int> kernel_calls;
+		std::map<int, cl_ulong> level_time;
+		cl_ulong total = 0;
+		for (size_t i = 0; i < records.size(); i++) {
+			const Record& r = records[i];
+			if (r.end < r.start || r.start < r.submit || r.submit < r.queued) {
+				continue;
+			}
+			kernel_time[r.name] += r.end - r.start;
+			kernel_wait[r.name] += r.start - r.queued;
+			kernel_calls[r.name]++;
+			level_time[r.level] += r.end - r.start;
+			total += r.end - r.start;
+		}
+
+		std::cout << std::endl << "Profile: " << s_runs[k].name << " (" << total * 1e-6 << " ms device time)" << std::endl;
+		std::cout << "Command\t\t\t\tCalls\tTotal ms\tAvg us\tShare\tAvg wait us" << std::endl;
+		for (std::map<std::string, cl_ulong>::const_iterator it = kernel_time.begin(); it != kernel_time.end(); ++it) {
+			int calls = kernel_calls[it->first];
+			std::string name = it->first;
+			name.resize(std::max(name.size(), (size_t)31), ' ');
+			std::cout << name << "\t" << calls << "\t" << it->second * 1e-6 << "\t\t" << it->second * 1e-3 / calls << "\t"
+					  << (total ? 100.0 * it->second / total : 0.0) << "%\t" << kernel_wait[it->first] * 1e-3 / calls << std::endl;
+		}
+		std::cout << "Level\tTotal ms" << std::endl;
+		for (std::map<int, cl_ulong>::const_reverse_iterator it = level_time.rbegin(); it != level_time.rend(); ++it) {
+			if (it->first < 0) {
+				std::cout << "-";
+			} else {
+				std::cout << it->first;
+			}
+			std::cout << "\t" << it->second * 1e-6 << std::endl;
+		}
+	}
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename)
+{
+	std::ofstream file(filename.c_str());
+	if (!file.good()) {
+		std::cout << "Cannot write trace: " << filename << std::endl;
+		return false;
+	}
+
+	// one process per run, device execution on thread 0, time in us relative to the first command of the run
+	file << "{\"traceEvents\":[" << std::endl;
+	bool first = true;
+	for (size_t k = 0; k < s_runs.size(); k++) {
+		const std::vector<Record>& records = s_runs[k].records;
+		file << (first ? "" : ",\n") << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << k << ",\"args\":{\"name\":\"" << s_runs[k].name << "\"}}";
+		first = false;
+
+		cl_ulong origin = 0;
+		for (size_t i = 0; i < records.size(); i++) {
+			if (records[i].queued && (origin == 0 || records[i].queued < origin)) {
+				origin = records[i].queued;
+			}
+		}
+		for (size_t i = 0; i < records.size(); i++) {
+			const Record& r = records[i];
+			if (r.end < r.start || r.start < r.submit || r.submit < r.queued || r.queued < origin) {
+				continue;
+			}
+			file << ",\n{\"name\":\"" << r.name << "\",\"cat\":\"level " << r.level << "\",\"ph\":\"X\",\"pid\":" << k << ",\"tid\":0"
+				 << ",\"ts\":" << (r.start - origin) * 1e-3 << ",\"dur\":" << (r.end - r.start) * 1e-3
+				 << ",\"args\":{\"level\":" << r.level << ",\"queued_to_submit_us\":" << (r.submit - r.queued) * 1e-3
+				 << ",\"submit_to_start_us\":" << (r.start - r.submit) * 1e-3 << "}}";
+		}
+	}
+	file << std::endl << "]}" << std::endl;
+
+	std::cout << "Trace written to " << filename << std::endl;
+	return file.good();
+}
+
+void Profiler::clear()
+{
+	for (size_t k = 0; k < s_runs.size(); k++) {
+		for (size_t i = 0; i < s_runs[k].records.size(); i++) {
+			if (s_runs[k].records[i].event) {
+				clReleaseEvent(s_runs[k].records[i].event);
+			}
+		}
+	}
+	s_runs.clear();
+	s_recording = false;
+	s_has_pending = false;
+}
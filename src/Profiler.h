@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Common.h"
+
+#include <string>
+#include <vector>
+
+/* Opt-in device profiler. When enabled, the engines pass Profiler::event(...) as the event argument of
+   their enqueue calls; the events are resolved at the end of a run into queued, submit, start and end
+   timestamps and grouped by command name and pyramid level (set by the engines via setLevel).
+   The command queues must be created with CL_QUEUE_PROFILING_ENABLE when enabled() is true.
+   Outside of a run (and when disabled) event() returns NULL and the enqueue calls are unchanged. */
+class Profiler
+{
+private:
+	struct Record
+	{
+		std::string name;
+		int level;			// pyramid level, -1 outside the level loop
+		cl_event event;
+		cl_ulong queued;	// device timestamps in ns
+		cl_ulong submit;
+		cl_ulong start;
+		cl_ulong end;
+	};
+
+	struct Run
+	{
+		std::string name;
+		std::vector<Record> records;
+	};
+
+	static bool s_enabled;
+	static bool s_recording;			// between beginRun and endRun
+	static int s_level;
+	static Record s_pending;			// record of the last event(), its event is set by the enqueue call
+	static bool s_has_pending;
+	static std::vector<Run> s_runs;
+
+public:
+	static void enable(bool enabled) { s_enabled = enabled; };
+	static bool enabled() { return s_enabled; };
+
+	/* commands enqueued between beginRun and endRun form one run (one process in the trace) */
+	static void beginRun(const std::string& name);
+	static void endRun();
+	static void setLevel(int level) { s_level = level; };
+
+	/* event slot for the next enqueue call, NULL when profiling is disabled */
+	static cl_event* event(cl_kernel kernel);
+	static cl_event* event(const char* name);
+
+	static void printSummary();
+	static bool writeChromeTrace(const std::string& filename);
+	static void clear();
+
+private:
+	static void flushPending();
+};
@@ -0,0 +1,136 @@
+#include "Timing.h"
+#include "CTimer.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+bool Timing::s_enabled = false;
+bool Timing::s_frame_open = false;
+std::string Timing::s_frame_name;
+double Timing::s_frame_start = 0.0;
+std::string Timing::s_output;
+std::vector<Timing::Scope> Timing::s_scopes;
+std::map<std::string, size_t> Timing::s_scope_index;
+std::vector<Timing::Open> Timing::s_stack;
+std::vector<std::pair<std::string, double> > Timing::s_counters;
+std::string Timing::s_last_frame;
+
+void Timing::beginFrame(const std::string& name)
+{
+	if (!s_enabled) {
+		return;
+	}
+	s_scopes.clear();
+	s_scope_index.clear();
+	s_stack.clear();
+	s_counters.clear();
+	s_frame_name = name;
+	s_frame_open = true;
+	s_frame_start = CTimer::Now();
+}
+
+size_t Timing::push(const char* name, int index)
+{
+	if (!s_frame_open) {
+		return 0;
+	}
+	std::ostringstream path;
+	if (!s_stack.empty()) {
+		path << s_scopes[s_stack.back().scope].path << "/";
+	}
+	path << name;
+	if (index >= 0) {
+		path << " " << index;
+	}
+
+	std::map<std::string, size_t>::iterator it = s_scope_index.find(path.str());
+	size_t scope;
+	if (it == s_scope_index.end()) {
+		Scope s;
+		s.path = path.str();
+		s.seconds = 0.0;
+		s.calls = 0;
+		scope = s_scopes.size();
+		s_scopes.push_back(s);
+		s_scope_index[s.path] = scope;
+	} else {
+		scope = it->second;
+	}
+
+	Open open;
+	open.scope = scope;
+	open.start = CTimer::Now();
+	s_stack.push_back(open);
+	return s_stack.size() - 1;
+}
+
+void Timing::pop()
+{
+	if (!s_frame_open || s_stack.empty()) {
+		return;
+	}
+	Scope& s = s_scopes[s_stack.back().scope];
+	s.seconds += CTimer::Now() - s_stack.back().start;
+	s.calls++;
+	s_stack.pop_back();
+}
+
+void Timing::popTo(size_t depth)
+{
+	while (s_frame_open && s_stack.size() > depth) {
+		pop();
+	}
+}
+
+void Timing::count(const char* name, double value)
+{
+	if (!s_frame_open) {
+		return;
+	}
+	for (size_t i = 0; i < s_counters.size(); i++) {
+		if (s_counters[i].first == name) {
+			s_counters[i].second += value;
+			return;
+		}
+	}
+	s_counters.push_back(std::make_pair(std::string(name), value));
+}
+
+void Timing::endFrame()
+{
+	if (!s_frame_open) {
+		return;
+	}
+	double frame_seconds = CTimer::Now() - s_frame_start;
+	// scopes left open by an early error return end with the frame
+	popTo(0);
+	s_frame_open = false;
+
+	std::ostringstream json;
+	json << "{\"frame\":\"" << s_frame_name << "\",\"ms\":" << frame_seconds * 1e3 << ",\"scopes\":[";
+	for (size_t i = 0; i < s_scopes.size(); i++) {
+		json << (i ? "," : "") << "{\"path\":\"" << s_scopes[i].path << "\",\"ms\":" << s_scopes[i].seconds * 1e3
+			 << ",\"calls\":" << s_scopes[i].calls << "}";
+	}
+	json << "],\"counters\":{";
+	for (size_t i = 0; i < s_counters.size(); i++) {
+		json << (i ? "," : "") << "\"" << s_counters[i].first << "\":" << s_counters[i].second;
+	}
+	json << "}}";
+	s_last_frame = json.str();
+
+	if (!s_output.empty()) {
+		std::ofstream file(s_output.c_str(), std::ios::out | std::ios::app);
+		if (file.good()) {
+			file << s_last_frame << std::endl;
+		} else {
+			std::cout << "Cannot write timings: " << s_output << std::endl;
+		}
+	}
+}
+
+std::string Timing::lastFrame()
+{
+	return s_last_frame;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+/* Hierarchical host timing. A frame (one computeFlow call) holds nested scopes, e.g.
+   "level 3/warp/backward registration"; scopes with the same path are summed. Counters add up
+   values such as transferred bytes. At the end of a frame one JSON line with the breakdown is
+   appended to the output file. Time is taken from the monotonic clock of CTimer::Now().
+   GPU phases measure host time: the host-driven engines finish their queues at the end of every phase,
+   the device-resident ones call TIMING_FENCE, which finishes the queue only while a frame is timed.
+   Use the TIMING_* macros; with GPUFLOW_NO_TIMING defined they compile to nothing, when timing is
+   disabled at runtime (or outside a frame) they cost one branch. */
+class Timing
+{
+private:
+	struct Scope
+	{
+		std::string path;
+		double seconds;
+		int calls;
+	};
+
+	struct Open
+	{
+		size_t scope;		// index into s_scopes
+		double start;
+	};
+
+	static bool s_enabled;
+	static bool s_frame_open;
+	static std::string s_frame_name;
+	static double s_frame_start;
+	static std::string s_output;
+	static std::vector<Scope> s_scopes;				// in order of first use
+	static std::map<std::string, size_t> s_scope_index;
+	static std::vector<Open> s_stack;
+	static std::vector<std::pair<std::string, double> > s_counters;
+
+public:
+	static void enable(bool enabled) { s_enabled = enabled; };
+	static bool enabled() { return s_enabled; };
+	/* true between beginFrame and endFrame */
+	static bool active() { return s_frame_open; };
+	/* file the per-frame JSON lines are appended to, empty to only keep the last frame in memory */
+	static void setOutput(const std::string& filename) { s_output = filename; };
+
+	static void beginFrame(const std::string& name);
+	static void endFrame();
+
+	/* push returns the stack depth before the push, popTo closes every scope opened since */
+	static size_t push(const char* name, int index = -1);
+	static void pop();
+	static void popTo(size_t depth);
+	static void count(const char* name, double value);
+
+	/* breakdown of the last frame as one JSON object */
+	static std::string lastFrame();
+
+private:
+	static std::string s_last_frame;
+};
+
+/* closes its scope and any TIMING_BEGIN left open by an early return inside it */
+class ScopedTiming
+{
+private:
+	size_t m_depth;
+
+public:
+	ScopedTiming(const char* name, int index = -1) : m_depth(Timing::push(name, index)) {};
+	~ScopedTiming() { Timing::popTo(m_depth); };
+};
+
+#define TIMING_CONCAT_(a, b)				a##b
+#define TIMING_CONCAT(a, b)					TIMING_CONCAT_(a, b)
+
+#ifndef GPUFLOW_NO_TIMING
+	#define TIMING_FRAME_BEGIN(name)		Timing::beginFrame(name)
+	#define TIMING_FRAME_END()				Timing::endFrame()
+	#define TIMING_SCOPE(name)				ScopedTiming TIMING_CONCAT(timing_scope_, __LINE__)(name)
+	#define TIMING_LEVEL(level)				ScopedTiming TIMING_CONCAT(timing_scope_, __LINE__)("level", level)
+	#define TIMING_BEGIN(name)				Timing::push(name)
+	#define TIMING_END()					Timing::pop()
+	#define TIMING_COUNT(name, value)		Timing::count(name, (double)(value))
+	// finishes an asynchronous queue at the end of a phase, only while a frame is timed
+	#define TIMING_FENCE(queue)				do { if (Timing::active()) { clFinish(queue); } } while (0)
+#else
+	#define TIMING_FRAME_BEGIN(name)		((void)0)
+	#define TIMING_FRAME_END()				((void)0)
+	#define TIMING_SCOPE(name)				((void)0)
+	#define TIMING_LEVEL(level)				((void)0)
+	#define TIMING_BEGIN(name)				((void)0)
+	#define TIMING_END()					((void)0)
+	#define TIMING_COUNT(name, value)		((void)0)
+	#define TIMING_FENCE(queue)				((void)0)
+#endif
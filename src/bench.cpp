@@ -0,0 +1,406 @@
+#include <iostream>
+// Linux declaration
+#ifndef _WIN32
+	#include <cmath>
+#endif
+
+#include "Image.h"
+#include "CTimer.h"
+#include "Common.h"
+
+#include "EngineFactory.h"
+#include "FlowStatistics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+/* Benchmark driver (gpuflow_bench): runs the selected engines on synthetic pairs with a known constant
+   motion, with warmup and repeated timed runs, and writes median / p95 time, throughput and endpoint
+   error of every (engine, size) as JSON, to compare releases.
+
+   gpuflow_bench [--engines naive,flow_driven,optimized,full,full_half,full_tiled,full_robust,cpu]
+                 [--sizes 256,512,1024,2048,4096,8192] [--warmup 2] [--repetitions 10]
+                 [--levels 100] [--scale 0.9] [--iterations 30] [--inner-iterations 10] [--temporal-iterations 5]
+                 [--alpha 4] [--omega 1]
+                 [--scheme jacobi|red_black] [--robust-kernels global,tiled,fused] [--motion 1.5,-0.75]
+                 [--device gpu|cpu|all] [--output ./data/output/bench.json]
+
+   With --robust-kernels flow_driven runs once per listed kernel variant, reported as flow_driven_<variant>;
+   without it flow_driven runs the default variant of the scheme. */
+
+struct BenchSettings
+{
+	std::vector<EngineKind> engines;
+	std::vector<int> sizes;
+	int warmup;
+	int repetitions;
+	int warp_levels;
+	float warp_scale;
+	int solver_iterations;
+	int inner_iterations;
+	int temporal_iterations;
+	float alpha;
+	float omega;
+	float e_smooth;
+	float e_data;
+	SolverScheme scheme;
+	std::vector<RobustKernels> robust_kernels;	// flow_driven variants, empty: default of the scheme
+	float motion_u;
+	float motion_v;
+	cl_device_type device_type;
+	std::string output;
+};
+
+struct BenchResult
+{
+	std::string engine;
+	int size;
+	bool ok;
+	int levels;
+	double median;
+	double p95;
+	double min;
+	double mpixel_iterations;	// solver pixel updates (all levels) per second, in millions
+	float mean_error;
+	float max_error;
+};
+
+cl_context			g_CLContext = NULL;
+cl_command_queue	g_CLCommandQueue = NULL;
+cl_device_id		g_CLDevice = NULL;
+
+bool ParseArguments(int argc, char** argv, BenchSettings& settings);
+EngineParameters Parameters(const BenchSettings& s);
+double SolverPixelUpdates(EngineKind engine, int width, int height, int levels, const BenchSettings& s);
+bool RunBenchmark(EngineKind engine, const std::string& name, const EngineParameters& p, int size, const BenchSettings& s, BenchResult& result);
+bool WriteResults(const std::vector<BenchResult>& results, const BenchSettings& s);
+
+int main(int argc, char** argv)
+{
+	BenchSettings settings;
+	settings.engines.push_back(ENGINE_NAIVE);
+	settings.engines.push_back(ENGINE_FLOW_DRIVEN);
+	settings.engines.push_back(ENGINE_OPTIMIZED);
+	settings.engines.push_back(ENGINE_FULL);
+	for (int size = 256; size <= 8192; size *= 2) {
+		settings.sizes.push_back(size);
+	}
+	settings.warmup = 2;
+	settings.repetitions = 10;
+	settings.warp_levels = 100;
+	settings.warp_scale = 0.9f;
+	settings.solver_iterations = 30;
+	settings.inner_iterations = 10;
+	settings.temporal_iterations = 5;
+	settings.alpha = 4.f;
+	settings.omega = 1.f;
+	settings.e_smooth = 0.001f;
+	settings.e_data = 0.001f;
+	settings.scheme = SOLVER_JACOBI;
+	settings.motion_u = 1.5f;
+	settings.motion_v = -0.75f;
+	settings.device_type = CL_DEVICE_TYPE_GPU;
+	settings.output = "./data/output/bench.json";
+
+	if (!ParseArguments(argc, argv, settings)) {
+		return 1;
+	}
+	// a CPU-only run needs no OpenCL device
+	bool device = false;
+	for (size_t e = 0; e < settings.engines.size(); e++) {
+		device = device || EngineUsesDevice(settings.engines[e]);
+	}
+	if (device && !InitContextResources(settings.device_type, false, g_CLContext, g_CLCommandQueue, g_CLDevice)) {
+		CleanupContextResources(g_CLContext, g_CLCommandQueue);
+		return 1;
+	}
+
+	std::vector<BenchResult> results;
+	for (size_t i = 0; i < settings.sizes.size(); i++) {
+		for (size_t e = 0; e < settings.engines.size(); e++) {
+			EngineKind engine = settings.engines[e];
+			// flow_driven once per kernel variant, the other engines once
+			size_t variants = (engine == ENGINE_FLOW_DRIVEN) ? std::max(settings.robust_kernels.size(), (size_t)1) : 1;
+			for (size_t k = 0; k < variants; k++) {
+				EngineParameters p = Parameters(settings);
+				std::string name = EngineName(engine);
+				if (engine == ENGINE_FLOW_DRIVEN && !settings.robust_kernels.empty()) {
+					p.robust_kernels = settings.robust_kernels[k];
+					name += std::string("_") + RobustKernelsName(p.robust_kernels);
+				}
+				BenchResult result;
+				RunBenchmark(engine, name, p, settings.sizes[i], settings, result);
+				results.push_back(result);
+			}
+		}
+	}
+
+	std::cout << std::endl << "Engine\t\tSize\tMedian s\tp95 s\t\tMpix*it/s\tMean error" << std::endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& r = results[i];
+		std::string name = r.engine;
+		name.resize(std::max(name.size(), (size_t)15), ' ');
+		if (r.ok) {
+			std::cout << name << "\t" << r.size << "\t" << r.median << "\t" << r.p95 << "\t" << r.mpixel_iterations << "\t\t" << r.mean_error << std::endl;
+		} else {
+			std::cout << name << "\t" << r.size << "\tfailed" << std::endl;
+		}
+	}
+
+	bool written = WriteResults(results, settings);
+	CleanupContextResources(g_CLContext, g_CLCommandQueue);
+	return written ? 0 : 1;
+}
+
+/**
+* Run one engine on a synthetic size x size pair: warmup runs, then timed repetitions
+*/
+bool RunBenchmark(EngineKind engine, const std::string& name, const EngineParameters& p, int size, const BenchSettings& s, BenchResult& result)
+{
+	result.engine = name;
+	result.size = size;
+	result.ok = false;
+	result.levels = OpticalFlowBase::computeMaxWarpLevels(size, size, s.warp_scale, s.warp_levels);
+	result.median = result.p95 = result.min = result.mpixel_iterations = 0.0;
+	result.mean_error = result.max_error = 0.f;
+
+	std::cout << std::endl << "--- " << name << " " << size << "x" << size << " ---" << std::endl;
+
+	Image img1(size, size);
+	Image img2(size, size);
+	Image::fillSyntheticPair(img1, img2, s.motion_u, s.motion_v);
+
+	OpticalFlowBase* flow = CreateEngine(engine, img1, img2, p, g_CLContext, g_CLCommandQueue, g_CLDevice);
+	if (!flow) {
+		std::cout << "Error initializing " << name << " for " << size << "x" << size << std::endl;
+		return false;
+	}
+
+	Image u;
+	Image v;
+	for (int i = 0; i < s.warmup; i++) {
+		flow->computeFlow(u, v);
+	}
+
+	CTimer timer;
+	std::vector<double> times;
+	for (int i = 0; i < s.repetitions; i++) {
+		timer.Start();
+		flow->computeFlow(u, v);
+		timer.Stop();
+		times.push_back(timer.GetElapsedTime());
+	}
+	ReleaseEngine(engine, flow);
+
+	if (times.empty()) {
+		return false;
+	}
+	std::sort(times.begin(), times.end());
+	size_t n = times.size();
+	result.median = (n % 2) ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+	result.p95 = times[std::min(n - 1, (size_t)ceil(0.95 * n) - 1)];
+	result.min = times[0];
+	result.mpixel_iterations = SolverPixelUpdates(engine, size, size, result.levels, s) / result.median * 1e-6;
+
+	// endpoint error against the constant motion of the pair
+	Image u_gt(u.actual_width(), u.actual_height());
+	Image v_gt(v.actual_width(), v.actual_height());
+	for (int y = 0; y < u_gt.actual_height(); y++) {
+		for (int x = 0; x < u_gt.actual_width(); x++) {
+			u_gt.pixel_w(x, y) = s.motion_u;
+			v_gt.pixel_w(x, y) = s.motion_v;
+		}
+	}
+	FlowStatistics statistics(NULL, NULL);
+	FlowMeasures measures;
+	statistics.computeHost(u, v, &u_gt, &v_gt, measures);
+	result.mean_error = measures.mean_epe;
+	result.max_error = measures.max_epe;
+	result.ok = true;
+	return true;
+}
+
+EngineParameters Parameters(const BenchSettings& s)
+{
+	EngineParameters p = { s.warp_levels, s.warp_scale, s.solver_iterations, s.inner_iterations, s.temporal_iterations,
+						   s.alpha, s.omega, s.e_smooth, s.e_data, s.scheme, WARP_BUFFER, DefaultRobustKernels(s.scheme) };
+	return p;
+}
+
+/**
+* Pixel updates of the linear solver in one computeFlow call, summed over the levels
+*/
+double SolverPixelUpdates(EngineKind engine, int width, int height, int levels, const BenchSettings& s)
+{
+	double iterations = s.solver_iterations;
+	if (EngineUsesInnerIterations(engine)) {
+		iterations *= s.inner_iterations;
+	}
+	double pixels = 0.0;
+	for (int level = 0; level < levels; level++) {
+		pixels += ceil(width * pow(s.warp_scale, level)) * ceil(height * pow(s.warp_scale, level));
+	}
+	return pixels * iterations;
+}
+
+/**
+* Comma separated list of integers or engine names
+*/
+static bool ParseIntList(const char* arg, std::vector<int>& list)
+{
+	list.clear();
+	std::stringstream stream(arg);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		int value = atoi(item.c_str());
+		if (value <= 0) {
+			return false;
+		}
+		list.push_back(value);
+	}
+	return !list.empty();
+}
+
+static bool ParseEngineList(const char* arg, std::vector<EngineKind>& list)
+{
+	list.clear();
+	std::stringstream stream(arg);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		EngineKind engine;
+		if (!EngineFromName(item, engine)) {
+			std::cout << "Unknown engine: " << item << std::endl;
+			return false;
+		}
+		list.push_back(engine);
+	}
+	return !list.empty();
+}
+
+bool ParseArguments(int argc, char** argv, BenchSettings& s)
+{
+	for (int i = 1; i < argc; i++) {
+		const char* option = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) {
+			std::cout << "Missing value for " << option << std::endl;
+			return false;
+		}
+		i++;
+
+		bool ok = true;
+		if (!strcmp(option, "--engines")) {
+			ok = ParseEngineList(value, s.engines);
+		} else if (!strcmp(option, "--sizes")) {
+			ok = ParseIntList(value, s.sizes);
+		} else if (!strcmp(option, "--warmup")) {
+			s.warmup = atoi(value);
+			ok = (s.warmup >= 0);
+		} else if (!strcmp(option, "--repetitions")) {
+			s.repetitions = atoi(value);
+			ok = (s.repetitions > 0);
+		} else if (!strcmp(option, "--levels")) {
+			s.warp_levels = atoi(value);
+			ok = (s.warp_levels > 0);
+		} else if (!strcmp(option, "--scale")) {
+			s.warp_scale = (float)atof(value);
+			ok = (s.warp_scale > 0.f && s.warp_scale < 1.f);
+		} else if (!strcmp(option, "--iterations")) {
+			s.solver_iterations = atoi(value);
+			ok = (s.solver_iterations > 0);
+		} else if (!strcmp(option, "--inner-iterations")) {
+			s.inner_iterations = atoi(value);
+			ok = (s.inner_iterations > 0);
+		} else if (!strcmp(option, "--temporal-iterations")) {
+			s.temporal_iterations = atoi(value);
+			ok = (s.temporal_iterations > 0);
+		} else if (!strcmp(option, "--alpha")) {
+			s.alpha = (float)atof(value);
+			ok = (s.alpha > 0.f);
+		} else if (!strcmp(option, "--omega")) {
+			s.omega = (float)atof(value);
+			ok = (s.omega > 0.f && s.omega < 2.f);
+		} else if (!strcmp(option, "--scheme")) {
+			ok = true;
+			if (!strcmp(value, "jacobi")) {
+				s.scheme = SOLVER_JACOBI;
+			} else if (!strcmp(value, "red_black")) {
+				s.scheme = SOLVER_RED_BLACK;
+			} else {
+				ok = false;
+			}
+		} else if (!strcmp(option, "--robust-kernels")) {
+			ok = RobustKernelsFromList(value, s.robust_kernels);
+		} else if (!strcmp(option, "--motion")) {
+			ok = (sscanf(value, "%f,%f", &s.motion_u, &s.motion_v) == 2);
+		} else if (!strcmp(option, "--device")) {
+			ok = true;
+			if (!strcmp(value, "gpu")) {
+				s.device_type = CL_DEVICE_TYPE_GPU;
+			} else if (!strcmp(value, "cpu")) {
+				s.device_type = CL_DEVICE_TYPE_CPU;
+			} else if (!strcmp(value, "all")) {
+				s.device_type = CL_DEVICE_TYPE_ALL;
+			} else {
+				ok = false;
+			}
+		} else if (!strcmp(option, "--output")) {
+			s.output = value;
+		} else {
+			std::cout << "Unknown option: " << option << std::endl;
+			return false;
+		}
+		if (!ok) {
+			std::cout << "Invalid value for " << option << ": " << value << std::endl;
+			return false;
+		}
+	}
+	// the tiled kernels have no red-black variant
+	for (size_t k = 0; k < s.robust_kernels.size(); k++) {
+		if (s.scheme == SOLVER_RED_BLACK && s.robust_kernels[k] != ROBUST_GLOBAL) {
+			std::cout << "--robust-kernels " << RobustKernelsName(s.robust_kernels[k]) << " needs --scheme jacobi" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool WriteResults(const std::vector<BenchResult>& results, const BenchSettings& s)
+{
+	std::ofstream file(s.output.c_str());
+	if (!file.good()) {
+		std::cout << "Cannot write results: " << s.output << std::endl;
+		return false;
+	}
+
+	char device_name[256] = "none";
+	if (g_CLDevice) {
+		clGetDeviceInfo(g_CLDevice, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+	}
+
+	file << "{" << std::endl;
+	file << "  \"device\": \"" << device_name << "\"," << std::endl;
+	file << "  \"settings\": {\"warmup\": " << s.warmup << ", \"repetitions\": " << s.repetitions << ", \"warp_levels\": " << s.warp_levels
+		 << ", \"warp_scale\": " << s.warp_scale << ", \"solver_iterations\": " << s.solver_iterations << ", \"inner_iterations\": " << s.inner_iterations
+		 << ", \"temporal_iterations\": " << s.temporal_iterations << ", \"alpha\": " << s.alpha << ", \"omega\": " << s.omega
+		 << ", \"scheme\": \"" << (s.scheme == SOLVER_RED_BLACK ? "red_black" : "jacobi") << "\", \"motion\": [" << s.motion_u << ", " << s.motion_v << "]}," << std::endl;
+	file << "  \"results\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& r = results[i];
+		file << "    {\"engine\": \"" << r.engine << "\", \"size\": " << r.size << ", \"ok\": " << (r.ok ? "true" : "false");
+		if (r.ok) {
+			file << ", \"levels\": " << r.levels << ", \"median_s\": " << r.median << ", \"p95_s\": " << r.p95 << ", \"min_s\": " << r.min
+				 << ", \"mpixel_iterations_per_s\": " << r.mpixel_iterations << ", \"mean_epe\": " << r.mean_error << ", \"max_epe\": " << r.max_error;
+		}
+		file << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	file << "  ]" << std::endl << "}" << std::endl;
+
+	std::cout << "Results written to " << s.output << std::endl;
+	return file.good();
+}
@@ -0,0 +1,224 @@
+#include "gpuflow.h"
+
+#include "Common.h"
+#include "Image.h"
+#include "EngineFactory.h"
+
+/* the source images are members, the engine keeps references to them for its lifetime */
+struct gpuflow_engine
+{
+	EngineKind kind;
+	int width;
+	int height;
+	Image img1;		// own buffers (8-bit input) or views of the caller memory (float input)
+	Image img2;
+	Image u;
+	Image v;
+	bool has_flow;
+	OpticalFlowBase* flow;
+	cl_context context;
+	cl_command_queue queue;
+	cl_device_id device;
+	bool owns_context;	// created by gpuflow_create, released with the engine
+};
+
+static EngineParameters ToEngineParameters(const gpuflow_parameters& p)
+{
+	EngineParameters e;
+	e.warp_levels = p.warp_levels;
+	e.warp_scale = p.warp_scale;
+	e.solver_iterations = p.solver_iterations;
+	e.inner_iterations = p.inner_iterations;
+	e.temporal_iterations = p.temporal_iterations;
+	e.alpha = p.alpha;
+	e.omega = p.omega;
+	e.e_smooth = p.e_smooth;
+	e.e_data = p.e_data;
+	e.scheme = p.red_black ? SOLVER_RED_BLACK : SOLVER_JACOBI;
+	e.warp_mode = WARP_BUFFER;
+	e.robust_kernels = DefaultRobustKernels(e.scheme);
+	return e;
+}
+
+static bool ValidParameters(const gpuflow_parameters& p)
+{
+	return p.warp_levels > 0 && p.warp_scale > 0.f && p.warp_scale < 1.f && p.solver_iterations > 0 && p.inner_iterations > 0 &&
+		   p.temporal_iterations > 0 && p.alpha > 0.f && p.omega > 0.f && p.omega < 2.f;
+}
+
+static gpuflow_status CreateHandle(const char* engine_name, int width, int height, const gpuflow_parameters* parameters,
+								   cl_context context, cl_command_queue queue, cl_device_id device, bool owns_context, gpuflow_engine** engine)
+{
+	gpuflow_parameters p;
+	gpuflow_default_parameters(&p);
+	if (parameters) {
+		p = *parameters;
+	}
+	EngineKind kind;
+	if (!engine || !engine_name || !EngineFromName(engine_name, kind) || width < 4 || height < 4 || !ValidParameters(p)) {
+		return GPUFLOW_ERROR_ARGUMENT;
+	}
+	*engine = NULL;
+
+	gpuflow_engine* e = new gpuflow_engine;
+	e->kind = kind;
+	e->width = width;
+	e->height = height;
+	e->has_flow = false;
+	e->flow = NULL;
+	e->context = context;
+	e->queue = queue;
+	e->device = device;
+	e->owns_context = owns_context;
+	e->img1.reinit(width, height, width, height, 0, 0);
+	e->img2.reinit(width, height, width, height, 0, 0);
+
+	if (EngineUsesDevice(kind) && !e->context) {
+		// what was created before a failure is released with the engine
+		e->owns_context = true;
+		if (!InitContextResources(CL_DEVICE_TYPE_GPU, false, e->context, e->queue, e->device)) {
+			gpuflow_destroy(e);
+			return GPUFLOW_ERROR_DEVICE;
+		}
+	}
+
+	SetKernelDirectory(p.kernel_dir);
+	e->flow = CreateEngine(kind, e->img1, e->img2, ToEngineParameters(p), e->context, e->queue, e->device);
+	if (!e->flow) {
+		gpuflow_destroy(e);
+		return GPUFLOW_ERROR_ENGINE;
+	}
+	*engine = e;
+	return GPUFLOW_OK;
+}
+
+extern "C" {
+
+void gpuflow_default_parameters(gpuflow_parameters* p)
+{
+	// defaults of gpuflow
+	p->warp_levels = 15;
+	p->warp_scale = 0.9f;
+	p->solver_iterations = 30;
+	p->inner_iterations = 10;
+	p->temporal_iterations = 5;
+	p->alpha = 4.f;
+	p->omega = 1.f;
+	p->e_smooth = 0.001f;
+	p->e_data = 0.001f;
+	p->red_black = 0;
+	p->kernel_dir = NULL;
+}
+
+gpuflow_status gpuflow_create(const char* engine_name, int width, int height, const gpuflow_parameters* parameters, gpuflow_engine** engine)
+{
+	return CreateHandle(engine_name, width, height, parameters, NULL, NULL, NULL, false, engine);
+}
+
+gpuflow_status gpuflow_create_with_context(const char* engine_name, int width, int height, const gpuflow_parameters* parameters,
+										   cl_context context, cl_command_queue queue, cl_device_id device, gpuflow_engine** engine)
+{
+	EngineKind kind;
+	if (engine_name && EngineFromName(engine_name, kind) && EngineUsesDevice(kind) && (!context || !queue || !device)) {
+		return GPUFLOW_ERROR_ARGUMENT;
+	}
+	return CreateHandle(engine_name, width, height, parameters, context, queue, device, false, engine);
+}
+
+void gpuflow_destroy(gpuflow_engine* engine)
+{
+	if (!engine) {
+		return;
+	}
+	if (engine->flow) {
+		ReleaseEngine(engine->kind, engine->flow);
+	}
+	if (engine->owns_context) {
+		CleanupContextResources(engine->context, engine->queue);
+	}
+	delete engine;
+}
+
+gpuflow_status gpuflow_compute_f32(gpuflow_engine* engine, const float* img1, const float* img2, size_t stride)
+{
+	if (!engine || !img1 || !img2 || stride < engine->width * sizeof(float)) {
+		return GPUFLOW_ERROR_ARGUMENT;
+	}
+	if (stride % sizeof(float) == 0) {
+		// the engines only read the source images, the views point to the caller memory
+		int pitch = (int)(stride / sizeof(float));
+		engine->img1.wrap(const_cast<float*>(img1), engine->width, engine->height, pitch);
+		engine->img2.wrap(const_cast<float*>(img2), engine->width, engine->height, pitch);
+	} else {
+		if (engine->img1.external()) {
+			engine->img1.reinit(engine->width, engine->height, engine->width, engine->height, 0, 0);
+			engine->img2.reinit(engine->width, engine->height, engine->width, engine->height, 0, 0);
+		}
+		for (int y = 0; y < engine->height; y++) {
+			const float* row1 = (const float*)((const char*)img1 + y * stride);
+			const float* row2 = (const float*)((const char*)img2 + y * stride);
+			for (int x = 0; x < engine->width; x++) {
+				engine->img1.pixel_w(x, y) = row1[x];
+				engine->img2.pixel_w(x, y) = row2[x];
+			}
+		}
+	}
+	engine->flow->computeFlow(engine->u, engine->v);
+	engine->has_flow = true;
+	return GPUFLOW_OK;
+}
+
+gpuflow_status gpuflow_compute_u8(gpuflow_engine* engine, const unsigned char* img1, const unsigned char* img2, size_t stride)
+{
+	if (!engine || !img1 || !img2 || stride < (size_t)engine->width) {
+		return GPUFLOW_ERROR_ARGUMENT;
+	}
+	if (engine->img1.external()) {
+		engine->img1.reinit(engine->width, engine->height, engine->width, engine->height, 0, 0);
+		engine->img2.reinit(engine->width, engine->height, engine->width, engine->height, 0, 0);
+	}
+	for (int y = 0; y < engine->height; y++) {
+		const unsigned char* row1 = img1 + y * stride;
+		const unsigned char* row2 = img2 + y * stride;
+		for (int x = 0; x < engine->width; x++) {
+			engine->img1.pixel_w(x, y) = row1[x];
+			engine->img2.pixel_w(x, y) = row2[x];
+		}
+	}
+	engine->flow->computeFlow(engine->u, engine->v);
+	engine->has_flow = true;
+	return GPUFLOW_OK;
+}
+
+gpuflow_status gpuflow_get_flow(const gpuflow_engine* engine, float* u, float* v, size_t stride)
+{
+	if (!engine || !u || !v || stride < engine->width * sizeof(float)) {
+		return GPUFLOW_ERROR_ARGUMENT;
+	}
+	if (!engine->has_flow) {
+		return GPUFLOW_ERROR_NO_FLOW;
+	}
+	for (int y = 0; y < engine->height; y++) {
+		float* row_u = (float*)((char*)u + y * stride);
+		float* row_v = (float*)((char*)v + y * stride);
+		for (int x = 0; x < engine->width; x++) {
+			row_u[x] = engine->u.pixel_r(x, y);
+			row_v[x] = engine->v.pixel_r(x, y);
+		}
+	}
+	return GPUFLOW_OK;
+}
+
+const char* gpuflow_status_string(gpuflow_status status)
+{
+	switch (status) {
+	case GPUFLOW_OK:				return "ok";
+	case GPUFLOW_ERROR_ARGUMENT:	return "invalid argument";
+	case GPUFLOW_ERROR_DEVICE:		return "no OpenCL device";
+	case GPUFLOW_ERROR_ENGINE:		return "engine resources could not be created";
+	case GPUFLOW_ERROR_NO_FLOW:		return "no flow computed yet";
+	}
+	return "unknown status";
+}
+
+}
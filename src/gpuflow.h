@@ -0,0 +1,80 @@
+#ifndef GPUFLOW_H
+#define GPUFLOW_H
+
+/*
+	libgpuflow: C interface of the optical flow engines for in-process use.
+
+	The engine is created for one image size and computes the flow of pairs of that size from caller memory,
+	the flow is copied into caller buffers. Strides are in bytes. Intensities are expected in [0, 255] like the
+	PGM images of the tools. float input with a stride that is a multiple of sizeof(float) is read in place
+	(no copy), 8-bit input is converted once into buffers of the engine. The kernel sources (*.cl) are loaded
+	when the engine is created, from gpuflow_parameters::kernel_dir, else from the directory in the environment
+	variable GPUFLOW_KERNEL_DIR, else from ./src/kernels relative to the working directory like in the tools.
+	The kernel directory is process-wide state, engines must not be created concurrently from several threads.
+*/
+
+#if defined(WIN32)
+	#include <CL/opencl.h>
+#elif defined (__APPLE__) || defined(MACOSX)
+	#include <OpenCL/opencl.h>
+#else
+	#include <CL/cl.h>
+#endif
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gpuflow_engine gpuflow_engine;
+
+typedef enum gpuflow_status
+{
+	GPUFLOW_OK = 0,
+	GPUFLOW_ERROR_ARGUMENT,		// unknown engine, invalid size, stride or parameters
+	GPUFLOW_ERROR_DEVICE,		// no OpenCL device, context or queue
+	GPUFLOW_ERROR_ENGINE,		// engine resources (programs, buffers) could not be created
+	GPUFLOW_ERROR_NO_FLOW		// gpuflow_get_flow before the first gpuflow_compute_*
+} gpuflow_status;
+
+/* model parameters, see gpuflow_default_parameters */
+typedef struct gpuflow_parameters
+{
+	int warp_levels;
+	float warp_scale;
+	int solver_iterations;
+	int inner_iterations;		// robust engines (flow_driven, full_robust)
+	int temporal_iterations;	// optimized
+	float alpha;
+	float omega;
+	float e_smooth;
+	float e_data;
+	int red_black;				// 0: Jacobi, 1: red-black SOR
+	const char* kernel_dir;		// directory of the kernel sources, NULL: GPUFLOW_KERNEL_DIR or ./src/kernels
+} gpuflow_parameters;
+
+void gpuflow_default_parameters(gpuflow_parameters* parameters);
+
+/* engine names of gpuflow --list-engines, e.g. "full"; parameters may be NULL for the defaults.
+   gpuflow_create uses the first GPU device, gpuflow_create_with_context the queue of the caller */
+gpuflow_status gpuflow_create(const char* engine_name, int width, int height, const gpuflow_parameters* parameters,
+							  gpuflow_engine** engine);
+gpuflow_status gpuflow_create_with_context(const char* engine_name, int width, int height, const gpuflow_parameters* parameters,
+										   cl_context context, cl_command_queue queue, cl_device_id device, gpuflow_engine** engine);
+void gpuflow_destroy(gpuflow_engine* engine);
+
+/* flow from img1 to img2, both width x height with rows stride bytes apart */
+gpuflow_status gpuflow_compute_f32(gpuflow_engine* engine, const float* img1, const float* img2, size_t stride);
+gpuflow_status gpuflow_compute_u8(gpuflow_engine* engine, const unsigned char* img1, const unsigned char* img2, size_t stride);
+
+/* flow of the last computed pair into width x height buffers with rows stride bytes apart */
+gpuflow_status gpuflow_get_flow(const gpuflow_engine* engine, float* u, float* v, size_t stride);
+
+const char* gpuflow_status_string(gpuflow_status status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
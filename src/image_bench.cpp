@@ -0,0 +1,288 @@
+#include <iostream>
+// Linux declaration
+#ifndef _WIN32
+	#include <cmath>
+#endif
+
+#include "Image.h"
+#include "CTimer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+/* Microbenchmarks of the host Image primitives (gpuflow_image_bench): every primitive is run at
+   several sizes until it took at least min_time seconds, the median time per call is reported as
+   ns/pixel and as bytes/s of the data the primitive has to read and write (the traffic model of
+   each primitive is in PrimitiveBytes). Results are printed and written as JSON.
+
+   gpuflow_image_bench [--sizes 256,512,1024,2048,4096] [--min-time 0.2] [--output ./data/output/image_bench.json] */
+
+enum ImagePrimitive
+{
+	PRIM_RESAMPLE_AREA,		// resampleAreaBasedWithoutReallocating, one pyramid step (scale 0.9)
+	PRIM_RESAMPLE_BILINEAR,	// resampleWithoutReallocating, one pyramid step (scale 0.9)
+	PRIM_BACKWARD,			// backwardRegistration
+	PRIM_FILL_BOUNDARIES,	// fillBoudaries
+	PRIM_ADD,				// operator+=
+	PRIM_ASSIGN,			// operator=
+	PRIM_READ_PGM,			// readImagePGM
+	PRIM_SAVE_RGB			// saveOpticalFlowRGB
+};
+
+static const char* g_primitive_names[] = {
+	"resampleAreaBasedWithoutReallocating",
+	"resampleWithoutReallocating",
+	"backwardRegistration",
+	"fillBoudaries",
+	"operator+=",
+	"operator=",
+	"readImagePGM",
+	"saveOpticalFlowRGB"
+};
+static const int g_primitive_count = sizeof(g_primitive_names) / sizeof(g_primitive_names[0]);
+
+/* inputs and outputs of all primitives at one size */
+struct PrimitiveFixture
+{
+	int width;
+	int height;
+	int dst_width;
+	int dst_height;
+	Image img1;
+	Image img2;
+	Image dst;
+	Image u;
+	Image v;
+	std::string pgm_path;
+	std::string rgb_path;
+};
+
+struct PrimitiveResult
+{
+	int primitive;
+	int size;
+	int calls;
+	double seconds;		// median per call
+	double ns_per_pixel;
+	double bytes_per_s;
+};
+
+bool InitFixture(PrimitiveFixture& f, int size);
+void RunPrimitive(ImagePrimitive primitive, PrimitiveFixture& f);
+double PrimitiveBytes(ImagePrimitive primitive, const PrimitiveFixture& f);
+PrimitiveResult MeasurePrimitive(ImagePrimitive primitive, PrimitiveFixture& f, double min_time);
+bool WriteResults(const std::vector<PrimitiveResult>& results, const std::string& path);
+void PrintUsage();
+
+int main(int argc, char** argv)
+{
+	std::vector<int> sizes;
+	for (int size = 256; size <= 4096; size *= 2) {
+		sizes.push_back(size);
+	}
+	double min_time = 0.2;
+	std::string output = "./data/output/image_bench.json";
+
+	for (int i = 1; i < argc; i += 2) {
+		const char* option = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) {
+			std::cout << "Missing value for " << option << std::endl;
+			PrintUsage();
+			return 1;
+		}
+		if (!strcmp(option, "--sizes")) {
+			sizes.clear();
+			std::stringstream stream(value);
+			std::string item;
+			while (std::getline(stream, item, ',')) {
+				if (atoi(item.c_str()) > 0) {
+					sizes.push_back(atoi(item.c_str()));
+				}
+			}
+		} else if (!strcmp(option, "--min-time")) {
+			min_time = atof(value);
+		} else if (!strcmp(option, "--output")) {
+			output = value;
+		} else {
+			std::cout << "Unknown option: " << option << std::endl;
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (sizes.empty() || min_time <= 0.0) {
+		std::cout << "Invalid --sizes or --min-time" << std::endl;
+		PrintUsage();
+		return 1;
+	}
+
+	std::vector<PrimitiveResult> results;
+	std::cout << "Primitive\t\t\t\tSize\tCalls\tns/pixel\tGB/s" << std::endl;
+	for (size_t s = 0; s < sizes.size(); s++) {
+		PrimitiveFixture fixture;
+		if (!InitFixture(fixture, sizes[s])) {
+			return 1;
+		}
+		for (int p = 0; p < g_primitive_count; p++) {
+			PrimitiveResult r = MeasurePrimitive((ImagePrimitive)p, fixture, min_time);
+			results.push_back(r);
+
+			std::string name = g_primitive_names[p];
+			name.resize(std::max(name.size(), (size_t)39), ' ');
+			std::cout << name << "\t" << r.size << "\t" << r.calls << "\t" << r.ns_per_pixel << "\t\t" << r.bytes_per_s * 1e-9 << std::endl;
+		}
+		remove(fixture.pgm_path.c_str());
+		remove(fixture.rgb_path.c_str());
+	}
+
+	return WriteResults(results, output) ? 0 : 1;
+}
+
+bool InitFixture(PrimitiveFixture& f, int size)
+{
+	f.width = size;
+	f.height = size;
+	f.dst_width = (int)ceil(size * 0.9f);
+	f.dst_height = (int)ceil(size * 0.9f);
+	f.img1.reinit(size, size, size, size, 1, 1);
+	f.img2.reinit(size, size, size, size, 1, 1);
+	f.dst.reinit(size, size, size, size, 1, 1);
+	f.u.reinit(size, size, size, size, 1, 1);
+	f.v.reinit(size, size, size, size, 1, 1);
+
+	// textured pair translated by (1.5, -0.75), the flow varies smoothly around it
+	Image::fillSyntheticPair(f.img1, f.img2, 1.5f, -0.75f);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			f.u.pixel_w(x, y) = 1.5f + 0.5f * sinf(0.01f * y);
+			f.v.pixel_w(x, y) = -0.75f + 0.5f * cosf(0.01f * x);
+		}
+	}
+	f.img1.fillBoudaries();
+	f.img2.fillBoudaries();
+
+	std::ostringstream path;
+	path << "./data/output/image_bench_" << size;
+	f.pgm_path = path.str() + ".pgm";
+	f.rgb_path = path.str() + "_rgb.ppm";
+	if (!f.img1.writeImagePGM(f.pgm_path)) {
+		std::cout << "Cannot write " << f.pgm_path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void RunPrimitive(ImagePrimitive primitive, PrimitiveFixture& f)
+{
+	switch (primitive) {
+	case PRIM_RESAMPLE_AREA:
+		Image::resampleAreaBasedWithoutReallocating(f.img1, f.dst, f.dst_width, f.dst_height);
+		break;
+	case PRIM_RESAMPLE_BILINEAR:
+		Image::resampleWithoutReallocating(f.img1, f.dst, f.dst_width, f.dst_height);
+		break;
+	case PRIM_BACKWARD:
+		Image::backwardRegistration(f.img1, f.img2, f.dst, f.u, f.v, 1.f, 1.f);
+		break;
+	case PRIM_FILL_BOUNDARIES:
+		f.img1.fillBoudaries();
+		break;
+	case PRIM_ADD:
+		f.dst.setActualSize(f.width, f.height);
+		f.dst += f.u;
+		break;
+	case PRIM_ASSIGN:
+		f.dst = f.img2;
+		break;
+	case PRIM_READ_PGM:
+		f.dst.readImagePGM(f.pgm_path);
+		break;
+	case PRIM_SAVE_RGB:
+		Image::saveOpticalFlowRGB(f.u, f.v, 2.f, f.rgb_path);
+		break;
+	}
+}
+
+/**
+* Bytes every primitive has to move at least (4 bytes per float pixel, 1 per PGM byte, 3 per RGB pixel)
+*/
+double PrimitiveBytes(ImagePrimitive primitive, const PrimitiveFixture& f)
+{
+	double src = (double)f.width * f.height;
+	double dst = (double)f.dst_width * f.dst_height;
+	switch (primitive) {
+	case PRIM_RESAMPLE_AREA:
+	case PRIM_RESAMPLE_BILINEAR:
+		return 4.0 * (src + dst);
+	case PRIM_BACKWARD:
+		return 4.0 * 5.0 * src;		// src1, src2, u, v in, dst2 out
+	case PRIM_FILL_BOUNDARIES:
+		return 4.0 * 2.0 * 2.0 * (f.width + f.height);	// mirrored pixels read and written
+	case PRIM_ADD:
+		return 4.0 * 3.0 * src;
+	case PRIM_ASSIGN:
+		return 4.0 * 2.0 * src;
+	case PRIM_READ_PGM:
+		return (1.0 + 4.0) * src;
+	case PRIM_SAVE_RGB:
+		return (4.0 * 2.0 + 3.0) * src;
+	}
+	return 0.0;
+}
+
+PrimitiveResult MeasurePrimitive(ImagePrimitive primitive, PrimitiveFixture& f, double min_time)
+{
+	// one warmup call (first touch, file cache), then at least 5 timed calls and min_time seconds
+	RunPrimitive(primitive, f);
+
+	CTimer timer;
+	std::vector<double> times;
+	double total = 0.0;
+	while (times.size() < 5 || total < min_time) {
+		timer.Start();
+		RunPrimitive(primitive, f);
+		timer.Stop();
+		times.push_back(timer.GetElapsedTime());
+		total += times.back();
+	}
+	std::sort(times.begin(), times.end());
+
+	PrimitiveResult r;
+	r.primitive = primitive;
+	r.size = f.width;
+	r.calls = (int)times.size();
+	r.seconds = times[times.size() / 2];
+	r.ns_per_pixel = r.seconds * 1e9 / ((double)f.width * f.height);
+	r.bytes_per_s = PrimitiveBytes(primitive, f) / r.seconds;
+	return r;
+}
+
+bool WriteResults(const std::vector<PrimitiveResult>& results, const std::string& path)
+{
+	std::ofstream file(path.c_str());
+	if (!file.good()) {
+		std::cout << "Cannot write results: " << path << std::endl;
+		return false;
+	}
+	file << "{\"results\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		const PrimitiveResult& r = results[i];
+		file << "  {\"primitive\": \"" << g_primitive_names[r.primitive] << "\", \"size\": " << r.size << ", \"calls\": " << r.calls
+			 << ", \"median_s\": " << r.seconds << ", \"ns_per_pixel\": " << r.ns_per_pixel << ", \"bytes_per_s\": " << r.bytes_per_s << "}"
+			 << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	file << "]}" << std::endl;
+
+	std::cout << "Results written to " << path << std::endl;
+	return file.good();
+}
+
+void PrintUsage()
+{
+	std::cout << "Usage: gpuflow_image_bench [--sizes 256,512,1024,2048,4096] [--min-time 0.2] [--output ./data/output/image_bench.json]" << std::endl;
+}
@@ -0,0 +1,564 @@
+#include <iostream>
+// Linux declaration
+#ifndef _WIN32
+	#include <cmath>
+#endif
+
+#include "Common.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+/* Kernel microbenchmarks (gpuflow_kernel_bench): every kernel of the solver programs is launched on
+   synthetic buffers with the image layout (1 pixel border, pitch a multiple of 32) at several sizes
+   and timed with RunKernelNTimes. The time per launch is reported as GB/s and GFLOP/s from the
+   per work-item traffic and flop model of the kernel table, and compared with the ceilings measured
+   by Roofline.cl on the same device (copy bandwidth, multiply-add throughput): "roofline" is the
+   time the ceilings allow divided by the measured time. Only OpenCL 1.1 calls are used, so a
+   CPU-only machine can run it with --device cpu (e.g. PoCL).
+
+   gpuflow_kernel_bench [--sizes 256,512,1024,2048] [--iterations 20] [--device gpu|cpu|all]
+                        [--output ./data/output/kernel_bench.json] */
+
+enum KernelShape
+{
+	SHAPE_IMAGE,			// 2D, one work-item per pixel
+	SHAPE_ELEMENTS,			// 1D, one work-item per buffer element (pitch * (height + 2))
+	SHAPE_HALF_ELEMENTS,	// 1D, one work-item per 2 buffer elements
+	SHAPE_ROW,				// one line of work-items over the width
+	SHAPE_COLUMN,			// one line of work-items over the height
+	SHAPE_RESAMPLE_Y,		// 2D, width x resampled height
+	SHAPE_RESAMPLE_X		// 2D, resampled width x height
+};
+
+struct ProgramSpec
+{
+	const char* name;
+	const char* file;			// in the kernel directory
+	const char* options;		// besides the include path of the kernel directory
+	size_t localWorkSize[2];
+};
+
+/* arguments, one character each:
+	I image buffer (1 float per element)	F flow buffer (2 floats per element)	J motion tensor (8 floats per element)
+	R resample index table					w resample weights						T resample taps
+	h grid spacing 1						a alpha 4								o omega 1
+	e epsilon 0.001							b border size 1							0 int 0 (color, offset)
+	W width									H height								P pitch
+	D resampled size (0.9 * size) */
+struct KernelSpec
+{
+	int program;				// index into g_programs
+	const char* name;
+	const char* args;
+	KernelShape shape;
+	double bytes;				// global memory traffic per work-item
+	double flops;				// floating point operations per work-item
+};
+
+static const ProgramSpec g_programs[] = {
+	{ "naive",		 "NaiveSolver.cl",		"",														{ 32, 16 } },
+	{ "optimized",	 "OptimizedSolver.cl",	"-D TILE_SIZE_X=32 -D TILE_SIZE_Y=16 -D TEMPORAL_ITERATIONS=4",	{ 32, 16 } },
+	{ "flow_driven", "FlowDrivenSolver.cl",	"-D TILE_SIZE_X=32 -D TILE_SIZE_Y=4",					{ 32, 4 } },
+	{ "full",		 "FullGPUSolver.cl",	"-D TILE_SIZE_X=32 -D TILE_SIZE_Y=4",					{ 32, 4 } }
+};
+static const int g_program_count = sizeof(g_programs) / sizeof(g_programs[0]);
+
+// BackwardRegistrationImage (image object argument) and MultiDeviceSolver.cl are not covered
+static const KernelSpec g_kernels[] = {
+	{ 0, "NaiveSolver",					"IIIIIIhhaobbWHPII",	SHAPE_IMAGE,		 32,	75 },
+	{ 0, "NaiveSolverRedBlack",			"IIIIIIhhaobbWHP0",		SHAPE_IMAGE,		 16,	38 },
+	{ 1, "OptimizedSolver",				"IIIIIIhhaoWHPII",		SHAPE_IMAGE,		 32,	75 },
+	{ 1, "OptimizedSolverRedBlack",		"IIIIIIhhaoWHP0",		SHAPE_IMAGE,		 16,	38 },
+	{ 1, "OptimizedSolverTemporal",		"IIIIIIhhaoWHPII",		SHAPE_IMAGE,		 32,	300 },
+	{ 1, "Zero",						"I",					SHAPE_ELEMENTS,		 4,		0 },
+	{ 2, "ComputeMotionTensor",			"IIhhbbWHPJ",			SHAPE_IMAGE,		 40,	20 },
+	{ 2, "ComputePhiKsi",				"IIIIIIehhbbWHPJe",		SHAPE_IMAGE,		 56,	40 },
+	{ 2, "ComputePhiKsiTiled",			"IIIIIIehhbbWHPJe",		SHAPE_IMAGE,		 56,	40 },
+	{ 2, "Solver",						"JIIIIhhaobbWHPIIII",	SHAPE_IMAGE,		 64,	90 },
+	{ 2, "SolverRedBlack",				"JIIIIhhaobbWHP0II",	SHAPE_IMAGE,		 32,	45 },
+	{ 2, "SolverTiled",					"JIIIIhhaobbWHPIIII",	SHAPE_IMAGE,		 64,	90 },
+	{ 2, "SolverTiledPhiKsi",			"JIIIIhhaobbWHPIIIIee",	SHAPE_IMAGE,		 72,	130 },
+	{ 3, "ComputeMotionTensor",			"IIhhbbWHPJ",			SHAPE_IMAGE,		 40,	20 },
+	{ 3, "Solver",						"JFFhhaobbWHPF",		SHAPE_IMAGE,		 56,	55 },
+	{ 3, "SolverRedBlack",				"JFFhhaobbWHP0",		SHAPE_IMAGE,		 28,	28 },
+	{ 3, "SolverTiled",					"JFFhhaobbWHPF",		SHAPE_IMAGE,		 56,	55 },
+	{ 3, "SolverTiledRedBlack",			"JFFhhaobbWHP0",		SHAPE_IMAGE,		 28,	28 },
+	{ 3, "ComputePhiKsi",				"FFIIehhbbWHPJe",		SHAPE_IMAGE,		 56,	40 },
+	{ 3, "SolverRobust",				"JFFhhaobbWHPFII",		SHAPE_IMAGE,		 64,	90 },
+	{ 3, "SolverRobustRedBlack",		"JFFhhaobbWHP0II",		SHAPE_IMAGE,		 32,	45 },
+	{ 3, "Zero",						"F",					SHAPE_ELEMENTS,		 8,		0 },
+	{ 3, "Add",							"FF",					SHAPE_HALF_ELEMENTS, 48,	4 },
+	{ 3, "BackwardRegistration",		"IIFhhbbWHPI",			SHAPE_IMAGE,		 20,	20 },
+	{ 3, "ReflectHorizontalBoudaries",	"IbbWHP",				SHAPE_ROW,			 16,	0 },
+	{ 3, "ReflectVerticalBoudaries",	"IbbWHP",				SHAPE_COLUMN,		 16,	0 },
+	{ 3, "ResampleY",					"IIRwTWDP",				SHAPE_RESAMPLE_Y,	 8.4,	4 },
+	{ 3, "ResampleX",					"IIRwTDHP",				SHAPE_RESAMPLE_X,	 8.4,	4 },
+	{ 3, "ResampleYFlow",				"FFRwTWDP",				SHAPE_RESAMPLE_Y,	 17,	8 },
+	{ 3, "ResampleXFlow",				"FFRwTDHP",				SHAPE_RESAMPLE_X,	 17,	8 },
+	{ 3, "ConvertFromFloat",			"II0",					SHAPE_ELEMENTS,		 8,		0 },
+	{ 3, "ConvertToFloat",				"II0",					SHAPE_ELEMENTS,		 8,		0 }
+};
+static const int g_kernel_count = sizeof(g_kernels) / sizeof(g_kernels[0]);
+
+static const int MAX_IMAGE_BUFFERS = 8;
+static const int MAX_FLOW_BUFFERS = 3;
+
+/* synthetic buffers of one size, shared by all kernels */
+struct KernelFixture
+{
+	int width;
+	int height;
+	int pitch;
+	int resampled;				// resampled width and height
+	int elements;				// pitch * (height + 2)
+	int taps;
+	cl_mem images[MAX_IMAGE_BUFFERS];
+	cl_mem flows[MAX_FLOW_BUFFERS];
+	cl_mem tensor;
+	cl_mem index;
+	cl_mem weights;
+};
+
+struct Ceilings
+{
+	double bytes_per_s;			// copy bandwidth (read + write)
+	double flops_per_s;			// multiply-add throughput
+};
+
+struct KernelResult
+{
+	int kernel;
+	int size;
+	double ms;					// per launch
+	double work_items;
+	double bytes_per_s;
+	double flops_per_s;
+	double intensity;			// flops per byte
+	double bandwidth_fraction;	// of the copy bandwidth
+	double roofline_fraction;	// time allowed by the ceilings / measured time
+};
+
+cl_context			g_CLContext			= NULL;
+cl_command_queue	g_CLCommandQueue	= NULL;
+cl_device_id		g_CLDevice			= NULL;
+
+cl_program BuildProgram(const ProgramSpec& spec);
+bool MeasureCeilings(unsigned int iterations, Ceilings& ceilings);
+bool InitFixture(KernelFixture& f, int size);
+void ReleaseFixture(KernelFixture& f);
+bool SetKernelArguments(cl_kernel kernel, const KernelSpec& spec, const KernelFixture& f);
+bool MeasureKernel(cl_program program, int k, const KernelFixture& f, const Ceilings& ceilings, unsigned int iterations, KernelResult& result);
+bool WriteResults(const std::vector<KernelResult>& results, const Ceilings& ceilings, unsigned int iterations, const std::string& path);
+void PrintUsage();
+
+int main(int argc, char** argv)
+{
+	std::vector<int> sizes;
+	for (int size = 256; size <= 2048; size *= 2) {
+		sizes.push_back(size);
+	}
+	unsigned int iterations = 20;
+	cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+	std::string output = "./data/output/kernel_bench.json";
+
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for " << argv[i] << std::endl;
+			PrintUsage();
+			return 1;
+		}
+		if (!strcmp(argv[i], "--sizes")) {
+			sizes.clear();
+			std::stringstream stream(argv[i + 1]);
+			std::string item;
+			while (std::getline(stream, item, ',')) {
+				if (atoi(item.c_str()) > 0) {
+					sizes.push_back(atoi(item.c_str()));
+				}
+			}
+		} else if (!strcmp(argv[i], "--iterations")) {
+			iterations = (unsigned int)std::max(1, atoi(argv[i + 1]));
+		} else if (!strcmp(argv[i], "--device")) {
+			if (!strcmp(argv[i + 1], "gpu")) {
+				device_type = CL_DEVICE_TYPE_GPU;
+			} else if (!strcmp(argv[i + 1], "cpu")) {
+				device_type = CL_DEVICE_TYPE_CPU;
+			} else if (!strcmp(argv[i + 1], "all")) {
+				device_type = CL_DEVICE_TYPE_ALL;
+			} else {
+				std::cout << "Unknown device type: " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--output")) {
+			output = argv[i + 1];
+		} else {
+			std::cout << "Unknown option: " << argv[i] << std::endl;
+			PrintUsage();
+			return 1;
+		}
+	}
+	if (sizes.empty()) {
+		std::cout << "Invalid --sizes" << std::endl;
+		PrintUsage();
+		return 1;
+	}
+
+	if (!InitContextResources(device_type, false, g_CLContext, g_CLCommandQueue, g_CLDevice)) {
+		CleanupContextResources(g_CLContext, g_CLCommandQueue);
+		return 1;
+	}
+
+	Ceilings ceilings;
+	if (!MeasureCeilings(iterations, ceilings)) {
+		CleanupContextResources(g_CLContext, g_CLCommandQueue);
+		return 1;
+	}
+	std::cout << "Copy bandwidth: " << ceilings.bytes_per_s * 1e-9 << " GB/s, multiply-add: " << ceilings.flops_per_s * 1e-9 << " GFLOP/s" << std::endl;
+
+	cl_program programs[g_program_count];
+	for (int p = 0; p < g_program_count; p++) {
+		programs[p] = BuildProgram(g_programs[p]);
+	}
+
+	std::vector<KernelResult> results;
+	for (size_t s = 0; s < sizes.size(); s++) {
+		KernelFixture fixture;
+		if (!InitFixture(fixture, sizes[s])) {
+			ReleaseFixture(fixture);
+			continue;
+		}
+		std::cout << std::endl << "--- " << sizes[s] << "x" << sizes[s] << " ---" << std::endl;
+		std::cout << "Kernel\t\t\t\t\tms\t\tGB/s\t\tGFLOP/s\t\tflop/B\tBW %\tRoofline %" << std::endl;
+		for (int k = 0; k < g_kernel_count; k++) {
+			if (!programs[g_kernels[k].program]) {
+				continue;
+			}
+			KernelResult r;
+			if (!MeasureKernel(programs[g_kernels[k].program], k, fixture, ceilings, iterations, r)) {
+				continue;
+			}
+			results.push_back(r);
+
+			std::string name = std::string(g_programs[g_kernels[k].program].name) + "/" + g_kernels[k].name;
+			name.resize(std::max(name.size(), (size_t)39), ' ');
+			std::cout << name << "\t" << r.ms << "\t\t" << r.bytes_per_s * 1e-9 << "\t\t" << r.flops_per_s * 1e-9 << "\t\t"
+					  << r.intensity << "\t" << (int)(100 * r.bandwidth_fraction) << "\t" << (int)(100 * r.roofline_fraction) << std::endl;
+		}
+		ReleaseFixture(fixture);
+	}
+
+	for (int p = 0; p < g_program_count; p++) {
+		SAFE_RELEASE_PROGRAM(programs[p]);
+	}
+	bool written = WriteResults(results, ceilings, iterations, output);
+	CleanupContextResources(g_CLContext, g_CLCommandQueue);
+	return written ? 0 : 1;
+}
+
+cl_program BuildProgram(const ProgramSpec& spec)
+{
+	cl_int cl_error;
+	char* program_code = NULL;
+	size_t program_size = 0;
+
+	LoadProgram(KernelPath(spec.file).c_str(), &program_code, &program_size);
+	if (!program_code) {
+		return NULL;
+	}
+
+	cl_program program = clCreateProgramWithSource(g_CLContext, 1, (const char**)&program_code, &program_size, &cl_error);
+	SAFE_DELETE_ARRAY(program_code);
+	if (cl_error != CL_SUCCESS) {
+		std::cout << "Error: Failed to create program " << spec.file << " [" << errorToString(cl_error) << "]" << std::endl;
+		return NULL;
+	}
+
+	std::string options = KernelIncludeOption() + " " + spec.options;
+	cl_error = clBuildProgram(program, 1, &g_CLDevice, options.c_str(), NULL, NULL);
+	if (cl_error != CL_SUCCESS) {
+		std::cout << "Error: Failed to build program " << spec.file << ", its kernels are skipped" << std::endl;
+		PrintBuildLog(program, g_CLDevice);
+		SAFE_RELEASE_PROGRAM(program);
+	}
+	return program;
+}
+
+/**
+* Ceilings of the roofline: bandwidth of a float4 copy and throughput of independent multiply-add chains
+*/
+bool MeasureCeilings(unsigned int iterations, Ceilings& ceilings)
+{
+	cl_int cl_error;
+	ProgramSpec roofline = { "roofline", "Roofline.cl", "", { 0, 0 } };
+	cl_program program = BuildProgram(roofline);
+	if (!program) {
+		return false;
+	}
+
+	// 64 MB per buffer, far beyond the last level cache
+	const size_t copy_items = 4 * 1024 * 1024;
+	const size_t mad_items = 1024 * 1024;
+	const int mad_iterations = 128;
+	float a = 0.999f;
+	float b = 0.001f;
+
+	cl_kernel copy = clCreateKernel(program, "Copy", &cl_error);
+	cl_kernel mad = clCreateKernel(program, "MultiplyAdd", &cl_error);
+	cl_mem src = clCreateBuffer(g_CLContext, CL_MEM_READ_WRITE, copy_items * 4 * sizeof(float), NULL, &cl_error);
+	cl_mem dst = clCreateBuffer(g_CLContext, CL_MEM_READ_WRITE, copy_items * 4 * sizeof(float), NULL, &cl_error);
+
+	bool ok = copy && mad && src && dst;
+	double copy_ms = -1.0;
+	double mad_ms = -1.0;
+	if (ok) {
+		cl_error  = clSetKernelArg(copy, 0, sizeof(cl_mem), (void*)&src);
+		cl_error |= clSetKernelArg(copy, 1, sizeof(cl_mem), (void*)&dst);
+		cl_error |= clSetKernelArg(mad, 0, sizeof(cl_mem), (void*)&dst);
+		cl_error |= clSetKernelArg(mad, 1, sizeof(cl_int), (void*)&mad_iterations);
+		cl_error |= clSetKernelArg(mad, 2, sizeof(cl_float), (void*)&a);
+		cl_error |= clSetKernelArg(mad, 3, sizeof(cl_float), (void*)&b);
+		ok = cl_error == CL_SUCCESS;
+	}
+	if (ok) {
+		// one untimed launch each (first touch of the buffers, lazy compilation)
+		RunKernelNTimes(g_CLCommandQueue, copy, 1, &copy_items, NULL, 1);
+		RunKernelNTimes(g_CLCommandQueue, mad, 1, &mad_items, NULL, 1);
+		copy_ms = RunKernelNTimes(g_CLCommandQueue, copy, 1, &copy_items, NULL, iterations);
+		mad_ms = RunKernelNTimes(g_CLCommandQueue, mad, 1, &mad_items, NULL, iterations);
+		ok = copy_ms > 0.0 && mad_ms > 0.0;
+	}
+	if (ok) {
+		ceilings.bytes_per_s = 2.0 * copy_items * 4 * sizeof(float) / (copy_ms * 1e-3);
+		ceilings.flops_per_s = 32.0 * mad_iterations * mad_items / (mad_ms * 1e-3);
+	} else {
+		std::cout << "Error: Failed to measure the roofline ceilings" << std::endl;
+	}
+
+	SAFE_RELEASE_MEMOBJECT(src);
+	SAFE_RELEASE_MEMOBJECT(dst);
+	SAFE_RELEASE_KERNEL(copy);
+	SAFE_RELEASE_KERNEL(mad);
+	SAFE_RELEASE_PROGRAM(program);
+	return ok;
+}
+
+bool InitFixture(KernelFixture& f, int size)
+{
+	cl_int cl_error;
+	f.width = size;
+	f.height = size;
+	f.pitch = (size + 2) % 32 == 0 ? size + 2 : size + 2 + 32 - (size + 2) % 32;
+	f.resampled = (int)ceil(size * 0.9f);
+	f.elements = f.pitch * (f.height + 2);
+	f.tensor = f.index = f.weights = NULL;
+	for (int i = 0; i < MAX_IMAGE_BUFFERS; i++) {
+		f.images[i] = NULL;
+	}
+	for (int i = 0; i < MAX_FLOW_BUFFERS; i++) {
+		f.flows[i] = NULL;
+	}
+
+	// smooth positive values keep the solver denominators and the robust functions well defined
+	std::vector<float> values(8 * (size_t)f.elements);
+	for (size_t i = 0; i < values.size(); i++) {
+		values[i] = 0.5f + 0.25f * sinf(0.1f * (float)(i % 4096));
+	}
+
+	for (int i = 0; i < MAX_IMAGE_BUFFERS; i++) {
+		f.images[i] = clCreateBuffer(g_CLContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, f.elements * sizeof(float), &values[0], &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating image buffer for " << size << "x" << size);
+	}
+	for (int i = 0; i < MAX_FLOW_BUFFERS; i++) {
+		f.flows[i] = clCreateBuffer(g_CLContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 2 * f.elements * sizeof(float), &values[0], &cl_error);
+		V_RETURN_FALSE_CL(cl_error, "Error allocating flow buffer for " << size << "x" << size);
+	}
+	f.tensor = clCreateBuffer(g_CLContext, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 8 * f.elements * sizeof(float), &values[0], &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating motion tensor for " << size << "x" << size);
+
+	// area based resampling table of the full GPU engine, size -> resampled
+	std::vector<cl_int> index;
+	std::vector<float> weights;
+	BuildResampleTable(size, f.resampled, index, weights, f.taps);
+	f.index = clCreateBuffer(g_CLContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, index.size() * sizeof(cl_int), &index[0], &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating resample table");
+	f.weights = clCreateBuffer(g_CLContext, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, weights.size() * sizeof(float), &weights[0], &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Error allocating resample table");
+
+	return true;
+}
+
+void ReleaseFixture(KernelFixture& f)
+{
+	for (int i = 0; i < MAX_IMAGE_BUFFERS; i++) {
+		SAFE_RELEASE_MEMOBJECT(f.images[i]);
+	}
+	for (int i = 0; i < MAX_FLOW_BUFFERS; i++) {
+		SAFE_RELEASE_MEMOBJECT(f.flows[i]);
+	}
+	SAFE_RELEASE_MEMOBJECT(f.tensor);
+	SAFE_RELEASE_MEMOBJECT(f.index);
+	SAFE_RELEASE_MEMOBJECT(f.weights);
+}
+
+/**
+* Set the arguments of a kernel from its argument string, buffers are taken from the fixture in order
+*/
+bool SetKernelArguments(cl_kernel kernel, const KernelSpec& spec, const KernelFixture& f)
+{
+	cl_int cl_error = CL_SUCCESS;
+	int images = 0;
+	int flows = 0;
+
+	for (cl_uint i = 0; spec.args[i]; i++) {
+		cl_float value_f = 0.f;
+		cl_int value_i = 0;
+		const cl_mem* buffer = NULL;
+		bool is_float = false;
+
+		switch (spec.args[i]) {
+		case 'I': buffer = &f.images[images++];	break;
+		case 'F': buffer = &f.flows[flows++];	break;
+		case 'J': buffer = &f.tensor;			break;
+		case 'R': buffer = &f.index;			break;
+		case 'w': buffer = &f.weights;			break;
+		case 'h': value_f = 1.f;		is_float = true; break;
+		case 'a': value_f = 4.f;		is_float = true; break;
+		case 'o': value_f = 1.f;		is_float = true; break;
+		case 'e': value_f = 0.001f;		is_float = true; break;
+		case 'b': value_i = 1;			break;
+		case '0': value_i = 0;			break;
+		case 'T': value_i = f.taps;		break;
+		case 'W': value_i = f.width;	break;
+		case 'H': value_i = f.height;	break;
+		case 'P': value_i = f.pitch;	break;
+		case 'D': value_i = f.resampled; break;
+		default:
+			std::cout << "Error: Unknown argument '" << spec.args[i] << "' of " << spec.name << std::endl;
+			return false;
+		}
+
+		if (buffer) {
+			cl_error |= clSetKernelArg(kernel, i, sizeof(cl_mem), (void*)buffer);
+		} else if (is_float) {
+			cl_error |= clSetKernelArg(kernel, i, sizeof(cl_float), (void*)&value_f);
+		} else {
+			cl_error |= clSetKernelArg(kernel, i, sizeof(cl_int), (void*)&value_i);
+		}
+	}
+	V_RETURN_FALSE_CL(cl_error, "Error setting kernel arguments of " << spec.name);
+	return true;
+}
+
+bool MeasureKernel(cl_program program, int k, const KernelFixture& f, const Ceilings& ceilings, unsigned int iterations, KernelResult& result)
+{
+	cl_int cl_error;
+	const KernelSpec& spec = g_kernels[k];
+	const size_t* lws = g_programs[spec.program].localWorkSize;
+
+	cl_kernel kernel = clCreateKernel(program, spec.name, &cl_error);
+	V_RETURN_FALSE_CL(cl_error, "Failed to create kernel: " << spec.name);
+	if (!SetKernelArguments(kernel, spec, f)) {
+		SAFE_RELEASE_KERNEL(kernel);
+		return false;
+	}
+
+	cl_uint dimensions = 2;
+	size_t globalWorkSize[2] = { 0, 1 };
+	size_t localWorkSize[2] = { lws[0], lws[1] };
+	const size_t* pLocalWorkSize = localWorkSize;
+	double work_items = 0.0;
+	switch (spec.shape) {
+	case SHAPE_IMAGE:
+		globalWorkSize[0] = GetGlobalWorkSize(f.width, lws[0]);
+		globalWorkSize[1] = GetGlobalWorkSize(f.height, lws[1]);
+		work_items = (double)f.width * f.height;
+		break;
+	case SHAPE_ELEMENTS:
+	case SHAPE_HALF_ELEMENTS:
+		dimensions = 1;
+		globalWorkSize[0] = spec.shape == SHAPE_ELEMENTS ? f.elements : f.elements / 2;
+		pLocalWorkSize = NULL;
+		work_items = (double)globalWorkSize[0];
+		break;
+	case SHAPE_ROW:
+	case SHAPE_COLUMN:
+		globalWorkSize[0] = GetGlobalWorkSize(spec.shape == SHAPE_ROW ? f.width : f.height, lws[0]);
+		localWorkSize[1] = 1;
+		work_items = spec.shape == SHAPE_ROW ? f.width : f.height;
+		break;
+	case SHAPE_RESAMPLE_Y:
+		globalWorkSize[0] = GetGlobalWorkSize(f.width, lws[0]);
+		globalWorkSize[1] = GetGlobalWorkSize(f.resampled, lws[1]);
+		work_items = (double)f.width * f.resampled;
+		break;
+	case SHAPE_RESAMPLE_X:
+		globalWorkSize[0] = GetGlobalWorkSize(f.resampled, lws[0]);
+		globalWorkSize[1] = GetGlobalWorkSize(f.height, lws[1]);
+		work_items = (double)f.resampled * f.height;
+		break;
+	}
+
+	// one untimed launch (lazy compilation, first touch), then the timed ones
+	RunKernelNTimes(g_CLCommandQueue, kernel, dimensions, globalWorkSize, pLocalWorkSize, 1);
+	double ms = RunKernelNTimes(g_CLCommandQueue, kernel, dimensions, globalWorkSize, pLocalWorkSize, iterations);
+	SAFE_RELEASE_KERNEL(kernel);
+	if (ms <= 0.0) {
+		std::cout << "Error: Failed to run kernel: " << spec.name << std::endl;
+		return false;
+	}
+
+	double bytes = spec.bytes * work_items;
+	double flops = spec.flops * work_items;
+	result.kernel = k;
+	result.size = f.width;
+	result.ms = ms;
+	result.work_items = work_items;
+	result.bytes_per_s = bytes / (ms * 1e-3);
+	result.flops_per_s = flops / (ms * 1e-3);
+	result.intensity = spec.flops / spec.bytes;
+	result.bandwidth_fraction = result.bytes_per_s / ceilings.bytes_per_s;
+	result.roofline_fraction = std::max(bytes / ceilings.bytes_per_s, flops / ceilings.flops_per_s) / (ms * 1e-3);
+	return true;
+}
+
+bool WriteResults(const std::vector<KernelResult>& results, const Ceilings& ceilings, unsigned int iterations, const std::string& path)
+{
+	std::ofstream file(path.c_str());
+	if (!file.good()) {
+		std::cout << "Cannot write results: " << path << std::endl;
+		return false;
+	}
+
+	char device_name[256] = "";
+	clGetDeviceInfo(g_CLDevice, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+
+	file << "{" << std::endl;
+	file << "  \"device\": \"" << device_name << "\"," << std::endl;
+	file << "  \"iterations\": " << iterations << "," << std::endl;
+	file << "  \"ceilings\": {\"bytes_per_s\": " << ceilings.bytes_per_s << ", \"flops_per_s\": " << ceilings.flops_per_s << "}," << std::endl;
+	file << "  \"results\": [" << std::endl;
+	for (size_t i = 0; i < results.size(); i++) {
+		const KernelResult& r = results[i];
+		const KernelSpec& spec = g_kernels[r.kernel];
+		file << "    {\"program\": \"" << g_programs[spec.program].name << "\", \"kernel\": \"" << spec.name << "\", \"size\": " << r.size
+			 << ", \"ms\": " << r.ms << ", \"work_items\": " << r.work_items << ", \"bytes_per_s\": " << r.bytes_per_s << ", \"flops_per_s\": " << r.flops_per_s
+			 << ", \"flops_per_byte\": " << r.intensity << ", \"bandwidth_fraction\": " << r.bandwidth_fraction << ", \"roofline_fraction\": " << r.roofline_fraction << "}"
+			 << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	file << "  ]" << std::endl;
+	file << "}" << std::endl;
+
+	std::cout << "Results written to " << path << std::endl;
+	return file.good();
+}
+
+void PrintUsage()
+{
+	std::cout << "Usage: gpuflow_kernel_bench [--sizes 256,512,1024,2048] [--iterations 20] [--device gpu|cpu|all]" << std::endl
+			  << "                            [--output ./data/output/kernel_bench.json]" << std::endl;
+}
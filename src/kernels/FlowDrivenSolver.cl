@@ -1,6 +1,35 @@
+#include "SolverCommon.cl"
 
 #define IND(X, Y) (((Y) + by) * pitch + ((X) + bx))
 
+// (u + du, v + dv) of pixel (X, Y) from the separate component buffers
+#define FLOW(X, Y) ((float2)(u[IND(X, Y)] + du[IND(X, Y)], v[IND(X, Y)] + dv[IND(X, Y)]))
+
+__kernel void ComputeMotionTensor(
+	__global	const	float*	d_img_1,	//  0 in     : 1st image 
+	__global	const	float*	d_img_2,	//  1 in     : 2nd image (motion compensated)
+						float	hx,			//  2 in     : grid spacing in x-direction
+						float	hy,			//  3 in     : grid spacing in y-direction
+						int		bx,			//  4 in	 : x-border size
+						int		by,         //  5 in     : y-border size
+						int		width,		//  6 in     : image width
+						int		height,		//  7 in     : image height
+						int		pitch,		//  8 in     : image pitch
+	__global			float8*	J			//  9 out	 : motion tensor
+	)
+{
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	float4 n_1 = (float4)(d_img_1[IND(x, y + 1)], d_img_1[IND(x, y - 1)], d_img_1[IND(x - 1, y)], d_img_1[IND(x + 1, y)]);
+	float4 n_2 = (float4)(d_img_2[IND(x, y + 1)], d_img_2[IND(x, y - 1)], d_img_2[IND(x - 1, y)], d_img_2[IND(x + 1, y)]);
+
+	J[IND(x, y)] = MotionTensor(d_img_1[IND(x, y)], n_1, d_img_2[IND(x, y)], n_2, hx, hy);
+}
 
 __kernel void ComputePhiKsi(
 	__global	const	float*	u,			//  0 in     : x-component of flow field 
@@ -17,9 +46,8 @@ __kernel void ComputePhiKsi(
 						int		width,		// 11 in     : image width
 						int		height,		// 12 in     : image height
 						int		pitch,		// 13 in     : image pitch
-	__global	const	float*	d_img_1,	// 14 in     : 1st image 
-	__global	const	float*	d_img_2,	// 15 in     : 2nd image
-						float	e_data		// 16 in     : e_data
+	__global	const	float8*	J,			// 14 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+						float	e_data		// 15 in     : e_data
 	)
 {
 	size_t x = get_global_id(0);
@@ -29,117 +57,313 @@ __kernel void ComputePhiKsi(
 		return;
 	}
 
-	float ux = (u[IND(x + 1, y)] - u[IND(x - 1, y)]) / (2.f * hx);
-	float uy = (u[IND(x, y + 1)] - u[IND(x, y - 1)]) / (2.f * hy);
-	float vx = (v[IND(x + 1, y)] - v[IND(x - 1, y)]) / (2.f * hx);
-	float vy = (v[IND(x, y + 1)] - v[IND(x, y - 1)]) / (2.f * hy);
-
-	float dux = (du[IND(x + 1, y)] - du[IND(x - 1, y)]) / (2.f * hx);
-	float duy = (du[IND(x, y + 1)] - du[IND(x, y - 1)]) / (2.f * hy);
-	float dvx = (dv[IND(x + 1, y)] - dv[IND(x - 1, y)]) / (2.f * hx);
-	float dvy = (dv[IND(x, y + 1)] - dv[IND(x, y - 1)]) / (2.f * hy);
-
-	dux = ux + dux;
-	duy = uy + duy;
-	dvx = vx + dvx;
-	dvy = vy + dvy;
-
-	phi[IND(x, y)] = 1.f / (2.f * sqrt(dux*dux + duy*duy + dvx*dvx + dvy*dvy + e_smooth * e_smooth));
-
-	// Derivatives variables
-	float fx = (d_img_1[IND(x + 1, y)] - d_img_1[IND(x - 1, y)] + d_img_2[IND(x + 1, y)] - d_img_2[IND(x - 1, y)]) / (4.f * hx);
-	float fy = (d_img_1[IND(x, y + 1)] - d_img_1[IND(x, y - 1)] + d_img_2[IND(x, y + 1)] - d_img_2[IND(x, y - 1)]) / (4.f * hy);
-	float ft = d_img_2[IND(x, y)] - d_img_1[IND(x, y)];
-
-	float J11 = fx * fx;
-	float J22 = fy * fy;
-	float J33 = ft * ft;
-	float J12 = fx * fy;
-	float J13 = fx * ft;
-	float J23 = fy * ft;
-	
-	// Weight for data term
-	float du_ = du[IND(x, y)];
-	float dv_ = dv[IND(x, y)];
-
-	float s = (J11 * du_ + J12 * dv_ + J13) * du_ +
-			  (J12 * du_ + J22 * dv_ + J23) * dv_ +
-			  (J13 * du_ + J23 * dv_ + J33);
-
-	s = (s > 0) * s;
-
-	// Penalizer function for data term
-	ksi[IND(x, y)] = 1.f / (2.f * sqrt(s + e_data * e_data));
+	// derivatives of u + du and v + dv
+	float2 w_x = (FLOW(x + 1, y) - FLOW(x - 1, y)) / (2.f * hx);
+	float2 w_y = (FLOW(x, y + 1) - FLOW(x, y - 1)) / (2.f * hy);
+
+	phi[IND(x, y)] = Phi(w_x, w_y, e_smooth);
+	ksi[IND(x, y)] = Ksi(J[IND(x, y)], (float2)(du[IND(x, y)], dv[IND(x, y)]), e_data);
 }
 
 __kernel void Solver(
-	__global	const	float*	d_img_1,	//  0 in     : 1st image 
-	__global	const	float*	d_img_2,	//  1 in     : 2nd image
-	__global			float*  du,			//  2 in	 : x-component of flow increment
-	__global			float*  dv,			//  3 in	 : y-component of flow increment
-	__global			float*  u,			//  4 in	 : x-component of flow field
-	__global			float*  v,			//  5 in	 : y-component of flow field
-						float	hx,			//  6 in     : grid spacing in x-direction
-						float	hy,			//  7 in     : grid spacing in y-direction
-						float	alpha,		//  8 in     : smoothness weight
-						float	omega,		//  9 in     : SOR overrelaxation parameter
-						int		bx,			// 10 in	 : x-border size
-						int		by,         // 11 in     : y-border size
-						int		width,		// 12 in     : image width
-						int		height,		// 13 in     : image height
-						int		pitch,		// 14 in     : image pitch
-	__global			float*	du_r,		// 15 out	 : du result
-	__global			float*	dv_r,		// 16 out	 : dv result
-	__global	const	float*	phi,		// 17 in     : precomputed phi
-	__global	const	float*	ksi			// 18 in     : precomputed ksi
+	__global	const	float8*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global			float*  du,			//  1 in	 : x-component of flow increment
+	__global			float*  dv,			//  2 in	 : y-component of flow increment
+	__global			float*  u,			//  3 in	 : x-component of flow field
+	__global			float*  v,			//  4 in	 : y-component of flow field
+						float	hx,			//  5 in     : grid spacing in x-direction
+						float	hy,			//  6 in     : grid spacing in y-direction
+						float	alpha,		//  7 in     : smoothness weight
+						float	omega,		//  8 in     : SOR overrelaxation parameter
+						int		bx,			//  9 in	 : x-border size
+						int		by,         // 10 in     : y-border size
+						int		width,		// 11 in     : image width
+						int		height,		// 12 in     : image height
+						int		pitch,		// 13 in     : image pitch
+	__global			float*	du_r,		// 14 out	 : du result
+	__global			float*	dv_r,		// 15 out	 : dv result
+	__global	const	float*	phi,		// 16 in     : precomputed phi
+	__global	const	float*	ksi			// 17 in     : precomputed ksi
+	)
+{
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	float4 w_phi = FaceWeights(StencilWeights(x, y, width, height, hx, hy, alpha), phi[IND(x, y)],
+							   (float4)(phi[IND(x, y + 1)], phi[IND(x, y - 1)], phi[IND(x - 1, y)], phi[IND(x + 1, y)]));
+
+	float2 uv_c = (float2)(u[IND(x, y)], v[IND(x, y)]);
+	float2 nb = StencilSum(w_phi, uv_c, FLOW(x, y + 1), FLOW(x, y - 1), FLOW(x - 1, y), FLOW(x + 1, y));
+
+	float2 duv_new = UpdateIncrement(J[IND(x, y)], ksi[IND(x, y)], w_phi, nb, (float2)(du[IND(x, y)], dv[IND(x, y)]), omega, 0);
+
+	du_r[IND(x, y)] = duv_new.x;
+	dv_r[IND(x, y)] = duv_new.y;
+}
+
+__kernel void SolverRedBlack(
+	__global	const	float8*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global			float*  du,			//  1 in:out : x-component of flow increment
+	__global			float*  dv,			//  2 in:out : y-component of flow increment
+	__global	const	float*  u,			//  3 in	 : x-component of flow field
+	__global	const	float*  v,			//  4 in	 : y-component of flow field
+						float	hx,			//  5 in     : grid spacing in x-direction
+						float	hy,			//  6 in     : grid spacing in y-direction
+						float	alpha,		//  7 in     : smoothness weight
+						float	omega,		//  8 in     : SOR overrelaxation parameter
+						int		bx,			//  9 in	 : x-border size
+						int		by,         // 10 in     : y-border size
+						int		width,		// 11 in     : image width
+						int		height,		// 12 in     : image height
+						int		pitch,		// 13 in     : image pitch
+						int		color,		// 14 in     : updated pixels: (x + y) % 2 == color
+	__global	const	float*	phi,		// 15 in     : precomputed phi
+	__global	const	float*	ksi			// 16 in     : precomputed ksi
+	)
+{
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	// in-place update: all 4 neighbours have the other color and are not written by this launch
+	if (x >= width || y >= height || ((x + y) & 1) != color) {
+		return;
+	}
+
+	float4 w_phi = FaceWeights(StencilWeights(x, y, width, height, hx, hy, alpha), phi[IND(x, y)],
+							   (float4)(phi[IND(x, y + 1)], phi[IND(x, y - 1)], phi[IND(x - 1, y)], phi[IND(x + 1, y)]));
+
+	float2 uv_c = (float2)(u[IND(x, y)], v[IND(x, y)]);
+	float2 nb = StencilSum(w_phi, uv_c, FLOW(x, y + 1), FLOW(x, y - 1), FLOW(x - 1, y), FLOW(x + 1, y));
+
+	// dv uses the already updated du of the same pixel (Gauss-Seidel)
+	float2 duv_new = UpdateIncrement(J[IND(x, y)], ksi[IND(x, y)], w_phi, nb, (float2)(du[IND(x, y)], dv[IND(x, y)]), omega, 1);
+
+	du[IND(x, y)] = duv_new.x;
+	dv[IND(x, y)] = duv_new.y;
+}
+
+/* Tiled kernels (Jacobi): the stencil operands of a work-group tile and its halo are fetched once into
+   local memory. TILE_SIZE_X and TILE_SIZE_Y must match the local work size (set when building). */
+
+#ifndef TILE_SIZE_X
+	#define TILE_SIZE_X		32
+#endif
+#ifndef TILE_SIZE_Y
+	#define TILE_SIZE_Y		4
+#endif
+
+#define BLOCK_W(H)	(TILE_SIZE_X + 2 * (H))
+#define BLOCK_H(H)	(TILE_SIZE_Y + 2 * (H))
+// local block with halo H, (X, Y) relative to the tile origin
+#define L(A, H, X, Y) ((A)[((Y) + (H)) * BLOCK_W(H) + (X) + (H)])
+
+// cooperative load of the tile with a halo of h pixels, coordinates are clamped to the image including its border
+void LoadBlock(
+	__global	const	float*	src,
+	__local				float*	dst,
+	int h, int bx, int by, int width, int height, int pitch
+	)
+{
+	int ox = get_group_id(0) * TILE_SIZE_X - h;
+	int oy = get_group_id(1) * TILE_SIZE_Y - h;
+
+	for (int i = get_local_id(1) * TILE_SIZE_X + get_local_id(0); i < BLOCK_W(h) * BLOCK_H(h); i += TILE_SIZE_X * TILE_SIZE_Y) {
+		int x = clamp(ox + i % BLOCK_W(h), -bx, width - 1 + bx);
+		int y = clamp(oy + i / BLOCK_W(h), -by, height - 1 + by);
+		dst[i] = src[IND(x, y)];
+	}
+}
+
+// (u + du, v + dv) at block position (X, Y) of the local flow blocks l_u, l_v, l_du, l_dv with halo H
+#define L_FLOW(H, X, Y) ((float2)(L(l_u, H, X, Y) + L(l_du, H, X, Y), L(l_v, H, X, Y) + L(l_dv, H, X, Y)))
+
+// Jacobi update of (du, dv) at tile position (lx, ly), flow blocks have halo h, phi block has halo 1
+float2 UpdateTile(
+	__local const float* l_du, __local const float* l_dv, __local const float* l_u, __local const float* l_v, int h,
+	__local const float* l_phi, int lx, int ly, float8 J_c, float ksi_, float4 w, float omega
 	)
 {
+	float4 w_phi = FaceWeights(w, L(l_phi, 1, lx, ly),
+							   (float4)(L(l_phi, 1, lx, ly + 1), L(l_phi, 1, lx, ly - 1), L(l_phi, 1, lx - 1, ly), L(l_phi, 1, lx + 1, ly)));
+
+	float2 uv_c = (float2)(L(l_u, h, lx, ly), L(l_v, h, lx, ly));
+	float2 nb = StencilSum(w_phi, uv_c, L_FLOW(h, lx, ly + 1), L_FLOW(h, lx, ly - 1), L_FLOW(h, lx - 1, ly), L_FLOW(h, lx + 1, ly));
+
+	return UpdateIncrement(J_c, ksi_, w_phi, nb, (float2)(L(l_du, h, lx, ly), L(l_dv, h, lx, ly)), omega, 0);
+}
+
+__kernel void ComputePhiKsiTiled(
+	__global	const	float*	u,			//  0 in     : x-component of flow field 
+	__global	const	float*	v,			//  1 in     : y-component of flow field
+	__global	const	float*	du,			//  2 in     : x-component of flow increment 
+	__global	const	float*	dv,			//  3 in     : y-component of flow increment
+	__global			float*	phi,		//  4 out    : phi 
+	__global			float*	ksi,		//  5 out    : ksi 
+						float	e_smooth,	//  6 in	 : e_smooth
+						float	hx,			//  7 in     : grid spacing in x-direction
+						float	hy,			//  8 in     : grid spacing in y-direction
+						int		bx,			//  9 in	 : x-border size
+						int		by,         // 10 in     : y-border size
+						int		width,		// 11 in     : image width
+						int		height,		// 12 in     : image height
+						int		pitch,		// 13 in     : image pitch
+	__global	const	float8*	J,			// 14 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+						float	e_data		// 15 in     : e_data
+	)
+{
+	// u + du and v + dv, the gradients need only their sum
+	__local float l_w1[BLOCK_W(1) * BLOCK_H(1)];
+	__local float l_w2[BLOCK_W(1) * BLOCK_H(1)];
+	__local float l_du[BLOCK_W(1) * BLOCK_H(1)];
+	__local float l_dv[BLOCK_W(1) * BLOCK_H(1)];
+
+	LoadBlock(u,  l_w1, 1, bx, by, width, height, pitch);
+	LoadBlock(v,  l_w2, 1, bx, by, width, height, pitch);
+	LoadBlock(du, l_du, 1, bx, by, width, height, pitch);
+	LoadBlock(dv, l_dv, 1, bx, by, width, height, pitch);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_local_id(1) * TILE_SIZE_X + get_local_id(0); i < BLOCK_W(1) * BLOCK_H(1); i += TILE_SIZE_X * TILE_SIZE_Y) {
+		l_w1[i] += l_du[i];
+		l_w2[i] += l_dv[i];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
 	size_t x = get_global_id(0);
 	size_t y = get_global_id(1);
 
 	if (x >= width || y >= height) {
 		return;
 	}
+	int lx = get_local_id(0);
+	int ly = get_local_id(1);
 
-	float hx_2 = alpha / (hx * hx);
-	float hy_2 = alpha / (hy * hy);
-	
-	// Derivatives variables
-	float fx = (d_img_1[IND(x + 1, y)] - d_img_1[IND(x - 1, y)] + d_img_2[IND(x + 1, y)] - d_img_2[IND(x - 1, y)]) / (4.f * hx);
-	float fy = (d_img_1[IND(x, y + 1)] - d_img_1[IND(x, y - 1)] + d_img_2[IND(x, y + 1)] - d_img_2[IND(x, y - 1)]) / (4.f * hy);
-	float ft = d_img_2[IND(x, y)] - d_img_1[IND(x, y)];
-	
-	float J11 = fx * fx;
-	float J22 = fy * fy;
-	float J33 = ft * ft;
-	float J12 = fx * fy;
-	float J13 = fx * ft;
-	float J23 = fy * ft;
+	float2 w_x = (float2)(L(l_w1, 1, lx + 1, ly) - L(l_w1, 1, lx - 1, ly), L(l_w2, 1, lx + 1, ly) - L(l_w2, 1, lx - 1, ly)) / (2.f * hx);
+	float2 w_y = (float2)(L(l_w1, 1, lx, ly + 1) - L(l_w1, 1, lx, ly - 1), L(l_w2, 1, lx, ly + 1) - L(l_w2, 1, lx, ly - 1)) / (2.f * hy);
 
-	// Compute weights 
-	float xp = (x < width - 1)	* hx_2;
-	float xm = (x > 0)			* hx_2;
-	float yp = (y < height - 1)	* hy_2;
-	float ym = (y > 0)			* hy_2;
+	phi[IND(x, y)] = Phi(w_x, w_y, e_smooth);
+	ksi[IND(x, y)] = Ksi(J[IND(x, y)], (float2)(L(l_du, 1, lx, ly), L(l_dv, 1, lx, ly)), e_data);
+}
 
-	float phiLower = (phi[IND(x, y + 1)] + phi[IND(x, y)]) / 2.0;
-	float phiUpper = (phi[IND(x, y - 1)] + phi[IND(x, y)]) / 2.0;
-	float phiLeft  = (phi[IND(x - 1, y)] + phi[IND(x, y)]) / 2.0;
-	float phiRight = (phi[IND(x + 1, y)] + phi[IND(x, y)]) / 2.0;
+__kernel void SolverTiled(
+	__global	const	float8*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global	const	float*  du,			//  1 in	 : x-component of flow increment
+	__global	const	float*  dv,			//  2 in	 : y-component of flow increment
+	__global	const	float*  u,			//  3 in	 : x-component of flow field
+	__global	const	float*  v,			//  4 in	 : y-component of flow field
+						float	hx,			//  5 in     : grid spacing in x-direction
+						float	hy,			//  6 in     : grid spacing in y-direction
+						float	alpha,		//  7 in     : smoothness weight
+						float	omega,		//  8 in     : SOR overrelaxation parameter
+						int		bx,			//  9 in	 : x-border size
+						int		by,         // 10 in     : y-border size
+						int		width,		// 11 in     : image width
+						int		height,		// 12 in     : image height
+						int		pitch,		// 13 in     : image pitch
+	__global			float*	du_r,		// 14 out	 : du result
+	__global			float*	dv_r,		// 15 out	 : dv result
+	__global	const	float*	phi,		// 16 in     : precomputed phi
+	__global	const	float*	ksi			// 17 in     : precomputed ksi
+	)
+{
+	__local float  l_du[BLOCK_W(1) * BLOCK_H(1)];
+	__local float  l_dv[BLOCK_W(1) * BLOCK_H(1)];
+	__local float   l_u[BLOCK_W(1) * BLOCK_H(1)];
+	__local float   l_v[BLOCK_W(1) * BLOCK_H(1)];
+	__local float l_phi[BLOCK_W(1) * BLOCK_H(1)];
+
+	LoadBlock(du,  l_du,  1, bx, by, width, height, pitch);
+	LoadBlock(dv,  l_dv,  1, bx, by, width, height, pitch);
+	LoadBlock(u,   l_u,   1, bx, by, width, height, pitch);
+	LoadBlock(v,   l_v,   1, bx, by, width, height, pitch);
+	LoadBlock(phi, l_phi, 1, bx, by, width, height, pitch);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	float4 w = StencilWeights(x, y, width, height, hx, hy, alpha);
+	float2 duv_new = UpdateTile(l_du, l_dv, l_u, l_v, 1, l_phi, get_local_id(0), get_local_id(1), J[IND(x, y)], ksi[IND(x, y)], w, omega);
+
+	du_r[IND(x, y)] = duv_new.x;
+	dv_r[IND(x, y)] = duv_new.y;
+}
+
+/* First inner iteration with the phi/ksi update fused in: the flow is loaded with a 2 pixel halo,
+   phi is computed for the tile and its 1 pixel halo in local memory and written out (with ksi)
+   for the remaining inner iterations of SolverTiled. */
+__kernel void SolverTiledPhiKsi(
+	__global	const	float8*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global	const	float*  du,			//  1 in	 : x-component of flow increment
+	__global	const	float*  dv,			//  2 in	 : y-component of flow increment
+	__global	const	float*  u,			//  3 in	 : x-component of flow field
+	__global	const	float*  v,			//  4 in	 : y-component of flow field
+						float	hx,			//  5 in     : grid spacing in x-direction
+						float	hy,			//  6 in     : grid spacing in y-direction
+						float	alpha,		//  7 in     : smoothness weight
+						float	omega,		//  8 in     : SOR overrelaxation parameter
+						int		bx,			//  9 in	 : x-border size
+						int		by,         // 10 in     : y-border size
+						int		width,		// 11 in     : image width
+						int		height,		// 12 in     : image height
+						int		pitch,		// 13 in     : image pitch
+	__global			float*	du_r,		// 14 out	 : du result
+	__global			float*	dv_r,		// 15 out	 : dv result
+	__global			float*	phi,		// 16 out    : phi
+	__global			float*	ksi,		// 17 out    : ksi
+						float	e_smooth,	// 18 in	 : e_smooth
+						float	e_data		// 19 in     : e_data
+	)
+{
+	__local float  l_du[BLOCK_W(2) * BLOCK_H(2)];
+	__local float  l_dv[BLOCK_W(2) * BLOCK_H(2)];
+	__local float   l_u[BLOCK_W(2) * BLOCK_H(2)];
+	__local float   l_v[BLOCK_W(2) * BLOCK_H(2)];
+	__local float l_phi[BLOCK_W(1) * BLOCK_H(1)];
 
-	float sumH = (xp*phiRight + xm*phiLeft + yp*phiLower + ym*phiUpper);
+	LoadBlock(du, l_du, 2, bx, by, width, height, pitch);
+	LoadBlock(dv, l_dv, 2, bx, by, width, height, pitch);
+	LoadBlock(u,  l_u,  2, bx, by, width, height, pitch);
+	LoadBlock(v,  l_v,  2, bx, by, width, height, pitch);
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-	float sumU = phiLower*yp*(u[IND(x, y + 1)] + du[IND(x, y + 1)] - u[IND(x, y)]) + phiUpper*ym*(u[IND(x, y - 1)] + du[IND(x, y - 1)] - u[IND(x, y)]) + 
-				 phiRight*xp*(u[IND(x + 1, y)] + du[IND(x + 1, y)] - u[IND(x, y)]) + phiLeft*xm*(u[IND(x - 1, y)] + du[IND(x - 1, y)] - u[IND(x, y)]);
+	// phi of the tile and its halo
+	for (int i = get_local_id(1) * TILE_SIZE_X + get_local_id(0); i < BLOCK_W(1) * BLOCK_H(1); i += TILE_SIZE_X * TILE_SIZE_Y) {
+		int px = i % BLOCK_W(1) - 1;
+		int py = i / BLOCK_W(1) - 1;
 
-	float sumV = phiLower*yp*(v[IND(x, y + 1)] + dv[IND(x, y + 1)] - v[IND(x, y)]) + phiUpper*ym*(v[IND(x, y - 1)] + dv[IND(x, y - 1)] - v[IND(x, y)]) +
-				 phiRight*xp*(v[IND(x + 1, y)] + dv[IND(x + 1, y)] - v[IND(x, y)]) + phiLeft*xm*(v[IND(x - 1, y)] + dv[IND(x - 1, y)] - v[IND(x, y)]);
+		float2 w_x = (L_FLOW(2, px + 1, py) - L_FLOW(2, px - 1, py)) / (2.f * hx);
+		float2 w_y = (L_FLOW(2, px, py + 1) - L_FLOW(2, px, py - 1)) / (2.f * hy);
 
-	du_r[IND(x, y)] = (1.0 - omega)*du[IND(x, y)] +
-					  omega*(ksi[IND(x, y)] * (-J13 - J12 * dv[IND(x, y)]) + sumU) / (ksi[IND(x, y)] * J11 + sumH);
+		l_phi[i] = Phi(w_x, w_y, e_smooth);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-	dv_r[IND(x, y)] = (1.0 - omega)*dv[IND(x, y)] +
-					  omega*(ksi[IND(x, y)] * (-J23 - J12 * du[IND(x, y)]) + sumV) / (ksi[IND(x, y)] * J22 + sumH);
- }
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
 
+	if (x >= width || y >= height) {
+		return;
+	}
+	int lx = get_local_id(0);
+	int ly = get_local_id(1);
 
+	float8 J_c = J[IND(x, y)];
+	float ksi_ = Ksi(J_c, (float2)(L(l_du, 2, lx, ly), L(l_dv, 2, lx, ly)), e_data);
+	phi[IND(x, y)] = L(l_phi, 1, lx, ly);
+	ksi[IND(x, y)] = ksi_;
+
+	float4 w = StencilWeights(x, y, width, height, hx, hy, alpha);
+	float2 duv_new = UpdateTile(l_du, l_dv, l_u, l_v, 2, l_phi, lx, ly, J_c, ksi_, w, omega);
+
+	du_r[IND(x, y)] = duv_new.x;
+	dv_r[IND(x, y)] = duv_new.y;
+}
@@ -0,0 +1,121 @@
+/*
+	Build options:
+		HALF_STORAGE : flow buffers hold half values (vload_half), arithmetic stays in float
+		GROUP_SIZE	 : work-group size (power of two)
+		BINS		 : histogram bins
+*/
+
+#define IND(X, Y) (((Y) + by) * pitch + ((X) + bx))
+
+#ifdef HALF_STORAGE
+	#define scalar_t		half
+	#define LOAD1(P, I)		vload_half((I), (P))
+#else
+	#define scalar_t		float
+	#define LOAD1(P, I)		((P)[I])
+#endif
+
+// ground truth components above this magnitude mark unknown flow (Middlebury convention)
+#define UNKNOWN_FLOW	1e6f
+
+// histogram bin of a value, -1 for NaN and infinity; clamped in float so the conversion to int stays defined
+inline int HistogramBin(float value, float bin)
+{
+	return isfinite(value) ? (int)fmin(fmax(value / bin, 0.f), (float)(BINS - 1)) : -1;
+}
+
+// one work-item per pixel, 1D over width * height; every work-group writes its partial result
+// (sum EPE, sum AAE, max EPE, known pixels, sum magnitude, max magnitude, 0, 0) and adds its local
+// histograms to the global ones. The flow of pixel (x, y) is u[offset + stride * IND(x, y)] and
+// v[offset + stride * IND(x, y) + v_offset], so separate and interleaved (u, v) buffers are both read in place
+__kernel void FlowStatistics(
+	__global	const	scalar_t* u,		//  0 in	 : x-component of flow field (or interleaved (u, v))
+	__global	const	scalar_t* v,		//  1 in	 : y-component of flow field (or interleaved (u, v))
+						int		offset,		//  2 in	 : first element of the flow field
+						int		stride,		//  3 in	 : elements per pixel (2 for interleaved (u, v))
+						int		v_offset,	//  4 in	 : element of v relative to u (1 for interleaved (u, v))
+						int		bx,			//  5 in	 : x-border size
+						int		by,         //  6 in     : y-border size
+						int		width,		//  7 in     : image width
+						int		height,		//  8 in     : image height
+						int		pitch,		//  9 in     : image pitch
+	__global	const	float*	u_gt,		// 10 in	 : x-component of ground truth, width x height without borders
+	__global	const	float*	v_gt,		// 11 in	 : y-component of ground truth, width x height without borders
+						int		has_gt,		// 12 in	 : 0: flow magnitude only
+						float	epe_bin,	// 13 in	 : width of the EPE histogram bins
+						float	magnitude_bin,	// 14 in : width of the flow magnitude histogram bins
+	__global			float8*	partial,	// 15 out	 : per work-group partial result
+	__global	volatile uint*	epe_histogram,		// 16 in:out : EPE histogram, BINS counters
+	__global	volatile uint*	magnitude_histogram	// 17 in:out : flow magnitude histogram, BINS counters
+	)
+{
+	__local float8 scratch[GROUP_SIZE];
+	__local volatile uint local_epe[BINS];
+	__local volatile uint local_magnitude[BINS];
+
+	int lid = get_local_id(0);
+	for (int b = lid; b < BINS; b += GROUP_SIZE) {
+		local_epe[b] = 0;
+		local_magnitude[b] = 0;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	float8 s = (float8)(0.f);
+	int i = get_global_id(0);
+	if (i < width * height) {
+		int x = i % width;
+		int y = i / width;
+		int k = offset + stride * IND(x, y);
+		float fu = LOAD1(u, k);
+		float fv = LOAD1(v, k + v_offset);
+
+		float magnitude = sqrt(fu * fu + fv * fv);
+		s.s4 = magnitude;
+		s.s5 = magnitude;
+		int mb = HistogramBin(magnitude, magnitude_bin);
+		if (mb >= 0)
+			atomic_inc(&local_magnitude[mb]);
+
+		if (has_gt) {
+			float gu = u_gt[i];
+			float gv = v_gt[i];
+			// NaN fails both comparisons and is unknown as well
+			if (fabs(gu) <= UNKNOWN_FLOW && fabs(gv) <= UNKNOWN_FLOW) {
+				float epe = sqrt((fu - gu) * (fu - gu) + (fv - gv) * (fv - gv));
+				// angle between the space-time vectors (u, v, 1)
+				float cosine = (fu * gu + fv * gv + 1.f) / sqrt((fu * fu + fv * fv + 1.f) * (gu * gu + gv * gv + 1.f));
+				s.s0 = epe;
+				s.s1 = degrees(acos(clamp(cosine, -1.f, 1.f)));
+				s.s2 = epe;
+				s.s3 = 1.f;
+				int eb = HistogramBin(epe, epe_bin);
+				if (eb >= 0)
+					atomic_inc(&local_epe[eb]);
+			}
+		}
+	}
+	scratch[lid] = s;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// tree reduction of the work-group
+	for (int step = GROUP_SIZE / 2; step > 0; step >>= 1) {
+		if (lid < step) {
+			float8 a = scratch[lid];
+			float8 b = scratch[lid + step];
+			scratch[lid] = (float8)(a.s0 + b.s0, a.s1 + b.s1, fmax(a.s2, b.s2), a.s3 + b.s3, a.s4 + b.s4, fmax(a.s5, b.s5), 0.f, 0.f);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) {
+		partial[get_group_id(0)] = scratch[0];
+	}
+
+	for (int b = lid; b < BINS; b += GROUP_SIZE) {
+		if (local_epe[b]) {
+			atomic_add(&epe_histogram[b], local_epe[b]);
+		}
+		if (local_magnitude[b]) {
+			atomic_add(&magnitude_histogram[b], local_magnitude[b]);
+		}
+	}
+}
@@ -1,25 +1,382 @@
+/*
+	Build options:
+		HALF_STORAGE : buffers hold half values (vload_half/vstore_half), arithmetic stays in float
+		TILE_SIZE_X	 : local work size in x-direction (tiled solver stage)
+		TILE_SIZE_Y	 : local work size in y-direction (tiled solver stage)
+		BATCH_STRIDE : pixels per image pair in batched buffers (pairs are stored one after another)
+*/
+
+#include "SolverCommon.cl"
+
 #define IND(X, Y) (((Y) + by) * pitch + ((X) + bx))
 
+// (u + du, v + dv) of pixel (X, Y) from the interleaved buffers uv and duv
+#define FLOW(X, Y) (LOAD2(uv, IND(X, Y)) + LOAD2(duv, IND(X, Y)))
+
+// flow fields are stored interleaved: (u, v) and (du, dv) are 2-vectors with the image layout
+// motion tensor is stored packed as 8-vector: (J11, J22, J12, J13, J23, J33, 0, 0)
+
+#ifdef HALF_STORAGE
+	#define scalar_t		half
+	#define vec2_t			half
+	#define vec4_t			half
+	#define vec8_t			half
+	#define LOAD1(P, I)		vload_half((I), (P))
+	#define LOAD2(P, I)		vload_half2((I), (P))
+	#define LOAD4(P, I)		vload_half4((I), (P))
+	#define LOAD8(P, I)		vload_half8((I), (P))
+	#define STORE1(V, P, I)	vstore_half((V), (I), (P))
+	#define STORE2(V, P, I)	vstore_half2((V), (I), (P))
+	#define STORE4(V, P, I)	vstore_half4((V), (I), (P))
+	#define STORE8(V, P, I)	vstore_half8((V), (I), (P))
+#else
+	#define scalar_t		float
+	#define vec2_t			float2
+	#define vec4_t			float4
+	#define vec8_t			float8
+	#define LOAD1(P, I)		((P)[I])
+	#define LOAD2(P, I)		((P)[I])
+	#define LOAD4(P, I)		((P)[I])
+	#define LOAD8(P, I)		((P)[I])
+	#define STORE1(V, P, I)	((P)[I] = (V))
+	#define STORE2(V, P, I)	((P)[I] = (V))
+	#define STORE4(V, P, I)	((P)[I] = (V))
+	#define STORE8(V, P, I)	((P)[I] = (V))
+#endif
+
+// batched solve: the image pair is selected by the last NDRange dimension D, every per-pixel buffer
+// argument is advanced to its pair before indexing (half storage counts scalar halves per pixel)
+#ifndef BATCH_STRIDE
+	#define BATCH_STRIDE	0
+#endif
+#ifdef HALF_STORAGE
+	#define SELECT_PAIR1(P, D)	((P) += get_global_id(D) * BATCH_STRIDE)
+	#define SELECT_PAIR2(P, D)	((P) += get_global_id(D) * 2 * BATCH_STRIDE)
+	#define SELECT_PAIR8(P, D)	((P) += get_global_id(D) * 8 * BATCH_STRIDE)
+#else
+	#define SELECT_PAIR1(P, D)	((P) += get_global_id(D) * BATCH_STRIDE)
+	#define SELECT_PAIR2(P, D)	SELECT_PAIR1(P, D)
+	#define SELECT_PAIR8(P, D)	SELECT_PAIR1(P, D)
+#endif
+
+__kernel void ComputeMotionTensor(
+	__global	const	scalar_t*	d_img_1,	//  0 in     : 1st image 
+	__global	const	scalar_t*	d_img_2,	//  1 in     : 2nd image (motion compensated)
+						float	hx,			//  2 in     : grid spacing in x-direction
+						float	hy,			//  3 in     : grid spacing in y-direction
+						int		bx,			//  4 in	 : x-border size
+						int		by,         //  5 in     : y-border size
+						int		width,		//  6 in     : image width
+						int		height,		//  7 in     : image height
+						int		pitch,		//  8 in     : image pitch
+	__global			vec8_t*	J			//  9 out	 : motion tensor
+	)
+{
+	SELECT_PAIR1(d_img_1, 2);
+	SELECT_PAIR1(d_img_2, 2);
+	SELECT_PAIR8(J, 2);
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	float4 n_1 = (float4)(LOAD1(d_img_1, IND(x, y + 1)), LOAD1(d_img_1, IND(x, y - 1)), LOAD1(d_img_1, IND(x - 1, y)), LOAD1(d_img_1, IND(x + 1, y)));
+	float4 n_2 = (float4)(LOAD1(d_img_2, IND(x, y + 1)), LOAD1(d_img_2, IND(x, y - 1)), LOAD1(d_img_2, IND(x - 1, y)), LOAD1(d_img_2, IND(x + 1, y)));
+
+	STORE8(MotionTensor(LOAD1(d_img_1, IND(x, y)), n_1, LOAD1(d_img_2, IND(x, y)), n_2, hx, hy), J, IND(x, y));
+}
+
 __kernel void Solver(
-	__global	const	float*	d_img_1,	//  0 in     : 1st image 
-	__global	const	float*	d_img_2,	//  1 in     : 2nd image
-	__global	const	float*  du,			//  2 in	 : x-component of flow increment
-	__global	const	float*  dv,			//  3 in	 : y-component of flow increment
-	__global	const	float*  u,			//  4 in	 : x-component of flow field
-	__global	const	float*  v,			//  5 in	 : y-component of flow field
-						float	hx,			//  6 in     : grid spacing in x-direction
-						float	hy,			//  7 in     : grid spacing in y-direction
-						float	alpha,		//  8 in     : smoothness weight
-						float	omega,		//  9 in     : SOR overrelaxation parameter
-						int		bx,			// 10 in	 : x-border size
-						int		by,         // 11 in     : y-border size
-						int		width,		// 12 in     : image width
-						int		height,		// 13 in     : image height
-						int		pitch,		// 14 in     : image pitch
-	__global			float*	du_r,		// 15 out	 : du result
-	__global			float*	dv_r		// 16 out	 : dv result
+	__global	const	vec8_t*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global	const	vec2_t* duv,		//  1 in	 : flow increment (du, dv)
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						float	alpha,		//  5 in     : smoothness weight
+						float	omega,		//  6 in     : SOR overrelaxation parameter
+						int		bx,			//  7 in	 : x-border size
+						int		by,         //  8 in     : y-border size
+						int		width,		//  9 in     : image width
+						int		height,		// 10 in     : image height
+						int		pitch,		// 11 in     : image pitch
+	__global			vec2_t*	duv_r		// 12 out	 : (du, dv) result
+	)
+{
+	SELECT_PAIR8(J, 2);
+	SELECT_PAIR2(duv, 2);
+	SELECT_PAIR2(uv, 2);
+	SELECT_PAIR2(duv_r, 2);
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	float4 w = StencilWeights(x, y, width, height, hx, hy, alpha);
+
+	float2 nb = StencilSum(w, LOAD2(uv, IND(x, y)), FLOW(x, y + 1), FLOW(x, y - 1), FLOW(x - 1, y), FLOW(x + 1, y));
+
+	float2 duv_new = UpdateIncrement(LOAD8(J, IND(x, y)), 1.f, w, nb, LOAD2(duv, IND(x, y)), omega, 0);
+
+	STORE2(duv_new, duv_r, IND(x, y));
+}
+
+__kernel void SolverRedBlack(
+	__global	const	vec8_t*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global			vec2_t* duv,		//  1 in:out : flow increment (du, dv)
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						float	alpha,		//  5 in     : smoothness weight
+						float	omega,		//  6 in     : SOR overrelaxation parameter
+						int		bx,			//  7 in	 : x-border size
+						int		by,         //  8 in     : y-border size
+						int		width,		//  9 in     : image width
+						int		height,		// 10 in     : image height
+						int		pitch,		// 11 in     : image pitch
+						int		color		// 12 in     : updated pixels: (x + y) % 2 == color
+	)
+{
+	SELECT_PAIR8(J, 2);
+	SELECT_PAIR2(duv, 2);
+	SELECT_PAIR2(uv, 2);
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	// in-place update: all 4 neighbours have the other color and are not written by this launch
+	if (x >= width || y >= height || ((x + y) & 1) != color) {
+		return;
+	}
+
+	float4 w = StencilWeights(x, y, width, height, hx, hy, alpha);
+
+	float2 nb = StencilSum(w, LOAD2(uv, IND(x, y)), FLOW(x, y + 1), FLOW(x, y - 1), FLOW(x - 1, y), FLOW(x + 1, y));
+
+	// dv uses the already updated du of the same pixel (Gauss-Seidel)
+	float2 duv_new = UpdateIncrement(LOAD8(J, IND(x, y)), 1.f, w, nb, LOAD2(duv, IND(x, y)), omega, 1);
+
+	STORE2(duv_new, duv, IND(x, y));
+}
+
+/* Tiled solver stage: the (u, v) and (du, dv) values of a work-group tile and its 1 pixel halo are
+   fetched once into local memory and shared by the 5-point stencils of the tile. The tile size must
+   match the local work size (TILE_SIZE_X and TILE_SIZE_Y are set when building the program). */
+
+#ifndef TILE_SIZE_X
+	#define TILE_SIZE_X		32
+#endif
+#ifndef TILE_SIZE_Y
+	#define TILE_SIZE_Y		4
+#endif
+
+void LoadFlowTile(
+	__global	const	vec2_t*	uv,
+	__global	const	vec2_t*	duv,
+	__local				float2	(*l_uv)[TILE_SIZE_X + 2],
+	__local				float2	(*l_duv)[TILE_SIZE_X + 2],
+	int x, int y, int lx, int ly, int bx, int by, int width, int height, int pitch
+	)
+{
+	// main area
+	l_uv [ly + 1][lx + 1] = LOAD2(uv,  IND(x, y));
+	l_duv[ly + 1][lx + 1] = LOAD2(duv, IND(x, y));
+
+	// halo, border pixels of the buffers are valid memory and have zero stencil weights
+	if (lx == 0) {
+		l_uv [ly + 1][0] = LOAD2(uv,  IND(x - 1, y));
+		l_duv[ly + 1][0] = LOAD2(duv, IND(x - 1, y));
+	}
+	if (lx == TILE_SIZE_X - 1 || x == width - 1) {
+		l_uv [ly + 1][lx + 2] = LOAD2(uv,  IND(x + 1, y));
+		l_duv[ly + 1][lx + 2] = LOAD2(duv, IND(x + 1, y));
+	}
+	if (ly == 0) {
+		l_uv [0][lx + 1] = LOAD2(uv,  IND(x, y - 1));
+		l_duv[0][lx + 1] = LOAD2(duv, IND(x, y - 1));
+	}
+	if (ly == TILE_SIZE_Y - 1 || y == height - 1) {
+		l_uv [ly + 2][lx + 1] = LOAD2(uv,  IND(x, y + 1));
+		l_duv[ly + 2][lx + 1] = LOAD2(duv, IND(x, y + 1));
+	}
+}
+
+// (u + du, v + dv) at position (X, Y) of the local tiles l_uv, l_duv
+#define TILE_FLOW(X, Y) (l_uv[Y][X] + l_duv[Y][X])
+
+__kernel void SolverTiled(
+	__global	const	vec8_t*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global	const	vec2_t* duv,		//  1 in	 : flow increment (du, dv)
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						float	alpha,		//  5 in     : smoothness weight
+						float	omega,		//  6 in     : SOR overrelaxation parameter
+						int		bx,			//  7 in	 : x-border size
+						int		by,         //  8 in     : y-border size
+						int		width,		//  9 in     : image width
+						int		height,		// 10 in     : image height
+						int		pitch,		// 11 in     : image pitch
+	__global			vec2_t*	duv_r		// 12 out	 : (du, dv) result
+	)
+{
+	SELECT_PAIR8(J, 2);
+	SELECT_PAIR2(duv, 2);
+	SELECT_PAIR2(uv, 2);
+	SELECT_PAIR2(duv_r, 2);
+
+	__local float2 l_uv [TILE_SIZE_Y + 2][TILE_SIZE_X + 2];
+	__local float2 l_duv[TILE_SIZE_Y + 2][TILE_SIZE_X + 2];
+
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int lx = get_local_id(0);
+	int ly = get_local_id(1);
+
+	// work-items outside of the image take part in the barrier only
+	bool inside = (x < width && y < height);
+	if (inside) {
+		LoadFlowTile(uv, duv, l_uv, l_duv, x, y, lx, ly, bx, by, width, height, pitch);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (!inside) {
+		return;
+	}
+
+	float4 w = StencilWeights(x, y, width, height, hx, hy, alpha);
+
+	int cx = lx + 1;
+	int cy = ly + 1;
+	float2 nb = StencilSum(w, l_uv[cy][cx], TILE_FLOW(cx, cy + 1), TILE_FLOW(cx, cy - 1), TILE_FLOW(cx - 1, cy), TILE_FLOW(cx + 1, cy));
+
+	float2 duv_new = UpdateIncrement(LOAD8(J, IND(x, y)), 1.f, w, nb, l_duv[cy][cx], omega, 0);
+
+	STORE2(duv_new, duv_r, IND(x, y));
+}
+
+__kernel void SolverTiledRedBlack(
+	__global	const	vec8_t*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global			vec2_t* duv,		//  1 in:out : flow increment (du, dv)
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						float	alpha,		//  5 in     : smoothness weight
+						float	omega,		//  6 in     : SOR overrelaxation parameter
+						int		bx,			//  7 in	 : x-border size
+						int		by,         //  8 in     : y-border size
+						int		width,		//  9 in     : image width
+						int		height,		// 10 in     : image height
+						int		pitch,		// 11 in     : image pitch
+						int		color		// 12 in     : updated pixels: (x + y) % 2 == color
+	)
+{
+	SELECT_PAIR8(J, 2);
+	SELECT_PAIR2(duv, 2);
+	SELECT_PAIR2(uv, 2);
+
+	__local float2 l_uv [TILE_SIZE_Y + 2][TILE_SIZE_X + 2];
+	__local float2 l_duv[TILE_SIZE_Y + 2][TILE_SIZE_X + 2];
+
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+	int lx = get_local_id(0);
+	int ly = get_local_id(1);
+
+	// work-items outside of the image take part in the barrier only
+	bool inside = (x < width && y < height);
+	if (inside) {
+		LoadFlowTile(uv, duv, l_uv, l_duv, x, y, lx, ly, bx, by, width, height, pitch);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// in-place update: all 4 neighbours have the other color and are not written by this launch
+	if (!inside || ((x + y) & 1) != color) {
+		return;
+	}
+
+	float4 w = StencilWeights(x, y, width, height, hx, hy, alpha);
+
+	int cx = lx + 1;
+	int cy = ly + 1;
+	float2 nb = StencilSum(w, l_uv[cy][cx], TILE_FLOW(cx, cy + 1), TILE_FLOW(cx, cy - 1), TILE_FLOW(cx - 1, cy), TILE_FLOW(cx + 1, cy));
+
+	// dv uses the already updated du of the same pixel (Gauss-Seidel)
+	float2 duv_new = UpdateIncrement(LOAD8(J, IND(x, y)), 1.f, w, nb, l_duv[cy][cx], omega, 1);
+
+	STORE2(duv_new, duv, IND(x, y));
+}
+
+/* Robust solver stage: flow-driven smoothness and robust data term (lagged nonlinearity),
+   phi and ksi are recomputed from the current increment before every block of inner iterations */
+
+__kernel void ComputePhiKsi(
+	__global	const	vec2_t*	uv,			//  0 in     : flow field (u, v)
+	__global	const	vec2_t*	duv,		//  1 in     : flow increment (du, dv)
+	__global			scalar_t* phi,		//  2 out    : phi
+	__global			scalar_t* ksi,		//  3 out    : ksi
+						float	e_smooth,	//  4 in	 : e_smooth
+						float	hx,			//  5 in     : grid spacing in x-direction
+						float	hy,			//  6 in     : grid spacing in y-direction
+						int		bx,			//  7 in	 : x-border size
+						int		by,         //  8 in     : y-border size
+						int		width,		//  9 in     : image width
+						int		height,		// 10 in     : image height
+						int		pitch,		// 11 in     : image pitch
+	__global	const	vec8_t*	J,			// 12 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+						float	e_data		// 13 in     : e_data
+	)
+{
+	SELECT_PAIR2(uv, 2);
+	SELECT_PAIR2(duv, 2);
+	SELECT_PAIR1(phi, 2);
+	SELECT_PAIR1(ksi, 2);
+	SELECT_PAIR8(J, 2);
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	// derivatives of u + du and v + dv
+	float2 w_x = (FLOW(x + 1, y) - FLOW(x - 1, y)) / (2.f * hx);
+	float2 w_y = (FLOW(x, y + 1) - FLOW(x, y - 1)) / (2.f * hy);
+
+	STORE1(Phi(w_x, w_y, e_smooth), phi, IND(x, y));
+	STORE1(Ksi(LOAD8(J, IND(x, y)), LOAD2(duv, IND(x, y)), e_data), ksi, IND(x, y));
+}
+
+__kernel void SolverRobust(
+	__global	const	vec8_t*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global	const	vec2_t* duv,		//  1 in	 : flow increment (du, dv)
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						float	alpha,		//  5 in     : smoothness weight
+						float	omega,		//  6 in     : SOR overrelaxation parameter
+						int		bx,			//  7 in	 : x-border size
+						int		by,         //  8 in     : y-border size
+						int		width,		//  9 in     : image width
+						int		height,		// 10 in     : image height
+						int		pitch,		// 11 in     : image pitch
+	__global			vec2_t*	duv_r,		// 12 out	 : (du, dv) result
+	__global	const	scalar_t* phi,		// 13 in     : precomputed phi
+	__global	const	scalar_t* ksi		// 14 in     : precomputed ksi
 	)
 {
+	SELECT_PAIR8(J, 2);
+	SELECT_PAIR2(duv, 2);
+	SELECT_PAIR2(uv, 2);
+	SELECT_PAIR2(duv_r, 2);
+	SELECT_PAIR1(phi, 2);
+	SELECT_PAIR1(ksi, 2);
+
 	size_t x = get_global_id(0);
 	size_t y = get_global_id(1);
 
@@ -27,76 +384,93 @@ __kernel void Solver(
 		return;
 	}
 
-	float hx_2 = alpha / (hx * hx);
-	float hy_2 = alpha / (hy * hy);
+	float4 w_phi = FaceWeights(StencilWeights(x, y, width, height, hx, hy, alpha), LOAD1(phi, IND(x, y)),
+							   (float4)(LOAD1(phi, IND(x, y + 1)), LOAD1(phi, IND(x, y - 1)), LOAD1(phi, IND(x - 1, y)), LOAD1(phi, IND(x + 1, y))));
 
-	// Derivatives variables
-	float fx = (d_img_1[IND(x + 1, y)] - d_img_1[IND(x - 1, y)] + d_img_2[IND(x + 1, y)] - d_img_2[IND(x - 1, y)]) / (4.f * hx);
-	float fy = (d_img_1[IND(x, y + 1)] - d_img_1[IND(x, y - 1)] + d_img_2[IND(x, y + 1)] - d_img_2[IND(x, y - 1)]) / (4.f * hy);
-	float ft = d_img_2[IND(x, y)] - d_img_1[IND(x, y)];
+	float2 nb = StencilSum(w_phi, LOAD2(uv, IND(x, y)), FLOW(x, y + 1), FLOW(x, y - 1), FLOW(x - 1, y), FLOW(x + 1, y));
 
-	float J11 = fx * fx;
-	float J22 = fy * fy;
-	float J12 = fx * fy;
-	float J13 = fx * ft;
-	float J23 = fy * ft;
+	float2 duv_new = UpdateIncrement(LOAD8(J, IND(x, y)), LOAD1(ksi, IND(x, y)), w_phi, nb, LOAD2(duv, IND(x, y)), omega, 0);
 
-	// Compute weights 
-	float xp = (x < width - 1)	* hx_2;
-	float xm = (x > 0)			* hx_2;
-	float yp = (y < height - 1)	* hy_2;
-	float ym = (y > 0)			* hy_2;
-	float sum = (xp + xm + yp + ym);
+	STORE2(duv_new, duv_r, IND(x, y));
+}
 
-	du_r[IND(x, y)] = (1.f - omega) * du[IND(x, y)] +
-		omega * (-J13 - J12 * dv[IND(x, y)] +
+__kernel void SolverRobustRedBlack(
+	__global	const	vec8_t*	J,			//  0 in     : motion tensor (J11, J22, J12, J13, J23, J33)
+	__global			vec2_t* duv,		//  1 in:out : flow increment (du, dv)
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						float	alpha,		//  5 in     : smoothness weight
+						float	omega,		//  6 in     : SOR overrelaxation parameter
+						int		bx,			//  7 in	 : x-border size
+						int		by,         //  8 in     : y-border size
+						int		width,		//  9 in     : image width
+						int		height,		// 10 in     : image height
+						int		pitch,		// 11 in     : image pitch
+						int		color,		// 12 in     : updated pixels: (x + y) % 2 == color
+	__global	const	scalar_t* phi,		// 13 in     : precomputed phi
+	__global	const	scalar_t* ksi		// 14 in     : precomputed ksi
+	)
+{
+	SELECT_PAIR8(J, 2);
+	SELECT_PAIR2(duv, 2);
+	SELECT_PAIR2(uv, 2);
+	SELECT_PAIR1(phi, 2);
+	SELECT_PAIR1(ksi, 2);
 
-		yp * (u[IND(x, y + 1)] - u[IND(x, y)]) + ym * (u[IND(x, y - 1)] - u[IND(x, y)]) +
-		xp * (u[IND(x + 1, y)] - u[IND(x, y)]) + xm * (u[IND(x - 1, y)] - u[IND(x, y)]) +
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
 
-		yp * du[IND(x, y + 1)] + ym * du[IND(x, y - 1)] +
-		xp * du[IND(x + 1, y)] + xm * du[IND(x - 1, y)]) / (J11 + sum);
+	// in-place update: all 4 neighbours have the other color and are not written by this launch
+	if (x >= width || y >= height || ((x + y) & 1) != color) {
+		return;
+	}
+
+	float4 w_phi = FaceWeights(StencilWeights(x, y, width, height, hx, hy, alpha), LOAD1(phi, IND(x, y)),
+							   (float4)(LOAD1(phi, IND(x, y + 1)), LOAD1(phi, IND(x, y - 1)), LOAD1(phi, IND(x - 1, y)), LOAD1(phi, IND(x + 1, y))));
 
-	dv_r[IND(x, y)] = (1.f - omega) * dv[IND(x, y)] +
-		omega * (-J23 - J12 * du[IND(x, y)] +
+	float2 nb = StencilSum(w_phi, LOAD2(uv, IND(x, y)), FLOW(x, y + 1), FLOW(x, y - 1), FLOW(x - 1, y), FLOW(x + 1, y));
 
-		yp * (v[IND(x, y + 1)] - v[IND(x, y)]) + ym * (v[IND(x, y - 1)] - v[IND(x, y)]) +
-		xp * (v[IND(x + 1, y)] - v[IND(x, y)]) + xm * (v[IND(x - 1, y)] - v[IND(x, y)]) +
+	// dv uses the already updated du of the same pixel (Gauss-Seidel)
+	float2 duv_new = UpdateIncrement(LOAD8(J, IND(x, y)), LOAD1(ksi, IND(x, y)), w_phi, nb, LOAD2(duv, IND(x, y)), omega, 1);
 
-		yp * dv[IND(x, y + 1)] + ym * dv[IND(x, y - 1)] +
-		xp * dv[IND(x + 1, y)] + xm * dv[IND(x - 1, y)]) / (J22 + sum);
+	STORE2(duv_new, duv, IND(x, y));
 }
 
 __kernel void Zero(
-	__global			float*  d_mem		//  0 out	 : device memory filled with zeros
+	__global			vec2_t* d_mem		//  0 out	 : device memory filled with zeros
 	)
 {
-	d_mem[get_global_id(0)] = 0.f;
+	STORE2((float2)(0.f), d_mem, get_global_id(0));
 }
 
 __kernel void Add(
-	__global			float4*  d_dst,		//  0 in:out : sum
-	__global	const	float4*  d_src		//  1 in	 : add
+	__global			vec4_t*  d_dst,		//  0 in:out : sum
+	__global	const	vec4_t*  d_src		//  1 in	 : add
 	)
 {
-	d_dst[get_global_id(0)] += d_src[get_global_id(0)];
+	STORE4(LOAD4(d_dst, get_global_id(0)) + LOAD4(d_src, get_global_id(0)), d_dst, get_global_id(0));
 }
 
 __kernel void BackwardRegistration(
-	__global	const	float*  d_img_1,	//  0 in	 : 1st image
-	__global	const	float*  d_img_2,	//  1 in	 : 2nd image
-	__global	const	float*  u,			//  2 in	 : x-component of flow field
-	__global	const	float*  v,			//  3 in	 : y-component of flow field
-						float	hx,			//  4 in     : grid spacing in x-direction
-						float	hy,			//  5 in     : grid spacing in y-direction
-						int		bx,			//  6 in	 : x-border size
-						int		by,         //  7 in     : y-border size
-						int		width,		//  8 in     : image width
-						int		height,		//  9 in     : image height
-						int		pitch,		// 10 in     : image pitch	
-	__global			float*  d_img_2_br	// 11 out	 : 2nd image (motion compensated)
+	__global	const	scalar_t*  d_img_1,	//  0 in	 : 1st image
+	__global	const	scalar_t*  d_img_2,	//  1 in	 : 2nd image
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						int		bx,			//  5 in	 : x-border size
+						int		by,         //  6 in     : y-border size
+						int		width,		//  7 in     : image width
+						int		height,		//  8 in     : image height
+						int		pitch,		//  9 in     : image pitch	
+	__global			scalar_t*  d_img_2_br	// 10 out	 : 2nd image (motion compensated)
 	)
 {
+	SELECT_PAIR1(d_img_1, 2);
+	SELECT_PAIR1(d_img_2, 2);
+	SELECT_PAIR2(uv, 2);
+	SELECT_PAIR1(d_img_2_br, 2);
+
 	int x = get_global_id(0);
 	int y = get_global_id(1);
 
@@ -112,13 +486,14 @@ __kernel void BackwardRegistration(
 	float hy_1 = 1.f / hy;
 
 	// Compute subpixel location 
-	yy_fp = y + v[IND(x, y)] * hy_1;
-	xx_fp = x + u[IND(x, y)] * hx_1;
+	float2 uv_c = LOAD2(uv, IND(x, y));
+	yy_fp = y + uv_c.y * hy_1;
+	xx_fp = x + uv_c.x * hx_1;
 	
 	// If the required image information is out of bounds 
 	if ((yy_fp < 0) || (xx_fp < 0) || (yy_fp > (height - 1)) || (xx_fp > (width - 1))){
 		// assume zero flow, i.e. set warped 2nd image to 1st image 
-		d_img_2_br[IND(x, y)] = d_img_1[IND(x, y)];
+		STORE1(LOAD1(d_img_1, IND(x, y)), d_img_2_br, IND(x, y));
 	} else {
 		// compute integer index of upper left pixel 
 		yy = floor(yy_fp);
@@ -129,15 +504,58 @@ __kernel void BackwardRegistration(
 		delta_x = xx_fp - xx;
 
 		// perform bilinear interpolation 
-		d_img_2_br[IND(x, y)] = (1.f - delta_y) * (1.f - delta_x)	* d_img_2[IND(xx, yy)]
-							  + (1.f - delta_y) * delta_x			* d_img_2[IND(xx + 1, yy)]
-							  + delta_y		    * (1.f - delta_x)	* d_img_2[IND(xx, yy + 1)]
-							  + delta_y		    * delta_x			* d_img_2[IND(xx + 1, yy + 1)];
+		float warped = (1.f - delta_y) * (1.f - delta_x)	* LOAD1(d_img_2, IND(xx, yy))
+					 + (1.f - delta_y) * delta_x			* LOAD1(d_img_2, IND(xx + 1, yy))
+					 + delta_y		   * (1.f - delta_x)	* LOAD1(d_img_2, IND(xx, yy + 1))
+					 + delta_y		   * delta_x			* LOAD1(d_img_2, IND(xx + 1, yy + 1));
+		STORE1(warped, d_img_2_br, IND(x, y));
+	}
+}
+
+// unnormalized coordinates, texel centers are at (x + 0.5, y + 0.5)
+__constant sampler_t linearSampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
+
+__kernel void BackwardRegistrationImage(
+	__global	const	scalar_t*  d_img_1,	//  0 in	 : 1st image
+	__read_only		image2d_t	img_2,		//  1 in	 : 2nd image (pitch x rows copy of the buffer including borders)
+	__global	const	vec2_t* uv,			//  2 in	 : flow field (u, v)
+						float	hx,			//  3 in     : grid spacing in x-direction
+						float	hy,			//  4 in     : grid spacing in y-direction
+						int		bx,			//  5 in	 : x-border size
+						int		by,         //  6 in     : y-border size
+						int		width,		//  7 in     : image width
+						int		height,		//  8 in     : image height
+						int		pitch,		//  9 in     : image pitch	
+	__global			scalar_t*  d_img_2_br	// 10 out	 : 2nd image (motion compensated)
+	)
+{
+	int x = get_global_id(0);
+	int y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	float hx_1 = 1.f / hx;
+	float hy_1 = 1.f / hy;
+
+	// Compute subpixel location 
+	float2 uv_c = LOAD2(uv, IND(x, y));
+	float yy_fp = y + uv_c.y * hy_1;
+	float xx_fp = x + uv_c.x * hx_1;
+
+	// If the required image information is out of bounds 
+	if ((yy_fp < 0) || (xx_fp < 0) || (yy_fp > (height - 1)) || (xx_fp > (width - 1))){
+		// assume zero flow, i.e. set warped 2nd image to 1st image 
+		STORE1(LOAD1(d_img_1, IND(x, y)), d_img_2_br, IND(x, y));
+	} else {
+		// bilinear interpolation is done by the sampler (8 bit fixed point weights on most hardware)
+		STORE1(read_imagef(img_2, linearSampler, (float2)(xx_fp + bx + 0.5f, yy_fp + by + 0.5f)).x, d_img_2_br, IND(x, y));
 	}
 }
 
 __kernel void ReflectHorizontalBoudaries(
-	__global			float*  d_img,		//  0 in	 : image
+	__global			scalar_t*  d_img,		//  0 in	 : image
 						int		bx,			//  1 in	 : x-border size
 						int		by,         //  2 in     : y-border size
 						int		width,		//  3 in     : image width
@@ -145,16 +563,18 @@ __kernel void ReflectHorizontalBoudaries(
 						int		pitch		//  5 in     : image pitch	
 	)
 {
+	SELECT_PAIR1(d_img, 1);
+
 	size_t x = get_global_id(0);
 	if (x >= width) {
 		return;
 	}
-	d_img[IND(x, -by)]	           = d_img[IND(x, by)];
-	d_img[IND(x, height - 1 + by)] = d_img[IND(x, height - 1 - by)];
+	STORE1(LOAD1(d_img, IND(x, by)),				 d_img, IND(x, -by));
+	STORE1(LOAD1(d_img, IND(x, height - 1 - by)), d_img, IND(x, height - 1 + by));
 }
 
 __kernel void ReflectVerticalBoudaries(
-	__global			float*  d_img,		//  0 in	 : image
+	__global			scalar_t*  d_img,		//  0 in	 : image
 						int		bx,			//  1 in	 : x-border size
 						int		by,         //  2 in     : y-border size
 						int		width,		//  3 in     : image width
@@ -162,155 +582,173 @@ __kernel void ReflectVerticalBoudaries(
 						int		pitch		//  5 in     : image pitch	
 	)
 {
+	SELECT_PAIR1(d_img, 1);
+
 	size_t y = get_global_id(0);
 	if (y >= height) {
 		return;
 	}
-	d_img[IND(-bx, y)]			   = d_img[IND(bx, y)];
-	d_img[IND(width  - 1 + bx, y)] = d_img[IND(width - 1 - by, y)];
+	STORE1(LOAD1(d_img, IND(bx, y)),				d_img, IND(-bx, y));
+	STORE1(LOAD1(d_img, IND(width - 1 - by, y)), d_img, IND(width - 1 + bx, y));
 }
 
+// area based resampling, one work-item per output pixel; the weight tables hold for every output
+// column (row) the overlap of its cell with the source cells, normalized by the output cell size
+
 __kernel void ResampleY(
-	__global	const	float*  d_src,		//  0 in	 : source image
-	__global			float*  d_dst,		//  1 out	 : resampled image
-						int		width,		//  2 in     : image width
-						int		src_height,	//  3 in     : image height
-						int		dst_height,	//  4 in     : image height
-						int		pitch		//  5 in     : image pitch	
+	__global	const	scalar_t* d_src,		//  0 in	 : source image
+	__global			scalar_t* d_dst,		//  1 out	 : resampled image
+	__global	const	int2*	 index,		//  2 in	 : per output row: (first source row, number of taps)
+	__global	const	float*	 weights,	//  3 in	 : per output row: taps weights (area fractions)
+						int		taps,		//  4 in     : weights stride
+						int		width,		//  5 in     : image width
+						int		dst_height,	//  6 in     : resampled image height
+						int		pitch		//  7 in     : image pitch	
 	)
 {
+	SELECT_PAIR1(d_src, 2);
+	SELECT_PAIR1(d_dst, 2);
+
 	const int bx = 1;
 	const int by = 1;
 
 	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
 
-	if (x >= width) {
+	if (x >= width || y >= dst_height) {
 		return;
 	}
 
-	int    sy;				/* loop variables		*/
-	float  hs, hd;          /* grid sizes           */
-	float  sleft, sright;   /* boundaries           */
-	float  dleft, dright;   /* boundaries           */
-	float  fac;             /* normalization factor */
-
-	hs = 1.0f / (float)src_height;     /* grid size of src               */
-	hd = 1.0f / (float)dst_height;     /* grid size of dst               */
-	sleft = 0.0f;					   /* left interval boundary of src  */
-	dleft = 0.0f;                      /* left interval boundary of dst  */
-	sy = 0;							   /* index for src                  */
-	fac = hs / hd;                     /* for normalization              */
-
-	__local float pixel;
-
-	for (int y = 0; y < dst_height; y++) {
-
-		/* calculate right interval boundaries */
-		sright = sleft + hs;
-		dright = dleft + hd;
-
-		if (sright > dright)  {
-			/* since sleft <= dleft, the entire d-cell i is in the s-cell k */
-			pixel = d_src[IND(x, sy)];
-		} else {
-			/* consider fraction alpha of the s-cell k in d-cell i */
-			pixel = (sright - dleft) * src_height * d_src[IND(x, sy++)];
-
-			/* update */
-			sright = sright + hs;
-
-			/* consider entire u-cells inside v-cell i */
-			while (sright <= dright)
-			/* s-cell sy lies entirely in v-cell y; sum up */
-			{
-				pixel += d_src[IND(x, sy)];
-				sright = sright + hs;
-				sy = min(++sy, src_height - 1);
-			}
-			/* consider fraction beta of the u-cell k in v-cell i */
-			pixel += (1.f - (sright - dright) * src_height) * d_src[IND(x, sy)];
-
-			/* normalization */
-			pixel *= fac;
-		}
-		/* update now it holds: sleft <= dleft */
-		sleft = sright - hs;
-		dleft = dright;
- 
-		/* write data back from local memory to global */
-		d_dst[IND(x, y)] = pixel;
+	int2 tap = index[y];
+	__global const float* w = weights + y * taps;
+
+	float pixel = 0.f;
+	for (int k = 0; k < tap.y; k++) {
+		int s = tap.x + k;
+		pixel += w[k] * LOAD1(d_src, IND(x, s));
 	}
+	STORE1(pixel, d_dst, IND(x, y));
 }
 
 __kernel void ResampleX(
-	__global	const	float*  d_src,		//  0 in	 : source image
-	__global			float*  d_dst,		//  1 out	 : resampled image
-						int		height,		//  2 in     : image height
-						int		src_width,	//  3 in     : image width
-						int		dst_width,	//  4 in     : image width
-						int		pitch		//  5 in     : image pitch	
+	__global	const	scalar_t* d_src,		//  0 in	 : source image
+	__global			scalar_t* d_dst,		//  1 out	 : resampled image
+	__global	const	int2*	 index,		//  2 in	 : per output column: (first source column, number of taps)
+	__global	const	float*	 weights,	//  3 in	 : per output column: taps weights (area fractions)
+						int		taps,		//  4 in     : weights stride
+						int		dst_width,	//  5 in     : resampled image width
+						int		height,		//  6 in     : image height
+						int		pitch		//  7 in     : image pitch	
 	)
 {
+	SELECT_PAIR1(d_src, 2);
+	SELECT_PAIR1(d_dst, 2);
+
 	const int bx = 1;
 	const int by = 1;
 
-	size_t y = get_global_id(0);
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
 
-	if (y >= height) {
+	if (x >= dst_width || y >= height) {
+		return;
+	}
+
+	int2 tap = index[x];
+	__global const float* w = weights + x * taps;
+
+	float pixel = 0.f;
+	for (int k = 0; k < tap.y; k++) {
+		int s = tap.x + k;
+		pixel += w[k] * LOAD1(d_src, IND(s, y));
+	}
+	STORE1(pixel, d_dst, IND(x, y));
+}
+
+__kernel void ResampleYFlow(
+	__global	const	vec2_t* d_src,		//  0 in	 : source flow field (u, v)
+	__global			vec2_t* d_dst,		//  1 out	 : resampled flow field (u, v)
+	__global	const	int2*	 index,		//  2 in	 : per output row: (first source row, number of taps)
+	__global	const	float*	 weights,	//  3 in	 : per output row: taps weights (area fractions)
+						int		taps,		//  4 in     : weights stride
+						int		width,		//  5 in     : image width
+						int		dst_height,	//  6 in     : resampled image height
+						int		pitch		//  7 in     : image pitch	
+	)
+{
+	SELECT_PAIR2(d_src, 2);
+	SELECT_PAIR2(d_dst, 2);
+
+	const int bx = 1;
+	const int by = 1;
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= dst_height) {
+		return;
+	}
+
+	int2 tap = index[y];
+	__global const float* w = weights + y * taps;
+
+	float2 pixel = 0.f;
+	for (int k = 0; k < tap.y; k++) {
+		int s = tap.x + k;
+		pixel += w[k] * LOAD2(d_src, IND(x, s));
+	}
+	STORE2(pixel, d_dst, IND(x, y));
+}
+
+__kernel void ResampleXFlow(
+	__global	const	vec2_t* d_src,		//  0 in	 : source flow field (u, v)
+	__global			vec2_t* d_dst,		//  1 out	 : resampled flow field (u, v)
+	__global	const	int2*	 index,		//  2 in	 : per output column: (first source column, number of taps)
+	__global	const	float*	 weights,	//  3 in	 : per output column: taps weights (area fractions)
+						int		taps,		//  4 in     : weights stride
+						int		dst_width,	//  5 in     : resampled image width
+						int		height,		//  6 in     : image height
+						int		pitch		//  7 in     : image pitch	
+	)
+{
+	SELECT_PAIR2(d_src, 2);
+	SELECT_PAIR2(d_dst, 2);
+
+	const int bx = 1;
+	const int by = 1;
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= dst_width || y >= height) {
 		return;
 	}
 
-	int    sx;				/* loop variables		*/
-	float  hs, hd;          /* grid sizes           */
-	float  sleft, sright;   /* boundaries           */
-	float  dleft, dright;   /* boundaries           */
-	float  fac;             /* normalization factor */
-
-	hs = 1.0f / (float)src_width;      /* grid size of src               */
-	hd = 1.0f / (float)dst_width;      /* grid size of dst               */
-	sleft = 0.0f;					   /* left interval boundary of src  */
-	dleft = 0.0f;                      /* left interval boundary of dst  */
-	sx = 0;							   /* index for src                  */
-	fac = hs / hd;                     /* for normalization              */
-
-	__local float pixel;
-
-	for (int x = 0; x < dst_width; x++) {
-
-		/* calculate right interval boundaries */
-		sright = sleft + hs;
-		dright = dleft + hd;
-
-		if (sright > dright)  {
-			/* since sleft <= dleft, the entire d-cell i is in the s-cell k */
-			pixel = d_src[IND(sx, y)];
-		} else {
-			/* consider fraction alpha of the s-cell k in d-cell i */
-			pixel = (sright - dleft) * src_width * d_src[IND(sx++, y)];
-
-			/* update */
-			sright = sright + hs;
-
-			/* consider entire u-cells inside v-cell i */
-			while (sright <= dright)
-				/* s-cell sy lies entirely in v-cell y; sum up */
-			{
-				pixel += d_src[IND(sx, y)];
-				sright = sright + hs;
-				sx = min(++sx, src_width - 1);
-			}
-			/* consider fraction beta of the u-cell k in v-cell i */
-			pixel += (1.f - (sright - dright) * src_width) * d_src[IND(sx, y)];
-
-			/* normalization */
-			pixel *= fac;
-		}
-		/* update now it holds: sleft <= dleft */
-		sleft = sright - hs;
-		dleft = dright;
-
-		/* write data back from local memory to global */
-		d_dst[IND(x, y)] = pixel;
+	int2 tap = index[x];
+	__global const float* w = weights + x * taps;
+
+	float2 pixel = 0.f;
+	for (int k = 0; k < tap.y; k++) {
+		int s = tap.x + k;
+		pixel += w[k] * LOAD2(d_src, IND(s, y));
 	}
+	STORE2(pixel, d_dst, IND(x, y));
+}
 
-}
\ No newline at end of file
+__kernel void ConvertFromFloat(
+	__global	const	float*	d_src,		//  0 in	 : float data
+	__global			scalar_t* d_dst,	//  1 out	 : data in storage format
+						int		offset		//  2 in	 : first destination element
+	)
+{
+	STORE1(d_src[get_global_id(0)], d_dst, offset + get_global_id(0));
+}
+
+__kernel void ConvertToFloat(
+	__global	const	scalar_t* d_src,	//  0 in	 : data in storage format
+	__global			float*	d_dst,		//  1 out	 : float data
+						int		offset		//  2 in	 : first source element
+	)
+{
+	d_dst[get_global_id(0)] = LOAD1(d_src, offset + get_global_id(0));
+}
@@ -2,9 +2,14 @@
 
 #define TILE_SIZE_X		32
 #define TILE_SIZE_Y		16
+#define TEMPORAL_ITERATIONS	4	// number of Jacobi iterations performed by OptimizedSolverTemporal per launch
 
 */
 
+#ifndef TEMPORAL_ITERATIONS
+	#define TEMPORAL_ITERATIONS 1
+#endif
+
 #define BX 1
 #define BY 1
 #define IND(X, Y) ((Y) * pitch + (X))
@@ -150,6 +155,318 @@ __kernel void OptimizedSolver(
 					  xp * l_dv[ly + BY][lx + BX + 1] + xm * l_dv[ly + BY][lx + BX - 1]) / (J22 + sum);
 }
 
+__kernel void OptimizedSolverRedBlack(
+	__global	const	float*	d_img_1,	//  0 in     : 1st image 
+	__global	const	float*	d_img_2,	//  1 in     : 2nd image
+	__global			float*	du,			//  2 in:out : x-component of flow increment
+	__global			float*	dv,			//  3 in:out : y-component of flow increment
+	__global	const	float*	u,			//  4 in	 : x-component of flow field
+	__global	const	float*	v,			//  5 in	 : y-component of flow field
+						float	hx,			//  6 in     : grid spacing in x-direction
+						float	hy,			//  7 in     : grid spacing in y-direction
+						float	alpha,		//  8 in     : smoothness weight
+						float	omega,		//  9 in     : sor overrelaxation parameter
+						int		width,		// 10 in     : image width
+						int		height,		// 11 in     : image height
+						int		pitch,		// 12 in     : image pitch
+						int		color		// 13 in     : updated pixels: (x + y) % 2 == color
+	)
+{
+	__local float l_img_1[TILE_SIZE_Y + 2 * BY][TILE_SIZE_X + 2 * BX];
+	__local float l_img_2[TILE_SIZE_Y + 2 * BY][TILE_SIZE_X + 2 * BX];
+	__local float	 l_du[TILE_SIZE_Y + 2 * BY][TILE_SIZE_X + 2 * BX];
+	__local float	 l_dv[TILE_SIZE_Y + 2 * BY][TILE_SIZE_X + 2 * BX];
+	__local float	  l_u[TILE_SIZE_Y + 2 * BY][TILE_SIZE_X + 2 * BX];
+	__local float	  l_v[TILE_SIZE_Y + 2 * BY][TILE_SIZE_X + 2 * BX];
+
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+	size_t lx = get_local_id(0);
+	size_t ly = get_local_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+
+	// fill main area
+	l_img_1[ly + BY][lx + BX] = d_img_1[IND(x, y)];
+	l_img_2[ly + BY][lx + BX] = d_img_2[IND(x, y)];
+	   l_du[ly + BY][lx + BX] =		 du[IND(x, y)];
+	   l_dv[ly + BY][lx + BX] =      dv[IND(x, y)];
+		l_u[ly + BY][lx + BX] =       u[IND(x, y)];
+		l_v[ly + BY][lx + BX] =	      v[IND(x, y)];
+
+	// left edge
+	if (lx == 0) {
+		if(x > 1) {
+			l_img_1[ly + BY][0] = d_img_1[IND(x - 1, y)];
+			l_img_2[ly + BY][0] = d_img_2[IND(x - 1, y)];
+			   l_du[ly + BY][0] =	   du[IND(x - 1, y)];
+			   l_dv[ly + BY][0] =	   dv[IND(x - 1, y)];
+			    l_u[ly + BY][0] =	    u[IND(x - 1, y)];
+				l_v[ly + BY][0] =	    v[IND(x - 1, y)];
+		} else {
+			l_img_1[ly + BY][0] = d_img_1[IND(BX, y)];
+			l_img_2[ly + BY][0] = d_img_2[IND(BX, y)];
+		}
+	}
+	// right edge
+	if (lx == TILE_SIZE_X - 1 || x == width - 1) {
+		if (x < width - 1) {
+			l_img_1[ly + BY][TILE_SIZE_X + BX] = d_img_1[IND(x + 1, y)];
+			l_img_2[ly + BY][TILE_SIZE_X + BX] = d_img_2[IND(x + 1, y)];
+			   l_du[ly + BY][TILE_SIZE_X + BX] =	  du[IND(x + 1, y)];
+			   l_dv[ly + BY][TILE_SIZE_X + BX] =	  dv[IND(x + 1, y)];
+		    	l_u[ly + BY][TILE_SIZE_X + BX] =	   u[IND(x + 1, y)];
+			    l_v[ly + BY][TILE_SIZE_X + BX] =   	   v[IND(x + 1, y)];
+		} else {
+			l_img_1[ly + BY][lx + BX + 1] = d_img_1[IND(width - 2, y)];
+			l_img_2[ly + BY][lx + BX + 1] = d_img_2[IND(width - 2, y)];
+		}
+	}
+	// upper edge
+	if (ly == 0) {
+		if (y > 1) {
+			l_img_1[0][lx + BX] = d_img_1[IND(x, y - 1)];
+			l_img_2[0][lx + BX] = d_img_2[IND(x, y - 1)];
+			   l_du[0][lx + BX] =	   du[IND(x, y - 1)];
+			   l_dv[0][lx + BX] =	   dv[IND(x, y - 1)];
+				l_u[0][lx + BX] =		u[IND(x, y - 1)];
+				l_v[0][lx + BX] =		v[IND(x, y - 1)];
+		} else {
+			l_img_1[0][lx + BX] = d_img_1[IND(x, BY)];
+			l_img_2[0][lx + BX] = d_img_2[IND(x, BY)];
+		}
+	}
+	// bottom edge
+	if (ly == TILE_SIZE_Y - 1 || y == height - 1) {
+		if (y < height - 1) {
+			l_img_1[TILE_SIZE_Y + BY][lx + BX] = d_img_1[IND(x, y + 1)];
+			l_img_2[TILE_SIZE_Y + BY][lx + BX] = d_img_2[IND(x, y + 1)];
+			   l_du[TILE_SIZE_Y + BY][lx + BX] =	  du[IND(x, y + 1)];
+			   l_dv[TILE_SIZE_Y + BY][lx + BX] =	  dv[IND(x, y + 1)];
+				l_u[TILE_SIZE_Y + BY][lx + BX] =	   u[IND(x, y + 1)];
+				l_v[TILE_SIZE_Y + BY][lx + BX] =	   v[IND(x, y + 1)];
+		} else {
+			l_img_1[ly + BY + 1][lx + BX] = d_img_1[IND(x, height - 2)];
+			l_img_2[ly + BY + 1][lx + BX] = d_img_2[IND(x, height - 2)];
+		}
+	}
+
+	// synchronize warp
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// in-place update: all 4 neighbours have the other color and are not written by this launch
+	if (((x + y) & 1) != color) {
+		return;
+	}
+	float hx_2 = alpha / (hx * hx);
+	float hy_2 = alpha / (hy * hy);
+
+	// Derivatives variables
+	float fx = (l_img_1[ly + BY][lx + BX + 1] - l_img_1[ly + BY][lx + BX - 1] + l_img_2[ly + BY][lx + BX + 1] - l_img_2[ly + BY][lx + BX - 1]) / (4.f * hx);
+	float fy = (l_img_1[ly + BY + 1][lx + BX] - l_img_1[ly + BY - 1][lx + BX] + l_img_2[ly + BY + 1][lx + BX] - l_img_2[ly + BY - 1][lx + BX]) / (4.f * hy);
+	float ft = l_img_2[ly + BY][lx + BX] - l_img_1[ly + BY][lx + BX];
+
+	float J11 = fx * fx;
+	float J22 = fy * fy;
+	float J12 = fx * fy;
+	float J13 = fx * ft;
+	float J23 = fy * ft;
+
+	// Compute weights 
+	float xp = (x < width - 1)	* hx_2;
+	float xm = (x > 0)			* hx_2;
+	float yp = (y < height - 1)	* hy_2;
+	float ym = (y > 0)			* hy_2;
+	float sum = (xp + xm + yp + ym);
+
+	float du_new = (1.f - omega) * l_du[ly + BY][lx + BX] +
+					  omega * (-J13 - J12 * l_dv[ly + BY][lx + BX] +
+
+					  yp * (l_u[ly + BY + 1][lx + BX] - l_u[ly + BY][lx + BX]) + ym * (l_u[ly + BY - 1][lx + BX] - l_u[ly + BY][lx + BX]) +
+			    	  xp * (l_u[ly + BY][lx + BX + 1] - l_u[ly + BY][lx + BX]) + xm * (l_u[ly + BY][lx + BX - 1] - l_u[ly + BY][lx + BX]) +
+
+					  yp * l_du[ly + BY + 1][lx + BX] + ym * l_du[ly + BY - 1][lx + BX] +
+					  xp * l_du[ly + BY][lx + BX + 1] + xm * l_du[ly + BY][lx + BX - 1]) / (J11 + sum);
+
+	// dv uses the already updated du of the same pixel (Gauss-Seidel)
+	float dv_new = (1.f - omega) * l_dv[ly + BY][lx + BX] +
+					  omega * (-J23 - J12 * du_new +
+
+					  yp * (l_v[ly + BY + 1][lx + BX] - l_v[ly + BY][lx + BX]) + ym * (l_v[ly + BY - 1][lx + BX] - l_v[ly + BY][lx + BX]) +
+					  xp * (l_v[ly + BY][lx + BX + 1] - l_v[ly + BY][lx + BX]) + xm * (l_v[ly + BY][lx + BX - 1] - l_v[ly + BY][lx + BX]) +
+
+					  yp * l_dv[ly + BY + 1][lx + BX] + ym * l_dv[ly + BY - 1][lx + BX] +
+					  xp * l_dv[ly + BY][lx + BX + 1] + xm * l_dv[ly + BY][lx + BX - 1]) / (J22 + sum);
+
+	du[IND(x, y)] = du_new;
+	dv[IND(x, y)] = dv_new;
+}
+
+/* Temporal blocking: the tile is loaded with a TEMPORAL_ITERATIONS wide halo and
+   TEMPORAL_ITERATIONS Jacobi iterations are performed in local memory before the
+   core of the tile is written back. After every local iteration the outermost valid
+   ring of the block shrinks by one pixel, so after the last one only the core is exact. */
+
+#define HALO			TEMPORAL_ITERATIONS
+#define BLOCK_SIZE_X	(TILE_SIZE_X + 2 * HALO)
+#define BLOCK_SIZE_Y	(TILE_SIZE_Y + 2 * HALO)
+#define BLOCK_POINTS	((BLOCK_SIZE_X * BLOCK_SIZE_Y + TILE_SIZE_X * TILE_SIZE_Y - 1) / (TILE_SIZE_X * TILE_SIZE_Y))
+
+__kernel void OptimizedSolverTemporal(
+	__global	const	float*	d_img_1,	//  0 in     : 1st image 
+	__global	const	float*	d_img_2,	//  1 in     : 2nd image
+	__global	const	float*	du,			//  2 in	 : x-component of flow increment
+	__global	const	float*	dv,			//  3 in	 : y-component of flow increment
+	__global	const	float*	u,			//  4 in	 : x-component of flow field
+	__global	const	float*	v,			//  5 in	 : y-component of flow field
+						float	hx,			//  6 in     : grid spacing in x-direction
+						float	hy,			//  7 in     : grid spacing in y-direction
+						float	alpha,		//  8 in     : smoothness weight
+						float	omega,		//  9 in     : sor overrelaxation parameter
+						int		width,		// 10 in     : image width
+						int		height,		// 11 in     : image height
+						int		pitch,		// 12 in     : image pitch
+	__global			float*	du_r,		// 13 out	 : du result
+	__global			float*	dv_r		// 14 out	 : dv result
+	)
+{
+	__local float l_du[BLOCK_SIZE_Y][BLOCK_SIZE_X];
+	__local float l_dv[BLOCK_SIZE_Y][BLOCK_SIZE_X];
+
+	// every work-item owns the same block points during all local iterations,
+	// so the terms which don't depend on du and dv are kept in private memory
+	float p_bu[BLOCK_POINTS];	// -J13 + smoothness term of u
+	float p_bv[BLOCK_POINTS];	// -J23 + smoothness term of v
+	float p_au[BLOCK_POINTS];	// J11 + sum of weights
+	float p_av[BLOCK_POINTS];	// J22 + sum of weights
+	float p_j12[BLOCK_POINTS];	// J12
+	float p_du[BLOCK_POINTS];	// du result of the current local iteration
+	float p_dv[BLOCK_POINTS];	// dv result of the current local iteration
+
+	const int lid = get_local_id(1) * TILE_SIZE_X + get_local_id(0);
+	const int ox = get_group_id(0) * TILE_SIZE_X - HALO;	// global position of the block origin
+	const int oy = get_group_id(1) * TILE_SIZE_Y - HALO;
+
+	float hx_2 = alpha / (hx * hx);
+	float hy_2 = alpha / (hy * hy);
+
+	// load block and precompute constant terms
+	for (int p = 0; p < BLOCK_POINTS; p++) {
+		int i = lid + p * TILE_SIZE_X * TILE_SIZE_Y;
+		if (i >= BLOCK_SIZE_X * BLOCK_SIZE_Y) {
+			continue;
+		}
+		int lx = i % BLOCK_SIZE_X;
+		int ly = i / BLOCK_SIZE_X;
+		int x = ox + lx;
+		int y = oy + ly;
+
+		if (x < 0 || x >= width || y < 0 || y >= height) {
+			// outside of the image, never read with non-zero weight
+			l_du[ly][lx] = 0.f;
+			l_dv[ly][lx] = 0.f;
+			continue;
+		}
+		l_du[ly][lx] = du[IND(x, y)];
+		l_dv[ly][lx] = dv[IND(x, y)];
+
+		// mirrored neighbours
+		int xm1 = (x > 0) ? x - 1 : BX;
+		int xp1 = (x < width - 1) ? x + 1 : width - 2;
+		int ym1 = (y > 0) ? y - 1 : BY;
+		int yp1 = (y < height - 1) ? y + 1 : height - 2;
+
+		// Derivatives variables
+		float fx = (d_img_1[IND(xp1, y)] - d_img_1[IND(xm1, y)] + d_img_2[IND(xp1, y)] - d_img_2[IND(xm1, y)]) / (4.f * hx);
+		float fy = (d_img_1[IND(x, yp1)] - d_img_1[IND(x, ym1)] + d_img_2[IND(x, yp1)] - d_img_2[IND(x, ym1)]) / (4.f * hy);
+		float ft = d_img_2[IND(x, y)] - d_img_1[IND(x, y)];
+
+		// Compute weights 
+		float xp = (x < width - 1)	* hx_2;
+		float xm = (x > 0)			* hx_2;
+		float yp = (y < height - 1)	* hy_2;
+		float ym = (y > 0)			* hy_2;
+		float sum = (xp + xm + yp + ym);
+
+		float uc = u[IND(x, y)];
+		float vc = v[IND(x, y)];
+
+		p_bu[p] = -fx * ft + 
+				  yp * (u[IND(x, yp1)] - uc) + ym * (u[IND(x, ym1)] - uc) +
+				  xp * (u[IND(xp1, y)] - uc) + xm * (u[IND(xm1, y)] - uc);
+		p_bv[p] = -fy * ft + 
+				  yp * (v[IND(x, yp1)] - vc) + ym * (v[IND(x, ym1)] - vc) +
+				  xp * (v[IND(xp1, y)] - vc) + xm * (v[IND(xm1, y)] - vc);
+		p_au[p] = fx * fx + sum;
+		p_av[p] = fy * fy + sum;
+		p_j12[p] = fx * fy;
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int k = 0; k < TEMPORAL_ITERATIONS; k++) {
+		// compute new values (Jacobi: all reads happen before any write)
+		for (int p = 0; p < BLOCK_POINTS; p++) {
+			int i = lid + p * TILE_SIZE_X * TILE_SIZE_Y;
+			if (i >= BLOCK_SIZE_X * BLOCK_SIZE_Y) {
+				continue;
+			}
+			int lx = i % BLOCK_SIZE_X;
+			int ly = i / BLOCK_SIZE_X;
+			int x = ox + lx;
+			int y = oy + ly;
+
+			p_du[p] = l_du[ly][lx];
+			p_dv[p] = l_dv[ly][lx];
+
+			// the outermost ring of the block has no neighbours in local memory
+			if (x < 0 || x >= width || y < 0 || y >= height ||
+				lx == 0 || lx == BLOCK_SIZE_X - 1 || ly == 0 || ly == BLOCK_SIZE_Y - 1) {
+				continue;
+			}
+
+			float xp = (x < width - 1)	* hx_2;
+			float xm = (x > 0)			* hx_2;
+			float yp = (y < height - 1)	* hy_2;
+			float ym = (y > 0)			* hy_2;
+
+			p_du[p] = (1.f - omega) * l_du[ly][lx] +
+					  omega * (p_bu[p] - p_j12[p] * l_dv[ly][lx] +
+					  yp * l_du[ly + 1][lx] + ym * l_du[ly - 1][lx] +
+					  xp * l_du[ly][lx + 1] + xm * l_du[ly][lx - 1]) / p_au[p];
+
+			p_dv[p] = (1.f - omega) * l_dv[ly][lx] +
+					  omega * (p_bv[p] - p_j12[p] * l_du[ly][lx] +
+					  yp * l_dv[ly + 1][lx] + ym * l_dv[ly - 1][lx] +
+					  xp * l_dv[ly][lx + 1] + xm * l_dv[ly][lx - 1]) / p_av[p];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (int p = 0; p < BLOCK_POINTS; p++) {
+			int i = lid + p * TILE_SIZE_X * TILE_SIZE_Y;
+			if (i < BLOCK_SIZE_X * BLOCK_SIZE_Y) {
+				l_du[i / BLOCK_SIZE_X][i % BLOCK_SIZE_X] = p_du[p];
+				l_dv[i / BLOCK_SIZE_X][i % BLOCK_SIZE_X] = p_dv[p];
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	// write back the core of the tile
+	size_t x = get_global_id(0);
+	size_t y = get_global_id(1);
+
+	if (x >= width || y >= height) {
+		return;
+	}
+	du_r[IND(x, y)] = l_du[get_local_id(1) + HALO][get_local_id(0) + HALO];
+	dv_r[IND(x, y)] = l_dv[get_local_id(1) + HALO][get_local_id(0) + HALO];
+}
+
 __kernel void Zero(
 	__global			float*  d_mem			//  0 out	 : device memory filled with zeros
 	)
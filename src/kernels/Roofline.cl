@@ -0,0 +1,32 @@
+/*
+	Ceilings of the kernel microbenchmark (gpuflow_kernel_bench)
+*/
+
+__kernel void Copy(
+	__global	const	float4*	d_src,		//  0 in	 : source
+	__global			float4*	d_dst		//  1 out	 : copy of the source
+	)
+{
+	d_dst[get_global_id(0)] = d_src[get_global_id(0)];
+}
+
+// four independent multiply-add chains per work-item, 32 flops per iteration
+__kernel void MultiplyAdd(
+	__global			float4*	d_dst,		//  0 out	 : results (keep the chains alive)
+						int		iterations,	//  1 in	 : iterations of the chains
+						float	a,			//  2 in	 : multiplier
+						float	b			//  3 in	 : addend
+	)
+{
+	float4 x0 = (float4)(get_global_id(0));
+	float4 x1 = x0 + 1.f;
+	float4 x2 = x0 + 2.f;
+	float4 x3 = x0 + 3.f;
+	for (int i = 0; i < iterations; i++) {
+		x0 = mad(x0, a, b);
+		x1 = mad(x1, a, b);
+		x2 = mad(x2, a, b);
+		x3 = mad(x3, a, b);
+	}
+	d_dst[get_global_id(0)] = x0 + x1 + x2 + x3;
+}
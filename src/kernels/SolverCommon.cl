@@ -0,0 +1,70 @@
+/*
+	Discretization shared by the solver programs (FlowDrivenSolver.cl, FullGPUSolver.cl), included by them.
+	The functions work on values, the kernels do the loads and stores in their own memory layout.
+
+	Neighbour order of the 5-point stencil in all float4 arguments: (y + 1, y - 1, x - 1, x + 1)
+	motion tensor is packed as float8: (J11, J22, J12, J13, J23, J33, 0, 0)
+*/
+
+// motion tensor from the neighbourhoods of both images (center value c, neighbours n)
+float8 MotionTensor(float c_1, float4 n_1, float c_2, float4 n_2, float hx, float hy)
+{
+	float fx = (n_1.s3 - n_1.s2 + n_2.s3 - n_2.s2) / (4.f * hx);
+	float fy = (n_1.s0 - n_1.s1 + n_2.s0 - n_2.s1) / (4.f * hy);
+	float ft = c_2 - c_1;
+
+	return (float8)(fx * fx, fy * fy, fx * fy, fx * ft, fy * ft, ft * ft, 0.f, 0.f);
+}
+
+// flow-driven smoothness weight from the derivatives w_x, w_y of (u + du, v + dv)
+float Phi(float2 w_x, float2 w_y, float e_smooth)
+{
+	return 1.f / (2.f * sqrt(dot(w_x, w_x) + dot(w_y, w_y) + e_smooth * e_smooth));
+}
+
+// robust data term weight of the increment duv_c
+float Ksi(float8 J_c, float2 duv_c, float e_data)
+{
+	float s = (J_c.s0 * duv_c.x + J_c.s2 * duv_c.y + J_c.s3) * duv_c.x +
+			  (J_c.s2 * duv_c.x + J_c.s1 * duv_c.y + J_c.s4) * duv_c.y +
+			  (J_c.s3 * duv_c.x + J_c.s4 * duv_c.y + J_c.s5);
+
+	s = (s > 0) * s;
+
+	return 1.f / (2.f * sqrt(s + e_data * e_data));
+}
+
+// smoothness weights of the 4 neighbours, zero across the image boundary
+float4 StencilWeights(int x, int y, int width, int height, float hx, float hy, float alpha)
+{
+	float hx_2 = alpha / (hx * hx);
+	float hy_2 = alpha / (hy * hy);
+
+	return (float4)((y < height - 1) * hy_2, (y > 0) * hy_2, (x > 0) * hx_2, (x < width - 1) * hx_2);
+}
+
+// stencil weights scaled by phi averaged over the faces between the center and its neighbours
+float4 FaceWeights(float4 w, float phi_c, float4 phi_n)
+{
+	return w * (phi_n + phi_c) / 2.f;
+}
+
+// weighted neighbour terms of both components, n holds (u + du, v + dv) of a neighbour, uv_c the center flow
+float2 StencilSum(float4 w, float2 uv_c, float2 n_lower, float2 n_upper, float2 n_left, float2 n_right)
+{
+	return w.s0 * (n_lower - uv_c) + w.s1 * (n_upper - uv_c) + w.s2 * (n_left - uv_c) + w.s3 * (n_right - uv_c);
+}
+
+/* SOR update of the increment at one pixel: w are the (face) weights, nb their StencilSum and
+   ksi_c the data term weight (1 for the quadratic model). With gauss_seidel dv uses the already
+   updated du of the same pixel, otherwise both components use the old increment (Jacobi). */
+float2 UpdateIncrement(float8 J_c, float ksi_c, float4 w, float2 nb, float2 duv_c, float omega, int gauss_seidel)
+{
+	float sumH = w.s0 + w.s1 + w.s2 + w.s3;
+
+	float2 duv_new;
+	duv_new.x = (1.f - omega) * duv_c.x + omega * (ksi_c * (-J_c.s3 - J_c.s2 * duv_c.y) + nb.x) / (ksi_c * J_c.s0 + sumH);
+	float du_ = gauss_seidel ? duv_new.x : duv_c.x;
+	duv_new.y = (1.f - omega) * duv_c.y + omega * (ksi_c * (-J_c.s4 - J_c.s2 * du_) + nb.y) / (ksi_c * J_c.s1 + sumH);
+	return duv_new;
+}
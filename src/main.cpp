@@ -9,11 +9,22 @@
 #include "CTimer.h"
 #include "Common.h"
 
-#include "CPUOpticalFlow.h"
-#include "GPUNaiveOpticalFlow.h"
-#include "GPUOptimizedOpticalFlow.h"
 #include "GPUFullOpticalFlow.h"
-#include "GPUFlowDrivenRobust.h"
+#include "GPUMultiDeviceOpticalFlow.h"
+#include "OutOfCoreOpticalFlow.h"
+#include "Autotuner.h"
+#include "Profiler.h"
+#include "Timing.h"
+#include "EngineFactory.h"
+#include "FlowStatistics.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 
 struct Measure
 {
@@ -28,294 +39,1076 @@ cl_context			g_CLContext = NULL;
 cl_command_queue	g_CLCommandQueue = NULL;
 cl_device_id		g_CLDevice = NULL;
 
-bool InitContextResources();
-void CleanupContextResources();
-Measure EndpointError(const Image& u_field, const Image& v_field, const Image& u_field_gt, const Image& v_field_gt, Image& difference);
+bool InitMultiDeviceResources(cl_device_type type, std::vector<ComputeDevice>& devices);
+void CleanupMultiDeviceResources(std::vector<ComputeDevice>& devices);
+Measure EndpointError(const Image& u_field, const Image& v_field, const Image& u_field_gt, const Image& v_field_gt);
+bool WriteSyntheticPair(const std::string& path_1, const std::string& path_2, int width, int height, float u, float v);
+Measure FlowFileError(const std::string& path, float u, float v);
+
+/* command line: a single engine (--engine) or the comparison of the selected runs (--compare) */
+struct RunOptions
+{
+	std::string engine;					// empty: comparison
+	std::vector<std::string> compare;	// runs of the comparison, "all" by default
+	std::string img1;
+	std::string img2;
+	std::string ground_truth;			// optional, errors are measured only if given
+	std::string flow_output;			// Middlebury .flo of the result, written only if given
+	std::string flow_image;				// color coded flow PGM of the result, written only if given
+	std::string initial_flow;			// .flo warm start of --engine, e.g. the flow of the previous frame
+	std::string sequence;				// printf pattern of the frames, e.g. ./data/seq/frame%02d.pgm: cold and warm start compared
+	int first_frame;
+	int last_frame;
+	bool forward_warp;					// the initial flow is moved along itself to the next frame first
+	int warm_levels;					// finest pyramid levels solved with a warm start
+	int warm_iterations;				// solver iterations per level with a warm start, 0: unchanged
+	SolverScheme cpu_scheme;
+	bool profile;
+	bool timing;
+	bool autotune;
+	bool residual;						// residual of Jacobi and red-black SOR for the same omega (--engine cpu|naive)
+	bool pinned;						// host images of the transfers in pinned memory, false: pageable (--pageable)
+	cl_device_type multi_device_type;	// devices of the striped solver, e.g. CL_DEVICE_TYPE_CPU with several PoCL devices (POCL_DEVICES="pthread pthread")
+	int exchange_interval;				// Jacobi iterations between halo exchanges of the striped solver (= halo rows)
+	int batch_size;						// image pairs solved in the same launches by the batched full GPU run (pays off for small images)
+	int out_of_core_size;				// side of the synthetic pair of the out-of-core run (2 x 400 MB PGM + 3.2 GB flow for 20k)
+	size_t memory_budget;				// bytes of device and host memory for one window of the out-of-core run
+};
+
+bool ParseArguments(int argc, char** argv, RunOptions& options, EngineParameters& p);
+void PrintUsage();
+bool Selected(const RunOptions& options, const char* run);
+int RunEngine(const RunOptions& options, const EngineParameters& p);
+int RunSequence(const RunOptions& options, OpticalFlowBase* flow, Image& img1, Image& img2);
+int RunResidualReport(EngineKind engine, const EngineParameters& p, const Image& img1, const Image& img2);
+bool ValidFramePattern(const std::string& pattern);
+std::string FramePath(const std::string& pattern, int frame);
+/**
+* Solves the pairs of a sequence twice, from zero flow (cold) and from the result of the previous pair (warm),
+* reports the frame times and the mean difference of the warm to the cold flow
+*/
+int RunSequence(const RunOptions& o, OpticalFlowBase* flow, Image& img1, Image& img2)
+{
+	int width = img1.width();
+	int height = img1.height();
+
+	Image u_cold;
+	Image v_cold;
+	Image u_warm;
+	Image v_warm;
+	Image u_initial;
+	Image v_initial;
+
+	CTimer timer;
+	double time_cold = 0.0;
+	double time_warm = 0.0;
+	double difference_sum = 0.0;
+	int warm_frames = 0;
+
+	for (int k = o.first_frame; k < o.last_frame; k++) {
+		// the first pair is loaded with the engine
+		if (k > o.first_frame && (!img1.readImagePGM(FramePath(o.sequence, k)) || !img2.readImagePGM(FramePath(o.sequence, k + 1)))) {
+			return 1;
+		}
+		if (img1.width() != width || img1.height() != height || img2.width() != width || img2.height() != height) {
+			std::cout << "Error: frame " << k << " differs in size from the first frame" << std::endl;
+			return 1;
+		}
+
+		flow->setInitialFlow(NULL, NULL);
+		timer.Start();
+		flow->computeFlow(u_cold, v_cold);
+		timer.Stop();
+		double frame_cold = timer.GetElapsedTime();
+
+		if (k > o.first_frame) {
+			flow->setInitialFlow(&u_initial, &v_initial, o.warm_levels, o.warm_iterations);
+			timer.Start();
+			flow->computeFlow(u_warm, v_warm);
+			timer.Stop();
+			double frame_warm = timer.GetElapsedTime();
+
+			Measure measure = EndpointError(u_warm, v_warm, u_cold, v_cold);
+			std::cout << "Frame " << k << "\tcold:\t" << frame_cold << "\twarm:\t" << frame_warm << "\tdifference:\t" << measure.mean << std::endl;
+			time_cold += frame_cold;
+			time_warm += frame_warm;
+			difference_sum += measure.mean;
+			warm_frames++;
+		} else {
+			// nothing to start from in the first pair
+			u_warm.reinit(width, height, width, height, 1, 1);
+			v_warm.reinit(width, height, width, height, 1, 1);
+			u_warm = u_cold;
+			v_warm = v_cold;
+			std::cout << "Frame " << k << "\tcold:\t" << frame_cold << std::endl;
+		}
+
+		// the warm result starts the next pair
+		if (o.forward_warp) {
+			Image::forwardWarpFlow(u_warm, v_warm, u_initial, v_initial);
+		} else {
+			u_initial.reinit(width, height, width, height, 1, 1);
+			v_initial.reinit(width, height, width, height, 1, 1);
+			u_initial = u_warm;
+			v_initial = v_warm;
+		}
+	}
+	flow->setInitialFlow(NULL, NULL);
+
+	if (warm_frames > 0) {
+		std::cout << std::endl << "Mean frame time cold:\t" << time_cold / warm_frames << "  warm:\t" << time_warm / warm_frames
+				  << "  reduction:\t" << 100.0 * (1.0 - time_warm / time_cold) << " %" << std::endl;
+		std::cout << "Mean difference warm to cold:\t" << difference_sum / warm_frames << std::endl;
+	}
+	return 0;
+}
+
+/**
+* Solves the pair with Jacobi and with red-black SOR for the same omega and reports the residual of the linear
+* system of the finest level relative to the zero increment, and the iterations to reach given relative residuals
+*/
+int RunResidualReport(EngineKind engine, const EngineParameters& p, const Image& img1, const Image& img2)
+{
+	const SolverScheme schemes[2] = { SOLVER_JACOBI, SOLVER_RED_BLACK };
+	std::vector<float> residuals[2];
+	for (int s = 0; s < 2; s++) {
+		EngineParameters parameters = p;
+		parameters.scheme = schemes[s];
+		OpticalFlowBase* flow = CreateEngine(engine, img1, img2, parameters, g_CLContext, g_CLCommandQueue, g_CLDevice);
+		if (!flow) {
+			std::cout << "Error initializing OpenCL resources." << std::endl;
+			return 1;
+		}
+		Image u;
+		Image v;
+		flow->setResidualReport(true);
+		flow->computeFlow(u, v);
+		residuals[s] = flow->residuals();
+		ReleaseEngine(engine, flow);
+	}
+	if (residuals[0].size() < 2 || residuals[1].size() < 2 || residuals[0][0] <= 0.f) {
+		std::cout << "No residual report for engine " << EngineName(engine) << " (cpu, naive)" << std::endl;
+		return 1;
+	}
+
+	int iterations = (int)residuals[0].size() - 1;
+	int step = std::max(1, iterations / 10);
+	std::cout << std::endl << "Relative residual of the finest level, omega " << p.omega << std::endl;
+	std::cout << "Iteration\tJacobi\t\tRed-black" << std::endl;
+	for (int i = step; i <= iterations; i += step) {
+		std::cout << i << "\t\t" << residuals[0][i] / residuals[0][0] << "\t" << residuals[1][i] / residuals[1][0] << std::endl;
+	}
+
+	const float targets[3] = { 1e-1f, 1e-2f, 1e-3f };
+	std::cout << "Iterations to\tJacobi\t\tRed-black" << std::endl;
+	for (int t = 0; t < 3; t++) {
+		std::cout << targets[t];
+		for (int s = 0; s < 2; s++) {
+			// a diverging solver (Jacobi with omega > 1) has NaN residuals and never reaches the target
+			int reached = 1;
+			while (reached <= iterations && !(residuals[s][reached] <= targets[t] * residuals[s][0])) {
+				reached++;
+			}
+			std::cout << "\t\t";
+			if (reached <= iterations) {
+				std::cout << reached;
+			} else {
+				std::cout << "> " << iterations;
+			}
+		}
+		std::cout << std::endl;
+	}
+	return 0;
+}
+
+/* true if the frame pattern holds exactly one int conversion (%d, optionally with flags and width like %02d),
+   other % only escaped as %% */
+bool ValidFramePattern(const std::string& pattern)
+{
+	int conversions = 0;
+	for (size_t i = 0; i < pattern.size(); i++) {
+		if (pattern[i] != '%') {
+			continue;
+		}
+		i++;
+		if (i < pattern.size() && pattern[i] == '%') {
+			continue;
+		}
+		while (i < pattern.size() && std::string("-+ #0").find(pattern[i]) != std::string::npos) {
+			i++;
+		}
+		while (i < pattern.size() && isdigit((unsigned char)pattern[i])) {
+			i++;
+		}
+		if (i >= pattern.size() || pattern[i] != 'd') {
+			return false;
+		}
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+/* path of a frame, the pattern is checked with ValidFramePattern */
+std::string FramePath(const std::string& pattern, int frame)
+{
+	char path[1024];
+	#ifdef _WIN32   // Windows version
+		_snprintf_s(path, sizeof(path), _TRUNCATE, pattern.c_str(), frame);
+	#else           // Linux version
+		snprintf(path, sizeof(path), pattern.c_str(), frame);
+	#endif
+	return path;
+}
+
+void PrintComparison(const char* method, double time, const Measure& measure, double time_cpu);
+std::string RunLabel(EngineKind engine);
+void TunedLocalWorkSize(Autotuner& tuner, EngineKind engine, const Image& img1, const Image& img2, const EngineParameters& p, int localWorkSize[2]);
 
 int main(int argc, char** argv) 
 {
+	RunOptions options;
+	options.cpu_scheme = SOLVER_JACOBI;
+	options.profile = false;
+	options.timing = false;
+	options.autotune = false;
+	options.residual = false;
+	options.pinned = true;
+	options.multi_device_type = CL_DEVICE_TYPE_ALL;
+	options.exchange_interval = 2;
+	options.batch_size = 8;
+	options.out_of_core_size = 20000;
+	options.memory_budget = (size_t)512 * 1024 * 1024;
+	options.first_frame = 0;
+	options.last_frame = 0;
+	options.forward_warp = false;
+	options.warm_levels = 3;
+	options.warm_iterations = 0;
+	// warp mode WARP_IMAGE: hardware filtered warping in the full GPU solver, WARP_COMPARE: run and check both
+	EngineParameters params = { 15, 0.9f, 30, 10, 5, 4.f, 1.f, 0.001f, 0.001f, SOLVER_JACOBI, WARP_BUFFER, ROBUST_TILED_FUSED };
+	if (!ParseArguments(argc, argv, options, params)) {
+		return 1;
+	}
+	if (options.img1.empty() && options.img2.empty()) {
+		options.img1 = "./data/rub1.pgm";
+		options.img2 = "./data/rub2.pgm";
+		if (options.ground_truth.empty()) {
+			options.ground_truth = "./data/rub_gt.flo";
+		}
+	}
+	if (!options.engine.empty()) {
+		return RunEngine(options, params);
+	}
+	if (options.compare.empty()) {
+		options.compare.push_back("all");
+	}
+
 	Image img1;
 	Image img2;
 	
 	Image u_field_gt;
 	Image v_field_gt;
 
-	int warp_levels = 15;
-	float warp_scale = 0.9f;
-	int solver_iterations = 30;
-	int inner_iterations = 10;
-	float alpha = 4.f;
-	float omega = 1.f;
-	float e_smooth = 0.001f;
-	float e_data = 0.001f;
+	int warp_levels = params.warp_levels;
+	float warp_scale = params.warp_scale;
+	int solver_iterations = params.solver_iterations;
+	SolverScheme solver_scheme = params.scheme;	// SOLVER_RED_BLACK: in-place SOR in all GPU solvers
+	SolverScheme cpu_solver_scheme = options.cpu_scheme;	// SOLVER_LEXICOGRAPHIC: in-place wavefront parallel SOR on the CPU
+	bool profile = options.profile;	// device timestamps of every command, summary table and Chrome trace (./data/output/trace.json, open in chrome://tracing)
+	bool timing = options.timing;	// level and phase breakdown of every run, one JSON line per run appended to ./data/output/timings.jsonl (compile out with -DGPUFLOW_NO_TIMING)
+	bool autotune = options.autotune;	// measure all legal work-group shapes of engines without a stored profile (./data/autotune_profiles.txt)
+	cl_device_type multi_device_type = options.multi_device_type;
+	int exchange_interval = options.exchange_interval;
+	bool out_of_core = std::find(options.compare.begin(), options.compare.end(), "out_of_core") != options.compare.end();	// out-of-core run on a synthetic out_of_core_size^2 pair (written to ./data/output), only if named
+	int out_of_core_size = options.out_of_core_size;
+	size_t out_of_core_budget = options.memory_budget;
+	int batch_size = options.batch_size;
+	bool pinned_host_memory = options.pinned;	// host images in mapped CL_MEM_ALLOC_HOST_PTR buffers (no driver staging copies)
+	float alpha = params.alpha;
+	float omega = params.omega;
+	float e_smooth = params.e_smooth;
+	float e_data = params.e_data;
 
-	if (InitContextResources() &&
-		//img1.readImagePGM("./data/my0.pgm") && img2.readImagePGM("./data/my1.pgm")) {
-		//u_field_gt.reinit(img1.width(), img1.height(), img1.actual_width(), img1.actual_height(), 0, 0);
-		//v_field_gt.reinit(img1.width(), img1.height(), img1.actual_width(), img1.actual_height(), 0, 0);
-
-		img1.readImagePGM("./data/rub1.pgm") && img2.readImagePGM("./data/rub2.pgm") && 
-		Image::readMiddlFlowFile("./data/rub_gt.flo", u_field_gt, v_field_gt)) {
-
-		//img1.readImagePGM("./data/frame0.pgm") && img2.readImagePGM("./data/frame1.pgm") &&
-		//Image::readMiddlFlowFile("./data/flow10.flo", u_field_gt, v_field_gt)) {
+	Profiler::enable(profile);
+	Timing::enable(timing);
+	Timing::setOutput("./data/output/timings.jsonl");
+	if (InitContextResources(CL_DEVICE_TYPE_GPU, Profiler::enabled(), g_CLContext, g_CLCommandQueue, g_CLDevice) &&
+		img1.readImagePGM(options.img1) && img2.readImagePGM(options.img2) &&
+		(options.ground_truth.empty() || Image::readMiddlFlowFile(options.ground_truth, u_field_gt, v_field_gt))) {
 
 		std::cout << "Initialization: OK" << std::endl;
 		std::cout << "Source image size: (" << img1.width() << "x" << img1.height() << ")" << std::endl;
+		std::cout << "Host memory of the transfers: " << (pinned_host_memory ? "pinned" : "pageable") << std::endl;
+
+		// host images of the transfers (sources, result fields and engine working images) use pinned memory
+		cl_context pin_context = pinned_host_memory ? g_CLContext : NULL;
+		img1.setPinned(pin_context, g_CLCommandQueue);
+		img2.setPinned(pin_context, g_CLCommandQueue);
 
+		// work-group shapes: stored profile of this device and image size, measured first if autotuning is enabled
+		Autotuner tuner(g_CLContext, g_CLDevice, "./data/autotune_profiles.txt", autotune);
+		if (!tuner.initResources()) {
+			std::cout << "Autotuner unavailable, using default work-group shapes." << std::endl;
+		}
 		CTimer timer;
-		// result flows, times, measures
-		Image u_field_cpu;
-		Image v_field_cpu;
-		Measure measure_cpu;
-		double time_cpu;
-
-		Image u_field_gpu_naive;
-		Image v_field_gpu_naive;
-		Measure measure_gpu_naive;
-		double time_gpu_naive;
-
-		Image u_field_gpu_flow_driven;
-		Image v_field_gpu_flow_driven;
-		Measure measure_gpu_flow_driven;
-		double time_gpu_flow_driven;
-
-		Image u_field_gpu_optimized;
-		Image v_field_gpu_optimized;
-		Measure measure_gpu_optimized;
-		double time_gpu_optimized;
-
-		Image u_field_gpu_full;
-		Image v_field_gpu_full;
-		Measure measure_gpu_full;
-		double time_gpu_full;
-
-		Image difference(img1.width(), img1.height());
+		// result flows, times and measures of the registry engines (index of EngineAt) and of the multi-device run
+		int engine_count = EngineCount();
+		Image* u_fields = new Image[engine_count];
+		Image* v_fields = new Image[engine_count];
+		std::vector<Measure> measures(engine_count, Measure());
+		std::vector<double> times(engine_count, 0.0);
+		double time_cpu = 0.0;
+		double time_gpu_full = 0.0;
+		Measure measure_gpu_full = Measure();
 
-		float flow_scale = 2.f * warp_scale;
+		Image u_field_gpu_multi;
+		Image v_field_gpu_multi;
+		Measure measure_gpu_multi = Measure();
+		double time_gpu_multi = 0.0;
 
-		Image::saveOpticalFlowRGB(u_field_gt, v_field_gt, flow_scale, "./data/output/flow_gt.pgm");
+		for (int k = 0; k < engine_count; k++) {
+			if (EngineUsesDevice(EngineAt(k))) {
+				u_fields[k].setPinned(pin_context, g_CLCommandQueue);
+				v_fields[k].setPinned(pin_context, g_CLCommandQueue);
+			}
+		}
 
-/* ########################################################################################################################################## */
-		std::cout << std::endl << "--- RUN CPU OPTICAL FLOW ---" << std::endl;
-		{
-			CPUOpticalFlow cpuOpticalFlow(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega);
-			timer.Start();
-			cpuOpticalFlow.computeFlow(u_field_cpu, v_field_cpu);
-			timer.Stop();
+		float flow_scale = 2.f * warp_scale;
 
-			time_cpu = timer.GetElapsedTime();
-			std::cout << "\nTime:\t" << time_cpu;
-			measure_cpu = EndpointError(u_field_cpu, v_field_cpu, u_field_gt, v_field_gt, difference);
-			std::cout << "  Mean error:\t" << measure_cpu.mean << "  Max error:\t" << measure_cpu.max << std::endl;
-			Image::saveOpticalFlowRGB(u_field_cpu, v_field_cpu, flow_scale, "./data/output/flow_cpu.pgm");
+		if (!options.ground_truth.empty()) {
+			Image::saveOpticalFlowRGB(u_field_gt, v_field_gt, flow_scale, "./data/output/flow_gt.pgm");
 		}
-		std::cout << "--- -------------------- ---" << std::endl;
 
 /* ########################################################################################################################################## */
-		std::cout << std::endl << "--- RUN GPU NAIVE OPTICAL FLOW ---" << std::endl;
-		{
-			int localWorkSize[2] = { 32, 16 };
-			GPUNaiveOpticalFlow gpuNaiveOpticalFlow(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega, 
-													g_CLContext, g_CLCommandQueue, localWorkSize);
-			if (!gpuNaiveOpticalFlow.initResources(g_CLContext, g_CLDevice)) {
-				std::cout << "Error initializing OpenCL resources." << std::endl;
-			} else {
-				timer.Start();
-				gpuNaiveOpticalFlow.computeFlow(u_field_gpu_naive, v_field_gpu_naive);
-				timer.Stop();
-
-				time_gpu_naive = timer.GetElapsedTime();
-				std::cout << "\nTime:\t" << time_gpu_naive;
-				measure_gpu_naive = EndpointError(u_field_gpu_naive, v_field_gpu_naive, u_field_gt, v_field_gt, difference);
-				std::cout << "  Mean error:\t" << measure_gpu_naive.mean << "  Max error:\t" << measure_gpu_naive.max << std::endl;
-				Image::saveOpticalFlowRGB(u_field_gpu_naive, v_field_gpu_naive, flow_scale, "./data/output/flow_gpu_naive.pgm");
+		for (int k = 0; k < engine_count; k++) {
+			EngineKind engine = EngineAt(k);
+			if (!Selected(options, EngineName(engine))) {
+				continue;
+			}
+			bool device = EngineUsesDevice(engine);
+			std::string label = RunLabel(engine);
+			std::string output = std::string("./data/output/flow_") + (device ? std::string("gpu_") + EngineName(engine) : std::string("cpu")) + ".pgm";
+			std::string title = "RUN " + label + " (" + EngineDescription(engine) + ")";
+
+			std::cout << std::endl << "--- " << title << " ---" << std::endl;
+			{
+				// params.scheme is a GPU scheme, the CPU engine takes its own
+				EngineParameters parameters = params;
+				if (!device) {
+					parameters.scheme = cpu_solver_scheme;
+				}
+				int localWorkSize[2];
+				TunedLocalWorkSize(tuner, engine, img1, img2, parameters, localWorkSize);
+				OpticalFlowBase* flow = CreateEngine(engine, img1, img2, parameters, g_CLContext, g_CLCommandQueue, g_CLDevice, localWorkSize);
+				if (!flow) {
+					std::cout << "Error initializing OpenCL resources." << std::endl;
+				} else {
+					if (device) {
+						flow->setPinnedHostMemory(pin_context, g_CLCommandQueue);
+					}
+					Profiler::beginRun(label);
+					TIMING_FRAME_BEGIN(label);
+					timer.Start();
+					flow->computeFlow(u_fields[k], v_fields[k]);
+					timer.Stop();
+					TIMING_FRAME_END();
+					Profiler::endRun();
+
+					times[k] = timer.GetElapsedTime();
+					measures[k] = EndpointError(u_fields[k], v_fields[k], u_field_gt, v_field_gt);
+					std::cout << "\nTime:\t" << times[k] << "  Mean error:\t" << measures[k].mean << "  Max error:\t" << measures[k].max << std::endl;
+					Image::saveOpticalFlowRGB(u_fields[k], v_fields[k], flow_scale, output);
+
+					if (engine == ENGINE_CPU) {
+						time_cpu = times[k];
+					} else if (engine == ENGINE_FULL) {
+						time_gpu_full = times[k];
+						measure_gpu_full = measures[k];
+
+						// same error measured on the resident flow, only the reduction results are read back
+						FlowStatistics statistics(g_CLContext, g_CLCommandQueue);
+						FlowMeasures device_measure;
+						if (!options.ground_truth.empty() && statistics.initResources(g_CLContext, g_CLDevice) && statistics.setGroundTruth(u_field_gt, v_field_gt) &&
+							statistics.compute(static_cast<GPUFullOpticalFlow*>(flow)->deviceFlow(), device_measure)) {
+							std::cout << "Device mean error:\t" << device_measure.mean_epe << "  95th percentile:\t" << device_measure.epe_p95
+									  << "  Mean angular error:\t" << device_measure.mean_aae << std::endl;
+						}
+						statistics.releaseResources();
+					} else if (engine == ENGINE_FULL_HALF && time_gpu_full > 0.0) {
+						std::cout << "Mean error cost:\t" << measures[k].mean - measure_gpu_full.mean << "  Throughput gain:\t" << time_gpu_full / times[k] << std::endl;
+					}
+					ReleaseEngine(engine, flow);
+				}
 			}
-			gpuNaiveOpticalFlow.releaseResources();
+			std::cout << "--- " << std::string(title.size(), '-') << " ---" << std::endl;
 		}
-		std::cout << "--- -------------------------- ---" << std::endl;
 
 /* ########################################################################################################################################## */
-		std::cout << std::endl << "--- RUN GPU FLOW DRIVEN ROBUST OPTICAL FLOW ---" << std::endl;
-		{
-			int localWorkSize[2] = { 32, 4 };
-			GPUFlowDrivenRobust gpuFlowDrivenRobust(img1, img2, warp_levels, warp_scale, solver_iterations, inner_iterations, alpha, omega, e_smooth, e_data,
-													g_CLContext, g_CLCommandQueue, localWorkSize);
-			if (!gpuFlowDrivenRobust.initResources(g_CLContext, g_CLDevice)) {
-				std::cout << "Error initializing OpenCL resources." << std::endl;
-			} else {
-				timer.Start();
-				gpuFlowDrivenRobust.computeFlow(u_field_gpu_flow_driven, v_field_gpu_flow_driven);
-				timer.Stop();
-
-				time_gpu_flow_driven = timer.GetElapsedTime();
-				std::cout << "\nTime:\t" << time_gpu_flow_driven;
-				measure_gpu_flow_driven = EndpointError(u_field_gpu_flow_driven, v_field_gpu_flow_driven, u_field_gt, v_field_gt, difference);
-				std::cout << "  Mean error:\t" << measure_gpu_flow_driven.mean << "  Max error:\t" << measure_gpu_flow_driven.max << std::endl;
-				Image::saveOpticalFlowRGB(u_field_gpu_flow_driven, v_field_gpu_flow_driven, flow_scale, "./data/output/flow_gpu_flow_driven.pgm");
+		if (Selected(options, "batch")) {
+			std::cout << std::endl << "--- RUN GPU FULL OPTICAL FLOW (BATCH) ---" << std::endl;
+			{
+				// the source pair is repeated batch_size times, every pair must give the single pair result
+				int localWorkSize[2];
+				TunedLocalWorkSize(tuner, ENGINE_FULL, img1, img2, params, localWorkSize);
+				GPUFullOpticalFlow gpuFullOpticalFlow(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega,
+													  g_CLContext, g_CLCommandQueue, localWorkSize, solver_scheme, WARP_BUFFER, false, STAGE_NAIVE, 1, e_smooth, e_data, batch_size);
+				if (!gpuFullOpticalFlow.initResources(g_CLContext, g_CLDevice)) {
+					std::cout << "Error initializing OpenCL resources." << std::endl;
+				} else {
+					const Image** img1_batch = new const Image*[batch_size];
+					const Image** img2_batch = new const Image*[batch_size];
+					Image* u_batch_fields = new Image[batch_size];
+					Image* v_batch_fields = new Image[batch_size];
+					Image** u_batch = new Image*[batch_size];
+					Image** v_batch = new Image*[batch_size];
+					for (int p = 0; p < batch_size; p++) {
+						img1_batch[p] = &img1;
+						img2_batch[p] = &img2;
+						u_batch[p] = &u_batch_fields[p];
+						v_batch[p] = &v_batch_fields[p];
+					}
+
+					Profiler::beginRun("GPU Full batch");
+					TIMING_FRAME_BEGIN("GPU Full batch");
+					timer.Start();
+					gpuFullOpticalFlow.computeFlowBatch(img1_batch, img2_batch, u_batch, v_batch, batch_size);
+					timer.Stop();
+					TIMING_FRAME_END();
+					Profiler::endRun();
+
+					double time_per_pair = timer.GetElapsedTime() / batch_size;
+					std::cout << "\nTime:\t" << timer.GetElapsedTime() << " (" << batch_size << " pairs, " << time_per_pair << " per pair)";
+					Measure measure_first = EndpointError(u_batch_fields[0], v_batch_fields[0], u_field_gt, v_field_gt);
+					Measure measure_last = EndpointError(u_batch_fields[batch_size - 1], v_batch_fields[batch_size - 1], u_field_gt, v_field_gt);
+					std::cout << "  Mean error:\t" << measure_first.mean << " / " << measure_last.mean << " (first / last pair)" << std::endl;
+					if (time_gpu_full > 0.0) {
+						std::cout << "Throughput gain:\t" << time_gpu_full / time_per_pair << std::endl;
+					}
+
+					delete[] img1_batch;
+					delete[] img2_batch;
+					delete[] u_batch;
+					delete[] v_batch;
+					delete[] u_batch_fields;
+					delete[] v_batch_fields;
+				}
+				gpuFullOpticalFlow.releaseResources();
+
 			}
-			gpuFlowDrivenRobust.releaseResources();
+			std::cout << "--- ------------------------------------- ---" << std::endl;
 		}
-		std::cout << "--- --------------------------------------- ---" << std::endl;
 
 /* ########################################################################################################################################## */
-		std::cout << std::endl << "--- RUN GPU OPTIMIZED OPTICAL FLOW ---" << std::endl;
-		{
-			int localWorkSize[2] = { 32, 16 };
-			GPUOptimizedOpticalFlow gpuOptimizedOpticalFlow(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega,
-															g_CLContext, g_CLCommandQueue, localWorkSize);
-			if (!gpuOptimizedOpticalFlow.initResources(g_CLContext, g_CLDevice)) {
-				std::cout << "Error initializing OpenCL resources." << std::endl;
-			} else {
-				timer.Start();
-				gpuOptimizedOpticalFlow.computeFlow(u_field_gpu_optimized, v_field_gpu_optimized);
-				timer.Stop();
-
-				time_gpu_optimized = timer.GetElapsedTime();
-				std::cout << "\nTime:\t" << time_gpu_optimized;
-				measure_gpu_optimized = EndpointError(u_field_gpu_optimized, v_field_gpu_optimized, u_field_gt, v_field_gt, difference);
-				std::cout << "  Mean error:\t" << measure_gpu_optimized.mean << "  Max error:\t" << measure_gpu_optimized.max << std::endl;
-				Image::saveOpticalFlowRGB(u_field_gpu_optimized, v_field_gpu_optimized, flow_scale, "./data/output/flow_gpu_optimized.pgm");
-			}
-			gpuOptimizedOpticalFlow.releaseResources();
+		// the striped solver is Jacobi only: --compare multi with red-black is rejected by ParseArguments, "all" skips it
+		if (Selected(options, "multi") && solver_scheme == SOLVER_RED_BLACK) {
+			std::cout << std::endl << "GPU multi-device run skipped: the striped solver supports only --scheme jacobi" << std::endl;
+		} else if (Selected(options, "multi")) {
+			std::cout << std::endl << "--- RUN GPU MULTI-DEVICE OPTICAL FLOW ---" << std::endl;
+			{
+				std::vector<ComputeDevice> devices;
+				if (!InitMultiDeviceResources(multi_device_type, devices)) {
+					std::cout << "Error initializing OpenCL devices." << std::endl;
+				} else {
+					int localWorkSize[2] = { 32, 4 };
+					GPUMultiDeviceOpticalFlow gpuMultiDeviceOpticalFlow(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega,
+																		devices, localWorkSize, exchange_interval);
+					if (!gpuMultiDeviceOpticalFlow.initResources()) {
+						std::cout << "Error initializing OpenCL resources." << std::endl;
+					} else {
+						Profiler::beginRun("GPU Multi");
+						TIMING_FRAME_BEGIN("GPU Multi");
+						timer.Start();
+						gpuMultiDeviceOpticalFlow.computeFlow(u_field_gpu_multi, v_field_gpu_multi);
+						timer.Stop();
+						TIMING_FRAME_END();
+						Profiler::endRun();
 
+						time_gpu_multi = timer.GetElapsedTime();
+						std::cout << "\nTime:\t" << time_gpu_multi;
+						measure_gpu_multi = EndpointError(u_field_gpu_multi, v_field_gpu_multi, u_field_gt, v_field_gt);
+						std::cout << "  Mean error:\t" << measure_gpu_multi.mean << "  Max error:\t" << measure_gpu_multi.max << std::endl;
+						Image::saveOpticalFlowRGB(u_field_gpu_multi, v_field_gpu_multi, flow_scale, "./data/output/flow_gpu_multi.pgm");
+					}
+					gpuMultiDeviceOpticalFlow.releaseResources();
+				}
+				CleanupMultiDeviceResources(devices);
+			}
+			std::cout << "--- ------------------------------------ ---" << std::endl;
 		}
-		std::cout << "--- ------------------------------ ---" << std::endl;
 
 /* ########################################################################################################################################## */
-		std::cout << std::endl << "--- RUN GPU FULL OPTICAL FLOW ---" << std::endl;
-		{
+		if (out_of_core) {
+			std::cout << std::endl << "--- RUN OUT-OF-CORE OPTICAL FLOW (SYNTHETIC) ---" << std::endl;
+			// constant translation, the ground truth is known without storing it
+			const float shift_u = 1.5f;
+			const float shift_v = -0.75f;
 			int localWorkSize[2] = { 32, 4 };
-			GPUFullOpticalFlow gpuFullOpticalFlow(img1, img2, warp_levels, warp_scale, solver_iterations, alpha, omega,
-												  g_CLContext, g_CLCommandQueue, localWorkSize);
-			if (!gpuFullOpticalFlow.initResources(g_CLContext, g_CLDevice)) {
-				std::cout << "Error initializing OpenCL resources." << std::endl;
-			} else {
-				timer.Start();
-				gpuFullOpticalFlow.computeFlow(u_field_gpu_full, v_field_gpu_full);
-				timer.Stop();
-
-				time_gpu_full = timer.GetElapsedTime();
-				std::cout << "\nTime:\t" << time_gpu_full;
-				measure_gpu_full = EndpointError(u_field_gpu_full, v_field_gpu_full, u_field_gt, v_field_gt, difference);
-				std::cout << "  Mean error:\t" << measure_gpu_full.mean << "  Max error:\t" << measure_gpu_full.max << std::endl;
-				Image::saveOpticalFlowRGB(u_field_gpu_full, v_field_gpu_full, flow_scale, "./data/output/flow_gpu_full.pgm");
+			OutOfCoreOpticalFlow outOfCoreOpticalFlow(warp_levels, warp_scale, solver_iterations, alpha, omega,
+													  g_CLContext, g_CLCommandQueue, g_CLDevice, localWorkSize, out_of_core_budget);
+			// the window layout is checked against the budget before the pair is written
+			if (outOfCoreOpticalFlow.planTiles(out_of_core_size, out_of_core_size) &&
+				WriteSyntheticPair("./data/output/synthetic_1.pgm", "./data/output/synthetic_2.pgm", out_of_core_size, out_of_core_size, shift_u, shift_v)) {
+				if (outOfCoreOpticalFlow.computeFlow("./data/output/synthetic_1.pgm", "./data/output/synthetic_2.pgm", "./data/output/synthetic.flo")) {
+					Measure measure = FlowFileError("./data/output/synthetic.flo", shift_u, shift_v);
+					std::cout << "Mean error:\t" << measure.mean << "  Max error:\t" << measure.max << std::endl;
+				}
 			}
-			gpuFullOpticalFlow.releaseResources();
-
+			std::cout << "--- ------------------------------------------ ---" << std::endl;
 		}
-		std::cout << "--- ------------------------- ---" << std::endl;
 
 /* ########################################################################################################################################## */
 		std::cout << std::endl << "*************** METHODS COMPARISON ***************" << std::endl << std::endl;
 		{
+			// rows of the runs that were selected, speed-up relative to the CPU run if it was selected
 			std::cout << "Method\t\tTime\t\tMean error\tMax error\tSpeed-up" << std::endl;
-			std::cout << "CPU\t\t" << time_cpu << "\t\t" << measure_cpu.mean << "\t" << measure_cpu.max << "\t\t1.0" << std::endl;
-
-			std::cout << "GPU Naive\t" << time_gpu_naive << "\t\t" << measure_gpu_naive.mean << "\t" << measure_gpu_naive.max << "\t\t" << time_cpu / time_gpu_naive << std::endl;
-
-			std::cout << "GPU Optimized\t" << time_gpu_optimized << "\t\t" << measure_gpu_optimized.mean << "\t" << measure_gpu_optimized.max << "\t\t" << time_cpu / time_gpu_optimized << std::endl;
-
-			std::cout << "GPU Full\t" << time_gpu_full << "\t\t" << measure_gpu_full.mean << "\t" << measure_gpu_full.max << "\t\t" << time_cpu / time_gpu_full << std::endl;
+			for (int k = 0; k < engine_count; k++) {
+				PrintComparison(RunLabel(EngineAt(k)).c_str(), times[k], measures[k], time_cpu);
+			}
+			PrintComparison("GPU Multi", time_gpu_multi, measure_gpu_multi, time_cpu);
 		}
 		std::cout << "*************** ****************** ***************" << std::endl;
 
+		if (Profiler::enabled()) {
+			Profiler::printSummary();
+			Profiler::writeChromeTrace("./data/output/trace.json");
+			Profiler::clear();
+		}
+
+		// pinned result images are released before their context
+		delete[] u_fields;
+		delete[] v_fields;
 	}
-	CleanupContextResources();
+	// the sources outlive the context, back to pageable memory
+	img1.setPinned(NULL, NULL);
+	img2.setPinned(NULL, NULL);
+	CleanupContextResources(g_CLContext, g_CLCommandQueue);
 
-	std::cout << "Press Enter to continue";
-	std::getchar();
+	// started without arguments (e.g. from the IDE): keep the console open
+	if (argc == 1) {
+		std::cout << "Press Enter to continue";
+		std::getchar();
+	}
 	return 0;
 }
 
 /**
-* Compute Endpoint error (EE) between ground truth result and computed flow field
-*
-* (u/v)_field		Computed result
-* (u/v)_field_gt	Ground truth result
-* difference		Endpoint error result as an Image
+* Mean and max. endpoint error of a flow field against the ground truth (FlowStatistics::computeHost), zero without ground truth
 */
-Measure EndpointError(const Image& u_field, const Image& v_field, const Image& u_field_gt, const Image& v_field_gt, Image& difference)
+Measure EndpointError(const Image& u_field, const Image& v_field, const Image& u_field_gt, const Image& v_field_gt)
 {
+	FlowStatistics statistics(NULL, NULL);
+	FlowMeasures measures;
+	statistics.computeHost(u_field, v_field, &u_field_gt, &v_field_gt, measures);
 
-	if ((u_field.actual_width() != u_field_gt.actual_width()) || (u_field.actual_height() != u_field.actual_height()))
-		return Measure();
+	Measure m = Measure();
+	m.max = measures.max_epe;
+	m.mean = measures.mean_epe;
+	m.sum = measures.mean_epe * measures.known;
+	return m;
+}
 
-	int width = u_field.actual_width();
-	int height = u_field.actual_height();
+/**
+* Write a textured pair of binary PGM images row by row (Image::syntheticTexture), the 2nd image is the 1st one translated by (u, v)
+*/
+bool WriteSyntheticPair(const std::string& path_1, const std::string& path_2, int width, int height, float u, float v)
+{
+	std::ofstream file_1(path_1.c_str(), std::ios_base::binary);
+	std::ofstream file_2(path_2.c_str(), std::ios_base::binary);
+	if (!file_1.good() || !file_2.good()) {
+		std::cout << "Cannot write synthetic images to " << path_1 << ", " << path_2 << std::endl;
+		return false;
+	}
+	file_1 << "P5" << std::endl << width << ' ' << height << std::endl << "255" << std::endl;
+	file_2 << "P5" << std::endl << width << ' ' << height << std::endl << "255" << std::endl;
+
+	unsigned char* row_1 = new unsigned char[width];
+	unsigned char* row_2 = new unsigned char[width];
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			row_1[x] = Image::syntheticTexture((float)x, (float)y);
+			row_2[x] = Image::syntheticTexture(x - u, y - v);
+		}
+		file_1.write(reinterpret_cast<char*>(row_1), width);
+		file_2.write(reinterpret_cast<char*>(row_2), width);
+	}
+	delete[] row_1;
+	delete[] row_2;
 
-	float endpointError;
-	float max = 0;
+	return file_1.good() && file_2.good();
+}
 
-	// Number of pixels considered to be a valid flow result
-	int countPixels = 0;
-	float sum = 0;
+/**
+* Endpoint error of a Middlebury flow file against a constant flow (u, v), the file is streamed row by row
+*/
+Measure FlowFileError(const std::string& path, float u, float v)
+{
+	Measure m = Measure();
+	std::ifstream file(path.c_str(), std::ios_base::binary);
+	float tag = 0.f;
+	int width = 0;
+	int height = 0;
+	file.read(reinterpret_cast<char*>(&tag), sizeof(float));
+	file.read(reinterpret_cast<char*>(&width), sizeof(int));
+	file.read(reinterpret_cast<char*>(&height), sizeof(int));
+	if (!file.good() || width <= 0 || height <= 0) {
+		std::cout << "Cannot read flow file: " << path << std::endl;
+		return m;
+	}
 
+	float* row = new float[2 * width];
+	double sum = 0.0;
 	for (int y = 0; y < height; y++) {
+		file.read(reinterpret_cast<char*>(row), 2 * width * sizeof(float));
 		for (int x = 0; x < width; x++) {
+			float error = sqrt((row[2 * x] - u) * (row[2 * x] - u) + (row[2 * x + 1] - v) * (row[2 * x + 1] - v));
+			m.max = std::max(m.max, error);
+			sum += error;
+		}
+	}
+	delete[] row;
+
+	m.sum = (float)sum;
+	m.mean = (float)(sum / ((double)width * height));
+	return m;
+}
 
-			/* unknown flow */
-			if ((std::fabs(u_field_gt.pixel_r(x, y)) > 1e6) || (std::fabs(v_field_gt.pixel_r(x, y)) > 1e6) || x != x || y != y) {
-				difference.pixel_w(x, y) = 0.f;
+/**
+* Options: --engine NAME runs that engine only, otherwise the comparison of the --compare runs (all without out_of_core by default)
+*/
+bool ParseArguments(int argc, char** argv, RunOptions& o, EngineParameters& p)
+{
+	bool robust_kernels = false;	// --robust-kernels given, otherwise the default of the scheme
+	for (int i = 1; i < argc; i++) {
+		const char* option = argv[i];
+		if (!strcmp(option, "--help")) {
+			PrintUsage();
+			return false;
+		} else if (!strcmp(option, "--list-engines")) {
+			for (int k = 0; k < EngineCount(); k++) {
+				std::string name = EngineName(EngineAt(k));
+				name.resize(std::max(name.size(), (size_t)15), ' ');
+				std::cout << name << EngineDescription(EngineAt(k)) << std::endl;
+			}
+			return false;
+		} else if (!strcmp(option, "--profile")) {
+			o.profile = true;
+			continue;
+		} else if (!strcmp(option, "--timing")) {
+			o.timing = true;
+			continue;
+		} else if (!strcmp(option, "--autotune")) {
+			o.autotune = true;
+			continue;
+		} else if (!strcmp(option, "--forward-warp")) {
+			o.forward_warp = true;
+			continue;
+		} else if (!strcmp(option, "--residual")) {
+			o.residual = true;
+			continue;
+		} else if (!strcmp(option, "--pageable")) {
+			o.pinned = false;
+			continue;
+		}
+
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) {
+			std::cout << "Missing value for " << option << std::endl;
+			return false;
+		}
+		i++;
+
+		bool ok = true;
+		if (!strcmp(option, "--engine")) {
+			EngineKind engine;
+			ok = EngineFromName(value, engine);
+			o.engine = value;
+		} else if (!strcmp(option, "--compare")) {
+			std::stringstream list(value);
+			std::string run;
+			while (std::getline(list, run, ',')) {
+				EngineKind engine;
+				ok = ok && (EngineFromName(run, engine) || run == "all" || run == "batch" || run == "multi" || run == "out_of_core");
+				o.compare.push_back(run);
+			}
+		} else if (!strcmp(option, "--img1")) {
+			o.img1 = value;
+		} else if (!strcmp(option, "--img2")) {
+			o.img2 = value;
+		} else if (!strcmp(option, "--gt")) {
+			o.ground_truth = value;
+		} else if (!strcmp(option, "--flo")) {
+			o.flow_output = value;
+		} else if (!strcmp(option, "--flow-image")) {
+			o.flow_image = value;
+		} else if (!strcmp(option, "--init-flow")) {
+			o.initial_flow = value;
+		} else if (!strcmp(option, "--sequence")) {
+			o.sequence = value;
+			ok = (o.sequence.size() < 900 && ValidFramePattern(o.sequence));
+		} else if (!strcmp(option, "--frames")) {
+			ok = (sscanf(value, "%d,%d", &o.first_frame, &o.last_frame) == 2 && o.first_frame >= 0 && o.last_frame > o.first_frame);
+		} else if (!strcmp(option, "--warm-levels")) {
+			o.warm_levels = atoi(value);
+			ok = (o.warm_levels > 0);
+		} else if (!strcmp(option, "--warm-iterations")) {
+			o.warm_iterations = atoi(value);
+			ok = (o.warm_iterations >= 0);
+		} else if (!strcmp(option, "--levels")) {
+			p.warp_levels = atoi(value);
+			ok = (p.warp_levels > 0);
+		} else if (!strcmp(option, "--scale")) {
+			p.warp_scale = (float)atof(value);
+			ok = (p.warp_scale > 0.f && p.warp_scale < 1.f);
+		} else if (!strcmp(option, "--iterations")) {
+			p.solver_iterations = atoi(value);
+			ok = (p.solver_iterations > 0);
+		} else if (!strcmp(option, "--inner-iterations")) {
+			p.inner_iterations = atoi(value);
+			ok = (p.inner_iterations > 0);
+		} else if (!strcmp(option, "--temporal-iterations")) {
+			p.temporal_iterations = atoi(value);
+			ok = (p.temporal_iterations > 0);
+		} else if (!strcmp(option, "--alpha")) {
+			p.alpha = (float)atof(value);
+			ok = (p.alpha > 0.f);
+		} else if (!strcmp(option, "--omega")) {
+			p.omega = (float)atof(value);
+			ok = (p.omega > 0.f && p.omega < 2.f);
+		} else if (!strcmp(option, "--scheme")) {
+			ok = true;
+			if (!strcmp(value, "jacobi")) {
+				p.scheme = SOLVER_JACOBI;
+			} else if (!strcmp(value, "red_black")) {
+				p.scheme = SOLVER_RED_BLACK;
 			} else {
-				endpointError = sqrt((u_field.pixel_r(x, y) - u_field_gt.pixel_r(x, y)) * 
-									 (u_field.pixel_r(x, y) - u_field_gt.pixel_r(x, y)) +
-									 (v_field.pixel_r(x, y) - v_field_gt.pixel_r(x, y)) *
-									 (v_field.pixel_r(x, y) - v_field_gt.pixel_r(x, y)));
-				difference.pixel_w(x, y) = endpointError;
+				ok = false;
+			}
+		} else if (!strcmp(option, "--robust-kernels")) {
+			ok = RobustKernelsFromName(value, p.robust_kernels);
+			robust_kernels = true;
+		} else if (!strcmp(option, "--multi-device")) {
+			ok = true;
+			if (!strcmp(value, "gpu")) {
+				o.multi_device_type = CL_DEVICE_TYPE_GPU;
+			} else if (!strcmp(value, "cpu")) {
+				o.multi_device_type = CL_DEVICE_TYPE_CPU;
+			} else if (!strcmp(value, "all")) {
+				o.multi_device_type = CL_DEVICE_TYPE_ALL;
+			} else {
+				ok = false;
+			}
+		} else if (!strcmp(option, "--exchange-interval")) {
+			o.exchange_interval = atoi(value);
+			ok = (o.exchange_interval >= 1);
+		} else if (!strcmp(option, "--batch")) {
+			o.batch_size = atoi(value);
+			ok = (o.batch_size >= 1);
+		} else if (!strcmp(option, "--out-of-core-size")) {
+			o.out_of_core_size = atoi(value);
+			ok = (o.out_of_core_size >= 16);
+		} else if (!strcmp(option, "--memory-budget")) {
+			int megabytes = atoi(value);
+			o.memory_budget = (size_t)megabytes * 1024 * 1024;
+			ok = (megabytes > 0);
+		} else if (!strcmp(option, "--cpu-scheme")) {
+			ok = true;
+			if (!strcmp(value, "jacobi")) {
+				o.cpu_scheme = SOLVER_JACOBI;
+			} else if (!strcmp(value, "red_black")) {
+				o.cpu_scheme = SOLVER_RED_BLACK;
+			} else if (!strcmp(value, "lexicographic")) {
+				o.cpu_scheme = SOLVER_LEXICOGRAPHIC;
+			} else {
+				ok = false;
+			}
+		} else {
+			std::cout << "Unknown option: " << option << std::endl;
+			PrintUsage();
+			return false;
+		}
+		if (!ok) {
+			std::cout << "Invalid value for " << option << ": " << value << std::endl;
+			return false;
+		}
+	}
+	if (!robust_kernels) {
+		p.robust_kernels = DefaultRobustKernels(p.scheme);
+	} else if (p.scheme == SOLVER_RED_BLACK && p.robust_kernels != ROBUST_GLOBAL) {
+		std::cout << "--robust-kernels " << RobustKernelsName(p.robust_kernels) << " needs --scheme jacobi" << std::endl;
+		return false;
+	}
+	if (p.scheme == SOLVER_RED_BLACK && std::find(o.compare.begin(), o.compare.end(), "multi") != o.compare.end()) {
+		std::cout << "--compare multi needs --scheme jacobi, the striped solver has no red-black variant" << std::endl;
+		return false;
+	}
+	if (!o.engine.empty() && !o.compare.empty()) {
+		std::cout << "--engine and --compare exclude each other" << std::endl;
+		return false;
+	}
+	if (!o.sequence.empty() && (o.engine.empty() || o.last_frame <= o.first_frame)) {
+		std::cout << "--sequence needs --engine and --frames" << std::endl;
+		return false;
+	}
+	if (o.residual && o.engine.empty()) {
+		std::cout << "--residual needs --engine" << std::endl;
+		return false;
+	}
+	EngineKind engine;
+	if (o.residual && EngineFromName(o.engine, engine) && !EngineReportsResidual(engine)) {
+		std::cout << "--residual is not supported by engine " << o.engine << " (cpu, naive)" << std::endl;
+		return false;
+	}
+	if (o.img1.empty() != o.img2.empty()) {
+		std::cout << "--img1 and --img2 are given together" << std::endl;
+		return false;
+	}
+	return true;
+}
 
-				if (endpointError > max)
-					max = endpointError;
+void PrintUsage()
+{
+	std::cout << "Usage: gpuflow [--engine NAME | --compare RUN,...] [options]" << std::endl
+			  << "  --engine NAME            run this engine only (--list-engines)" << std::endl
+			  << "  --compare RUN,...        comparison of engines and batch, multi, out_of_core (default: all except out_of_core)" << std::endl
+			  << "  --img1 FILE --img2 FILE  input pair, binary PGM (default: ./data/rub1.pgm, ./data/rub2.pgm)" << std::endl
+			  << "  --gt FILE                ground truth .flo, errors are reported if given" << std::endl
+			  << "  --flo FILE               writes the flow as .flo (--engine)" << std::endl
+			  << "  --flow-image FILE        writes the color coded flow as PGM (--engine)" << std::endl
+			  << "  --levels N --scale S --iterations N --inner-iterations N --temporal-iterations N" << std::endl
+			  << "  --alpha A --omega W --scheme jacobi|red_black --cpu-scheme jacobi|red_black|lexicographic" << std::endl
+			  << "  --robust-kernels global|tiled|fused" << std::endl
+			  << "                           flow_driven kernels (default: fused for jacobi, global for red_black)" << std::endl
+			  << "  --init-flow FILE         warm start of --engine from this .flo (e.g. the previous frame)" << std::endl
+			  << "  --sequence PATTERN --frames FIRST,LAST" << std::endl
+			  << "                           frames (printf pattern with one %d, e.g. frame%02d.pgm) solved with cold and warm start, frame times compared" << std::endl
+			  << "  --forward-warp --warm-levels N --warm-iterations N" << std::endl
+			  << "                           warm start: initial flow moved to the next frame, finest levels solved, iterations (0: unchanged)" << std::endl
+			  << "  --residual               residual of the finest level over the iterations, Jacobi and red-black for the same omega (--engine cpu|naive)" << std::endl
+			  << "  --batch N                pairs of the batch run, solved in the same launches (default: 8)" << std::endl
+			  << "  --multi-device gpu|cpu|all --exchange-interval N" << std::endl
+			  << "                           devices of the multi run (default: all) and Jacobi iterations between its halo exchanges (default: 2)" << std::endl
+			  << "  --out-of-core-size N --memory-budget MB" << std::endl
+			  << "                           side of the synthetic out_of_core pair (default: 20000) and memory for one window (default: 512)" << std::endl
+			  << "  --pageable               host images of the transfers in pageable instead of pinned memory" << std::endl
+			  << "  --profile --timing --autotune" << std::endl;
+}
 
-				sum = sum + endpointError;
-				countPixels++;
+bool Selected(const RunOptions& options, const char* run)
+{
+	for (size_t i = 0; i < options.compare.size(); i++) {
+		if (options.compare[i] == run || options.compare[i] == "all") {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+* Runs one engine of the registry on the input pair, nothing but the requested outputs is written
+*/
+int RunEngine(const RunOptions& o, const EngineParameters& p)
+{
+	EngineKind engine;
+	EngineFromName(o.engine, engine);
+
+	Profiler::enable(o.profile);
+	Timing::enable(o.timing);
+	Timing::setOutput("./data/output/timings.jsonl");
+
+	Image img1;
+	Image img2;
+	Image u_field_gt;
+	Image v_field_gt;
+	Image u_initial;
+	Image v_initial;
+	std::string path_1 = o.sequence.empty() ? o.img1 : FramePath(o.sequence, o.first_frame);
+	std::string path_2 = o.sequence.empty() ? o.img2 : FramePath(o.sequence, o.first_frame + 1);
+	if (!img1.readImagePGM(path_1) || !img2.readImagePGM(path_2) ||
+		(!o.ground_truth.empty() && !Image::readMiddlFlowFile(o.ground_truth, u_field_gt, v_field_gt))) {
+		return 1;
+	}
+	if (!o.initial_flow.empty()) {
+		Image u_flow;
+		Image v_flow;
+		if (!Image::readMiddlFlowFile(o.initial_flow, u_flow, v_flow)) {
+			return 1;
+		}
+		if (o.forward_warp) {
+			Image::forwardWarpFlow(u_flow, v_flow, u_initial, v_initial);
+		} else {
+			u_initial.reinit(u_flow.width(), u_flow.height(), u_flow.width(), u_flow.height(), 1, 1);
+			v_initial.reinit(v_flow.width(), v_flow.height(), v_flow.width(), v_flow.height(), 1, 1);
+			u_initial = u_flow;
+			v_initial = v_flow;
+		}
+	}
+	// the CPU engine runs without an OpenCL context
+	if (EngineUsesDevice(engine)) {
+		if (!InitContextResources(CL_DEVICE_TYPE_GPU, Profiler::enabled(), g_CLContext, g_CLCommandQueue, g_CLDevice)) {
+			CleanupContextResources(g_CLContext, g_CLCommandQueue);
+			return 1;
+		}
+	}
+	// host images of the transfers use pinned memory unless --pageable
+	cl_context pin_context = o.pinned ? g_CLContext : NULL;
+	img1.setPinned(pin_context, g_CLCommandQueue);
+	img2.setPinned(pin_context, g_CLCommandQueue);
+	std::cout << "Engine: " << EngineName(engine) << "  Source image size: (" << img1.width() << "x" << img1.height() << ")" << std::endl;
+
+	int result = 1;
+	{
+		// p.scheme is a GPU scheme, the CPU engine takes its own
+		EngineParameters parameters = p;
+		if (!EngineUsesDevice(engine)) {
+			parameters.scheme = o.cpu_scheme;
+		}
+		// work-group shape: stored profile of this device and image size, measured first with --autotune
+		int localWorkSize[2];
+		{
+			Autotuner tuner(g_CLContext, g_CLDevice, "./data/autotune_profiles.txt", o.autotune);
+			if (EngineUsesDevice(engine) && !tuner.initResources()) {
+				std::cout << "Autotuner unavailable, using the default work-group shape." << std::endl;
+			}
+			TunedLocalWorkSize(tuner, engine, img1, img2, parameters, localWorkSize);
+		}
+		Image u_field;
+		Image v_field;
+		u_field.setPinned(pin_context, g_CLCommandQueue);
+		v_field.setPinned(pin_context, g_CLCommandQueue);
+		OpticalFlowBase* flow = CreateEngine(engine, img1, img2, parameters, g_CLContext, g_CLCommandQueue, g_CLDevice, localWorkSize);
+		if (flow) {
+			flow->setPinnedHostMemory(pin_context, g_CLCommandQueue);
+		}
+		if (!flow) {
+			std::cout << "Error initializing OpenCL resources." << std::endl;
+		} else if (o.residual) {
+			ReleaseEngine(engine, flow);
+			result = RunResidualReport(engine, parameters, img1, img2);
+		} else if (!o.sequence.empty()) {
+			result = RunSequence(o, flow, img1, img2);
+			ReleaseEngine(engine, flow);
+		} else {
+			if (!o.initial_flow.empty()) {
+				flow->setInitialFlow(&u_initial, &v_initial, o.warm_levels, o.warm_iterations);
 			}
+			CTimer timer;
+			Profiler::beginRun(EngineName(engine));
+			TIMING_FRAME_BEGIN(EngineName(engine));
+			timer.Start();
+			flow->computeFlow(u_field, v_field);
+			timer.Stop();
+			TIMING_FRAME_END();
+			Profiler::endRun();
+			ReleaseEngine(engine, flow);
+
+			std::cout << "Time:\t" << timer.GetElapsedTime();
+			if (!o.ground_truth.empty()) {
+				Measure measure = EndpointError(u_field, v_field, u_field_gt, v_field_gt);
+				std::cout << "  Mean error:\t" << measure.mean << "  Max error:\t" << measure.max;
+			}
+			std::cout << std::endl;
+
+			result = 0;
+			if (!o.flow_output.empty() && !Image::writeMiddlFlowFile(o.flow_output, u_field, v_field)) {
+				result = 1;
+			}
+			if (!o.flow_image.empty()) {
+				Image::saveOpticalFlowRGB(u_field, v_field, 2.f * p.warp_scale, o.flow_image);
+			}
+		}
+
+		if (Profiler::enabled()) {
+			Profiler::printSummary();
+			Profiler::writeChromeTrace("./data/output/trace.json");
+			Profiler::clear();
 		}
 	}
-	// Save current statistics measures
-	Measure m;
-	m.max = max;
-	m.sum = sum;
-	m.mean = sum / (float)countPixels;
+	// the pinned result images are released above, before their context, the sources outlive it
+	img1.setPinned(NULL, NULL);
+	img2.setPinned(NULL, NULL);
+	CleanupContextResources(g_CLContext, g_CLCommandQueue);
+	return result;
+}
 
-	return m;
-}	
+/**
+* Run of a registry engine in the comparison table, the profiler and the timing output
+*/
+std::string RunLabel(EngineKind engine)
+{
+	return EngineUsesDevice(engine) ? std::string("GPU ") + EngineName(engine) : std::string("CPU");
+}
+
+/**
+* Work-group shape of an engine: stored profile of the device and image size, measured first if the tuner tunes,
+* the default shape of the engine otherwise
+*/
+void TunedLocalWorkSize(Autotuner& tuner, EngineKind engine, const Image& img1, const Image& img2, const EngineParameters& p, int localWorkSize[2])
+{
+	DefaultLocalWorkSize(engine, localWorkSize);
+	if (EngineUsesDevice(engine)) {
+		EngineTuningTarget target(engine, img1, img2, p, g_CLContext, g_CLDevice);
+		tuner.selectLocalWorkSize(target, img1.width(), img1.height(), localWorkSize);
+	}
+}
+
+void PrintComparison(const char* method, double time, const Measure& measure, double time_cpu)
+{
+	if (time <= 0.0) {
+		return;
+	}
+	std::string name = method;
+	name.resize(std::max(name.size(), (size_t)16), ' ');
+	std::cout << name << time << "\t\t" << measure.mean << "\t" << measure.max << "\t\t";
+	if (time_cpu > 0.0) {
+		std::cout << time_cpu / time << std::endl;
+	} else {
+		std::cout << "-" << std::endl;
+	}
+}
 
-bool InitContextResources()
+bool InitMultiDeviceResources(cl_device_type type, std::vector<ComputeDevice>& devices)
 {
-	//error code
 	cl_int clError;
-	cl_platform_id		g_CLPlatform[2];
+	cl_platform_id platforms[8];
+	cl_uint platformCount = 0;
 
-	//get platform ID
-	V_RETURN_FALSE_CL(clGetPlatformIDs(2, g_CLPlatform, NULL), "Failed to get CL platform ID");
+	V_RETURN_FALSE_CL(clGetPlatformIDs(8, platforms, &platformCount), "Failed to get CL platform ID");
 
-	//get a reference to the first available GPU device
-	#ifdef _WIN32   // Windows version
-		V_RETURN_FALSE_CL(clGetDeviceIDs(g_CLPlatform[1], CL_DEVICE_TYPE_GPU, 1, &g_CLDevice, NULL), "No GPU device found.");
-	#else           // Linux version
-		V_RETURN_FALSE_CL(clGetDeviceIDs(g_CLPlatform[0], CL_DEVICE_TYPE_GPU, 1, &g_CLDevice, NULL), "No GPU device found.");
-	#endif
+	// one context per platform with all of its devices of the requested type, one queue per device
+	for (cl_uint p = 0; p < min(platformCount, (cl_uint)8); p++) {
+		cl_device_id platformDevices[16];
+		cl_uint deviceCount = 0;
+		if (clGetDeviceIDs(platforms[p], type, 16, platformDevices, &deviceCount) != CL_SUCCESS || deviceCount == 0) {
+			continue;
+		}
+		deviceCount = min(deviceCount, (cl_uint)16);
 
-	char deviceName[256];
-	V_RETURN_FALSE_CL(clGetDeviceInfo(g_CLDevice, CL_DEVICE_NAME, 256, &deviceName, NULL), "Unable to query device name.");
-	cout << "Device: " << deviceName << endl;
+		cl_context context = clCreateContext(0, deviceCount, platformDevices, NULL, NULL, &clError);
+		V_RETURN_FALSE_CL(clError, "Failed to create OpenCL context.");
 
-	//Create a new OpenCL context on the selected device
-	g_CLContext = clCreateContext(0, 1, &g_CLDevice, NULL, NULL, &clError);
-	V_RETURN_FALSE_CL(clError, "Failed to create OpenCL context.");
+		for (cl_uint d = 0; d < deviceCount; d++) {
+			ComputeDevice device;
+			device.context = context;
+			device.device = platformDevices[d];
+			device.queue = clCreateCommandQueue(context, platformDevices[d], Profiler::enabled() ? CL_QUEUE_PROFILING_ENABLE : 0, &clError);
+			V_RETURN_FALSE_CL(clError, "Failed to create the command queue in the context");
 
-	//Finally, create the command queue. All the asynchronous commands to the device will be issued
-	//from the CPU into this queue. This way the host program can continue the execution until some results
-	//from that device are needed.
-	g_CLCommandQueue = clCreateCommandQueue(g_CLContext, g_CLDevice, 0, &clError);
-	V_RETURN_FALSE_CL(clError, "Failed to create the command queue in the context");
+			// every device holds a reference, so the context is released with its last device
+			if (d > 0) {
+				clRetainContext(context);
+			}
+			devices.push_back(device);
+		}
+	}
 
-	return true;
+	cout << "Devices for the multi-device solver: " << devices.size() << endl;
+	return !devices.empty();
 }
 
-void CleanupContextResources()
+void CleanupMultiDeviceResources(std::vector<ComputeDevice>& devices)
 {
-	if (g_CLCommandQueue)	clReleaseCommandQueue(g_CLCommandQueue);
-	if (g_CLContext)			clReleaseContext(g_CLContext);
+	for (size_t d = 0; d < devices.size(); d++) {
+		if (devices[d].queue)	clReleaseCommandQueue(devices[d].queue);
+		if (devices[d].context)	clReleaseContext(devices[d].context);
+	}
+	devices.clear();
 }
@@ -0,0 +1,512 @@
+#include <iostream>
+// Linux declaration
+#ifndef _WIN32
+	#include <cmath>
+#endif
+
+#include "Image.h"
+#include "CTimer.h"
+#include "Common.h"
+#include "EngineFactory.h"
+#include "FlowStatistics.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+/* Accuracy versus time sweep (gpuflow_sweep): runs every engine with every combination of the parameter
+   grids on datasets with ground truth (PGM pair + Middlebury .flo), records the median time and the mean
+   endpoint / angular error, and marks the Pareto frontier (no other configuration is both faster and
+   more accurate). With --budget the fastest configuration within the endpoint error budget is reported.
+   Time is summed and errors are averaged over the datasets. Results are written as JSON.
+
+   gpuflow_sweep [--engines naive,optimized,full,full_robust] [--levels 100] [--scales 0.5,0.75,0.9]
+                 [--iterations 10,30,60] [--inner-iterations 5,10] [--alphas 2,4,8]
+                 [--dataset ./data/rub1.pgm,./data/rub2.pgm,./data/rub_gt.flo] (repeatable)
+                 [--warmup 1] [--repetitions 3] [--scheme jacobi|red_black] [--robust-kernels global,tiled,fused]
+                 [--budget 0.5] [--device gpu|cpu|all] [--output ./data/output/sweep.json]
+
+   --robust-kernels adds the kernel variants of flow_driven as a grid dimension, without it flow_driven runs
+   the default variant of the scheme. */
+
+struct Dataset
+{
+	std::string img1_path;
+	std::string img2_path;
+	std::string flow_path;
+	Image img1;
+	Image img2;
+	Image u_gt;
+	Image v_gt;
+};
+
+struct SweepSettings
+{
+	std::vector<EngineKind> engines;
+	std::vector<int> warp_levels;
+	std::vector<float> warp_scales;
+	std::vector<int> solver_iterations;
+	std::vector<int> inner_iterations;
+	std::vector<float> alphas;
+	std::vector<std::string> datasets;		// "img1.pgm,img2.pgm,gt.flo"
+	int warmup;
+	int repetitions;
+	SolverScheme scheme;
+	std::vector<RobustKernels> robust_kernels;	// flow_driven variants, empty: default of the scheme
+	float budget;							// endpoint error, < 0 if not given
+	cl_device_type device_type;
+	std::string output;
+};
+
+struct SweepPoint
+{
+	EngineKind engine;
+	EngineParameters parameters;
+	bool ok;
+	double seconds;							// sum of the per-dataset medians
+	float epe;								// mean endpoint error, averaged over the datasets
+	float aae;								// mean angular error in degrees, averaged over the datasets
+	std::vector<double> dataset_seconds;
+	std::vector<float> dataset_epe;
+	std::vector<float> dataset_aae;
+	bool pareto;
+};
+
+cl_context			g_CLContext = NULL;
+cl_command_queue	g_CLCommandQueue = NULL;
+cl_device_id		g_CLDevice = NULL;
+
+bool ParseArguments(int argc, char** argv, SweepSettings& settings);
+bool LoadDataset(const std::string& spec, Dataset& dataset);
+bool RunPoint(const std::vector<Dataset*>& datasets, const SweepSettings& s, SweepPoint& point);
+void MarkParetoFrontier(std::vector<SweepPoint>& points);
+bool WriteResults(const std::vector<SweepPoint>& points, const std::vector<Dataset*>& datasets, const SweepSettings& s);
+
+int main(int argc, char** argv)
+{
+	SweepSettings settings;
+	settings.engines.push_back(ENGINE_NAIVE);
+	settings.engines.push_back(ENGINE_OPTIMIZED);
+	settings.engines.push_back(ENGINE_FULL);
+	settings.engines.push_back(ENGINE_FULL_ROBUST);
+	settings.warp_levels.push_back(100);
+	settings.warp_scales.push_back(0.5f);
+	settings.warp_scales.push_back(0.75f);
+	settings.warp_scales.push_back(0.9f);
+	settings.solver_iterations.push_back(10);
+	settings.solver_iterations.push_back(30);
+	settings.solver_iterations.push_back(60);
+	settings.inner_iterations.push_back(5);
+	settings.inner_iterations.push_back(10);
+	settings.alphas.push_back(2.f);
+	settings.alphas.push_back(4.f);
+	settings.alphas.push_back(8.f);
+	settings.warmup = 1;
+	settings.repetitions = 3;
+	settings.scheme = SOLVER_JACOBI;
+	settings.budget = -1.f;
+	settings.device_type = CL_DEVICE_TYPE_GPU;
+	settings.output = "./data/output/sweep.json";
+
+	if (!ParseArguments(argc, argv, settings)) {
+		return 1;
+	}
+	if (settings.datasets.empty()) {
+		settings.datasets.push_back("./data/rub1.pgm,./data/rub2.pgm,./data/rub_gt.flo");
+	}
+
+	std::vector<Dataset*> datasets;
+	bool loaded = true;
+	for (size_t i = 0; i < settings.datasets.size() && loaded; i++) {
+		datasets.push_back(new Dataset());
+		loaded = LoadDataset(settings.datasets[i], *datasets.back());
+	}
+	if (loaded && !InitContextResources(settings.device_type, false, g_CLContext, g_CLCommandQueue, g_CLDevice)) {
+		loaded = false;
+	}
+
+	std::vector<SweepPoint> points;
+	for (size_t e = 0; e < settings.engines.size() && loaded; e++) {
+		EngineKind engine = settings.engines[e];
+		// engines without an inner loop run the first inner iteration count only
+		size_t inner_count = EngineUsesInnerIterations(engine) ? settings.inner_iterations.size() : 1;
+		size_t kernels_count = (engine == ENGINE_FLOW_DRIVEN) ? std::max(settings.robust_kernels.size(), (size_t)1) : 1;
+		for (size_t l = 0; l < settings.warp_levels.size(); l++)
+		for (size_t sc = 0; sc < settings.warp_scales.size(); sc++)
+		for (size_t it = 0; it < settings.solver_iterations.size(); it++)
+		for (size_t in = 0; in < inner_count; in++)
+		for (size_t a = 0; a < settings.alphas.size(); a++)
+		for (size_t k = 0; k < kernels_count; k++) {
+			SweepPoint point;
+			point.engine = engine;
+			// temporal iterations, omega and the robust epsilons keep the defaults of main.cpp
+			EngineParameters p = { settings.warp_levels[l], settings.warp_scales[sc], settings.solver_iterations[it], settings.inner_iterations[in], 5,
+								   settings.alphas[a], 1.f, 0.001f, 0.001f, settings.scheme, WARP_BUFFER, DefaultRobustKernels(settings.scheme) };
+			if (engine == ENGINE_FLOW_DRIVEN && !settings.robust_kernels.empty()) {
+				p.robust_kernels = settings.robust_kernels[k];
+			}
+			point.parameters = p;
+			RunPoint(datasets, settings, point);
+			points.push_back(point);
+
+			std::cout << EngineName(engine) << " levels " << p.warp_levels << " scale " << p.warp_scale << " iterations " << p.solver_iterations;
+			if (EngineUsesInnerIterations(engine)) {
+				std::cout << " inner " << p.inner_iterations;
+			}
+			std::cout << " alpha " << p.alpha;
+			if (engine == ENGINE_FLOW_DRIVEN) {
+				std::cout << " kernels " << RobustKernelsName(p.robust_kernels);
+			}
+			if (point.ok) {
+				std::cout << ":\t" << point.seconds << " s\tEPE " << point.epe << "\tAAE " << point.aae << std::endl;
+			} else {
+				std::cout << ":\tfailed" << std::endl;
+			}
+		}
+	}
+
+	bool written = false;
+	if (loaded) {
+		MarkParetoFrontier(points);
+
+		std::cout << std::endl << "Pareto frontier (fastest first):" << std::endl;
+		std::cout << "Engine\t\tLevels\tScale\tIter\tInner\tAlpha\tTime s\t\tEPE\t\tAAE" << std::endl;
+		const SweepPoint* within_budget = NULL;
+		for (size_t i = 0; i < points.size(); i++) {
+			const SweepPoint& q = points[i];
+			if (q.pareto) {
+				std::string name = EngineName(q.engine);
+				if (q.engine == ENGINE_FLOW_DRIVEN) {
+					name += std::string("_") + RobustKernelsName(q.parameters.robust_kernels);
+				}
+				name.resize(std::max(name.size(), (size_t)15), ' ');
+				std::cout << name << "\t" << q.parameters.warp_levels << "\t" << q.parameters.warp_scale << "\t" << q.parameters.solver_iterations << "\t"
+						  << (EngineUsesInnerIterations(q.engine) ? q.parameters.inner_iterations : 0) << "\t" << q.parameters.alpha << "\t"
+						  << q.seconds << "\t" << q.epe << "\t" << q.aae << std::endl;
+			}
+			if (q.ok && settings.budget >= 0.f && q.epe <= settings.budget && (!within_budget || q.seconds < within_budget->seconds)) {
+				within_budget = &q;
+			}
+		}
+		if (settings.budget >= 0.f) {
+			if (within_budget) {
+				std::string name = EngineName(within_budget->engine);
+				if (within_budget->engine == ENGINE_FLOW_DRIVEN) {
+					name += std::string("_") + RobustKernelsName(within_budget->parameters.robust_kernels);
+				}
+				std::cout << std::endl << "Fastest within EPE " << settings.budget << ": " << name
+						  << " levels " << within_budget->parameters.warp_levels << " scale " << within_budget->parameters.warp_scale
+						  << " iterations " << within_budget->parameters.solver_iterations << " inner " << within_budget->parameters.inner_iterations
+						  << " alpha " << within_budget->parameters.alpha << " (" << within_budget->seconds << " s, EPE " << within_budget->epe << ")" << std::endl;
+			} else {
+				std::cout << std::endl << "No configuration within EPE " << settings.budget << std::endl;
+			}
+		}
+
+		written = WriteResults(points, datasets, settings);
+	}
+
+	for (size_t i = 0; i < datasets.size(); i++) {
+		SAFE_DELETE(datasets[i]);
+	}
+	CleanupContextResources(g_CLContext, g_CLCommandQueue);
+	return written ? 0 : 1;
+}
+
+/**
+* Load "img1.pgm,img2.pgm,gt.flo"
+*/
+bool LoadDataset(const std::string& spec, Dataset& dataset)
+{
+	std::stringstream stream(spec);
+	std::getline(stream, dataset.img1_path, ',');
+	std::getline(stream, dataset.img2_path, ',');
+	std::getline(stream, dataset.flow_path, ',');
+	if (dataset.flow_path.empty()) {
+		std::cout << "Dataset expects img1.pgm,img2.pgm,gt.flo: " << spec << std::endl;
+		return false;
+	}
+	if (!dataset.img1.readImagePGM(dataset.img1_path) || !dataset.img2.readImagePGM(dataset.img2_path) ||
+		!Image::readMiddlFlowFile(dataset.flow_path, dataset.u_gt, dataset.v_gt)) {
+		std::cout << "Cannot load dataset: " << spec << std::endl;
+		return false;
+	}
+	if (dataset.img1.actual_width() != dataset.u_gt.actual_width() || dataset.img1.actual_height() != dataset.u_gt.actual_height() ||
+		dataset.img1.actual_width() != dataset.img2.actual_width() || dataset.img1.actual_height() != dataset.img2.actual_height()) {
+		std::cout << "Image and ground truth sizes differ: " << spec << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+* Run one configuration on all datasets: warmup runs, then timed repetitions; errors of the last run
+*/
+bool RunPoint(const std::vector<Dataset*>& datasets, const SweepSettings& s, SweepPoint& point)
+{
+	point.ok = false;
+	point.pareto = false;
+	point.seconds = 0.0;
+	point.epe = point.aae = 0.f;
+
+	for (size_t d = 0; d < datasets.size(); d++) {
+		Dataset& dataset = *datasets[d];
+		OpticalFlowBase* flow = CreateEngine(point.engine, dataset.img1, dataset.img2, point.parameters, g_CLContext, g_CLCommandQueue, g_CLDevice);
+		if (!flow) {
+			return false;
+		}
+
+		Image u;
+		Image v;
+		for (int i = 0; i < s.warmup; i++) {
+			flow->computeFlow(u, v);
+		}
+		CTimer timer;
+		std::vector<double> times;
+		for (int i = 0; i < s.repetitions; i++) {
+			timer.Start();
+			flow->computeFlow(u, v);
+			timer.Stop();
+			times.push_back(timer.GetElapsedTime());
+		}
+		ReleaseEngine(point.engine, flow);
+
+		std::sort(times.begin(), times.end());
+		size_t n = times.size();
+		double median = (n % 2) ? times[n / 2] : 0.5 * (times[n / 2 - 1] + times[n / 2]);
+
+		// mean endpoint and angular error over the pixels with known ground truth
+		FlowStatistics statistics(NULL, NULL);
+		FlowMeasures measures;
+		statistics.computeHost(u, v, &dataset.u_gt, &dataset.v_gt, measures);
+		point.dataset_seconds.push_back(median);
+		point.dataset_epe.push_back(measures.mean_epe);
+		point.dataset_aae.push_back(measures.mean_aae);
+		point.seconds += median;
+		point.epe += measures.mean_epe / datasets.size();
+		point.aae += measures.mean_aae / datasets.size();
+	}
+	point.ok = true;
+	return true;
+}
+
+/**
+* A configuration is on the frontier if no other one is at least as fast and strictly more accurate;
+* the points are sorted by time (failed ones last) so the frontier is printed and written fastest first
+*/
+void MarkParetoFrontier(std::vector<SweepPoint>& points)
+{
+	std::vector<std::pair<std::pair<double, float>, size_t> > order;
+	for (size_t i = 0; i < points.size(); i++) {
+		if (points[i].ok) {
+			order.push_back(std::make_pair(std::make_pair(points[i].seconds, points[i].epe), i));
+		}
+	}
+	std::sort(order.begin(), order.end());
+
+	float best_epe = 0.f;
+	for (size_t i = 0; i < order.size(); i++) {
+		SweepPoint& point = points[order[i].second];
+		if (i == 0 || point.epe < best_epe) {
+			point.pareto = true;
+			best_epe = point.epe;
+		}
+	}
+
+	std::vector<SweepPoint> sorted;
+	for (size_t i = 0; i < order.size(); i++) {
+		sorted.push_back(points[order[i].second]);
+	}
+	for (size_t i = 0; i < points.size(); i++) {
+		if (!points[i].ok) {
+			sorted.push_back(points[i]);
+		}
+	}
+	points.swap(sorted);
+}
+
+bool WriteResults(const std::vector<SweepPoint>& points, const std::vector<Dataset*>& datasets, const SweepSettings& s)
+{
+	std::ofstream file(s.output.c_str());
+	if (!file.good()) {
+		std::cout << "Cannot write results: " << s.output << std::endl;
+		return false;
+	}
+
+	char device_name[256] = "";
+	clGetDeviceInfo(g_CLDevice, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+
+	file << "{" << std::endl;
+	file << "  \"device\": \"" << device_name << "\"," << std::endl;
+	file << "  \"datasets\": [";
+	for (size_t d = 0; d < datasets.size(); d++) {
+		file << (d ? ", " : "") << "{\"img1\": \"" << datasets[d]->img1_path << "\", \"img2\": \"" << datasets[d]->img2_path
+			 << "\", \"flow\": \"" << datasets[d]->flow_path << "\"}";
+	}
+	file << "]," << std::endl;
+	file << "  \"settings\": {\"warmup\": " << s.warmup << ", \"repetitions\": " << s.repetitions
+		 << ", \"scheme\": \"" << (s.scheme == SOLVER_RED_BLACK ? "red_black" : "jacobi") << "\"";
+	if (s.budget >= 0.f) {
+		file << ", \"budget_epe\": " << s.budget;
+	}
+	file << "}," << std::endl;
+	file << "  \"points\": [" << std::endl;
+	for (size_t i = 0; i < points.size(); i++) {
+		const SweepPoint& q = points[i];
+		file << "    {\"engine\": \"" << EngineName(q.engine) << "\", \"warp_levels\": " << q.parameters.warp_levels << ", \"warp_scale\": " << q.parameters.warp_scale
+			 << ", \"solver_iterations\": " << q.parameters.solver_iterations;
+		if (EngineUsesInnerIterations(q.engine)) {
+			file << ", \"inner_iterations\": " << q.parameters.inner_iterations;
+		}
+		if (q.engine == ENGINE_FLOW_DRIVEN) {
+			file << ", \"robust_kernels\": \"" << RobustKernelsName(q.parameters.robust_kernels) << "\"";
+		}
+		file << ", \"alpha\": " << q.parameters.alpha << ", \"ok\": " << (q.ok ? "true" : "false");
+		if (q.ok) {
+			file << ", \"seconds\": " << q.seconds << ", \"mean_epe\": " << q.epe << ", \"mean_aae\": " << q.aae << ", \"pareto\": " << (q.pareto ? "true" : "false")
+				 << ", \"per_dataset\": [";
+			for (size_t d = 0; d < q.dataset_seconds.size(); d++) {
+				file << (d ? ", " : "") << "{\"seconds\": " << q.dataset_seconds[d] << ", \"mean_epe\": " << q.dataset_epe[d] << ", \"mean_aae\": " << q.dataset_aae[d] << "}";
+			}
+			file << "]";
+		}
+		file << "}" << (i + 1 < points.size() ? "," : "") << std::endl;
+	}
+	file << "  ]" << std::endl;
+	file << "}" << std::endl;
+
+	std::cout << "Results written to " << s.output << std::endl;
+	return file.good();
+}
+
+/**
+* Comma separated lists of positive numbers or engine names
+*/
+static bool ParseIntList(const char* arg, std::vector<int>& list)
+{
+	list.clear();
+	std::stringstream stream(arg);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		int value = atoi(item.c_str());
+		if (value <= 0) {
+			return false;
+		}
+		list.push_back(value);
+	}
+	return !list.empty();
+}
+
+static bool ParseFloatList(const char* arg, std::vector<float>& list)
+{
+	list.clear();
+	std::stringstream stream(arg);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		float value = (float)atof(item.c_str());
+		if (value <= 0.f) {
+			return false;
+		}
+		list.push_back(value);
+	}
+	return !list.empty();
+}
+
+static bool ParseEngineList(const char* arg, std::vector<EngineKind>& list)
+{
+	list.clear();
+	std::stringstream stream(arg);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		EngineKind engine;
+		if (!EngineFromName(item, engine)) {
+			std::cout << "Unknown engine: " << item << std::endl;
+			return false;
+		}
+		list.push_back(engine);
+	}
+	return !list.empty();
+}
+
+bool ParseArguments(int argc, char** argv, SweepSettings& s)
+{
+	for (int i = 1; i < argc; i++) {
+		const char* option = argv[i];
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (!value) {
+			std::cout << "Missing value for " << option << std::endl;
+			return false;
+		}
+		i++;
+
+		bool ok = true;
+		if (!strcmp(option, "--engines")) {
+			ok = ParseEngineList(value, s.engines);
+		} else if (!strcmp(option, "--levels")) {
+			ok = ParseIntList(value, s.warp_levels);
+		} else if (!strcmp(option, "--scales")) {
+			ok = ParseFloatList(value, s.warp_scales);
+			for (size_t k = 0; k < s.warp_scales.size(); k++) {
+				ok = ok && s.warp_scales[k] < 1.f;
+			}
+		} else if (!strcmp(option, "--iterations")) {
+			ok = ParseIntList(value, s.solver_iterations);
+		} else if (!strcmp(option, "--inner-iterations")) {
+			ok = ParseIntList(value, s.inner_iterations);
+		} else if (!strcmp(option, "--alphas")) {
+			ok = ParseFloatList(value, s.alphas);
+		} else if (!strcmp(option, "--dataset")) {
+			s.datasets.push_back(value);
+		} else if (!strcmp(option, "--warmup")) {
+			s.warmup = atoi(value);
+			ok = (s.warmup >= 0);
+		} else if (!strcmp(option, "--repetitions")) {
+			s.repetitions = atoi(value);
+			ok = (s.repetitions > 0);
+		} else if (!strcmp(option, "--scheme")) {
+			if (!strcmp(value, "jacobi")) {
+				s.scheme = SOLVER_JACOBI;
+			} else if (!strcmp(value, "red_black")) {
+				s.scheme = SOLVER_RED_BLACK;
+			} else {
+				ok = false;
+			}
+		} else if (!strcmp(option, "--robust-kernels")) {
+			ok = RobustKernelsFromList(value, s.robust_kernels);
+		} else if (!strcmp(option, "--budget")) {
+			s.budget = (float)atof(value);
+			ok = (s.budget >= 0.f);
+		} else if (!strcmp(option, "--device")) {
+			if (!strcmp(value, "gpu")) {
+				s.device_type = CL_DEVICE_TYPE_GPU;
+			} else if (!strcmp(value, "cpu")) {
+				s.device_type = CL_DEVICE_TYPE_CPU;
+			} else if (!strcmp(value, "all")) {
+				s.device_type = CL_DEVICE_TYPE_ALL;
+			} else {
+				ok = false;
+			}
+		} else if (!strcmp(option, "--output")) {
+			s.output = value;
+		} else {
+			std::cout << "Unknown option: " << option << std::endl;
+			return false;
+		}
+
+		if (!ok) {
+			std::cout << "Invalid value for " << option << ": " << value << std::endl;
+			return false;
+		}
+	}
+	// the tiled kernels have no red-black variant
+	for (size_t k = 0; k < s.robust_kernels.size(); k++) {
+		if (s.scheme == SOLVER_RED_BLACK && s.robust_kernels[k] != ROBUST_GLOBAL) {
+			std::cout << "--robust-kernels " << RobustKernelsName(s.robust_kernels[k]) << " needs --scheme jacobi" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}